@@ -8,8 +8,10 @@
 
 #include "zetton_common/util/log.h"
 #include "zetton_common/util/perf.h"
+#include "zetton_stream/base/frame_pool.h"
 #include "zetton_stream/source/legacy_v4l2_stream_source.h"
 #include "zetton_stream/source/v4l2_stream_source.h"
+#include "zetton_stream/util/ocv.h"
 
 ABSL_FLAG(std::string, device, "/dev/video0", "path to video device");
 ABSL_FLAG(int, width, 320, "image width to capture");
@@ -17,6 +19,10 @@ ABSL_FLAG(int, height, 240, "image height to capture");
 ABSL_FLAG(int, frame_rate, 30, "frame rate to capture");
 ABSL_FLAG(std::string, pixel_format, "YUYV", "pixel format to capture");
 ABSL_FLAG(std::string, output_file, "test.png", "path to captured image file");
+ABSL_FLAG(bool, async, false, "reconnect the device in background");
+ABSL_FLAG(std::string, goal, "requested",
+          "capture mode negotiation goal: requested, max_fps, min_bandwidth "
+          "or min_decode_cost");
 
 int main(int argc, char** argv) {
   // parse args
@@ -27,6 +33,8 @@ int main(int argc, char** argv) {
   auto frame_rate = absl::GetFlag(FLAGS_frame_rate);
   auto pixel_format = absl::GetFlag(FLAGS_pixel_format);
   auto output_file = absl::GetFlag(FLAGS_output_file);
+  auto async = absl::GetFlag(FLAGS_async);
+  auto goal = absl::GetFlag(FLAGS_goal);
 
   // prepare stream url
   zetton::stream::StreamOptions options;
@@ -46,6 +54,9 @@ int main(int argc, char** argv) {
   options.width = width;
   options.height = height;
   options.frame_rate = frame_rate;
+  options.async = async;
+  options.negotiation_goal =
+      zetton::stream::StreamNegotiationGoalFromStr(goal.c_str());
   // disable auto exposure
   options.camera.auto_exposure = 1;
 
@@ -57,30 +68,13 @@ int main(int argc, char** argv) {
       zetton::stream::LegacyV4l2StreamSourceV4l2StreamSource>();
 #endif
   source->Init(options);
-
-  // init output image
-  auto raw_image = std::make_shared<zetton::stream::CameraImage>();
-  raw_image->width = options.width;
-  raw_image->height = options.height;
-  if (options.output_format ==
-      zetton::stream::StreamPixelFormat::PIXEL_FORMAT_YUYV) {
-    raw_image->image_size = raw_image->width * raw_image->height * 2;
-    raw_image->bytes_per_pixel = 2;
-  } else if (options.output_format ==
-             zetton::stream::StreamPixelFormat::PIXEL_FORMAT_RGB) {
-    raw_image->image_size = raw_image->width * raw_image->height * 3;
-    raw_image->bytes_per_pixel = 3;
-  }
-  raw_image->is_new = 0;
-  raw_image->image =
-      reinterpret_cast<char*>(calloc(raw_image->image_size, sizeof(char)));
-  memset(raw_image->image, 0, raw_image->image_size * sizeof(char));
-  if (raw_image->image == nullptr) {
-    AERROR << "system calloc memory error, size:" << raw_image->image_size;
-    return 1;
-  }
+  source->SetStateCallback([](zetton::stream::StreamState state) {
+    AINFO_F("device state changed to {}",
+            zetton::stream::StreamStateToStr(state));
+  });
 
   // capture and save image
+  zetton::stream::FramePoolPtr pool;
   while (true) {
     // wait for device
     if (!source->WaitForDevice()) {
@@ -88,15 +82,29 @@ int main(int argc, char** argv) {
       usleep(100000);
       continue;
     }
+    // init output images at the negotiated size, rows are padded for aligned
+    // stores and frames are recycled instead of allocated per capture
+    if (pool == nullptr) {
+      int output_width = 0;
+      int output_height = 0;
+      source->GetOutputSize(&output_width, &output_height);
+      pool = zetton::stream::FramePool::Create(
+          source->GetOutputPixelFormat(), output_width, output_height,
+          static_cast<int>(options.num_buffers));
+      if (pool == nullptr) {
+        AERROR << "failed to allocate frame pool";
+        return 1;
+      }
+    }
     // poll image from camera
-    if (!source->Capture(raw_image)) {
+    auto frame = pool->AcquireFrame();
+    if (!source->Capture(frame)) {
       AERROR << "camera device poll failed";
       usleep(100000);
       continue;
     }
-    // write to file
-    cv::Mat image(raw_image->height, raw_image->width, CV_8UC3,
-                  raw_image->image);
+    // write to file, the view works on the captured frame without copying
+    cv::Mat image = zetton::stream::ToMat(frame);
     cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
     cv::imwrite("test.jpg", image);
     break;
@@ -114,8 +122,10 @@ int main(int argc, char** argv) {
       AERROR_F("wait for device error");
       continue;
     }
-    // poll image from camera
-    if (!source->Capture(raw_image)) {
+    // poll image from camera, the frame goes back to the pool at the end of
+    // the iteration
+    auto frame = pool->AcquireFrame();
+    if (!source->Capture(frame)) {
       AERROR << "camera device poll failed";
       continue;
     }
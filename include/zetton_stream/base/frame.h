@@ -2,11 +2,20 @@
 
 #include <malloc.h>
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
 
+#include "zetton_stream/base/stream_options.h"
+
 namespace zetton {
 namespace stream {
 
+// rows of images allocated by CameraImage::Allocate() start on this boundary
+constexpr int kImageRowAlignment = 64;
+
 // camera raw image struct
 struct CameraImage {
   int width;
@@ -16,18 +25,165 @@ struct CameraImage {
   int is_new;
   int tv_sec;
   int tv_usec;
-  char* image;
+  char* image = nullptr;
+  // bytes from the start of one row to the next, 0 if rows are tightly packed
+  int stride = 0;
+  // false if the image memory belongs to someone else, e.g. a FramePool
+  bool owns_image = true;
+
+  // capture timestamp in nanoseconds, in the clock domain reported by the
+  // driver (see V4L2_BUF_FLAG_TIMESTAMP_MASK in flags)
+  uint64_t timestamp_ns = 0;
+  // capture timestamp in nanoseconds, converted to the system (realtime) clock
+  uint64_t system_timestamp_ns = 0;
+  // frame sequence number counted by the driver
+  uint32_t sequence = 0;
+  // number of frames dropped by the driver right before this frame
+  uint32_t dropped_frames = 0;
+  // raw V4L2 buffer flags (e.g. V4L2_BUF_FLAG_ERROR, timestamp source)
+  uint32_t flags = 0;
+  // number of bytes used by the payload in the driver buffer
+  uint32_t bytes_used = 0;
 
   ~CameraImage() {
-    if (image != nullptr) {
+    if (image != nullptr && owns_image) {
       free(reinterpret_cast<void*>(image));
       image = nullptr;
     }
   }
+
+  inline int GetStride() const {
+    return stride > 0 ? stride : width * bytes_per_pixel;
+  }
+
+  // (re)allocate the image with every row padded to kImageRowAlignment bytes
+  bool Allocate(int image_width, int image_height, int image_bytes_per_pixel) {
+    if (image != nullptr && owns_image) {
+      free(reinterpret_cast<void*>(image));
+    }
+    image = nullptr;
+    owns_image = true;
+    width = image_width;
+    height = image_height;
+    bytes_per_pixel = image_bytes_per_pixel;
+    stride = (width * bytes_per_pixel + kImageRowAlignment - 1) /
+             kImageRowAlignment * kImageRowAlignment;
+    image_size = stride * height;
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, kImageRowAlignment, image_size) != 0) {
+      image_size = 0;
+      return false;
+    }
+    image = reinterpret_cast<char*>(buffer);
+    return true;
+  }
 };
 
 using CameraImagePtr = std::shared_ptr<CameraImage>;
 
+// maximum number of planes of a frame
+constexpr int kMaxFramePlanes = 4;
+
+// how the memory of a frame is held
+enum class FrameMemory {
+  MEMORY_NONE = 0,
+  // allocated by the frame itself
+  MEMORY_OWNED,
+  // slot of a FramePool, recycled when the frame is released
+  MEMORY_POOLED,
+  // memory of someone else (driver buffer, camera image, mapped file), valid
+  // as long as the owner of the frame is held
+  MEMORY_BORROWED,
+  // dmabuf file descriptors, the data may not be mapped
+  MEMORY_DMABUF,
+  MEMORY_MAX_NUM
+};
+
+const char* FrameMemoryToStr(FrameMemory memory);
+
+// bytes per pixel of the first plane, 0 for compressed or unknown formats
+int GetBytesPerPixel(StreamPixelFormat format);
+// number of planes of a format, 0 if unknown
+int GetNumPlanes(StreamPixelFormat format);
+// bytes of a frame with the given stride of the first plane, all planes
+// included. compressed formats get an upper bound of their payload
+size_t GetFrameSize(StreamPixelFormat format, int width, int height,
+                    int stride);
+
+struct FramePlane {
+  uint8_t* data = nullptr;
+  // bytes from the start of one row to the next, 0 for compressed data
+  int stride = 0;
+  // bytes of the plane, row padding included
+  size_t size = 0;
+  // dmabuf of the plane and offset of its data in it, -1 if not exported
+  int fd = -1;
+  size_t offset = 0;
+};
+
+// descriptor of a video frame: layout of its planes, pixel format, capture
+// metadata and who holds its memory. copies are shallow and share the memory.
+struct Frame {
+  StreamPixelFormat pixel_format = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  int width = 0;
+  int height = 0;
+  int num_planes = 0;
+  std::array<FramePlane, kMaxFramePlanes> planes;
+
+  FrameMemory memory = FrameMemory::MEMORY_NONE;
+  // keeps owned, pooled or borrowed memory alive as long as the frame
+  std::shared_ptr<void> owner;
+
+  // capture timestamp in nanoseconds, in the clock domain reported by the
+  // driver (see V4L2_BUF_FLAG_TIMESTAMP_MASK in flags)
+  uint64_t timestamp_ns = 0;
+  // capture timestamp in nanoseconds, converted to the system (realtime) clock
+  uint64_t system_timestamp_ns = 0;
+  // frame sequence number counted by the source
+  uint32_t sequence = 0;
+  // number of frames dropped by the source right before this frame
+  uint32_t dropped_frames = 0;
+  // raw V4L2 buffer flags (e.g. V4L2_BUF_FLAG_ERROR, timestamp source)
+  uint32_t flags = 0;
+  // number of bytes of the payload, e.g. the size of a compressed frame
+  uint32_t bytes_used = 0;
+
+  // allocate memory for the format, with rows padded to row_alignment bytes.
+  // memory of the same layout is reused
+  bool Allocate(StreamPixelFormat format, int frame_width, int frame_height,
+                int row_alignment = kImageRowAlignment);
+  // describe memory of someone else, planes follow each other from data on.
+  // the owner is kept to keep the memory alive
+  bool Wrap(StreamPixelFormat format, int frame_width, int frame_height,
+            void* data, int stride, std::shared_ptr<void> memory_owner = nullptr,
+            FrameMemory memory_type = FrameMemory::MEMORY_BORROWED);
+  // drop the memory and the layout
+  void Release();
+  void ResetMetadata();
+
+  inline uint8_t* GetData(int plane = 0) const { return planes[plane].data; }
+  inline int GetStride(int plane = 0) const { return planes[plane].stride; }
+  inline bool IsMapped() const {
+    return num_planes > 0 && planes[0].data != nullptr;
+  }
+  // borrowed memory nobody holds, e.g. an image only valid during a call.
+  // such frames are copied before they are kept
+  inline bool IsTransient() const {
+    return memory == FrameMemory::MEMORY_BORROWED && owner == nullptr;
+  }
+  size_t GetSize() const;
+};
+
+using FramePtr = std::shared_ptr<Frame>;
+
+// copy the capture metadata between frames and camera images
+void CopyMetadata(const Frame& frame, CameraImage* image);
+void CopyMetadata(const CameraImage& image, Frame* frame);
+// deep copy of a frame into memory of the destination, which is allocated
+// unless it already has the layout. e.g. to keep a borrowed frame. false if
+// the destination has memory of another layout it does not own
+bool CopyFrame(const Frame& src, Frame* dst);
+
 struct CameraBuffer {
   void* start;
   size_t length;
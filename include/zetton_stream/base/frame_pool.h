@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+
+namespace zetton {
+namespace stream {
+
+// fixed set of frames carved out of one preallocated arena. frames are handed
+// out as reference-counted FramePtr or CameraImagePtr and go back to the pool
+// when the last reference is released, so that steady-state capture never
+// allocates. frames keep the pool alive, it may be dropped while they are in
+// use.
+class FramePool : public std::enable_shared_from_this<FramePool> {
+ public:
+  // num_frames frames of width x height pixels with rows aligned to
+  // kImageRowAlignment. huge pages are used if requested and available
+  static std::shared_ptr<FramePool> Create(StreamPixelFormat format, int width,
+                                           int height, int num_frames,
+                                           bool huge_pages = false);
+  // one frame per buffer of the stream, sized from its output format and
+  // region of interest
+  static std::shared_ptr<FramePool> Create(const StreamOptions& options,
+                                           bool huge_pages = false);
+  ~FramePool();
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+ public:
+  // take a free frame, waiting up to timeout_ms for one to be released
+  // (negative waits forever). returns nullptr if all frames are in use
+  FramePtr AcquireFrame(int timeout_ms = 0);
+  // same as a camera image, only meaningful for single-plane formats
+  CameraImagePtr Acquire(int timeout_ms = 0);
+
+  inline int GetCapacity() const { return num_frames_; }
+  int GetAvailable();
+  inline size_t GetFrameSize() const { return frame_size_; }
+  inline size_t GetArenaSize() const { return arena_size_; }
+  inline bool IsHugePages() const { return huge_pages_; }
+  inline StreamPixelFormat GetPixelFormat() const { return pixel_format_; }
+
+ private:
+  struct Slot;
+  template <typename T>
+  class SlotAllocator;
+
+  FramePool() = default;
+  bool Init(StreamPixelFormat format, int width, int height, int num_frames,
+            bool huge_pages);
+  bool AllocateArena(size_t size, bool huge_pages);
+  Slot* TakeSlot(int timeout_ms);
+  void Release(Slot* slot);
+
+ private:
+  void* arena_ = nullptr;
+  size_t arena_size_ = 0;
+  bool huge_pages_ = false;
+  StreamPixelFormat pixel_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  size_t frame_size_ = 0;
+  int num_frames_ = 0;
+
+  std::unique_ptr<Slot[]> slots_;
+  // reserved to num_frames_, so that releasing never allocates
+  std::vector<Slot*> free_slots_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+using FramePoolPtr = std::shared_ptr<FramePool>;
+
+}  // namespace stream
+}  // namespace zetton
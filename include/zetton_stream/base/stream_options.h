@@ -83,6 +83,8 @@ enum class StreamPixelFormat {
   PIXEL_FORMAT_UYVY,
   PIXEL_FORMAT_MJPEG,
   PIXEL_FORMAT_YUVMONO10,
+  PIXEL_FORMAT_NV12,
+  PIXEL_FORMAT_NV16,
   PIXEL_FORMAT_MAX_NUM
 };
 
@@ -100,6 +102,44 @@ enum class StreamPlatformType {
 const char* StreamPlatformTypeToStr(StreamPlatformType platform);
 StreamPlatformType StreamPlatformTypeFromStr(const char* str);
 
+enum class StreamState {
+  STATE_CLOSED = 0,
+  STATE_STREAMING,
+  STATE_LOST,
+  STATE_RECONNECTING,
+  STATE_MAX_NUM
+};
+
+const char* StreamStateToStr(StreamState state);
+StreamState StreamStateFromStr(const char* str);
+
+// goal of the capture mode negotiation
+enum class StreamNegotiationGoal {
+  // stay as close as possible to the requested pixel format, size and rate
+  GOAL_REQUESTED = 0,
+  GOAL_MAX_FPS,
+  GOAL_MIN_BANDWIDTH,
+  GOAL_MIN_DECODE_COST,
+  GOAL_MAX_NUM
+};
+
+const char* StreamNegotiationGoalToStr(StreamNegotiationGoal goal);
+StreamNegotiationGoal StreamNegotiationGoalFromStr(const char* str);
+
+// what an asynchronous sink output does with a frame when its queue is full
+enum class StreamBackpressure {
+  // wait for room, the producer is slowed down to the output
+  BACKPRESSURE_BLOCK = 0,
+  // replace the oldest queued frame
+  BACKPRESSURE_DROP_OLDEST,
+  // drop the new frame
+  BACKPRESSURE_DROP_NEWEST,
+  BACKPRESSURE_MAX_NUM
+};
+
+const char* StreamBackpressureToStr(StreamBackpressure backpressure);
+StreamBackpressure StreamBackpressureFromStr(const char* str);
+
 struct CameraSourceOptions {
   int brightness = -1;
   int contrast = -1;
@@ -114,6 +154,15 @@ struct CameraSourceOptions {
   bool auto_focus = false;
 };
 
+// region of interest in pixels of the captured frame, disabled if the width
+// or the height is zero
+struct StreamRoi {
+  uint32_t x = 0;
+  uint32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
 struct StreamOptions {
  public:
   StreamUri resource;
@@ -135,6 +184,8 @@ struct StreamOptions {
   StreamPixelFormat pixel_format;
   StreamPixelFormat output_format;
   StreamPlatformType platform;
+  StreamNegotiationGoal negotiation_goal;
+  StreamRoi roi;
 
   CameraSourceOptions camera;
 
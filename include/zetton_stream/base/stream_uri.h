@@ -15,6 +15,8 @@ enum class StreamProtocolType {
   PROTOCOL_DISPLAY,
   PROTOCOL_APPSRC,
   PROTOCOL_APPSINK,
+  PROTOCOL_SHM,
+  PROTOCOL_HTTP,
   PROTOCOL_MAX_NUM,
 };
 
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "zetton_stream/base/stream_options.h"
 
 namespace zetton {
@@ -29,7 +31,8 @@ class BaseStreamProcessor {
   inline const StreamOptions& GetOptions() const { return options_; }
 
  protected:
-  bool is_streaming_;
+  // written by the threads of some sources while the application reads it
+  std::atomic<bool> is_streaming_{false};
   StreamOptions options_;
 };
 
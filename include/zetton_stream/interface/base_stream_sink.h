@@ -1,26 +1,47 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 
+#include "zetton_stream/base/frame.h"
 #include "zetton_stream/base/stream_options.h"
 #include "zetton_stream/interface/base_stream_processor.h"
+#include "zetton_stream/util/sink_output_queue.h"
 
 namespace zetton {
 namespace stream {
 
 class BaseStreamSink : public BaseStreamProcessor {
  public:
+  ~BaseStreamSink() override;
+
+ public:
+  // render a frame with its format, layout and capture metadata. sinks
+  // override it and call the base implementation to hand the frame to their
+  // outputs. the frame is shared, so sinks may keep or queue it instead of
+  // copying, as long as they do not write to it
+  virtual bool Render(const FramePtr& frame);
+
+  // render a tightly packed output_format image, only valid during the call
+  bool Render(void* image, uint32_t width, uint32_t height);
   template <typename T>
   bool Render(T* image, uint32_t width, uint32_t height) {
-    return Render((void**)image, width, height);
+    return Render(static_cast<void*>(image), width, height);
   }
 
-  virtual bool Render(void* image, uint32_t width, uint32_t height);
+  // whether frames of a format are rendered without conversion, so that
+  // producers can pick the fastest one. any format by default
+  virtual bool IsFormatSupported(StreamPixelFormat format) const {
+    return true;
+  }
 
  public:
   inline void AddOutput(BaseStreamSink* output) {
-    if (output != nullptr) outputs_.push_back(output);
+    AddOutput(output, SinkOutputOptions());
   }
+  // asynchronous outputs render on a worker thread of their own, behind a
+  // bounded queue. a slow one then only delays itself
+  void AddOutput(BaseStreamSink* output, const SinkOutputOptions& options);
 
   inline uint32_t GetNumOutputs(BaseStreamSink* output) const {
     return outputs_.size();
@@ -30,10 +51,20 @@ class BaseStreamSink : public BaseStreamProcessor {
     return outputs_[index];
   }
 
+  // queue statistics of an asynchronous output, zero for the others
+  SinkOutputStatistics GetOutputStatistics(uint32_t index);
+  // wait until the asynchronous outputs rendered every queued frame
+  void FlushOutputs();
+  // render the queued frames and stop the asynchronous outputs, done on
+  // destruction at the latest
+  void StopOutputs();
+
   virtual void SetStatus(const char* str);
 
  protected:
   std::vector<BaseStreamSink*> outputs_;
+  // queue of every output, nullptr for outputs rendered on the caller thread
+  std::vector<std::unique_ptr<SinkOutputQueue>> output_queues_;
 };
 
 }  // namespace stream
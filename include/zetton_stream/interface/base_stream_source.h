@@ -10,6 +10,19 @@ namespace stream {
 class BaseStreamSource : public BaseStreamProcessor {
  public:
   virtual bool Capture(const CameraImagePtr& raw_image) = 0;
+  // capture into a frame, memory is allocated on first use if the frame has
+  // none. sources that only fill camera images capture into a view of the
+  // frame, which must then have a single, tightly packed plane
+  virtual bool Capture(const FramePtr& frame);
+
+ protected:
+  // capture a frame of the source into the frame of the caller. a frame
+  // without memory becomes a view holding the source frame, the others get a
+  // copy. false if there is no source frame
+  bool CaptureFrom(const FramePtr& source, const FramePtr& frame);
+  // copy a frame of the source into the camera image of the caller, which is
+  // allocated unless it already has the layout
+  bool CaptureFrom(const FramePtr& source, const CameraImagePtr& raw_image);
 };
 
 }  // namespace stream
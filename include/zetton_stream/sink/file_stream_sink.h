@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+namespace zetton {
+namespace stream {
+
+// container of a recorded file
+enum class FileContainer {
+  // frames back to back without padding, e.g. concatenated JPEGs for MJPEG
+  CONTAINER_RAW = 0,
+  // YUV4MPEG2, planar 4:2:0, 4:2:2 or mono. packed and semi-planar YUV
+  // frames are converted to planar while they are written
+  CONTAINER_Y4M,
+  CONTAINER_MAX_NUM
+};
+
+const char* FileContainerToStr(FileContainer container);
+FileContainer FileContainerFromStr(const char* str);
+
+// records uncompressed or MJPEG frames to a file (file://path), Y4M for
+// .y4m files and raw otherwise. a text index next to it (path.idx) lists the
+// offset, size and timestamps of every frame.
+// frames are packed into large aligned buffers that a writer thread writes
+// with O_DIRECT, so recording neither stalls the capture thread nor fills
+// the page cache. if the file system does not support O_DIRECT, written
+// ranges are flushed and dropped from the page cache instead. frames are
+// dropped while all buffers are waiting for the disk
+class FileStreamSink : public BaseStreamSink {
+ public:
+  FileStreamSink() = default;
+  ~FileStreamSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override;
+
+  // wait for the disk instead of dropping frames, for producers that are not
+  // the capture thread. must be set before Open()
+  inline void SetBlocking(bool blocking) { blocking_ = blocking; }
+
+  inline FileContainer GetContainer() const { return container_; }
+  inline uint64_t GetNumWritten() const { return frames_written_; }
+  // frames dropped because the disk fell behind
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+  inline uint64_t GetNumBytes() const { return bytes_written_; }
+
+ private:
+  struct Buffer {
+    std::shared_ptr<uint8_t> data;
+    size_t size = 0;
+    // offset of the buffer in the file
+    uint64_t offset = 0;
+    // index lines of the frames ending in this buffer
+    std::string index;
+  };
+
+  // all with mutex_ held
+  bool WriteHeader(const Frame& frame);
+  bool WriteFrame(const Frame& frame);
+  // bytes a frame takes in the file
+  size_t GetRecordSize(const Frame& frame) const;
+  // bytes the buffers can take before the disk catches up
+  size_t GetAvailable() const;
+  void Append(const void* data, size_t size);
+  void Submit();
+
+  void Run();
+  bool WriteBuffer(const Buffer& buffer);
+
+ private:
+  FileContainer container_ = FileContainer::CONTAINER_RAW;
+  std::string path_;
+  int fd_ = -1;
+  FILE* index_ = nullptr;
+  bool direct_ = false;
+  bool blocking_ = false;
+  size_t buffer_size_ = 0;
+  size_t num_buffers_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  std::thread thread_;
+  bool stop_ = false;
+  bool failed_ = false;
+  std::vector<Buffer> free_buffers_;
+  std::deque<Buffer> full_buffers_;
+  Buffer current_;
+  // file size once every submitted buffer is written
+  uint64_t file_size_ = 0;
+
+  // layout of the first frame, every other frame must match it
+  Frame layout_;
+  bool has_layout_ = false;
+  std::vector<uint8_t> row_;
+
+  std::atomic<uint64_t> frames_written_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+  std::atomic<uint64_t> bytes_written_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
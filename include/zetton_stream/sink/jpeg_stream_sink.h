@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+#include "zetton_stream/util/jpeg_encoder.h"
+
+namespace zetton {
+namespace stream {
+
+using JpegCallback = std::function<void(const FramePtr& jpeg)>;
+
+// encodes frames to JPEG on a pool of worker threads, for snapshots and
+// previews. Render() only hands the frame to an idle worker, a frame is
+// dropped when every worker is busy so that capture never waits for the
+// encoder. the JPEGs are MJPEG frames carrying the metadata of their source
+// frame, rendered to the outputs of the sink (e.g. a MjpegRecordSink) and
+// passed to the callback in capture order, on a worker thread. with a
+// file://path resource, the file is replaced by every JPEG.
+// the size of the JPEGs is width x height of the options, 0 keeps the size
+// of the frames
+class JpegStreamSink : public BaseStreamSink {
+ public:
+  JpegStreamSink() = default;
+  ~JpegStreamSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override {
+    return JpegEncoder::IsSupported(format);
+  }
+
+  // must be set before Open()
+  inline void SetQuality(int quality) { jpeg_.quality = quality; }
+  inline void SetNumThreads(uint32_t num_threads) {
+    num_threads_ = num_threads;
+  }
+  inline void SetCallback(const JpegCallback& callback) {
+    callback_ = callback;
+  }
+
+  // last JPEG, nullptr before the first one
+  FramePtr GetLatest();
+
+  inline uint64_t GetNumEncoded() const { return frames_encoded_; }
+  // frames dropped because every worker was busy, or encoded too late
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+  inline uint64_t GetNumFailed() const { return frames_failed_; }
+
+ private:
+  struct Job {
+    FramePtr frame;
+    // capture order of the frame
+    uint64_t ticket = 0;
+  };
+
+  void Run();
+  void Deliver(const FramePtr& jpeg, uint64_t ticket);
+  bool WriteSnapshot(const Frame& jpeg);
+
+ private:
+  JpegOptions jpeg_;
+  uint32_t num_threads_ = 2;
+  JpegCallback callback_;
+  std::string path_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<std::thread> threads_;
+  std::deque<Job> jobs_;
+  uint32_t idle_workers_ = 0;
+  uint64_t next_ticket_ = 0;
+  bool stop_ = false;
+
+  // serializes the outputs, the callback and the snapshot
+  std::mutex deliver_mutex_;
+  uint64_t delivered_ticket_ = 0;
+  std::mutex latest_mutex_;
+  FramePtr latest_;
+
+  std::atomic<uint64_t> frames_encoded_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+  std::atomic<uint64_t> frames_failed_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+namespace zetton {
+namespace stream {
+
+// serves MJPEG frames as a multipart/x-mixed-replace stream over HTTP
+// (http://ip:port/path, 0.0.0.0 for every interface), which browsers, curl
+// and ffplay can show. without a path, every path serves the stream.
+// JPEGs come from MJPEG cameras or a JpegStreamSink, and every frame is
+// shared by all clients: the part header is built once and sent together
+// with the JPEG by a non-blocking gather write, nothing is copied per
+// client. a client that cannot keep up finishes the frame it is sending and
+// then skips to the latest one, so it never holds more than one frame
+class MjpegHttpSink : public BaseStreamSink {
+ public:
+  MjpegHttpSink() = default;
+  ~MjpegHttpSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override {
+    return format == StreamPixelFormat::PIXEL_FORMAT_MJPEG;
+  }
+
+  // must be set before Open()
+  inline void SetMaxClients(uint32_t max_clients) {
+    max_clients_ = max_clients;
+  }
+  // socket buffer of a client, which bounds how far behind it can fall.
+  // 0 keeps the default of the kernel
+  inline void SetSendBufferSize(int size) { send_buffer_size_ = size; }
+
+  // port the server listens on, e.g. when bound to port 0
+  inline int GetPort() const { return port_; }
+  inline uint32_t GetNumClients() const { return num_clients_; }
+  // frames sent to clients and frames clients skipped, over all clients
+  inline uint64_t GetNumSent() const { return frames_sent_; }
+  inline uint64_t GetNumSkipped() const { return frames_skipped_; }
+
+ private:
+  // a frame as sent to every client
+  struct Part {
+    uint64_t id = 0;
+    std::string header;
+    // keeps the JPEG alive while clients send it
+    FramePtr frame;
+    std::vector<uint8_t> copy;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+  };
+  using PartPtr = std::shared_ptr<const Part>;
+
+  struct Client {
+    int fd = -1;
+    std::string address;
+    // request until the empty line, then the response header to send
+    std::string request;
+    std::string response;
+    size_t response_sent = 0;
+    bool streaming = false;
+    bool waiting_writable = false;
+    // part being sent, nullptr while the client waits for a frame
+    PartPtr part;
+    size_t part_sent = 0;
+    uint64_t last_id = 0;
+  };
+
+  // all on the server thread
+  void Run();
+  void Accept();
+  bool Receive(Client* client, const PartPtr& latest);
+  bool Send(Client* client, const PartPtr& latest);
+  bool SetWritable(Client* client, bool writable);
+  void Disconnect(int fd);
+
+ private:
+  std::string address_;
+  int port_ = 0;
+  std::string path_;
+  uint32_t max_clients_ = 16;
+  int send_buffer_size_ = 1 << 20;
+
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::map<int, Client> clients_;
+
+  std::mutex mutex_;
+  PartPtr latest_;
+  uint64_t next_id_ = 1;
+
+  std::atomic<uint32_t> num_clients_{0};
+  std::atomic<uint64_t> frames_sent_{0};
+  std::atomic<uint64_t> frames_skipped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
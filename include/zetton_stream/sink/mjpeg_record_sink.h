@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+struct AVFormatContext;
+struct AVPacket;
+struct AVStream;
+
+namespace zetton {
+namespace stream {
+
+// when a recording moves on to a new file, disabled if zero
+struct RecordSegmentOptions {
+  uint64_t max_bytes = 0;
+  uint32_t max_duration_s = 0;
+};
+
+// records the JPEGs of MJPEG cameras to AVI or MKV files (file://path, the
+// container follows the extension) through libavformat, without decoding or
+// re-encoding anything. every frame is stored as a key frame at the driver
+// timestamp, AVI fills gaps with empty frames at frame_rate. with segments,
+// files are named path_00000.ext, path_00001.ext, ...
+// muxing writes to the file, so slow disks are best kept off the capture
+// thread with an asynchronous output, see SinkOutputOptions
+class MjpegRecordSink : public BaseStreamSink {
+ public:
+  MjpegRecordSink() = default;
+  ~MjpegRecordSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override {
+    return format == StreamPixelFormat::PIXEL_FORMAT_MJPEG;
+  }
+
+  // must be set before Open()
+  inline void SetSegmentOptions(const RecordSegmentOptions& segment) {
+    segment_ = segment;
+  }
+
+  inline uint64_t GetNumWritten() const { return frames_written_; }
+  inline uint32_t GetNumSegments() const { return segment_index_; }
+  // file being written, empty before the first frame
+  std::string GetCurrentPath();
+
+ private:
+  // all with mutex_ held
+  std::string GetSegmentPath(uint32_t index) const;
+  bool OpenSegment(const Frame& frame);
+  void CloseSegment();
+  bool WritePacket(const Frame& frame, uint64_t timestamp_ns);
+
+ private:
+  RecordSegmentOptions segment_;
+  std::mutex mutex_;
+
+  AVFormatContext* context_ = nullptr;
+  AVStream* stream_ = nullptr;
+  AVPacket* packet_ = nullptr;
+  std::string path_;
+  std::atomic<uint32_t> segment_index_{0};
+  // capture time of the first frame of the segment
+  uint64_t segment_start_ns_ = 0;
+  int64_t last_pts_ = -1;
+  int width_ = 0;
+  int height_ = 0;
+
+  std::atomic<uint64_t> frames_written_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+#include "zetton_stream/util/rtp_payload.h"
+
+namespace zetton {
+namespace stream {
+
+// streams frames as RTP over UDP to rtp://ip:port, unicast or multicast.
+// MJPEG frames are sent as RFC 2435 JPEG, UYVY, YUYV, RGB and BGR frames as
+// RFC 4175 uncompressed video. packets point into the frame and are sent by
+// batches of sendmmsg(), and with UDP segmentation offload where the kernel
+// supports it, so a frame takes a few system calls instead of one per
+// packet. options.bit_rate (bits per second) paces the packets so that
+// large frames do not overflow switches and receivers, 0 sends them at once
+class RtpStreamSink : public BaseStreamSink {
+ public:
+  RtpStreamSink() = default;
+  ~RtpStreamSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override {
+    return RtpPacketizer::IsSupported(format);
+  }
+
+  // must be set before Open(). the size of the UDP payload, which should fit
+  // the MTU of the path
+  inline void SetMaxPacketSize(size_t size) { max_packet_size_ = size; }
+  // use UDP segmentation offload if available
+  inline void SetGso(bool gso) { gso_ = gso; }
+
+  inline bool IsGsoEnabled() const { return gso_enabled_; }
+  inline uint64_t GetNumFrames() const { return frames_sent_; }
+  inline uint64_t GetNumPackets() const { return packets_sent_; }
+  inline uint64_t GetNumBytes() const { return bytes_sent_; }
+
+ private:
+  // all with mutex_ held
+  bool Send(const std::vector<RtpPacket>& packets);
+  // add a message of packets from first on, several packets of the same size
+  // with segmentation offload, and returns how many. 0 if the batch is full
+  size_t AddMessage(const std::vector<RtpPacket>& packets, size_t first,
+                    size_t max_bytes, size_t num_messages,
+                    size_t* num_iovecs);
+  // send the batch, num_sent are the messages sent even on failure
+  bool SendMessages(size_t num_messages, size_t* num_sent);
+  // wait until bytes can be sent at the bit rate
+  void Pace(size_t bytes);
+
+ private:
+  size_t max_packet_size_ = 1400;
+  bool gso_ = true;
+  bool gso_enabled_ = false;
+
+  std::mutex mutex_;
+  int fd_ = -1;
+  RtpPacketizer packetizer_;
+  std::vector<RtpPacket> packets_;
+  uint32_t timestamp_offset_ = 0;
+
+  // messages of a batch, reused from frame to frame
+  std::vector<mmsghdr> messages_;
+  std::vector<iovec> iovecs_;
+  std::vector<uint8_t> controls_;
+  // packets of each message
+  std::vector<size_t> message_packets_;
+
+  // pacing
+  uint64_t next_send_ns_ = 0;
+
+  std::atomic<uint64_t> frames_sent_{0};
+  std::atomic<uint64_t> packets_sent_{0};
+  std::atomic<uint64_t> bytes_sent_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+#include "zetton_stream/util/shm_frame_ring.h"
+
+namespace zetton {
+namespace stream {
+
+// publishes frames to other processes through a ring in POSIX shared memory,
+// see ShmFrameRing. the resource names the shared memory (shm://name), the
+// slots are sized for output_format frames of width x height and there are
+// num_buffers of them. frames are dropped while readers hold every slot
+class ShmStreamSink : public BaseStreamSink {
+ public:
+  ShmStreamSink() = default;
+  ~ShmStreamSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  // publish a frame of any format, see Publish()
+  bool Render(const FramePtr& frame) override;
+
+  // copy a frame of any format that fits into a slot and publish it
+  bool Publish(const Frame& frame);
+  // a output_format frame living in a free slot, e.g. to capture into
+  // without any copy. it is published by Publish() and must not be written
+  // afterwards, a frame released without being published gives its slot back
+  FramePtr AcquireFrame();
+
+  inline uint64_t GetNumPublished() const { return frames_published_; }
+  // frames dropped because readers held every slot
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+
+ private:
+  struct SlotClaim;
+
+  // slot of a frame acquired from this sink, -1 if it is somewhere else
+  int FindClaimedSlot(const Frame& frame);
+
+ private:
+  ShmFrameRingPtr ring_;
+  size_t slot_size_ = 0;
+  std::mutex mutex_;
+  // id of the unpublished frame handed out by AcquireFrame() per slot, 0 if
+  // none. shared with the frames, which may outlive the sink
+  using ClaimTable = std::array<std::atomic<uint64_t>, kShmMaxSlots>;
+  std::shared_ptr<ClaimTable> claims_;
+  uint64_t next_claim_ = 1;
+  std::atomic<uint64_t> frames_published_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+namespace zetton {
+namespace stream {
+
+struct TriggerRecordOptions {
+  // seconds recorded before and after a trigger
+  double pre_seconds = 5.0;
+  double post_seconds = 5.0;
+  // memory of the ring, and frames it holds at most
+  size_t buffer_size = 64 << 20;
+  uint32_t max_frames = 1024;
+};
+
+// keeps the last pre_seconds of frames in a ring and records them, and the
+// frames of the next post_seconds, to a file when Trigger() is called, e.g.
+// for incident capture. MJPEG payloads and raw frames are copied into one
+// preallocated buffer, so memory is bounded and nothing is allocated per
+// frame. a background thread writes events to path_00000.ext,
+// path_00001.ext, ... through a FileStreamSink (raw or y4m), or a
+// MjpegRecordSink for avi and mkv files. a trigger during an event extends
+// it. frames are dropped while the ring is full of frames waiting for the
+// disk
+class TriggerRecordSink : public BaseStreamSink {
+ public:
+  TriggerRecordSink() = default;
+  ~TriggerRecordSink() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  using BaseStreamSink::Render;
+  bool Render(const FramePtr& frame) override;
+  bool IsFormatSupported(StreamPixelFormat format) const override;
+
+  // record the frames in the ring and the ones of the next post_seconds
+  void Trigger();
+
+  // must be set before Open()
+  inline void SetTriggerOptions(const TriggerRecordOptions& trigger) {
+    trigger_ = trigger;
+  }
+
+  bool IsRecording();
+  inline uint32_t GetNumEvents() const { return num_events_; }
+  inline uint64_t GetNumWritten() const { return frames_written_; }
+  // frames dropped because they did not fit the ring
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+
+ private:
+  struct Slot {
+    // view of the frame in the ring, allocated once
+    FramePtr frame;
+    size_t offset = 0;
+    size_t size = 0;
+    uint64_t timestamp_ns = 0;
+    // waiting to be written, as part of an event
+    bool pending = false;
+    uint32_t event = 0;
+  };
+
+  // all with mutex_ held
+  bool Store(const Frame& frame, uint64_t timestamp_ns);
+  // offset a frame of size bytes fits at, evicting frames that were written
+  // or are too old. false if it cannot fit
+  bool Reserve(size_t size, uint64_t timestamp_ns, size_t* offset);
+  inline Slot& GetSlot(uint32_t n) {
+    return slots_[(head_ + n) % slots_.size()];
+  }
+
+  void Run();
+  bool IsMjpegContainer() const;
+  std::string GetEventPath(uint32_t index) const;
+  std::unique_ptr<BaseStreamSink> OpenEvent(uint32_t index);
+
+ private:
+  TriggerRecordOptions trigger_;
+  std::string path_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread thread_;
+  bool stop_ = false;
+
+  // ring of frames, oldest at head_
+  std::unique_ptr<uint8_t[]> buffer_;
+  std::vector<Slot> slots_;
+  uint32_t head_ = 0;
+  uint32_t count_ = 0;
+  // where the next frame goes
+  size_t write_offset_ = 0;
+
+  // event in progress, frames up to end_ns_ are recorded. 0 until the first
+  // frame after the trigger
+  bool recording_ = false;
+  uint32_t event_index_ = 0;
+  uint64_t end_ns_ = 0;
+  uint64_t last_ns_ = 0;
+  uint32_t num_pending_ = 0;
+
+  std::atomic<uint32_t> num_events_{0};
+  std::atomic<uint64_t> frames_written_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/frame_pool.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_source.h"
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+namespace zetton {
+namespace stream {
+
+// decodes the video of container files (file://video.mp4, .mkv, .sdp, ...)
+// and network streams (rtsp://, rtp://) with libavformat and libavcodec.
+// one thread demuxes into a bounded packet queue, another decodes with frame
+// threading into a few frames ready for Acquire(), so capture never waits
+// for the demuxer or a slow frame. frames come in options.pixel_format at
+// the size of the options (0 keeps the size of the video): a decoded frame
+// that already has that layout is handed out as is, holding a reference to
+// the buffer of the decoder, others are converted by swscale into frames of
+// a pool. files are decoded as fast as frames are taken and repeat with
+// options.loop, live streams drop packets up to the next keyframe and the
+// oldest frames instead of falling behind. a live stream that fails or ends
+// is opened again with exponential backoff, it must keep its codec
+class FfmpegStreamSource : public BaseStreamSource {
+ public:
+  FfmpegStreamSource() = default;
+  ~FfmpegStreamSource() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  // wait up to timeout_ms for the next decoded frame. returns nullptr on
+  // timeout and at the end of the stream
+  FramePtr Acquire(int timeout_ms = 2000);
+  // frames without memory share the decoded frame, others get a copy
+  bool Capture(const FramePtr& frame) override;
+  // copy of a single plane frame
+  bool Capture(const CameraImagePtr& raw_image) override;
+
+  // continue from the keyframe before seconds into the stream, frames before
+  // the position are decoded but not handed out. files only
+  bool Seek(double seconds);
+
+  // use RTSP over TCP instead of UDP, must be set before Open()
+  inline void SetRtspTcp(bool tcp) { rtsp_tcp_ = tcp; }
+
+  // position of the last frame in seconds
+  double GetPosition();
+  bool IsEndOfStream();
+  inline uint64_t GetNumDroppedPackets() const { return packets_dropped_; }
+  inline uint64_t GetNumDroppedFrames() const { return frames_dropped_; }
+
+ private:
+  struct Packet {
+    AVPacket* packet = nullptr;
+    // packets of an older serial were read before a seek
+    uint32_t serial = 0;
+  };
+  struct Decoded {
+    FramePtr frame;
+    uint32_t serial = 0;
+    double position = 0;
+  };
+
+  bool OpenInput();
+  bool OpenDemuxer();
+  bool OpenDecoder();
+  void ReleaseInput();
+  static int Interrupt(void* opaque);
+
+  // demuxer thread
+  void Read();
+  // reopen a lost live stream, false once the source is closed
+  bool Reconnect();
+  bool SeekInput(double seconds);
+  // with mutex_ held, false if the packet was dropped
+  bool PushPacket(std::unique_lock<std::mutex>* lock, AVPacket* packet,
+                  uint32_t serial);
+  void ClearPackets();
+
+  // decoder thread
+  void Decode();
+  bool ReceiveFrames(uint32_t serial);
+  FramePtr Convert(AVFrame* frame);
+
+ private:
+  std::string url_;
+  bool live_ = false;
+  bool rtsp_tcp_ = false;
+
+  // owned by the threads while they run
+  AVFormatContext* format_ = nullptr;
+  AVCodecContext* codec_ = nullptr;
+  AVFrame* decoded_ = nullptr;
+  SwsContext* sws_ = nullptr;
+  FramePoolPtr pool_;
+  int pool_width_ = 0;
+  int pool_height_ = 0;
+  int stream_index_ = -1;
+  // stream time base in seconds and the first timestamp
+  double time_base_ = 0;
+  int64_t start_pts_ = 0;
+  int passes_ = 0;
+
+  std::thread read_thread_;
+  std::thread decode_thread_;
+  std::atomic<bool> stop_{false};
+  // blocking I/O is interrupted past this time, 0 for never
+  std::atomic<uint64_t> io_deadline_ns_{0};
+
+  std::mutex mutex_;
+  std::condition_variable packet_cond_;
+  std::condition_variable frame_cond_;
+  std::deque<Packet> packets_;
+  size_t packet_bytes_ = 0;
+  std::deque<Decoded> frames_;
+  // bumped by every seek, older packets and frames are dropped
+  uint32_t serial_ = 0;
+  bool seek_requested_ = false;
+  double seek_seconds_ = 0;
+  // frames of the serial before this timestamp are skipped after a seek
+  int64_t skip_pts_ = 0;
+  // packets are dropped up to a keyframe after a seek or an overflow
+  bool wait_keyframe_ = false;
+  // the decoder ran out of packets for the serial
+  bool decoded_all_ = false;
+  uint32_t decoded_serial_ = 0;
+  double position_ = 0;
+  uint32_t sequence_ = 0;
+
+  std::atomic<uint64_t> packets_dropped_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/frame_pool.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_source.h"
+#include "zetton_stream/sink/file_stream_sink.h"
+
+namespace zetton {
+namespace stream {
+
+// how fast a recording is replayed
+enum class FilePacing {
+  // at the recorded timestamps, or the frame rate without them. frames a
+  // slow reader misses are dropped like a camera would
+  PACING_REALTIME = 0,
+  // every frame as soon as it is read
+  PACING_FASTEST,
+  // at most options.frame_rate frames per second, or the rate of the
+  // recording, never dropping
+  PACING_FIXED,
+  PACING_MAX_NUM
+};
+
+const char* FilePacingToStr(FilePacing pacing);
+FilePacing FilePacingFromStr(const char* str);
+
+// replays recordings of a FileStreamSink (file://path) without a camera,
+// e.g. for benchmarks and regression tests. the file is memory-mapped and
+// frames are views of the mapping, nothing is copied: Y4M for .y4m files,
+// concatenated JPEGs for .mjpeg/.mjpg files or the MJPEG pixel format, and
+// raw frames of the pixel format and size of the options otherwise. the
+// index next to the file (path.idx) gives offsets and timestamps if it is
+// there, otherwise the file is scanned for frames. Y4M stores planar YUV,
+// which frames cannot describe, so 4:2:0 and 4:2:2 recordings are
+// interleaved into NV12 and NV16 (or YUYV/UYVY if asked for) frames of a
+// pool, only mono recordings are zero-copy. options.loop repeats the
+// recording that many times, -1 forever. frames carry the timestamps of the
+// index, shifted by the length of the recording on every pass, or the time
+// they are replayed at without them
+class FileStreamSource : public BaseStreamSource {
+ public:
+  FileStreamSource() = default;
+  ~FileStreamSource() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  // wait up to timeout_ms for the next frame to be due and return a view of
+  // it. returns nullptr on timeout and at the end of the recording
+  FramePtr Acquire(int timeout_ms = 2000);
+  // frames without memory become views of the file, others get a copy
+  bool Capture(const FramePtr& frame) override;
+  // copy of a single plane frame
+  bool Capture(const CameraImagePtr& raw_image) override;
+
+  inline void SetPacing(FilePacing pacing) { pacing_ = pacing; }
+  inline FilePacing GetPacing() const { return pacing_; }
+
+  // frames of the recording, and whether all of them were replayed
+  inline size_t GetNumFrames() const { return entries_.size(); }
+  inline bool IsEndOfStream() const { return end_of_stream_; }
+
+ private:
+  // a frame in the file
+  struct Entry {
+    uint64_t offset = 0;
+    size_t size = 0;
+    uint64_t timestamp_ns = 0;
+    uint64_t system_timestamp_ns = 0;
+    uint32_t flags = 0;
+  };
+
+  // all with mutex_ held
+  bool ReadIndex();
+  bool ScanY4m();
+  bool ScanMjpeg();
+  bool ScanRaw();
+  // steady clock time frame n of the pass is due
+  uint64_t GetDueTime(size_t n) const;
+  FramePtr GetFrame(const Entry& entry, int timeout_ms);
+
+ private:
+  FileContainer container_ = FileContainer::CONTAINER_RAW;
+  FilePacing pacing_ = FilePacing::PACING_REALTIME;
+  std::string path_;
+
+  std::mutex mutex_;
+  // the mapping, unmapped when the last frame is released
+  std::shared_ptr<uint8_t> mapping_;
+  size_t file_size_ = 0;
+  std::vector<Entry> entries_;
+
+  // layout of the frames, and of the file for y4m
+  StreamPixelFormat pixel_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  int width_ = 0;
+  int height_ = 0;
+  // y4m chroma subsampling, 420, 422 or 0 for mono
+  int y4m_chroma_ = 0;
+  FramePoolPtr pool_;
+
+  // replay
+  uint64_t interval_ns_ = 0;
+  bool has_timestamps_ = false;
+  size_t next_ = 0;
+  int passes_ = 0;
+  bool started_ = false;
+  uint64_t pass_start_ns_ = 0;
+  uint64_t last_due_ns_ = 0;
+  uint32_t sequence_ = 0;
+  bool end_of_stream_ = false;
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -5,14 +5,19 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include <atomic>
 #include <memory>
-#include <sstream>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "zetton_stream/base/frame.h"
 #include "zetton_stream/base/stream_options.h"
 #include "zetton_stream/interface/base_stream_source.h"
+#include "zetton_stream/util/device_supervisor.h"
+#include "zetton_stream/util/frame_statistics.h"
 #include "zetton_stream/util/mjpeg_decoder.h"
+#include "zetton_stream/util/v4l2_controls.h"
 
 namespace zetton {
 namespace stream {
@@ -25,56 +30,81 @@ class LegacyV4l2StreamSource : public BaseStreamSource {
  public:
   bool Init(const StreamOptions& options) override;
   bool Open() override { return WaitForDevice(); };
-  void Close() override { shutdown(); };
+  void Close() override;
 
  public:
   // user use this function to get camera frame data
+  using BaseStreamSource::Capture;
   bool Capture(const CameraImagePtr& raw_image) override;
 
   bool IsCapturing();
   bool WaitForDevice();
 
+  // state changes of the device, called from the supervisor thread in async
+  // mode. must be set before the device is opened
+  inline void SetStateCallback(StreamStateCallback callback) {
+    state_callback_ = std::move(callback);
+  }
+  StreamState GetState() const;
+
+  // capture statistics (jitter, drops, clock offset), safe to call from any
+  // thread
+  FrameStatisticsSnapshot GetStatistics() const;
+
+  // camera controls of the opened device, names follow v4l2-ctl
+  const std::vector<V4l2ControlInfo>& GetControls() const;
+  bool GetControl(const std::string& name, int64_t* value);
+  bool SetControl(const std::string& name, int64_t value);
+
  private:
   bool init_device();
   bool uninit_device();
 
-  void set_device_config();
-  // enables/disable auto focus
-  void set_auto_focus(int value);
-  // set video device parameters
-  void set_v4l_parameter(const std::string& param, int value);
-  void set_v4l_parameter(const std::string& param, const std::string& value);
+  // apply camera options through the native controls api
+  bool set_device_config();
 
   bool init_read(unsigned int buffer_size);
   bool init_mmap();
   bool init_userp(unsigned int buffer_size);
   bool close_device();
   bool open_device();
-  bool read_frame(CameraImagePtr raw_image);
+  // outcome of reading a frame, frames dropped by decimation are no error
+  enum class ReadResult { READ_FRAME, READ_SKIPPED, READ_ERROR };
+  ReadResult read_frame(CameraImagePtr raw_image);
   bool process_image(void* src, int len, CameraImagePtr dest);
   bool start_capturing();
   bool stop_capturing();
+  bool reopen();
   void reconnect();
+  // tear down the device and let the supervisor reconnect in async mode
+  void handle_device_lost();
   void reset_device();
   void shutdown();
 
  private:
-  StreamOptions options_;
   MjpegDecoder mjpeg_decoder_;
+  V4l2Controls controls_;
 
   unsigned int pixel_format_;
   bool monochrome_;
   int fd_;
+  // duplicate of fd_ for the controls api, queried once per open
+  cv4l_fd control_fd_;
   CameraBuffer* buffers_;
   unsigned int n_buffers_;
 
-  bool is_capturing_;
+  std::atomic<bool> is_capturing_;
 
+  // sequence of the frames read with read(), which has no buffer metadata
   uint64_t image_seq_;
-  float frame_warning_interval_ = 0.0;
+  int64_t last_sequence_;
   float device_wait_sec_ = 0.0;
-  uint64_t last_nsec_ = 0;
-  float frame_drop_interval_ = 0.0;
+  FrameStatistics statistics_;
+
+  // guards the device against the supervisor reopening it
+  std::mutex device_mutex_;
+  DeviceSupervisor supervisor_;
+  StreamStateCallback state_callback_;
 };
 
 }  // namespace stream
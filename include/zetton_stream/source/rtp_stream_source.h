@@ -0,0 +1,69 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_source.h"
+#include "zetton_stream/util/rtp_payload.h"
+
+namespace zetton {
+namespace stream {
+
+// receives the RTP streams of an RtpStreamSink on rtp://ip:port, joining the
+// group of a multicast address. packets are read by batches of recvmmsg()
+// and reassembled into frames of a pool. with the MJPEG codec, frames are
+// JPEGs that describe themselves, otherwise raw frames of the pixel format
+// and size of the options, which must match the sender
+class RtpStreamSource : public BaseStreamSource {
+ public:
+  RtpStreamSource() = default;
+  ~RtpStreamSource() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  // wait up to timeout_ms for the next complete frame, a frame of the pool
+  // until it is released. returns nullptr on timeout
+  FramePtr Acquire(int timeout_ms = 2000);
+  // frames without memory share the frame of the pool, others get a copy
+  bool Capture(const FramePtr& frame) override;
+  // copy of a single plane frame
+  bool Capture(const CameraImagePtr& raw_image) override;
+
+  // port the source listens on, e.g. when bound to port 0
+  inline int GetPort() const { return port_; }
+  inline uint64_t GetNumLost() const { return packets_lost_; }
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+
+ private:
+  // with mutex_ held. next packet of the batch, reading a new batch when it
+  // is used up. false on timeout
+  bool Receive(int timeout_ms, const uint8_t** packet, size_t* size);
+
+ private:
+  std::mutex mutex_;
+  int fd_ = -1;
+  int port_ = 0;
+  RtpDepacketizer depacketizer_;
+
+  // a batch of packets and the next one to reassemble
+  std::vector<uint8_t> buffer_;
+  std::vector<mmsghdr> messages_;
+  std::vector<iovec> iovecs_;
+  size_t num_received_ = 0;
+  size_t next_ = 0;
+
+  std::atomic<uint64_t> packets_lost_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
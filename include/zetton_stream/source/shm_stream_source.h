@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/interface/base_stream_source.h"
+#include "zetton_stream/util/shm_frame_ring.h"
+
+namespace zetton {
+namespace stream {
+
+// reads the frames a ShmStreamSink publishes in another process, straight
+// from the shared memory. the resource names the shared memory (shm://name).
+// by default every capture returns the latest frame and skips older ones,
+// SetReadAll() reads every frame still in the ring instead. a frame keeps its
+// slot from being reused until it is released, so frames should not be held
+// longer than the writer takes to cycle through its slots
+class ShmStreamSource : public BaseStreamSource {
+ public:
+  ShmStreamSource() = default;
+  ~ShmStreamSource() override;
+
+ public:
+  bool Init(const StreamOptions& options) override;
+  bool Open() override;
+  void Close() override;
+
+  // wait up to timeout_ms for a frame newer than the last one and return a
+  // view of its slot. reattaches if the writer was restarted. returns nullptr
+  // on timeout
+  FramePtr Acquire(int timeout_ms = 2000);
+  // frames without memory become views of the slot, others get a copy
+  bool Capture(const FramePtr& frame) override;
+  // copy of a single plane frame
+  bool Capture(const CameraImagePtr& raw_image) override;
+
+  inline void SetReadAll(bool read_all) { read_all_ = read_all; }
+  // frames the writer published that were never read
+  inline uint64_t GetNumSkipped() const { return frames_skipped_; }
+
+ private:
+  // with mutex_ held
+  bool Attach();
+
+ private:
+  ShmFrameRingPtr ring_;
+  uint64_t last_number_ = 0;
+  bool read_all_ = false;
+  std::mutex mutex_;
+  std::atomic<uint64_t> frames_skipped_{0};
+};
+
+}  // namespace stream
+}  // namespace zetton
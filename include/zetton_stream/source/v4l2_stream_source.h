@@ -1,9 +1,18 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 #include "zetton_stream/base/frame.h"
 #include "zetton_stream/base/stream_options.h"
 #include "zetton_stream/interface/base_stream_source.h"
+#include "zetton_stream/util/device_supervisor.h"
+#include "zetton_stream/util/frame_statistics.h"
 #include "zetton_stream/util/mjpeg_decoder.h"
+#include "zetton_stream/util/v4l2_controls.h"
+#include "zetton_stream/util/v4l2_format_negotiator.h"
 #include "zetton_stream/util/v4l/cv4l-helpers.h"
 #include "zetton_stream/util/v4l2.h"
 
@@ -19,39 +28,111 @@ class V4l2StreamSource : public BaseStreamSource {
   bool Init(const StreamOptions& options) override;
   bool WaitForDevice();
   bool Capture(const CameraImagePtr& raw_image) override;
+  // capture into the frame directly, its memory is allocated on first use
+  bool Capture(const FramePtr& frame) override;
 
   bool Open() override { return WaitForDevice(); };
-  void Close() override { Shutdown(); };
+  void Close() override;
 
  public:
   bool IsCaptuering();
+  // pixel format and size of captured frames, known once the device is open.
+  // the driver may deliver another size than the requested one
+  StreamPixelFormat GetOutputPixelFormat() const;
+  void GetOutputSize(int* width, int* height) const;
+  // state changes of the device, called from the supervisor thread in async
+  // mode. must be set before the device is opened
+  inline void SetStateCallback(StreamStateCallback callback) {
+    state_callback_ = std::move(callback);
+  }
+  StreamState GetState() const;
+  // capture statistics (jitter, drops, clock offset), safe to call from any
+  // thread
+  FrameStatisticsSnapshot GetStatistics() const;
+
+  // camera controls of the opened device, names follow v4l2-ctl
+  const std::vector<V4l2ControlInfo>& GetControls() const;
+  bool GetControl(const std::string& name, int64_t* value);
+  bool SetControl(const std::string& name, int64_t value);
 
  private:
+  bool Reopen();
   void Shutdown();
+  // tear down the device and let the supervisor reconnect in async mode
+  void HandleDeviceLost();
 
   bool OpenDevice();
   bool CloseDevice();
   bool InitDevice();
+  // frame layout of a FIFO or regular file standing in for the device
+  bool InitFileInput();
   bool UninitDevice();
   bool StartCapturing();
   bool StopCapturing();
 
-  bool ReadFrame(CameraImagePtr raw_image);
+  // outcome of reading a frame, frames dropped by decimation are no error
+  enum class ReadResult { READ_FRAME, READ_SKIPPED, READ_ERROR };
+
+  bool CaptureFrame(Frame* frame);
+  ReadResult ReadFrame(Frame* dest);
+  // read() one frame, straight into the destination if no conversion is needed
+  ReadResult ReadFrameDirect(Frame* dest);
+  bool CanReadInPlace(const Frame& dest) const;
   bool ProcessImage(std::array<void*, VIDEO_MAX_PLANES> mplane_data,
                     std::array<unsigned int, VIDEO_MAX_PLANES> mplane_size,
-                    CameraImagePtr dest);
+                    Frame* dest);
+  // convert a luma plane and an interleaved chroma plane directly
+  bool ProcessSemiPlanarImage(std::array<void*, VIDEO_MAX_PLANES> mplane_data,
+                              Frame* dest);
+  // crop with VIDIOC_S_SELECTION, falls back to a software crop
+  bool ApplyRoi(cv4l_fmt* fmt);
+  bool SetSoftwareRoi(StreamRoi roi);
+  static bool IsSemiPlanar(unsigned int pixel_format);
 
  private:
-  StreamOptions options_;
   MjpegDecoder mjpeg_decoder_;
+  V4l2Controls controls_;
+  V4l2FormatNegotiator negotiator_;
 
   cv4l_fd fd_;
   cv4l_queue* buffers_;
   unsigned int n_buffers_;
+  unsigned int num_planes_;
   unsigned int pixel_format_;
+  // candidates of the mode negotiation, the requested format first
+  std::vector<uint32_t> pixel_formats_;
+  // stride of every plane in bytes
+  std::array<unsigned int, VIDEO_MAX_PLANES> bytesperline_;
+  // frame size negotiated with the driver, the requested one may differ
+  unsigned int width_;
+  unsigned int height_;
+  // region of interest cropped in software, empty if the device crops
+  StreamRoi sw_roi_;
+  // full frame of decoded MJPEG, used when it cannot be decoded in place
+  std::vector<char> decode_buffer_;
 
-  bool is_capturing_;
+  // read() i/o: a FIFO or regular file may replace the device for testing
+  int file_fd_;
+  bool file_input_;
+  size_t frame_size_;
+  std::vector<char> read_buffer_;
+  uint32_t read_sequence_;
+  int file_loops_;
+
+  std::atomic<bool> is_capturing_;
   bool monochrome_;
+  bool mjpeg_decoder_ready_;
+  // frame size the mjpeg decoder was set up for
+  unsigned int decoder_width_;
+  unsigned int decoder_height_;
+
+  int64_t last_sequence_;
+  FrameStatistics statistics_;
+
+  // guards the device against the supervisor reopening it
+  std::mutex device_mutex_;
+  DeviceSupervisor supervisor_;
+  StreamStateCallback state_callback_;
 };
 
 }  // namespace stream
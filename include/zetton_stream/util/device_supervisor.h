@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "zetton_stream/base/stream_options.h"
+
+namespace zetton {
+namespace stream {
+
+using StreamStateCallback = std::function<void(StreamState state)>;
+
+// background supervisor that reopens a lost device off the capture path. it
+// retries with exponential backoff and wakes up early when the device node is
+// (re)created, watched through inotify on the parent directory of the node.
+class DeviceSupervisor {
+ public:
+  // reopens the device and restarts streaming, returns true on success
+  using ReopenFunc = std::function<bool()>;
+
+  DeviceSupervisor() = default;
+  ~DeviceSupervisor();
+
+ public:
+  // start supervising, the device is considered lost until the first
+  // successful reopen. the state callback is invoked from the supervisor
+  // thread and from the caller of NotifyLost()
+  bool Start(const std::string& device, ReopenFunc reopen,
+             StreamStateCallback callback = nullptr);
+  void Stop();
+
+  // mark the device as lost and schedule a reopen, never blocks
+  void NotifyLost();
+
+  inline bool IsRunning() const { return thread_.joinable(); }
+  inline StreamState GetState() const { return state_; }
+
+  // backoff between two reopen attempts, doubled after every failure
+  inline void SetBackoff(int min_ms, int max_ms) {
+    min_backoff_ms_ = min_ms;
+    max_backoff_ms_ = max_ms;
+  }
+
+ private:
+  void Run();
+  void SetState(StreamState state);
+  // wait until the timeout expires, the device node shows up or the
+  // supervisor is stopped. returns true if the device node changed
+  bool WaitForDeviceEvent(int timeout_ms);
+
+ private:
+  std::string device_;
+  std::string device_name_;
+  ReopenFunc reopen_;
+  StreamStateCallback callback_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_ = false;
+  std::atomic<StreamState> state_{StreamState::STATE_CLOSED};
+
+  int inotify_fd_ = -1;
+  int wake_fd_ = -1;
+  int min_backoff_ms_ = 100;
+  int max_backoff_ms_ = 5000;
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/util/frame_preprocessor.h"
+
+namespace zetton {
+namespace stream {
+
+struct BatchOptions {
+  // tensors per batch
+  int batch_size = 1;
+  // slot i of every batch belongs to source i, so batch_size is the number of
+  // sources. otherwise slots are filled in arrival order, e.g. with
+  // consecutive frames of one source
+  bool per_source = false;
+  // a batch is handed out at most this long after its first frame arrived,
+  // even if it is not full. 0 waits for full batches
+  int max_latency_ms = 0;
+  // preallocated batches, one is filled while the others are in use
+  int num_buffers = 2;
+};
+
+struct BatchEntry {
+  // false for slots that received no frame
+  bool valid = false;
+  int source = -1;
+  uint64_t timestamp_ns = 0;
+  uint32_t sequence = 0;
+  PreprocessTransform transform;
+};
+
+// batch_size tensors back to back, i.e. one NCHW tensor with N = batch_size
+struct FrameBatch {
+  uint8_t* data = nullptr;
+  size_t tensor_size = 0;
+  int batch_size = 0;
+  // valid entries
+  int num_frames = 0;
+  // handed out before it was full, by the latency deadline, a flush or a
+  // source that was a frame ahead of the others
+  bool expired = false;
+  std::vector<BatchEntry> entries;
+
+  inline uint8_t* GetTensor(int index) const {
+    return data + tensor_size * index;
+  }
+  inline size_t GetSize() const { return tensor_size * batch_size; }
+};
+
+using FrameBatchPtr = std::shared_ptr<FrameBatch>;
+
+struct BatchStatistics {
+  uint64_t frames_added = 0;
+  // frames that could not be preprocessed
+  uint64_t frames_failed = 0;
+  uint64_t batches_full = 0;
+  uint64_t batches_expired = 0;
+  // ready batches recycled because the consumer fell behind
+  uint64_t batches_dropped = 0;
+};
+
+// assembles frames of one or more sources into preallocated batch buffers.
+// every frame is preprocessed straight into its slot of the batch, and
+// batches are handed out when full or when their deadline expires. if the
+// consumer falls behind, the oldest batch that was not handed out yet is
+// recycled, so producers never block. batches go back to the batcher when
+// the last reference is released
+class FrameBatcher : public std::enable_shared_from_this<FrameBatcher> {
+ public:
+  static std::shared_ptr<FrameBatcher> Create(
+      const BatchOptions& options, const PreprocessOptions& preprocess);
+  ~FrameBatcher();
+
+  FrameBatcher(const FrameBatcher&) = delete;
+  FrameBatcher& operator=(const FrameBatcher&) = delete;
+
+ public:
+  // preprocess a frame into the open batch, may be called from several
+  // threads. returns false if the frame was not added
+  bool Add(const Frame& frame, int source = 0);
+  inline bool Add(const FramePtr& frame, int source = 0) {
+    return frame && Add(*frame, source);
+  }
+
+  // wait up to timeout_ms (negative waits forever) for the next batch.
+  // returns nullptr on timeout or after Stop()
+  FrameBatchPtr Wait(int timeout_ms = -1);
+  // hand out the open batch now, even if it is not full
+  void Flush();
+  // wake up all waiters, no batches are handed out afterwards
+  void Stop();
+
+  BatchStatistics GetStatistics();
+  inline const BatchOptions& GetOptions() const { return options_; }
+  inline size_t GetTensorSize() const {
+    return preprocessor_.GetTensorSize();
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // a batch and its bookkeeping while it is being filled
+  struct Buffer {
+    FrameBatch batch;
+    std::shared_ptr<void> memory;
+    Clock::time_point open_time;
+    // slots handed to writers, and writers still preprocessing
+    int reserved = 0;
+    int writers = 0;
+    bool closed = false;
+  };
+
+  FrameBatcher() = default;
+  bool Init(const BatchOptions& options, const PreprocessOptions& preprocess);
+  // all with mutex_ held
+  Buffer* OpenBuffer();
+  void CloseBuffer(Buffer* buffer, bool expired);
+  void FinishBuffer(Buffer* buffer);
+  void Recycle(Buffer* buffer);
+
+ private:
+  BatchOptions options_;
+  FramePreprocessor preprocessor_;
+
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  // reserved to num_buffers, so that handing out batches never allocates
+  std::vector<Buffer*> free_buffers_;
+  std::deque<Buffer*> ready_buffers_;
+  Buffer* open_buffer_ = nullptr;
+  BatchStatistics statistics_;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+using FrameBatcherPtr = std::shared_ptr<FrameBatcher>;
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+
+namespace zetton {
+namespace stream {
+
+enum class TensorDataType {
+  DATA_TYPE_FLOAT32 = 0,
+  DATA_TYPE_FLOAT16,
+  DATA_TYPE_INT8,
+  DATA_TYPE_MAX_NUM,
+};
+const char* TensorDataTypeToStr(TensorDataType type);
+TensorDataType TensorDataTypeFromStr(const char* str);
+// bytes per element
+size_t GetTensorElementSize(TensorDataType type);
+
+struct PreprocessOptions {
+  // size of the tensor, every frame is resized (bilinear) to fit
+  int width = 0;
+  int height = 0;
+  // keep the aspect ratio and pad the borders with pad_value, otherwise the
+  // frame is stretched to the tensor size
+  bool letterbox = true;
+  std::array<uint8_t, 3> pad_value = {114, 114, 114};
+  // order of the channel planes of the tensor
+  bool bgr = false;
+  // value = (pixel - mean) / std per channel, in the channel order of the
+  // tensor. the defaults map pixels to [0, 1]
+  std::array<float, 3> mean = {0.0f, 0.0f, 0.0f};
+  std::array<float, 3> std = {255.0f, 255.0f, 255.0f};
+  TensorDataType data_type = TensorDataType::DATA_TYPE_FLOAT32;
+  // int8 tensors store round(value / quant_scale) + quant_zero_point
+  float quant_scale = 1.0f / 127.0f;
+  int quant_zero_point = 0;
+  // threads working on one frame including the caller, 0 uses all cores
+  int num_threads = 0;
+};
+
+// placement of the frame in the tensor, to map results back to the frame
+struct PreprocessTransform {
+  float scale_x = 1.0f;
+  float scale_y = 1.0f;
+  int offset_x = 0;
+  int offset_y = 0;
+  // size of the resized frame inside the tensor
+  int width = 0;
+  int height = 0;
+
+  inline float ToSourceX(float x) const { return (x - offset_x) / scale_x; }
+  inline float ToSourceY(float y) const { return (y - offset_y) / scale_y; }
+};
+
+// fused conversion of a frame into a normalized planar (NCHW, N = 1, C = 3)
+// tensor: color conversion, bilinear resize, letterbox, normalization and
+// type conversion happen in a single pass over the tensor rows. only the
+// source rows that are sampled are converted, one row at a time, and the
+// rows of the tensor are split between a set of persistent threads.
+// supported inputs are YUYV, UYVY, NV12, NV16, RGB, BGR and GRAY8 frames
+class FramePreprocessor {
+ public:
+  FramePreprocessor() = default;
+  ~FramePreprocessor();
+
+  FramePreprocessor(const FramePreprocessor&) = delete;
+  FramePreprocessor& operator=(const FramePreprocessor&) = delete;
+
+ public:
+  bool Init(const PreprocessOptions& options);
+
+  // write the tensor of frame to dst, which must hold GetTensorSize() bytes.
+  // calls are serialized, the worker threads are shared
+  bool Process(const Frame& frame, void* dst,
+               PreprocessTransform* transform = nullptr);
+
+  inline const PreprocessOptions& GetOptions() const { return options_; }
+  inline int GetNumThreads() const { return static_cast<int>(bands_.size()); }
+  // bytes of one tensor
+  inline size_t GetTensorSize() const {
+    return static_cast<size_t>(options_.width) * options_.height * 3 *
+           GetTensorElementSize(options_.data_type);
+  }
+  static bool IsSupported(StreamPixelFormat format);
+
+ private:
+  // tensor rows handled by one thread and its scratch rows
+  struct Band {
+    int row_begin = 0;
+    int row_end = 0;
+    // one source row converted to rgb
+    std::vector<uint8_t> rgb_row;
+    // two horizontally resampled source rows, 3 channel planes each
+    std::array<std::vector<float>, 2> rows;
+    std::array<int, 2> source_rows = {{-1, -1}};
+    // normalized values of one channel before type conversion
+    std::vector<float> values;
+  };
+
+  void Shutdown();
+  void WorkerLoop(size_t band);
+  // recompute the sampling tables when the source size changes
+  void Configure(StreamPixelFormat format, int width, int height);
+  void ProcessBand(Band* band);
+  const uint8_t* ConvertRow(const Frame& frame, int row, Band* band) const;
+  void ResampleRow(const uint8_t* rgb, float* dst) const;
+  void LoadRows(const Frame& frame, int row0, int row1, Band* band) const;
+  void FillPadding(uint8_t* dst, int plane, int count) const;
+  void StoreValues(const float* values, uint8_t* dst, int count) const;
+
+ private:
+  PreprocessOptions options_;
+  size_t element_size_ = 4;
+  // per tensor plane
+  std::array<float, 3> scale_ = {{1.0f, 1.0f, 1.0f}};
+  std::array<float, 3> bias_ = {{0.0f, 0.0f, 0.0f}};
+  std::array<std::array<uint8_t, 4>, 3> pad_ = {};
+  // tensor plane of every channel of a converted source row
+  std::array<int, 3> channel_plane_ = {{0, 1, 2}};
+
+  // sampling tables of the current source size
+  StreamPixelFormat source_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  int source_width_ = 0;
+  int source_height_ = 0;
+  PreprocessTransform transform_;
+  // byte offsets of the left and right neighbours in an rgb row
+  std::vector<int32_t> x_offset0_;
+  std::vector<int32_t> x_offset1_;
+  std::vector<float> x_weight_;
+  // leading columns whose neighbours can be gathered as 32-bit words
+  int gather_end_ = 0;
+  std::vector<int> y_row0_;
+  std::vector<int> y_row1_;
+  std::vector<float> y_weight_;
+
+  std::vector<Band> bands_;
+  std::vector<std::thread> workers_;
+  std::mutex process_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  uint64_t generation_ = 0;
+  size_t pending_ = 0;
+  bool stop_ = false;
+  // job of the current generation
+  const Frame* frame_ = nullptr;
+  uint8_t* dst_ = nullptr;
+};
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "zetton_stream/base/frame.h"
+
+namespace zetton {
+namespace stream {
+
+// upper bounds (in milliseconds) of the inter-frame jitter histogram bins,
+// the last bin collects everything above the last bound
+constexpr std::array<double, 7> kJitterHistogramBounds = {1.0,  2.0,  5.0, 10.0,
+                                                          20.0, 50.0, 100.0};
+constexpr size_t kJitterHistogramBins = kJitterHistogramBounds.size() + 1;
+
+struct FrameStatisticsSnapshot {
+  // frames dequeued from the driver
+  uint64_t frames_received = 0;
+  // frames handed out to the user
+  uint64_t frames_delivered = 0;
+  // frames dropped by software frame-rate decimation
+  uint64_t frames_decimated = 0;
+  // frames dropped by the driver (sum of sequence gaps)
+  uint64_t frames_dropped = 0;
+  // number of sequence gaps reported by the driver
+  uint64_t sequence_gaps = 0;
+  // frames flagged with V4L2_BUF_FLAG_ERROR
+  uint64_t error_frames = 0;
+  // inter-frame intervals above the warning interval
+  uint64_t timestamp_jumps = 0;
+  // frames whose camera timestamp is too far from the system clock
+  uint64_t clock_offset_exceptions = 0;
+
+  // inter-frame interval statistics in milliseconds
+  double last_interval_ms = 0.0;
+  double mean_interval_ms = 0.0;
+  double min_interval_ms = 0.0;
+  double max_interval_ms = 0.0;
+  // standard deviation of the inter-frame interval in milliseconds
+  double jitter_ms = 0.0;
+  // histogram of |interval - expected interval|
+  std::array<uint64_t, kJitterHistogramBins> jitter_histogram{};
+
+  // system clock minus camera timestamp in milliseconds
+  double clock_offset_ms = 0.0;
+  double max_clock_offset_ms = 0.0;
+};
+
+// always-on capture statistics of a stream source: inter-frame jitter, driver
+// sequence gaps, camera vs system clock offset and software frame-rate
+// decimation. all state is fixed-size, so updating and querying never
+// allocates.
+class FrameStatistics {
+ public:
+  // reset all counters for a stream with the given frame rate (0 disables the
+  // rate-based checks), name is used in log messages
+  void Init(float frame_rate, const std::string& name = "");
+  // reset all counters and keep the configuration
+  void Reset();
+
+  // account a captured frame, returns false if the frame should be dropped by
+  // decimation
+  bool Update(const Frame& frame);
+  bool Update(const CameraImage& image);
+
+  // copy of the current statistics, safe to call from any thread
+  FrameStatisticsSnapshot GetSnapshot() const;
+
+ private:
+  void ResetLocked();
+  // whether a warning of the given kind may be logged now (at most once per
+  // second for each kind)
+  bool ShouldWarn(uint64_t* last_warn_ns, uint64_t now_ns) const;
+
+ private:
+  mutable std::mutex mutex_;
+  FrameStatisticsSnapshot stats_;
+  std::string name_;
+
+  // expected interval between two frames in nanoseconds
+  uint64_t expected_interval_ns_ = 0;
+  // warning when the interval exceeds 1.5x the expected interval
+  uint64_t warning_interval_ns_ = 0;
+  // drop frames arriving faster than 0.9x the expected interval
+  uint64_t drop_interval_ns_ = 0;
+  // maximum accepted offset between system clock and camera timestamps
+  int64_t max_clock_offset_ns_ = 500000000;
+
+  uint64_t last_timestamp_ns_ = 0;
+  uint64_t last_delivered_ns_ = 0;
+  double interval_sum_ms_ = 0.0;
+  double interval_sq_sum_ms_ = 0.0;
+  uint64_t num_intervals_ = 0;
+
+  uint64_t last_jump_warn_ns_ = 0;
+  uint64_t last_gap_warn_ns_ = 0;
+  uint64_t last_clock_warn_ns_ = 0;
+};
+
+}  // namespace stream
+}  // namespace zetton
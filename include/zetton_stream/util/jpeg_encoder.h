@@ -0,0 +1,61 @@
+#pragma once
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwsContext;
+
+namespace zetton {
+namespace stream {
+
+struct JpegOptions {
+  // 1 (smallest) to 100 (best)
+  int quality = 80;
+  // size of the JPEG, 0 keeps the frame size. if only one is set the other
+  // follows the aspect ratio of the frame
+  int width = 0;
+  int height = 0;
+};
+
+// encodes frames to baseline JPEG with the MJPEG encoder of libavcodec. YUV
+// frames (YUYV, UYVY, NV12, NV16) and gray frames are resampled to planar
+// 4:2:0 by swscale, downscaled in the same pass, without going through RGB.
+// not thread-safe, use one encoder per thread
+class JpegEncoder {
+ public:
+  JpegEncoder() = default;
+  ~JpegEncoder();
+
+  JpegEncoder(const JpegEncoder&) = delete;
+  JpegEncoder& operator=(const JpegEncoder&) = delete;
+
+ public:
+  bool Init(const JpegOptions& options);
+  // encode a frame to an MJPEG frame holding the packet of its payload, which
+  // carries the metadata of the source frame. nullptr on failure
+  FramePtr Encode(const Frame& frame);
+
+  static bool IsSupported(StreamPixelFormat format);
+  inline const JpegOptions& GetOptions() const { return options_; }
+
+ private:
+  // (re)open the codec for frames of a layout
+  bool Configure(const Frame& frame);
+  void Release();
+
+ private:
+  JpegOptions options_;
+  AVCodecContext* context_ = nullptr;
+  AVFrame* picture_ = nullptr;
+  SwsContext* sws_ = nullptr;
+
+  // layout the codec is configured for
+  StreamPixelFormat source_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  int source_width_ = 0;
+  int source_height_ = 0;
+};
+
+}  // namespace stream
+}  // namespace zetton
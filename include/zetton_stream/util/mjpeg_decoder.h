@@ -24,6 +24,9 @@ class MjpegDecoder {
   bool Init(int image_width, int image_height);
   bool ToRGB(char* mjpeg_buffer, int len, char* rgb_buffer, int NumPixels);
 
+ private:
+  void Release();
+
  private:
   AVFrame* avframe_camera_;
   AVFrame* avframe_rgb_;
@@ -2,6 +2,7 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "zetton_stream/base/frame.h"
 #include "zetton_stream/base/stream_options.h"
 
 namespace zetton {
@@ -9,5 +10,23 @@ namespace stream {
 
 bool CheckFrame(const cv::Mat& frame, const StreamOptions& options);
 
-}
+// OpenCV type of the first plane of a pixel format, -1 if there is none
+int GetMatType(StreamPixelFormat format);
+
+// zero-copy views of captured frames. the views share the memory of the frame
+// and keep it alive through their allocator, so they stay valid after the
+// frame is released by its consumer. memory allocated by OpenCV when a view
+// is resized or retyped is not part of the frame anymore.
+//
+// whole frame: packed formats as one matrix of their pixel type, semi-planar
+// formats as one single-channel matrix of all planes (as expected by
+// cv::COLOR_YUV2RGB_NV12), compressed formats as one row of bytes_used bytes
+cv::Mat ToMat(const FramePtr& frame);
+// one plane of the frame, e.g. the interleaved chroma of NV12 as CV_8UC2
+cv::Mat ToMat(const FramePtr& frame, int plane);
+cv::Mat ToMat(const CameraImagePtr& image);
+cv::UMat ToUMat(const FramePtr& frame,
+                cv::AccessFlag access_flags = cv::ACCESS_RW);
+
+}  // namespace stream
 }  // namespace zetton
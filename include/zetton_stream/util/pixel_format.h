@@ -21,9 +21,57 @@ int convert_yuv_to_rgb_pixel(int y, int u, int v);
 int convert_yuv_to_rgb_buffer(unsigned char *yuv, unsigned char *rgb,
                               unsigned int width, unsigned int height);
 
+// semi-planar yuv (a luma plane followed by an interleaved chroma plane) to
+// packed rgb. planes may live in separate buffers and every plane has its own
+// stride in bytes. nv12 has one chroma row per two luma rows, nv16 one per row
+void nv12_to_rgb(const unsigned char *y, unsigned int y_stride,
+                 const unsigned char *uv, unsigned int uv_stride,
+                 unsigned char *rgb, unsigned int rgb_stride,
+                 unsigned int width, unsigned int height);
+void nv16_to_rgb(const unsigned char *y, unsigned int y_stride,
+                 const unsigned char *uv, unsigned int uv_stride,
+                 unsigned char *rgb, unsigned int rgb_stride,
+                 unsigned int width, unsigned int height);
+
+// row-wise conversions between images with padded rows, strides are in bytes
+// and may differ between source and destination
+void yuyv_to_rgb(const unsigned char *src, unsigned int src_stride,
+                 unsigned char *dst, unsigned int dst_stride,
+                 unsigned int width, unsigned int height);
+void uyvy_to_rgb(const unsigned char *src, unsigned int src_stride,
+                 unsigned char *dst, unsigned int dst_stride,
+                 unsigned int width, unsigned int height);
+void uyvy_to_yuyv(const unsigned char *src, unsigned int src_stride,
+                  unsigned char *dst, unsigned int dst_stride,
+                  unsigned int width, unsigned int height);
+void mono10_to_mono8(const unsigned char *src, unsigned int src_stride,
+                     unsigned char *dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height);
+void copy_rows(const unsigned char *src, unsigned int src_stride,
+               unsigned char *dst, unsigned int dst_stride,
+               unsigned int row_bytes, unsigned int height);
+
 #ifdef WITH_AVX
 #define SIMD_INLINE inline __attribute__((always_inline))
 void yuyv2rgb_avx(unsigned char *YUV, unsigned char *RGB, int NumPixels);
+void nv12_to_rgb_avx(const unsigned char *y, unsigned int y_stride,
+                     const unsigned char *uv, unsigned int uv_stride,
+                     unsigned char *rgb, unsigned int rgb_stride,
+                     unsigned int width, unsigned int height);
+void nv16_to_rgb_avx(const unsigned char *y, unsigned int y_stride,
+                     const unsigned char *uv, unsigned int uv_stride,
+                     unsigned char *rgb, unsigned int rgb_stride,
+                     unsigned int width, unsigned int height);
+// aligned loads and stores are used for every row that allows them
+void yuyv_to_rgb_avx(const unsigned char *src, unsigned int src_stride,
+                     unsigned char *dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height);
+void uyvy_to_rgb_avx(const unsigned char *src, unsigned int src_stride,
+                     unsigned char *dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height);
+void uyvy_to_yuyv_avx(const unsigned char *src, unsigned int src_stride,
+                      unsigned char *dst, unsigned int dst_stride,
+                      unsigned int width, unsigned int height);
 void print_m256(const __m256i a);
 void print_m256_i32(const __m256i a);
 void print_m256_i16(const __m256i a);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/frame_pool.h"
+#include "zetton_stream/base/stream_options.h"
+
+namespace zetton {
+namespace stream {
+
+constexpr size_t kRtpHeaderSize = 12;
+// rtp header and the largest payload header, quantization tables aside
+constexpr size_t kRtpMaxHeaderSize = 40;
+// pieces of frame memory a packet carries
+constexpr int kRtpMaxPayloads = 4;
+constexpr uint32_t kRtpVideoClockRate = 90000;
+// static payload type of JPEG, and the dynamic one used for raw video
+constexpr uint8_t kRtpJpegPayloadType = 26;
+constexpr uint8_t kRtpRawPayloadType = 96;
+
+// a packet of a frame, its headers followed by pieces of the frame
+struct RtpPacket {
+  uint8_t header[kRtpMaxHeaderSize];
+  size_t header_size = 0;
+  const uint8_t* payload[kRtpMaxPayloads];
+  size_t payload_size[kRtpMaxPayloads];
+  int num_payloads = 0;
+
+  size_t GetSize() const;
+};
+
+// splits frames into RTP packets, JPEG (RFC 2435) for MJPEG frames and
+// uncompressed video (RFC 4175) for UYVY, YUYV, RGB and BGR frames. packets
+// point into the frame instead of copying it, except for YUYV frames which
+// are reordered to the UYVY byte order of RFC 4175 first.
+// JPEGs must be baseline 4:2:2 or 4:2:0 with the standard Huffman tables and
+// at most 2040x2040, which RFC 2435 cannot describe otherwise
+class RtpPacketizer {
+ public:
+  bool Init(uint32_t ssrc, size_t max_packet_size);
+
+  // packets of a frame at an rtp timestamp, valid until the next call and
+  // as long as the frame
+  bool Packetize(const Frame& frame, uint32_t timestamp,
+                 std::vector<RtpPacket>* packets);
+
+  static bool IsSupported(StreamPixelFormat format);
+
+ private:
+  bool PacketizeJpeg(const Frame& frame, uint32_t timestamp,
+                     std::vector<RtpPacket>* packets);
+  bool PacketizeRaw(const Frame& frame, uint32_t timestamp,
+                    std::vector<RtpPacket>* packets);
+  uint8_t* AddPacket(std::vector<RtpPacket>* packets, size_t* num_packets,
+                     uint8_t payload_type, uint32_t timestamp);
+
+ private:
+  uint32_t ssrc_ = 0;
+  size_t max_packet_size_ = 1400;
+  // rtp sequence number, the upper half is the extended sequence number of
+  // RFC 4175
+  uint32_t sequence_ = 0;
+  // quantization tables of the last JPEG
+  uint8_t tables_[256];
+  // YUYV frames reordered to UYVY
+  std::vector<uint8_t> scratch_;
+};
+
+// reassembles the frames of an RtpPacketizer into frames of a pool. packets
+// must arrive in order, a frame missing a packet is dropped. so are JPEG
+// frames of less than 512 pixels, which have no room for their headers
+class RtpDepacketizer {
+ public:
+  // raw frames have the layout of the sender, given here. JPEG frames take
+  // it from the packets
+  bool Init(StreamPixelFormat format, int width, int height, int num_frames);
+
+  // add a packet, returns the frame it completes
+  FramePtr Push(const uint8_t* packet, size_t size);
+
+  inline uint64_t GetNumLost() const { return packets_lost_; }
+  inline uint64_t GetNumDropped() const { return frames_dropped_; }
+
+ private:
+  bool PushJpeg(const uint8_t* payload, size_t size, bool first);
+  bool PushRaw(const uint8_t* payload, size_t size, bool first);
+  // a pool frame for the next frame
+  bool StartFrame(StreamPixelFormat format, int width, int height);
+  void DropFrame();
+  // bytes of a complete raw frame
+  size_t GetRawSize() const;
+
+ private:
+  StreamPixelFormat format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  int width_ = 0;
+  int height_ = 0;
+  int num_frames_ = 0;
+  FramePoolPtr pool_;
+
+  // frame being assembled
+  FramePtr frame_;
+  bool broken_ = false;
+  uint32_t timestamp_ = 0;
+  int32_t expected_sequence_ = -1;
+  size_t header_size_ = 0;
+  size_t received_ = 0;
+  uint32_t num_frames_received_ = 0;
+
+  uint64_t packets_lost_ = 0;
+  uint64_t frames_dropped_ = 0;
+};
+
+}  // namespace stream
+}  // namespace zetton
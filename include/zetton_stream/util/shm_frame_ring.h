@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "zetton_stream/base/frame.h"
+
+namespace zetton {
+namespace stream {
+
+// readers attached to one ring at the same time
+constexpr int kShmMaxReaders = 32;
+// slots of one ring
+constexpr int kShmMaxSlots = 64;
+
+// frame description stored next to the data of a slot, plane offsets are
+// relative to the start of the slot data
+struct ShmFrameInfo {
+  int32_t pixel_format = 0;
+  int32_t width = 0;
+  int32_t height = 0;
+  int32_t num_planes = 0;
+  uint64_t plane_offset[kMaxFramePlanes] = {};
+  uint64_t plane_size[kMaxFramePlanes] = {};
+  int32_t plane_stride[kMaxFramePlanes] = {};
+  uint64_t timestamp_ns = 0;
+  uint64_t system_timestamp_ns = 0;
+  uint32_t sequence = 0;
+  uint32_t dropped_frames = 0;
+  uint32_t flags = 0;
+  uint32_t bytes_used = 0;
+};
+
+// describe a frame laid out in a slot, and map a slot back to a frame
+void GetShmFrameInfo(const Frame& frame, const uint8_t* slot_data,
+                     ShmFrameInfo* info);
+bool SetShmFrameInfo(const ShmFrameInfo& info, uint8_t* slot_data,
+                     size_t slot_size, Frame* frame);
+
+// ring of frame slots in POSIX shared memory, written by one process and
+// read zero-copy by up to kShmMaxReaders others. no locks are shared:
+//  - every slot has a mask with one bit per reader holding it and one bit for
+//    the writer. the writer only claims slots without readers, readers only
+//    keep slots the writer is not writing
+//  - frames are numbered from 1 on, the number of the latest frame and its
+//    slot are published in one atomic word
+//  - readers sleep on a futex in the shared memory, the writer only wakes it
+//    when someone is waiting
+//  - the pid of every reader and of the writer is registered, so that the
+//    slots held by a process that died are reclaimed by the others
+class ShmFrameRing {
+ public:
+  // create the ring for writing, or take over the ring of a writer that died
+  // if it has the same layout
+  static std::shared_ptr<ShmFrameRing> Create(const std::string& name,
+                                              int num_slots, size_t slot_size);
+  // attach to the ring of a running writer as a reader
+  static std::shared_ptr<ShmFrameRing> Open(const std::string& name);
+  ~ShmFrameRing();
+
+  ShmFrameRing(const ShmFrameRing&) = delete;
+  ShmFrameRing& operator=(const ShmFrameRing&) = delete;
+
+ public:
+  // writer: claim the slot with the oldest frame that no reader holds,
+  // returns -1 if all slots are held
+  int ClaimSlot();
+  // writer: publish the frame written to a claimed slot
+  void Publish(int slot, const ShmFrameInfo& info);
+  // writer: give a claimed slot back without publishing
+  void Abort(int slot);
+
+  // reader: hold the slot of a frame newer than after, the next one if it is
+  // still in the ring and next is set, the latest one otherwise. returns -1
+  // if there is no newer frame
+  int Acquire(uint64_t after, bool next, uint64_t* number, ShmFrameInfo* info);
+  // reader: let the writer reuse a held slot
+  void Release(int slot);
+  // reader: wait up to timeout_ms, forever if negative, for a frame newer
+  // than after. returns false on timeout or if the writer is gone
+  bool Wait(uint64_t after, int timeout_ms);
+
+  // number of the latest published frame, 0 if none
+  uint64_t GetLatestNumber() const;
+  // the writer closed the ring or died
+  bool IsWriterGone() const;
+  // free the slots and reader entries of processes that died
+  int ReclaimDeadReaders();
+
+  inline uint8_t* GetSlotData(int slot) const {
+    return data_ + slot_stride_ * slot;
+  }
+  inline size_t GetSlotSize() const { return slot_size_; }
+  inline int GetNumSlots() const { return num_slots_; }
+  inline bool IsWriter() const { return writer_; }
+  inline const std::string& GetName() const { return name_; }
+
+ private:
+  struct Header;
+  struct Slot;
+
+  ShmFrameRing() = default;
+  bool Map(int fd, size_t size);
+  // slot pointers from the layout in the mapped header
+  void SetLayout();
+  void Unmap();
+  bool Register();
+  void Unregister();
+  void WakeReaders();
+
+ private:
+  std::string name_;
+  bool writer_ = false;
+  void* memory_ = nullptr;
+  size_t memory_size_ = 0;
+  Header* header_ = nullptr;
+  Slot* slots_ = nullptr;
+  uint8_t* data_ = nullptr;
+  int num_slots_ = 0;
+  size_t slot_size_ = 0;
+  size_t slot_stride_ = 0;
+  // reader entry and its bit in the slot masks
+  int reader_index_ = -1;
+};
+
+using ShmFrameRingPtr = std::shared_ptr<ShmFrameRing>;
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/stream_options.h"
+
+namespace zetton {
+namespace stream {
+
+class BaseStreamSink;
+
+// how a sink hands frames to one of its outputs
+struct SinkOutputOptions {
+  // render on a worker thread of the output instead of the producer thread
+  bool async = false;
+  // frames waiting for the worker
+  int queue_size = 4;
+  StreamBackpressure backpressure = StreamBackpressure::BACKPRESSURE_BLOCK;
+};
+
+struct SinkOutputStatistics {
+  uint64_t frames_queued = 0;
+  uint64_t frames_rendered = 0;
+  // frames the output failed to render
+  uint64_t frames_failed = 0;
+  // frames dropped by the backpressure policy
+  uint64_t frames_dropped = 0;
+  // deepest the queue has been
+  int max_queue_depth = 0;
+};
+
+// bounded queue of frames rendered to one sink by a worker thread, so that a
+// slow output does not stall the producer nor the other outputs. frames are
+// shared, not copied, so they must not be written while queued
+class SinkOutputQueue {
+ public:
+  SinkOutputQueue() = default;
+  ~SinkOutputQueue();
+
+  SinkOutputQueue(const SinkOutputQueue&) = delete;
+  SinkOutputQueue& operator=(const SinkOutputQueue&) = delete;
+
+ public:
+  bool Start(BaseStreamSink* output, const SinkOutputOptions& options);
+  // render the frames still queued, then join the worker
+  void Stop();
+
+  // queue a frame following the backpressure policy. returns false if it was
+  // dropped or the queue is stopped
+  bool Push(const FramePtr& frame);
+  // wait until every queued frame is rendered
+  void Flush();
+
+  SinkOutputStatistics GetStatistics();
+  inline BaseStreamSink* GetOutput() const { return output_; }
+
+ private:
+  void Run();
+
+ private:
+  BaseStreamSink* output_ = nullptr;
+  SinkOutputOptions options_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  // signals queued frames and room in the queue
+  std::condition_variable cond_;
+  std::condition_variable room_cond_;
+  std::deque<FramePtr> queue_;
+  // the worker is rendering a frame taken off the queue
+  bool rendering_ = false;
+  bool running_ = false;
+  bool stop_ = false;
+  SinkOutputStatistics statistics_;
+};
+
+}  // namespace stream
+}  // namespace zetton
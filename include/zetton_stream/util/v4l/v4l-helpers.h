@@ -1451,7 +1451,11 @@ static inline int v4l_queue_mmap_bufs(struct v4l_fd *f, struct v4l_queue *q,
         m = mmap(NULL, v4l_queue_g_length(q, p), PROT_READ | PROT_WRITE,
                  MAP_SHARED, v4l_queue_g_fd(q, b, p), 0);
 
-      if (m == MAP_FAILED) return errno;
+      if (m == MAP_FAILED) {
+        /* count what is mapped so far, so that munmap_bufs frees it */
+        q->mappings = b + 1;
+        return errno;
+      }
       v4l_queue_s_mmapping(q, b, p, m);
     }
   }
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <sys/time.h>
+
+#include <cstdint>
+#include <ctime>
+
 #include "zetton_common/log/log.h"
+#include "zetton_stream/base/frame.h"
 #include "zetton_stream/util/v4l/cv4l-helpers.h"
 #include "zetton_stream/util/v4l/v4l-helpers.h"
 
@@ -25,5 +31,67 @@ static int xioctl(int fd, int request, void* arg) {
   return r;
 }
 
+// convert a V4L2 buffer timestamp to nanoseconds
+inline uint64_t TimevalToNanoseconds(const struct timeval& tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000000ULL +
+         static_cast<uint64_t>(tv.tv_usec) * 1000ULL;
+}
+
+// offset in nanoseconds to add to a CLOCK_MONOTONIC timestamp to express it in
+// CLOCK_REALTIME
+inline int64_t GetMonotonicToRealtimeOffset() {
+  struct timespec mono, real;
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  return (static_cast<int64_t>(real.tv_sec) - mono.tv_sec) * 1000000000LL +
+         (static_cast<int64_t>(real.tv_nsec) - mono.tv_nsec);
+}
+
+// fill the capture metadata of a dequeued V4L2 buffer into a frame or camera
+// image. last_sequence keeps the driver sequence of the previous frame (-1 if
+// there is none yet) and is used to count the frames dropped by the driver.
+template <typename Image>
+inline void FillCaptureMetadata(const struct v4l2_buffer& buf,
+                                uint32_t bytes_used, int64_t* last_sequence,
+                                Image* image) {
+  image->timestamp_ns = TimevalToNanoseconds(buf.timestamp);
+  image->sequence = buf.sequence;
+  image->flags = buf.flags;
+  image->bytes_used = bytes_used;
+
+  // convert the driver timestamp into the system time base
+  if (image->timestamp_ns == 0) {
+    // driver does not provide timestamps, use the dequeue time instead
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    image->system_timestamp_ns =
+        static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+  } else if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+             V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    image->system_timestamp_ns =
+        image->timestamp_ns + GetMonotonicToRealtimeOffset();
+  } else {
+    // unknown or copied timestamps are taken from the system clock
+    image->system_timestamp_ns = image->timestamp_ns;
+  }
+
+  // count frames dropped by the driver from gaps in the sequence number
+  if (*last_sequence >= 0 && buf.sequence > *last_sequence) {
+    image->dropped_frames =
+        static_cast<uint32_t>(buf.sequence - *last_sequence - 1);
+  } else {
+    image->dropped_frames = 0;
+  }
+  *last_sequence = buf.sequence;
+}
+
+inline void FillCaptureMetadata(const struct v4l2_buffer& buf,
+                                uint32_t bytes_used, int64_t* last_sequence,
+                                CameraImage* image) {
+  image->tv_sec = static_cast<int>(buf.timestamp.tv_sec);
+  image->tv_usec = static_cast<int>(buf.timestamp.tv_usec);
+  FillCaptureMetadata<CameraImage>(buf, bytes_used, last_sequence, image);
+}
+
 }  // namespace stream
 }  // namespace zetton
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/util/v4l/cv4l-helpers.h"
+
+namespace zetton {
+namespace stream {
+
+struct V4l2ControlInfo {
+  uint32_t id;
+  uint32_t type;
+  uint32_t flags;
+  // control name in v4l2-ctl style, e.g. "white_balance_temperature_auto"
+  std::string name;
+  int64_t minimum;
+  int64_t maximum;
+  uint64_t step;
+  int64_t default_value;
+};
+
+using V4l2ControlValues = std::vector<std::pair<uint32_t, int64_t>>;
+
+// native V4L2 camera controls built on VIDIOC_QUERY_EXT_CTRL and
+// VIDIOC_S_EXT_CTRLS, replacing calls to the external v4l2-ctl binary
+class V4l2Controls {
+ public:
+  // enumerate all controls of the device and cache their ids and ranges
+  bool Enumerate(cv4l_fd* fd);
+  void Clear() { controls_.clear(); }
+
+  const V4l2ControlInfo* Find(uint32_t id) const;
+  const V4l2ControlInfo* Find(const std::string& name) const;
+  inline const std::vector<V4l2ControlInfo>& GetControls() const {
+    return controls_;
+  }
+
+  bool GetControl(cv4l_fd* fd, uint32_t id, int64_t* value) const;
+  bool SetControl(cv4l_fd* fd, uint32_t id, int64_t value) const;
+  // set all given controls with a single VIDIOC_S_EXT_CTRLS call, values are
+  // clamped to the control range and unsupported controls are skipped
+  bool SetControls(cv4l_fd* fd, const V4l2ControlValues& values) const;
+
+  // apply the camera options in one batch
+  bool Apply(cv4l_fd* fd, const CameraSourceOptions& options) const;
+  // translate the camera options into control values
+  static V4l2ControlValues ToControlValues(const CameraSourceOptions& options);
+
+ private:
+  std::vector<V4l2ControlInfo> controls_;
+};
+
+}  // namespace stream
+}  // namespace zetton
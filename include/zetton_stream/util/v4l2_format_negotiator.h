@@ -0,0 +1,64 @@
+#pragma once
+
+#include <linux/videodev2.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "zetton_stream/base/stream_options.h"
+#include "zetton_stream/util/v4l/cv4l-helpers.h"
+
+namespace zetton {
+namespace stream {
+
+// one capture mode of a device: pixel format, frame size and frame interval
+struct V4l2Mode {
+  uint32_t pixel_format = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // zero if the driver does not report frame intervals
+  v4l2_fract interval{0, 0};
+
+  inline float FrameRate() const {
+    return interval.numerator > 0
+               ? static_cast<float>(interval.denominator) / interval.numerator
+               : 0.0f;
+  }
+};
+
+std::string V4l2ModeToStr(const V4l2Mode& mode);
+
+// picks the capture mode of a device through VIDIOC_ENUM_FMT,
+// VIDIOC_ENUM_FRAMESIZES and VIDIOC_ENUM_FRAMEINTERVALS instead of trusting
+// VIDIOC_S_FMT to do the right thing. results are cached per device and
+// request, so that reconnecting does not enumerate again.
+class V4l2FormatNegotiator {
+ public:
+  // enumerate all modes of the device with the given pixel formats, stepwise
+  // and continuous ranges are reduced to the modes closest to the request
+  bool Enumerate(cv4l_fd* fd, const StreamOptions& options,
+                 const std::vector<uint32_t>& pixel_formats);
+  inline const std::vector<V4l2Mode>& GetModes() const { return modes_; }
+
+  // pick the best mode for options.negotiation_goal among the given pixel
+  // formats, the first one being the requested format
+  bool Negotiate(cv4l_fd* fd, const StreamOptions& options,
+                 const std::vector<uint32_t>& pixel_formats, V4l2Mode* mode);
+
+  // drop cached results, e.g. after the device has been replaced
+  static void ClearCache();
+
+ private:
+  bool SelectMode(const StreamOptions& options,
+                  const std::vector<uint32_t>& pixel_formats,
+                  V4l2Mode* mode) const;
+  void AddFrameSize(cv4l_fd* fd, const StreamOptions& options,
+                    uint32_t pixel_format, uint32_t width, uint32_t height);
+
+ private:
+  std::vector<V4l2Mode> modes_;
+};
+
+}  // namespace stream
+}  // namespace zetton
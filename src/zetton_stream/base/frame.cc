@@ -0,0 +1,243 @@
+#include "zetton_stream/base/frame.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace zetton {
+namespace stream {
+
+const char* FrameMemoryToStr(FrameMemory memory) {
+  switch (memory) {
+    case FrameMemory::MEMORY_OWNED:
+      return "owned";
+    case FrameMemory::MEMORY_POOLED:
+      return "pooled";
+    case FrameMemory::MEMORY_BORROWED:
+      return "borrowed";
+    case FrameMemory::MEMORY_DMABUF:
+      return "dmabuf";
+    case FrameMemory::MEMORY_NONE:
+    default:
+      return "none";
+  }
+}
+
+int GetBytesPerPixel(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return 1;
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY16_LE:
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+    case StreamPixelFormat::PIXEL_FORMAT_YUVMONO10:
+      return 2;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      return 3;
+    case StreamPixelFormat::PIXEL_FORMAT_RGBA:
+    case StreamPixelFormat::PIXEL_FORMAT_BGRA:
+      return 4;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB16:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR16:
+      return 6;
+    case StreamPixelFormat::PIXEL_FORMAT_RGBA16:
+    case StreamPixelFormat::PIXEL_FORMAT_BGRA16:
+      return 8;
+    case StreamPixelFormat::PIXEL_FORMAT_MJPEG:
+    default:
+      return 0;
+  }
+}
+
+int GetNumPlanes(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_UNKNOWN:
+    case StreamPixelFormat::PIXEL_FORMAT_MAX_NUM:
+      return 0;
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+size_t GetFrameSize(StreamPixelFormat format, int width, int height,
+                    int stride) {
+  const size_t luma = static_cast<size_t>(stride) * height;
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+      return luma + static_cast<size_t>(stride) * ((height + 1) / 2);
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return luma * 2;
+    case StreamPixelFormat::PIXEL_FORMAT_MJPEG:
+      // same bound as the sizeimage of most drivers
+      return static_cast<size_t>(width) * height * 2;
+    default:
+      return luma;
+  }
+}
+
+bool Frame::Allocate(StreamPixelFormat format, int frame_width,
+                     int frame_height, int row_alignment) {
+  if (frame_width <= 0 || frame_height <= 0 || row_alignment <= 0 ||
+      GetNumPlanes(format) == 0) {
+    return false;
+  }
+  if (memory == FrameMemory::MEMORY_OWNED && pixel_format == format &&
+      width == frame_width && height == frame_height) {
+    return true;
+  }
+
+  // 1. rows of the first plane padded to the alignment, the chroma plane of
+  // semi-planar formats has the same stride
+  const int row_bytes = frame_width * GetBytesPerPixel(format);
+  const int stride =
+      (row_bytes + row_alignment - 1) / row_alignment * row_alignment;
+  const size_t size = GetFrameSize(format, frame_width, frame_height, stride);
+
+  // 2. the allocation is aligned to the cache line in any case
+  void* buffer = nullptr;
+  const size_t alignment =
+      row_alignment > kImageRowAlignment ? row_alignment : kImageRowAlignment;
+  if (posix_memalign(&buffer, alignment, size) != 0) {
+    return false;
+  }
+  return Wrap(format, frame_width, frame_height, buffer, stride,
+              std::shared_ptr<void>(buffer, free), FrameMemory::MEMORY_OWNED);
+}
+
+bool Frame::Wrap(StreamPixelFormat format, int frame_width, int frame_height,
+                 void* data, int stride, std::shared_ptr<void> memory_owner,
+                 FrameMemory memory_type) {
+  const int frame_planes = GetNumPlanes(format);
+  if (data == nullptr || frame_planes == 0) {
+    return false;
+  }
+
+  pixel_format = format;
+  width = frame_width;
+  height = frame_height;
+  num_planes = frame_planes;
+  planes.fill(FramePlane());
+  auto* ptr = static_cast<uint8_t*>(data);
+  const size_t size = GetFrameSize(format, frame_width, frame_height, stride);
+  if (num_planes == 1) {
+    planes[0].data = ptr;
+    planes[0].stride = stride;
+    planes[0].size = size;
+  } else {
+    // interleaved chroma right after the luma plane
+    planes[0].data = ptr;
+    planes[0].stride = stride;
+    planes[0].size = static_cast<size_t>(stride) * frame_height;
+    planes[1].data = ptr + planes[0].size;
+    planes[1].stride = stride;
+    planes[1].size = size - planes[0].size;
+  }
+  memory = memory_type;
+  owner = std::move(memory_owner);
+  return true;
+}
+
+void Frame::Release() {
+  planes.fill(FramePlane());
+  num_planes = 0;
+  memory = FrameMemory::MEMORY_NONE;
+  owner.reset();
+}
+
+void Frame::ResetMetadata() {
+  timestamp_ns = 0;
+  system_timestamp_ns = 0;
+  sequence = 0;
+  dropped_frames = 0;
+  flags = 0;
+  bytes_used = 0;
+}
+
+size_t Frame::GetSize() const {
+  size_t size = 0;
+  for (int i = 0; i < num_planes; ++i) {
+    size += planes[i].size;
+  }
+  return size;
+}
+
+void CopyMetadata(const Frame& frame, CameraImage* image) {
+  image->tv_sec = static_cast<int>(frame.timestamp_ns / 1000000000ULL);
+  image->tv_usec = static_cast<int>(frame.timestamp_ns % 1000000000ULL / 1000);
+  image->timestamp_ns = frame.timestamp_ns;
+  image->system_timestamp_ns = frame.system_timestamp_ns;
+  image->sequence = frame.sequence;
+  image->dropped_frames = frame.dropped_frames;
+  image->flags = frame.flags;
+  image->bytes_used = frame.bytes_used;
+}
+
+void CopyMetadata(const CameraImage& image, Frame* frame) {
+  frame->timestamp_ns = image.timestamp_ns;
+  frame->system_timestamp_ns = image.system_timestamp_ns;
+  frame->sequence = image.sequence;
+  frame->dropped_frames = image.dropped_frames;
+  frame->flags = image.flags;
+  frame->bytes_used = image.bytes_used;
+}
+
+bool CopyFrame(const Frame& src, Frame* dst) {
+  if (!src.IsMapped()) {
+    return false;
+  }
+  if (!dst->IsMapped() || dst->pixel_format != src.pixel_format ||
+      dst->width != src.width || dst->height != src.height ||
+      dst->num_planes != src.num_planes) {
+    // memory of a pool or of someone else is never replaced behind its back
+    if (dst->IsMapped() && dst->memory != FrameMemory::MEMORY_OWNED) {
+      return false;
+    }
+    dst->Release();
+    if (!dst->Allocate(src.pixel_format, src.width, src.height)) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < src.num_planes; ++i) {
+    const FramePlane& from = src.planes[i];
+    const FramePlane& to = dst->planes[i];
+    if (from.stride == 0 || to.stride == 0) {
+      // compressed payload
+      const size_t size = src.bytes_used > 0 && src.num_planes == 1
+                              ? std::min<size_t>(src.bytes_used, from.size)
+                              : from.size;
+      if (size > to.size) {
+        return false;
+      }
+      memcpy(to.data, from.data, size);
+    } else if (from.stride == to.stride) {
+      memcpy(to.data, from.data, std::min(from.size, to.size));
+    } else {
+      const size_t row_bytes = std::min(from.stride, to.stride);
+      const size_t rows = std::min(from.size / from.stride,
+                                   to.size / to.stride);
+      for (size_t y = 0; y < rows; ++y) {
+        memcpy(to.data + y * to.stride, from.data + y * from.stride,
+               row_bytes);
+      }
+    }
+  }
+
+  dst->timestamp_ns = src.timestamp_ns;
+  dst->system_timestamp_ns = src.system_timestamp_ns;
+  dst->sequence = src.sequence;
+  dst->dropped_frames = src.dropped_frames;
+  dst->flags = src.flags;
+  dst->bytes_used = src.bytes_used;
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
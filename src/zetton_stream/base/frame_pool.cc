@@ -0,0 +1,266 @@
+#include "zetton_stream/base/frame_pool.h"
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+// room for the shared_ptr control block of a frame, see SlotAllocator
+constexpr size_t kControlBlockSize = 128;
+
+size_t RoundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+struct FramePool::Slot {
+  // two views of the same memory, only one is handed out at a time
+  Frame frame;
+  CameraImage image;
+  alignas(std::max_align_t) unsigned char control_block[kControlBlockSize];
+};
+
+// hands out the control block storage of a slot to std::shared_ptr, so that
+// handing out a frame does not allocate. the slot goes back to the pool once
+// the control block is freed, i.e. after the last shared and weak reference
+// is gone. falls back to the heap if the control block of the standard
+// library does not fit
+template <typename T>
+class FramePool::SlotAllocator {
+ public:
+  using value_type = T;
+
+  SlotAllocator(std::shared_ptr<FramePool> pool, Slot* slot)
+      : pool_(std::move(pool)), slot_(slot) {}
+  template <typename U>
+  SlotAllocator(const SlotAllocator<U>& other)  // NOLINT
+      : pool_(other.pool_), slot_(other.slot_) {}
+
+  T* allocate(size_t n) {
+    if (n * sizeof(T) <= sizeof(slot_->control_block) &&
+        alignof(T) <= alignof(std::max_align_t)) {
+      return reinterpret_cast<T*>(slot_->control_block);
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t) {
+    if (reinterpret_cast<unsigned char*>(p) != slot_->control_block) {
+      ::operator delete(p);
+    }
+    pool_->Release(slot_);
+  }
+
+  template <typename U>
+  bool operator==(const SlotAllocator<U>& other) const {
+    return slot_ == other.slot_;
+  }
+  template <typename U>
+  bool operator!=(const SlotAllocator<U>& other) const {
+    return slot_ != other.slot_;
+  }
+
+  // frames keep their pool and its arena alive
+  std::shared_ptr<FramePool> pool_;
+  Slot* slot_;
+};
+
+std::shared_ptr<FramePool> FramePool::Create(StreamPixelFormat format,
+                                             int width, int height,
+                                             int num_frames, bool huge_pages) {
+  std::shared_ptr<FramePool> pool(new FramePool());
+  if (!pool->Init(format, width, height, num_frames, huge_pages)) {
+    return nullptr;
+  }
+  return pool;
+}
+
+std::shared_ptr<FramePool> FramePool::Create(const StreamOptions& options,
+                                             bool huge_pages) {
+  int width = static_cast<int>(options.width);
+  int height = static_cast<int>(options.height);
+  if (options.roi.width > 0 && options.roi.height > 0) {
+    width = static_cast<int>(options.roi.width);
+    height = static_cast<int>(options.roi.height);
+  }
+  return Create(options.output_format, width, height,
+                static_cast<int>(options.num_buffers), huge_pages);
+}
+
+FramePool::~FramePool() {
+  // the images do not own their memory, so only the arena is freed
+  slots_.reset();
+  if (arena_ != nullptr) {
+    munmap(arena_, arena_size_);
+    arena_ = nullptr;
+  }
+}
+
+bool FramePool::Init(StreamPixelFormat format, int width, int height,
+                     int num_frames, bool huge_pages) {
+  if (width <= 0 || height <= 0 || num_frames <= 0 ||
+      GetNumPlanes(format) == 0) {
+    AERROR_F("invalid frame pool of {} frames of {}x{} {}", num_frames, width,
+             height, StreamPixelFormatToStr(format));
+    return false;
+  }
+
+  // 1. lay out the frames back to back, every row starts on an aligned
+  // boundary and so does every frame
+  const int bytes_per_pixel = GetBytesPerPixel(format);
+  const int stride = static_cast<int>(
+      RoundUp(static_cast<size_t>(width) * bytes_per_pixel,
+              kImageRowAlignment));
+  frame_size_ = RoundUp(stream::GetFrameSize(format, width, height, stride),
+                        kImageRowAlignment);
+  pixel_format_ = format;
+  num_frames_ = num_frames;
+  if (!AllocateArena(frame_size_ * num_frames, huge_pages)) {
+    return false;
+  }
+
+  // 2. bind every slot to its part of the arena
+  slots_.reset(new Slot[num_frames]);
+  free_slots_.reserve(num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    char* data = static_cast<char*>(arena_) + frame_size_ * i;
+    slots_[i].frame.Wrap(format, width, height, data, stride, nullptr,
+                         FrameMemory::MEMORY_POOLED);
+    CameraImage& image = slots_[i].image;
+    image.width = width;
+    image.height = height;
+    image.bytes_per_pixel = bytes_per_pixel;
+    image.stride = stride;
+    image.image_size = static_cast<int>(frame_size_);
+    image.image = data;
+    image.owns_image = false;
+    free_slots_.push_back(&slots_[i]);
+  }
+
+  AINFO_F("frame pool of {} frames of {}x{} {} allocated ({} bytes{})",
+          num_frames, width, height, StreamPixelFormatToStr(format),
+          arena_size_,
+          huge_pages_ ? ", huge pages" : "");
+  return true;
+}
+
+bool FramePool::AllocateArena(size_t size, bool huge_pages) {
+  // 1. explicit huge pages, only available if reserved (vm.nr_hugepages)
+  if (huge_pages) {
+    const size_t huge_size = RoundUp(size, kHugePageSize);
+    void* arena = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena != MAP_FAILED) {
+      arena_ = arena;
+      arena_size_ = huge_size;
+      huge_pages_ = true;
+    } else {
+      AWARN_F("no huge pages reserved for frame pool: code {}, string [{}]",
+              errno, strerror(errno));
+    }
+  }
+
+  // 2. regular pages, transparent huge pages if requested
+  if (arena_ == nullptr) {
+    void* arena = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+      AERROR_F("cannot allocate frame pool of {} bytes: code {}, string [{}]",
+               size, errno, strerror(errno));
+      return false;
+    }
+    arena_ = arena;
+    arena_size_ = size;
+    if (huge_pages) {
+      madvise(arena_, arena_size_, MADV_HUGEPAGE);
+    }
+  }
+
+  // 3. fault in all pages now, so that RSS does not grow while capturing
+  memset(arena_, 0, arena_size_);
+  return true;
+}
+
+FramePool::Slot* FramePool::TakeSlot(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto available = [this] { return !free_slots_.empty(); };
+  if (timeout_ms < 0) {
+    cond_.wait(lock, available);
+  } else if (timeout_ms > 0) {
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), available);
+  }
+  if (free_slots_.empty()) {
+    return nullptr;
+  }
+  Slot* slot = free_slots_.back();
+  free_slots_.pop_back();
+  return slot;
+}
+
+FramePtr FramePool::AcquireFrame(int timeout_ms) {
+  // 1. take a free slot
+  Slot* slot = TakeSlot(timeout_ms);
+  if (slot == nullptr) {
+    return nullptr;
+  }
+
+  // 2. forget the metadata of its previous use
+  slot->frame.ResetMetadata();
+
+  // 3. hand it out, the control block lives in the slot as well and returns
+  // the slot when freed
+  return FramePtr(&slot->frame, [](Frame*) {},
+                  SlotAllocator<Frame>(shared_from_this(), slot));
+}
+
+CameraImagePtr FramePool::Acquire(int timeout_ms) {
+  // 1. take a free slot
+  Slot* slot = TakeSlot(timeout_ms);
+  if (slot == nullptr) {
+    return nullptr;
+  }
+
+  // 2. forget the metadata of its previous use
+  CameraImage& image = slot->image;
+  image.is_new = 0;
+  image.tv_sec = 0;
+  image.tv_usec = 0;
+  image.timestamp_ns = 0;
+  image.system_timestamp_ns = 0;
+  image.sequence = 0;
+  image.dropped_frames = 0;
+  image.flags = 0;
+  image.bytes_used = 0;
+
+  // 3. hand it out, the control block lives in the slot as well and returns
+  // the slot when freed
+  return CameraImagePtr(&image, [](CameraImage*) {},
+                        SlotAllocator<CameraImage>(shared_from_this(), slot));
+}
+
+int FramePool::GetAvailable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int>(free_slots_.size());
+}
+
+void FramePool::Release(Slot* slot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(slot);
+  }
+  cond_.notify_one();
+}
+
+}  // namespace stream
+}  // namespace zetton
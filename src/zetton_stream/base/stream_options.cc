@@ -196,6 +196,10 @@ const char* StreamPixelFormatToStr(StreamPixelFormat pixel_format) {
       return "MJPEG";
     case StreamPixelFormat::PIXEL_FORMAT_YUVMONO10:
       return "YUVMONO10";
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+      return "NV12";
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return "NV16";
     default:
       return "BGR";
   }
@@ -211,6 +215,78 @@ StreamPlatformType StreamPlatformTypeFromStr(const char* str) {
   return StreamPlatformType::PLATFORM_CPU;
 }
 
+const char* StreamStateToStr(StreamState state) {
+  switch (state) {
+    case StreamState::STATE_CLOSED:
+      return "closed";
+    case StreamState::STATE_STREAMING:
+      return "streaming";
+    case StreamState::STATE_LOST:
+      return "lost";
+    case StreamState::STATE_RECONNECTING:
+      return "reconnecting";
+    default:
+      return "closed";
+  }
+}
+
+StreamState StreamStateFromStr(const char* str) {
+  if (!str) return StreamState::STATE_CLOSED;
+  for (int n = 0; n < static_cast<int>(StreamState::STATE_MAX_NUM); ++n) {
+    const auto value = (StreamState)n;
+    if (strcasecmp(str, StreamStateToStr(value)) == 0) return value;
+  }
+  return StreamState::STATE_CLOSED;
+}
+
+const char* StreamNegotiationGoalToStr(StreamNegotiationGoal goal) {
+  switch (goal) {
+    case StreamNegotiationGoal::GOAL_REQUESTED:
+      return "requested";
+    case StreamNegotiationGoal::GOAL_MAX_FPS:
+      return "max_fps";
+    case StreamNegotiationGoal::GOAL_MIN_BANDWIDTH:
+      return "min_bandwidth";
+    case StreamNegotiationGoal::GOAL_MIN_DECODE_COST:
+      return "min_decode_cost";
+    default:
+      return "requested";
+  }
+}
+
+StreamNegotiationGoal StreamNegotiationGoalFromStr(const char* str) {
+  if (!str) return StreamNegotiationGoal::GOAL_REQUESTED;
+  for (int n = 0;
+       n < static_cast<int>(StreamNegotiationGoal::GOAL_MAX_NUM); ++n) {
+    const auto value = (StreamNegotiationGoal)n;
+    if (strcasecmp(str, StreamNegotiationGoalToStr(value)) == 0) return value;
+  }
+  return StreamNegotiationGoal::GOAL_REQUESTED;
+}
+
+const char* StreamBackpressureToStr(StreamBackpressure backpressure) {
+  switch (backpressure) {
+    case StreamBackpressure::BACKPRESSURE_BLOCK:
+      return "block";
+    case StreamBackpressure::BACKPRESSURE_DROP_OLDEST:
+      return "drop_oldest";
+    case StreamBackpressure::BACKPRESSURE_DROP_NEWEST:
+      return "drop_newest";
+    default:
+      return "block";
+  }
+}
+
+StreamBackpressure StreamBackpressureFromStr(const char* str) {
+  if (!str) return StreamBackpressure::BACKPRESSURE_BLOCK;
+  for (int n = 0;
+       n < static_cast<int>(StreamBackpressure::BACKPRESSURE_MAX_NUM); ++n) {
+    const auto value = (StreamBackpressure)n;
+    if (strcasecmp(str, StreamBackpressureToStr(value)) == 0) return value;
+  }
+  return StreamBackpressure::BACKPRESSURE_BLOCK;
+}
+
 StreamOptions::StreamOptions() {
   width = 0;
   height = 0;
@@ -228,6 +304,7 @@ StreamOptions::StreamOptions() {
   codec = StreamCodec::CODEC_UNKNOWN;
   pixel_format = StreamPixelFormat::PIXEL_FORMAT_BGR;
   output_format = pixel_format;
+  negotiation_goal = StreamNegotiationGoal::GOAL_REQUESTED;
 }
 
 }  // namespace stream
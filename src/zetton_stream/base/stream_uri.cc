@@ -29,6 +29,10 @@ const char* StreamProtocolTypeToStr(StreamProtocolType type) {
       return "file";
     case StreamProtocolType::PROTOCOL_DISPLAY:
       return "display";
+    case StreamProtocolType::PROTOCOL_SHM:
+      return "shm";
+    case StreamProtocolType::PROTOCOL_HTTP:
+      return "http";
     default:
       return "default";
   }
@@ -126,6 +130,12 @@ bool StreamUri::Parse(const char* uri) {
     }
   } else if (protocol_string == "file") {
     extension = common::GetFileExtension(location);
+  } else if (protocol_string == "shm") {
+    // name of the POSIX shared memory object, e.g. shm://camera0
+    if (location.empty()) {
+      AERROR_F("Missing shared memory name in {}", string);
+      return false;
+    }
   } else {
     // search for ip/port format
     std::string port_str;
@@ -5,12 +5,51 @@
 namespace zetton {
 namespace stream {
 
+BaseStreamSink::~BaseStreamSink() { StopOutputs(); }
+
 bool BaseStreamSink::Render(void *image, uint32_t width, uint32_t height) {
+  // borrowed view of the image, copied by outputs that queue it
+  const int bytes_per_pixel = GetBytesPerPixel(options_.output_format);
+  auto frame = std::make_shared<Frame>();
+  if (image == nullptr || bytes_per_pixel == 0 ||
+      !frame->Wrap(options_.output_format, static_cast<int>(width),
+                   static_cast<int>(height), image,
+                   static_cast<int>(width) * bytes_per_pixel)) {
+    AERROR_F("cannot render {}x{} {} image", width, height,
+             StreamPixelFormatToStr(options_.output_format));
+    return false;
+  }
+  return Render(frame);
+}
+
+bool BaseStreamSink::Render(const FramePtr &frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
   const uint32_t num_outputs = outputs_.size();
   bool result = true;
 
+  // borrowed frames without an owner may be gone once the call returns, e.g.
+  // images rendered through the void* overload, so queues get a copy of
+  // them. the others, pooled ones included, are shared by reference count
+  FramePtr shared = frame;
   for (uint32_t n = 0; n < num_outputs; n++) {
-    if (!outputs_[n]->Render(image, width, height)) {
+    if (output_queues_[n] == nullptr) {
+      if (!outputs_[n]->Render(frame)) {
+        result = false;
+      }
+      continue;
+    }
+    if (shared == frame && frame->IsTransient()) {
+      shared = std::make_shared<Frame>();
+      if (!CopyFrame(*frame, shared.get())) {
+        AERROR_F("cannot queue {}x{} {} frame", frame->width, frame->height,
+                 StreamPixelFormatToStr(frame->pixel_format));
+        return false;
+      }
+    }
+    if (!output_queues_[n]->Push(shared)) {
       result = false;
     }
   }
@@ -18,6 +57,42 @@ bool BaseStreamSink::Render(void *image, uint32_t width, uint32_t height) {
   return result;
 }
 
+void BaseStreamSink::AddOutput(BaseStreamSink *output,
+                               const SinkOutputOptions &options) {
+  if (output == nullptr) return;
+
+  std::unique_ptr<SinkOutputQueue> queue;
+  if (options.async) {
+    queue.reset(new SinkOutputQueue());
+    if (!queue->Start(output, options)) {
+      AWARN_F("rendering output {} on the caller thread",
+              output->GetResource().string);
+      queue.reset();
+    }
+  }
+  outputs_.push_back(output);
+  output_queues_.push_back(std::move(queue));
+}
+
+SinkOutputStatistics BaseStreamSink::GetOutputStatistics(uint32_t index) {
+  if (index >= output_queues_.size() || output_queues_[index] == nullptr) {
+    return SinkOutputStatistics();
+  }
+  return output_queues_[index]->GetStatistics();
+}
+
+void BaseStreamSink::FlushOutputs() {
+  for (auto &queue : output_queues_) {
+    if (queue != nullptr) queue->Flush();
+  }
+}
+
+void BaseStreamSink::StopOutputs() {
+  for (auto &queue : output_queues_) {
+    if (queue != nullptr) queue->Stop();
+  }
+}
+
 void BaseStreamSink::SetStatus(const char *str) {}
 
 }  // namespace stream
@@ -0,0 +1,112 @@
+#include "zetton_stream/interface/base_stream_source.h"
+
+#include "zetton_common/util/log.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zetton {
+namespace stream {
+
+bool BaseStreamSource::Capture(const FramePtr& frame) {
+  if (frame == nullptr) {
+    AERROR_F("capture error. frame is null");
+    return false;
+  }
+  if (!frame->IsMapped() &&
+      !frame->Allocate(options_.output_format, options_.width, options_.height,
+                       1)) {
+    AERROR_F("cannot allocate {}x{} {} frame", options_.width, options_.height,
+             StreamPixelFormatToStr(options_.output_format));
+    return false;
+  }
+  const int bytes_per_pixel = GetBytesPerPixel(frame->pixel_format);
+  if (frame->num_planes != 1 ||
+      frame->GetStride() != frame->width * bytes_per_pixel) {
+    AERROR_F("{}x{} {} frame cannot be captured as a camera image",
+             frame->width, frame->height,
+             StreamPixelFormatToStr(frame->pixel_format));
+    return false;
+  }
+
+  // camera image borrowing the memory of the frame
+  auto image = std::make_shared<CameraImage>();
+  image->width = frame->width;
+  image->height = frame->height;
+  image->bytes_per_pixel = bytes_per_pixel;
+  image->stride = frame->GetStride();
+  image->image_size = static_cast<int>(frame->planes[0].size);
+  image->image = reinterpret_cast<char*>(frame->GetData());
+  image->owns_image = false;
+  if (!Capture(image)) {
+    return false;
+  }
+  CopyMetadata(*image, frame.get());
+  return true;
+}
+
+bool BaseStreamSource::CaptureFrom(const FramePtr& source,
+                                   const FramePtr& frame) {
+  if (frame == nullptr) {
+    AERROR_F("capture error. frame is null");
+    return false;
+  }
+  if (source == nullptr) {
+    return false;
+  }
+
+  // 1. zero-copy, the frame holds the one of the source
+  if (!frame->IsMapped()) {
+    *frame = *source;
+    frame->memory = FrameMemory::MEMORY_BORROWED;
+    frame->owner = source;
+    return true;
+  }
+
+  // 2. copy into the memory of the frame
+  if (!CopyFrame(*source, frame.get())) {
+    AERROR_F("cannot copy {}x{} {} frame to {}x{} {} frame", source->width,
+             source->height, StreamPixelFormatToStr(source->pixel_format),
+             frame->width, frame->height,
+             StreamPixelFormatToStr(frame->pixel_format));
+    return false;
+  }
+  return true;
+}
+
+bool BaseStreamSource::CaptureFrom(const FramePtr& source,
+                                   const CameraImagePtr& raw_image) {
+  if (raw_image == nullptr) {
+    AERROR_F("capture error. raw image is null");
+    return false;
+  }
+  if (source == nullptr) {
+    return false;
+  }
+  const int bytes_per_pixel = GetBytesPerPixel(source->pixel_format);
+  if (source->num_planes != 1 || bytes_per_pixel == 0) {
+    AERROR_F("{} frames cannot be captured as camera images",
+             StreamPixelFormatToStr(source->pixel_format));
+    return false;
+  }
+
+  // the image is packed unless it was allocated with padded rows
+  if (raw_image->image == nullptr || raw_image->width != source->width ||
+      raw_image->height != source->height ||
+      raw_image->bytes_per_pixel != bytes_per_pixel) {
+    if (!raw_image->owns_image ||
+        !raw_image->Allocate(source->width, source->height, bytes_per_pixel)) {
+      AERROR_F("cannot allocate {}x{} camera image", source->width,
+               source->height);
+      return false;
+    }
+  }
+  copy_rows(source->GetData(), source->GetStride(),
+            reinterpret_cast<unsigned char*>(raw_image->image),
+            raw_image->GetStride(), source->width * bytes_per_pixel,
+            source->height);
+  CopyMetadata(*source, raw_image.get());
+  raw_image->is_new = 1;
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
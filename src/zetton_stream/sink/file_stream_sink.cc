@@ -0,0 +1,535 @@
+#include "zetton_stream/sink/file_stream_sink.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// O_DIRECT offsets, sizes and memory are aligned to this
+constexpr size_t kDirectAlignment = 4096;
+// bytes written to the file at once
+constexpr size_t kWriteBufferSize = 8 << 20;
+
+constexpr char kY4mFrameHeader[] = "FRAME\n";
+constexpr size_t kY4mFrameHeaderSize = sizeof(kY4mFrameHeader) - 1;
+
+// y4m colorspace of a pixel format, nullptr if it has none
+const char* GetY4mColorspace(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+      return "mono";
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+      return "420";
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+      return "422";
+    default:
+      return nullptr;
+  }
+}
+
+// bytes of a row and number of rows of a plane as stored in a raw file
+void GetPlaneRows(const Frame& frame, int plane, size_t* row_bytes,
+                  size_t* rows) {
+  const FramePlane& p = frame.planes[plane];
+  *row_bytes = static_cast<size_t>(frame.width) *
+               GetBytesPerPixel(frame.pixel_format);
+  *rows = p.stride > 0 ? p.size / p.stride : 0;
+}
+
+// compressed payload of a frame
+size_t GetPayloadSize(const Frame& frame) {
+  return frame.bytes_used > 0 && frame.bytes_used < frame.planes[0].size
+             ? frame.bytes_used
+             : frame.planes[0].size;
+}
+
+}  // namespace
+
+const char* FileContainerToStr(FileContainer container) {
+  switch (container) {
+    case FileContainer::CONTAINER_RAW:
+      return "raw";
+    case FileContainer::CONTAINER_Y4M:
+      return "y4m";
+    default:
+      return "raw";
+  }
+}
+
+FileContainer FileContainerFromStr(const char* str) {
+  if (!str) return FileContainer::CONTAINER_RAW;
+  for (int n = 0; n < static_cast<int>(FileContainer::CONTAINER_MAX_NUM);
+       ++n) {
+    const auto value = (FileContainer)n;
+    if (strcasecmp(str, FileContainerToStr(value)) == 0) return value;
+  }
+  return FileContainer::CONTAINER_RAW;
+}
+
+FileStreamSink::~FileStreamSink() { Close(); }
+
+bool FileStreamSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_FILE ||
+      options_.resource.location.empty()) {
+    AERROR_F("{} is not a file", options_.resource.string);
+    return false;
+  }
+  path_ = options_.resource.location;
+  container_ = FileContainerFromStr(options_.resource.extension.c_str());
+  return true;
+}
+
+bool FileStreamSink::IsFormatSupported(StreamPixelFormat format) const {
+  if (container_ == FileContainer::CONTAINER_Y4M) {
+    return GetY4mColorspace(format) != nullptr;
+  }
+  return GetNumPlanes(format) > 0;
+}
+
+bool FileStreamSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    return true;
+  }
+
+  // 1. the file, bypassing the page cache if the file system can
+  direct_ = true;
+  fd_ = open(path_.c_str(),
+             O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+  if (fd_ < 0 && errno == EINVAL) {
+    direct_ = false;
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (fd_ < 0) {
+    AERROR_F("cannot open {}: code {}, string [{}]", path_, errno,
+             strerror(errno));
+    return false;
+  }
+  const std::string index_path = path_ + ".idx";
+  index_ = fopen(index_path.c_str(), "w");
+  if (index_ == nullptr) {
+    AERROR_F("cannot open {}: code {}, string [{}]", index_path, errno,
+             strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  fprintf(index_,
+          "# frame offset size timestamp_ns system_timestamp_ns sequence "
+          "flags\n");
+
+  // 2. write buffers
+  buffer_size_ = kWriteBufferSize;
+  const int num_buffers = std::max(static_cast<int>(options_.num_buffers), 2);
+  num_buffers_ = static_cast<size_t>(num_buffers);
+  free_buffers_.clear();
+  full_buffers_.clear();
+  for (int i = 0; i < num_buffers; ++i) {
+    void* data = nullptr;
+    if (posix_memalign(&data, kDirectAlignment, buffer_size_) != 0) {
+      AERROR_F("cannot allocate write buffers of {} bytes", buffer_size_);
+      free_buffers_.clear();
+      fclose(index_);
+      index_ = nullptr;
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+    Buffer buffer;
+    buffer.data.reset(static_cast<uint8_t*>(data), free);
+    free_buffers_.push_back(std::move(buffer));
+  }
+  current_ = std::move(free_buffers_.back());
+  free_buffers_.pop_back();
+  current_.size = 0;
+  current_.offset = 0;
+  file_size_ = 0;
+  has_layout_ = false;
+  stop_ = false;
+  failed_ = false;
+
+  // 3. writer
+  thread_ = std::thread(&FileStreamSink::Run, this);
+  is_streaming_ = true;
+  AINFO_F("recording {} to {}{}", FileContainerToStr(container_), path_,
+          direct_ ? " with direct I/O" : "");
+  return true;
+}
+
+void FileStreamSink::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+      return;
+    }
+    // the last, partial buffer
+    if (current_.size > 0 || !current_.index.empty()) {
+      Submit();
+    }
+    stop_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+
+  // 1. cut the padding of the last direct write
+  if (direct_ && ftruncate(fd_, static_cast<off_t>(file_size_)) != 0) {
+    AERROR_F("cannot truncate {}: code {}, string [{}]", path_, errno,
+             strerror(errno));
+  }
+  close(fd_);
+  fd_ = -1;
+  fclose(index_);
+  index_ = nullptr;
+  free_buffers_.clear();
+  full_buffers_.clear();
+  current_ = Buffer();
+  is_streaming_ = false;
+  AINFO_F("recorded {} frames of {} bytes to {}, {} dropped",
+          frames_written_.load(), bytes_written_.load(), path_,
+          frames_dropped_.load());
+}
+
+bool FileStreamSink::Render(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  bool written = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (fd_ < 0 || failed_) {
+      AERROR_F("cannot record to {}", path_);
+      return false;
+    }
+    if (!has_layout_ && !WriteHeader(*frame)) {
+      return false;
+    }
+    if (blocking_) {
+      // frames larger than all buffers but one could wait forever, they are
+      // dropped as usual
+      const size_t record_size = GetRecordSize(*frame);
+      done_cond_.wait(lock, [&] {
+        return failed_ || record_size <= GetAvailable() ||
+               record_size > buffer_size_ * (num_buffers_ - 1);
+      });
+    }
+    written = WriteFrame(*frame);
+  }
+  return BaseStreamSink::Render(frame) && written;
+}
+
+bool FileStreamSink::WriteHeader(const Frame& frame) {
+  // 1. the layout of the recording
+  if (!IsFormatSupported(frame.pixel_format) ||
+      (container_ == FileContainer::CONTAINER_Y4M &&
+       (frame.width % 2 != 0 || frame.height % 2 != 0))) {
+    AERROR_F("cannot record {}x{} {} frames to a {} file", frame.width,
+             frame.height, StreamPixelFormatToStr(frame.pixel_format),
+             FileContainerToStr(container_));
+    return false;
+  }
+  layout_.pixel_format = frame.pixel_format;
+  layout_.width = frame.width;
+  layout_.height = frame.height;
+  has_layout_ = true;
+  row_.resize(static_cast<size_t>(frame.width));
+  if (container_ != FileContainer::CONTAINER_Y4M) {
+    return true;
+  }
+
+  // 2. y4m stream header, the frame rate as a fraction
+  uint32_t rate_num = 30;
+  uint32_t rate_den = 1;
+  if (options_.frame_rate > 0) {
+    rate_num = static_cast<uint32_t>(std::lround(options_.frame_rate * 1000));
+    rate_den = 1000;
+    while (rate_num % 10 == 0 && rate_den % 10 == 0) {
+      rate_num /= 10;
+      rate_den /= 10;
+    }
+  }
+  char header[128];
+  const int size =
+      snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C%s\n",
+               frame.width, frame.height, rate_num, rate_den,
+               GetY4mColorspace(frame.pixel_format));
+  Append(header, static_cast<size_t>(size));
+  return true;
+}
+
+size_t FileStreamSink::GetRecordSize(const Frame& frame) const {
+  const size_t luma = static_cast<size_t>(frame.width) * frame.height;
+  if (container_ == FileContainer::CONTAINER_Y4M) {
+    switch (frame.pixel_format) {
+      case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+        return kY4mFrameHeaderSize + luma;
+      case StreamPixelFormat::PIXEL_FORMAT_NV12:
+        return kY4mFrameHeaderSize + luma + luma / 2;
+      default:
+        return kY4mFrameHeaderSize + luma * 2;
+    }
+  }
+  if (GetBytesPerPixel(frame.pixel_format) == 0) {
+    return GetPayloadSize(frame);
+  }
+  size_t size = 0;
+  for (int i = 0; i < frame.num_planes; ++i) {
+    size_t row_bytes = 0;
+    size_t rows = 0;
+    GetPlaneRows(frame, i, &row_bytes, &rows);
+    size += row_bytes * rows;
+  }
+  return size;
+}
+
+bool FileStreamSink::WriteFrame(const Frame& frame) {
+  // 1. every frame has the layout of the first one
+  if (frame.pixel_format != layout_.pixel_format ||
+      frame.width != layout_.width || frame.height != layout_.height) {
+    AERROR_F("cannot record {}x{} {} frame to a recording of {}x{} {}",
+             frame.width, frame.height,
+             StreamPixelFormatToStr(frame.pixel_format), layout_.width,
+             layout_.height, StreamPixelFormatToStr(layout_.pixel_format));
+    return false;
+  }
+
+  // 2. drop it if the free buffers cannot take it, the capture thread never
+  // waits for the disk
+  const size_t record_size = GetRecordSize(frame);
+  if (record_size > GetAvailable()) {
+    ++frames_dropped_;
+    ADEBUG_F("disk fell behind, dropped frame {} of {}", frame.sequence,
+             path_);
+    return false;
+  }
+
+  // 3. the frame, converted to planar for y4m
+  size_t data_size = record_size;
+  if (container_ == FileContainer::CONTAINER_Y4M) {
+    Append(kY4mFrameHeader, kY4mFrameHeaderSize);
+    data_size -= kY4mFrameHeaderSize;
+  }
+  const uint64_t offset = current_.offset + current_.size;
+  const size_t width = static_cast<size_t>(frame.width);
+  const size_t height = static_cast<size_t>(frame.height);
+  const uint8_t* data = frame.GetData(0);
+  const size_t stride = static_cast<size_t>(frame.GetStride(0));
+  switch (container_ == FileContainer::CONTAINER_Y4M
+              ? frame.pixel_format
+              : StreamPixelFormat::PIXEL_FORMAT_UNKNOWN) {
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+      for (size_t y = 0; y < height; ++y) {
+        Append(data + y * stride, width);
+      }
+      break;
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16: {
+      for (size_t y = 0; y < height; ++y) {
+        Append(data + y * stride, width);
+      }
+      // deinterleave the chroma plane, u then v
+      const uint8_t* uv = frame.GetData(1);
+      const size_t uv_stride = static_cast<size_t>(frame.GetStride(1));
+      const size_t uv_height =
+          frame.pixel_format == StreamPixelFormat::PIXEL_FORMAT_NV12
+              ? height / 2
+              : height;
+      for (int c = 0; c < 2; ++c) {
+        for (size_t y = 0; y < uv_height; ++y) {
+          const uint8_t* src = uv + y * uv_stride + c;
+          for (size_t x = 0; x < width / 2; ++x) {
+            row_[x] = src[x * 2];
+          }
+          Append(row_.data(), width / 2);
+        }
+      }
+      break;
+    }
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY: {
+      // byte offsets of y, u and v in a macropixel
+      const bool yuyv =
+          frame.pixel_format == StreamPixelFormat::PIXEL_FORMAT_YUYV;
+      const size_t y_offset = yuyv ? 0 : 1;
+      const size_t u_offset = yuyv ? 1 : 0;
+      const size_t v_offset = yuyv ? 3 : 2;
+      for (size_t y = 0; y < height; ++y) {
+        const uint8_t* src = data + y * stride + y_offset;
+        for (size_t x = 0; x < width; ++x) {
+          row_[x] = src[x * 2];
+        }
+        Append(row_.data(), width);
+      }
+      for (const size_t c_offset : {u_offset, v_offset}) {
+        for (size_t y = 0; y < height; ++y) {
+          const uint8_t* src = data + y * stride + c_offset;
+          for (size_t x = 0; x < width / 2; ++x) {
+            row_[x] = src[x * 4];
+          }
+          Append(row_.data(), width / 2);
+        }
+      }
+      break;
+    }
+    default:
+      if (GetBytesPerPixel(frame.pixel_format) == 0) {
+        // compressed payload
+        Append(data, data_size);
+        break;
+      }
+      // planes without their row padding
+      for (int i = 0; i < frame.num_planes; ++i) {
+        size_t row_bytes = 0;
+        size_t rows = 0;
+        GetPlaneRows(frame, i, &row_bytes, &rows);
+        const FramePlane& plane = frame.planes[i];
+        if (static_cast<size_t>(plane.stride) == row_bytes) {
+          Append(plane.data, row_bytes * rows);
+          continue;
+        }
+        for (size_t y = 0; y < rows; ++y) {
+          Append(plane.data + y * plane.stride, row_bytes);
+        }
+      }
+      break;
+  }
+
+  // 4. index it with the buffer it ends in, written after its data
+  char line[160];
+  const int size = snprintf(
+      line, sizeof(line),
+      "%" PRIu64 " %" PRIu64 " %zu %" PRIu64 " %" PRIu64 " %u %u\n",
+      static_cast<uint64_t>(frames_written_), offset, data_size,
+      static_cast<uint64_t>(frame.timestamp_ns),
+      static_cast<uint64_t>(frame.system_timestamp_ns), frame.sequence,
+      frame.flags);
+  current_.index.append(line, static_cast<size_t>(size));
+  ++frames_written_;
+  return true;
+}
+
+size_t FileStreamSink::GetAvailable() const {
+  return buffer_size_ - current_.size + free_buffers_.size() * buffer_size_;
+}
+
+void FileStreamSink::Append(const void* data, size_t size) {
+  const uint8_t* src = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    // full buffers are only handed over when more data arrives, so that the
+    // last bytes of a frame never need a free buffer
+    if (current_.size == buffer_size_) {
+      Submit();
+    }
+    const size_t n = std::min(size, buffer_size_ - current_.size);
+    memcpy(current_.data.get() + current_.size, src, n);
+    current_.size += n;
+    src += n;
+    size -= n;
+  }
+}
+
+void FileStreamSink::Submit() {
+  file_size_ = current_.offset + current_.size;
+  full_buffers_.push_back(std::move(current_));
+  cond_.notify_one();
+
+  // the caller made sure there is a free buffer, except on close
+  current_ = Buffer();
+  if (free_buffers_.empty()) {
+    return;
+  }
+  current_ = std::move(free_buffers_.back());
+  free_buffers_.pop_back();
+  current_.size = 0;
+  current_.offset = file_size_;
+  current_.index.clear();
+}
+
+void FileStreamSink::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [&] { return stop_ || !full_buffers_.empty(); });
+    if (full_buffers_.empty()) {
+      break;
+    }
+    Buffer buffer = std::move(full_buffers_.front());
+    full_buffers_.pop_front();
+    lock.unlock();
+
+    const bool written = WriteBuffer(buffer);
+
+    lock.lock();
+    if (!written) {
+      failed_ = true;
+    }
+    buffer.size = 0;
+    buffer.index.clear();
+    free_buffers_.push_back(std::move(buffer));
+    done_cond_.notify_all();
+  }
+}
+
+bool FileStreamSink::WriteBuffer(const Buffer& buffer) {
+  // 1. the data, direct writes of the last buffer are padded to the alignment
+  // and truncated on close
+  const size_t size =
+      direct_ ? (buffer.size + kDirectAlignment - 1) / kDirectAlignment *
+                    kDirectAlignment
+              : buffer.size;
+  if (size > buffer.size) {
+    memset(buffer.data.get() + buffer.size, 0, size - buffer.size);
+  }
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t n =
+        pwrite(fd_, buffer.data.get() + written, size - written,
+               static_cast<off_t>(buffer.offset + written));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      AERROR_F("cannot write {} bytes to {}: code {}, string [{}]",
+               size - written, path_, errno, strerror(errno));
+      return false;
+    }
+    written += static_cast<size_t>(n);
+  }
+  bytes_written_ += buffer.size;
+
+  // 2. without direct I/O, flush the range and drop it from the page cache
+  if (!direct_ && size > 0) {
+    sync_file_range(fd_, static_cast<off_t>(buffer.offset),
+                    static_cast<off_t>(size),
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd_, static_cast<off_t>(buffer.offset),
+                  static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+  }
+
+  // 3. the index of the frames that are now on disk
+  if (!buffer.index.empty()) {
+    fwrite(buffer.index.data(), 1, buffer.index.size(), index_);
+    fflush(index_);
+  }
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,199 @@
+#include "zetton_stream/sink/jpeg_stream_sink.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+JpegStreamSink::~JpegStreamSink() { Close(); }
+
+bool JpegStreamSink::Init(const StreamOptions& options) {
+  options_ = options;
+  switch (options_.resource.protocol) {
+    case StreamProtocolType::PROTOCOL_FILE:
+      path_ = options_.resource.location;
+      break;
+    case StreamProtocolType::PROTOCOL_DEFAULT:
+    case StreamProtocolType::PROTOCOL_APPSINK:
+      // JPEGs only go to the outputs and the callback
+      path_.clear();
+      break;
+    default:
+      AERROR_F("cannot write jpeg to {}", options_.resource.string);
+      return false;
+  }
+  jpeg_.width = static_cast<int>(options_.width);
+  jpeg_.height = static_cast<int>(options_.height);
+  return true;
+}
+
+bool JpegStreamSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!threads_.empty()) {
+    return true;
+  }
+  JpegEncoder encoder;
+  if (num_threads_ == 0 || !encoder.Init(jpeg_)) {
+    AERROR_F("cannot encode jpeg with {} threads", num_threads_);
+    return false;
+  }
+
+  stop_ = false;
+  idle_workers_ = num_threads_;
+  next_ticket_ = 0;
+  delivered_ticket_ = 0;
+  for (uint32_t n = 0; n < num_threads_; ++n) {
+    threads_.emplace_back(&JpegStreamSink::Run, this);
+  }
+  is_streaming_ = true;
+  return true;
+}
+
+void JpegStreamSink::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (threads_.empty()) {
+      return;
+    }
+    stop_ = true;
+  }
+  // workers encode the frames they were handed before they stop
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.clear();
+  is_streaming_ = false;
+  AINFO_F("encoded {} jpeg, {} dropped, {} failed", frames_encoded_.load(),
+          frames_dropped_.load(), frames_failed_.load());
+}
+
+FramePtr JpegStreamSink::GetLatest() {
+  std::lock_guard<std::mutex> lock(latest_mutex_);
+  return latest_;
+}
+
+bool JpegStreamSink::Render(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  if (!IsFormatSupported(frame->pixel_format)) {
+    AERROR_F("cannot encode {} frames to jpeg",
+             StreamPixelFormatToStr(frame->pixel_format));
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (threads_.empty() || stop_) {
+    return false;
+  }
+  // 1. only frames a worker can take right away
+  if (jobs_.size() >= idle_workers_) {
+    ++frames_dropped_;
+    ADEBUG_F("jpeg workers busy, dropped frame {}", frame->sequence);
+    return false;
+  }
+
+  // 2. the worker may still read the frame after the call, so transient
+  // frames are copied
+  Job job;
+  job.ticket = next_ticket_++;
+  job.frame = frame;
+  if (frame->IsTransient()) {
+    job.frame = std::make_shared<Frame>();
+    if (!CopyFrame(*frame, job.frame.get())) {
+      AERROR_F("cannot queue {}x{} {} frame", frame->width, frame->height,
+               StreamPixelFormatToStr(frame->pixel_format));
+      return false;
+    }
+  }
+  jobs_.push_back(std::move(job));
+  lock.unlock();
+  cond_.notify_one();
+  return true;
+}
+
+void JpegStreamSink::Run() {
+  JpegEncoder encoder;
+  encoder.Init(jpeg_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+    if (jobs_.empty()) {
+      break;
+    }
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+    --idle_workers_;
+    lock.unlock();
+
+    FramePtr jpeg = encoder.Encode(*job.frame);
+    // release the source frame, e.g. a capture buffer, before delivering
+    job.frame.reset();
+    if (jpeg == nullptr) {
+      ++frames_failed_;
+    } else {
+      Deliver(jpeg, job.ticket);
+    }
+
+    lock.lock();
+    ++idle_workers_;
+  }
+}
+
+void JpegStreamSink::Deliver(const FramePtr& jpeg, uint64_t ticket) {
+  std::lock_guard<std::mutex> lock(deliver_mutex_);
+  // 1. a later frame was faster, this one would go back in time
+  if (ticket < delivered_ticket_) {
+    ++frames_dropped_;
+    return;
+  }
+  delivered_ticket_ = ticket + 1;
+  ++frames_encoded_;
+  {
+    std::lock_guard<std::mutex> latest_lock(latest_mutex_);
+    latest_ = jpeg;
+  }
+
+  // 2. snapshot, callback and outputs
+  if (!path_.empty()) {
+    WriteSnapshot(*jpeg);
+  }
+  if (callback_) {
+    callback_(jpeg);
+  }
+  BaseStreamSink::Render(jpeg);
+}
+
+bool JpegStreamSink::WriteSnapshot(const Frame& jpeg) {
+  // readers never see a partial file
+  const std::string temp_path = path_ + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+  if (file == nullptr) {
+    AERROR_F("cannot open {}: {}", temp_path, strerror(errno));
+    return false;
+  }
+  const size_t size = jpeg.bytes_used;
+  const bool written = fwrite(jpeg.GetData(), 1, size, file) == size;
+  if (fclose(file) != 0 || !written) {
+    AERROR_F("cannot write {}: {}", temp_path, strerror(errno));
+    remove(temp_path.c_str());
+    return false;
+  }
+  if (rename(temp_path.c_str(), path_.c_str()) != 0) {
+    AERROR_F("cannot replace {}: {}", path_, strerror(errno));
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,500 @@
+#include "zetton_stream/sink/mjpeg_http_sink.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+constexpr char kResponseHeader[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Server: zetton_stream\r\n"
+    "Connection: close\r\n"
+    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+    "Pragma: no-cache\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=zettonframe\r\n"
+    "\r\n";
+constexpr char kPartTrailer[] = "\r\n";
+constexpr size_t kPartTrailerSize = sizeof(kPartTrailer) - 1;
+
+// requests are a request line and a few headers
+constexpr size_t kMaxRequestSize = 8192;
+constexpr int kMaxEvents = 32;
+
+// best effort, the connection is closed right after
+void SendError(int fd, const char* status) {
+  char response[128];
+  const int size = snprintf(
+      response, sizeof(response),
+      "HTTP/1.0 %s\r\nConnection: close\r\nContent-Length: 0\r\n\r\n",
+      status);
+  if (send(fd, response, size, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+    ADEBUG_F("cannot send {}: {}", status, strerror(errno));
+  }
+}
+
+}  // namespace
+
+MjpegHttpSink::~MjpegHttpSink() { Close(); }
+
+bool MjpegHttpSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_HTTP ||
+      options_.resource.port < 0) {
+    AERROR_F("{} is not an http address", options_.resource.string);
+    return false;
+  }
+  address_ = options_.resource.location;
+  port_ = options_.resource.port;
+  path_ = options_.resource.mountpoint;
+  return true;
+}
+
+bool MjpegHttpSink::Open() {
+  if (thread_.joinable()) {
+    return true;
+  }
+
+  // 1. listening socket
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port_));
+  if (inet_pton(AF_INET, address_.c_str(), &addr.sin_addr) != 1) {
+    AERROR_F("invalid address {}", address_);
+    return false;
+  }
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  const int enable = 1;
+  if (listen_fd_ < 0 ||
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable)) < 0 ||
+      bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd_, SOMAXCONN) < 0) {
+    AERROR_F("cannot listen on {}:{}: {}", address_, port_, strerror(errno));
+    Close();
+    return false;
+  }
+  socklen_t addr_size = sizeof(addr);
+  if (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                  &addr_size) == 0) {
+    port_ = ntohs(addr.sin_port);
+  }
+
+  // 2. events of the sockets, and of new frames
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  bool added = epoll_fd_ >= 0 && event_fd_ >= 0;
+  event.data.fd = listen_fd_;
+  added = added && epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) == 0;
+  event.data.fd = event_fd_;
+  added = added && epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &event) == 0;
+  if (!added) {
+    AERROR_F("cannot poll {}:{}: {}", address_, port_, strerror(errno));
+    Close();
+    return false;
+  }
+
+  stop_ = false;
+  thread_ = std::thread(&MjpegHttpSink::Run, this);
+  is_streaming_ = true;
+  AINFO_F("serving MJPEG on http://{}:{}{}", address_, port_, path_);
+  return true;
+}
+
+void MjpegHttpSink::Close() {
+  if (thread_.joinable()) {
+    stop_ = true;
+    const uint64_t value = 1;
+    if (write(event_fd_, &value, sizeof(value)) < 0) {
+      AWARN_F("cannot wake up http server: {}", strerror(errno));
+    }
+    thread_.join();
+  }
+  while (!clients_.empty()) {
+    Disconnect(clients_.begin()->first);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int* fd : {&listen_fd_, &epoll_fd_, &event_fd_}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  latest_.reset();
+  is_streaming_ = false;
+}
+
+bool MjpegHttpSink::Render(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  if (frame->pixel_format != StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    AERROR_F("cannot serve {} frames without encoding them",
+             StreamPixelFormatToStr(frame->pixel_format));
+    return false;
+  }
+
+  // 0. nobody to send it to, nothing is copied. clients connecting later
+  // start with the next frame instead of an old one
+  if (num_clients_ == 0) {
+    bool open = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      open = event_fd_ >= 0;
+      latest_.reset();
+    }
+    return BaseStreamSink::Render(frame) && open;
+  }
+
+  // 1. the part every client sends. JPEGs owned by the frame are shared as
+  // they are, the others are copied once so that slow clients do not hold
+  // buffers of the source
+  auto part = std::make_shared<Part>();
+  const size_t capacity = frame->planes[0].size;
+  part->size = frame->bytes_used > 0 && frame->bytes_used < capacity
+                   ? frame->bytes_used
+                   : capacity;
+  if (frame->memory == FrameMemory::MEMORY_OWNED && frame->owner != nullptr) {
+    part->frame = frame;
+    part->data = frame->GetData();
+  } else {
+    part->copy.assign(frame->GetData(), frame->GetData() + part->size);
+    part->data = part->copy.data();
+  }
+  char header[192];
+  snprintf(header, sizeof(header),
+           "--zettonframe\r\n"
+           "Content-Type: image/jpeg\r\n"
+           "Content-Length: %zu\r\n"
+           "X-Timestamp: %llu.%06llu\r\n"
+           "\r\n",
+           part->size,
+           static_cast<unsigned long long>(frame->timestamp_ns / 1000000000),
+           static_cast<unsigned long long>(frame->timestamp_ns / 1000 %
+                                           1000000));
+  part->header = header;
+
+  // 2. replace the latest frame and wake up the server
+  bool served = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event_fd_ >= 0) {
+      part->id = next_id_++;
+      latest_ = part;
+      const uint64_t value = 1;
+      served = write(event_fd_, &value, sizeof(value)) == sizeof(value);
+    }
+  }
+  return BaseStreamSink::Render(frame) && served;
+}
+
+void MjpegHttpSink::Run() {
+  epoll_event events[kMaxEvents];
+  std::vector<int> closed;
+  while (!stop_) {
+    const int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (num_events < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      AERROR_F("http server stopped: {}", strerror(errno));
+      break;
+    }
+    PartPtr latest;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      latest = latest_;
+    }
+
+    // 1. sockets
+    bool new_frame = false;
+    closed.clear();
+    for (int i = 0; i < num_events; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == listen_fd_) {
+        Accept();
+        continue;
+      }
+      if (fd == event_fd_) {
+        uint64_t value;
+        new_frame = read(event_fd_, &value, sizeof(value)) > 0;
+        continue;
+      }
+      auto it = clients_.find(fd);
+      if (it == clients_.end()) {
+        continue;
+      }
+      Client* client = &it->second;
+      bool connected = !(events[i].events & (EPOLLERR | EPOLLHUP));
+      if (connected && (events[i].events & EPOLLIN)) {
+        connected = Receive(client, latest);
+      }
+      if (connected && (events[i].events & EPOLLOUT)) {
+        connected = Send(client, latest);
+      }
+      if (!connected) {
+        closed.push_back(fd);
+      }
+    }
+
+    // 2. clients done with their last frame start the new one, the others
+    // skip to the latest frame once they are done
+    if (new_frame && latest != nullptr) {
+      for (auto& it : clients_) {
+        Client* client = &it.second;
+        if (client->streaming && client->part == nullptr &&
+            !client->waiting_writable && !Send(client, latest)) {
+          closed.push_back(it.first);
+        }
+      }
+    }
+    for (int fd : closed) {
+      Disconnect(fd);
+    }
+  }
+}
+
+void MjpegHttpSink::Accept() {
+  while (true) {
+    sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    const int fd =
+        accept4(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_size,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        AWARN_F("cannot accept http client: {}", strerror(errno));
+      }
+      return;
+    }
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    const std::string address = std::string(ip) + ":" +
+                                std::to_string(ntohs(addr.sin_port));
+    if (clients_.size() >= max_clients_) {
+      AWARN_F("refused http client {}, {} clients connected", address,
+              clients_.size());
+      SendError(fd, "503 Service Unavailable");
+      close(fd);
+      continue;
+    }
+
+    // parts go out as soon as they are written, and the kernel does not
+    // queue seconds of frames for slow clients
+    const int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (send_buffer_size_ > 0) {
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer_size_,
+                 sizeof(send_buffer_size_));
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+      AWARN_F("cannot poll http client {}: {}", address, strerror(errno));
+      close(fd);
+      continue;
+    }
+    Client& client = clients_[fd];
+    client.fd = fd;
+    client.address = address;
+    num_clients_ = clients_.size();
+  }
+}
+
+bool MjpegHttpSink::Receive(Client* client, const PartPtr& latest) {
+  // 1. read what the client sent, only the request matters
+  char buffer[1024];
+  while (true) {
+    const ssize_t size = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (size > 0) {
+      if (!client->streaming) {
+        client->request.append(buffer, size);
+      }
+      if (client->request.size() > kMaxRequestSize) {
+        SendError(client->fd, "431 Request Header Fields Too Large");
+        return false;
+      }
+      continue;
+    }
+    if (size == 0) {
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+    return false;
+  }
+  if (client->streaming ||
+      client->request.find("\r\n\r\n") == std::string::npos) {
+    return true;
+  }
+
+  // 2. request line, "GET /path?query HTTP/1.1"
+  const std::string& request = client->request;
+  const size_t method_end = request.find(' ');
+  const size_t target_end = request.find_first_of(" ?\r", method_end + 1);
+  if (method_end == std::string::npos || target_end == std::string::npos) {
+    SendError(client->fd, "400 Bad Request");
+    return false;
+  }
+  if (request.compare(0, method_end, "GET") != 0) {
+    SendError(client->fd, "405 Method Not Allowed");
+    return false;
+  }
+  const std::string target =
+      request.substr(method_end + 1, target_end - method_end - 1);
+  if (!path_.empty() && target != path_) {
+    SendError(client->fd, "404 Not Found");
+    return false;
+  }
+
+  // 3. start streaming, from the latest frame
+  AINFO_F("http client {} connected", client->address);
+  client->request.clear();
+  client->request.shrink_to_fit();
+  client->response = kResponseHeader;
+  client->streaming = true;
+  return Send(client, latest);
+}
+
+bool MjpegHttpSink::Send(Client* client, const PartPtr& latest) {
+  while (true) {
+    // 1. next frame, skipping the ones the client missed
+    if (client->part == nullptr && latest != nullptr &&
+        latest->id > client->last_id) {
+      if (client->last_id > 0) {
+        frames_skipped_ += latest->id - client->last_id - 1;
+      }
+      client->part = latest;
+      client->part_sent = 0;
+      client->last_id = latest->id;
+    }
+    const size_t response_left =
+        client->response.size() - client->response_sent;
+    if (response_left == 0 && client->part == nullptr) {
+      return SetWritable(client, false);
+    }
+
+    // 2. what is left of the response header, the part header, the JPEG and
+    // the trailer, in one gather write
+    iovec iov[4];
+    int count = 0;
+    if (response_left > 0) {
+      iov[count].iov_base = &client->response[client->response_sent];
+      iov[count++].iov_len = response_left;
+    }
+    if (client->part != nullptr) {
+      const Part& part = *client->part;
+      const void* pieces[3] = {part.header.data(), part.data, kPartTrailer};
+      const size_t sizes[3] = {part.header.size(), part.size,
+                               kPartTrailerSize};
+      size_t offset = client->part_sent;
+      for (int i = 0; i < 3; ++i) {
+        if (offset >= sizes[i]) {
+          offset -= sizes[i];
+          continue;
+        }
+        iov[count].iov_base =
+            const_cast<uint8_t*>(static_cast<const uint8_t*>(pieces[i])) +
+            offset;
+        iov[count++].iov_len = sizes[i] - offset;
+        offset = 0;
+      }
+    }
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    const ssize_t sent =
+        sendmsg(client->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // socket buffer is full, go on once it drains
+        return SetWritable(client, true);
+      }
+      ADEBUG_F("cannot send to http client {}: {}", client->address,
+               strerror(errno));
+      return false;
+    }
+
+    // 3. advance
+    size_t left = static_cast<size_t>(sent);
+    const size_t response_sent = std::min(left, response_left);
+    client->response_sent += response_sent;
+    left -= response_sent;
+    if (client->part != nullptr) {
+      client->part_sent += left;
+      if (client->part_sent == client->part->header.size() +
+                                   client->part->size + kPartTrailerSize) {
+        client->part.reset();
+        ++frames_sent_;
+      }
+    }
+  }
+}
+
+bool MjpegHttpSink::SetWritable(Client* client, bool writable) {
+  if (client->waiting_writable == writable) {
+    return true;
+  }
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  event.data.fd = client->fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client->fd, &event) < 0) {
+    return false;
+  }
+  client->waiting_writable = writable;
+  return true;
+}
+
+void MjpegHttpSink::Disconnect(int fd) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) {
+    return;
+  }
+  if (it->second.streaming) {
+    AINFO_F("http client {} disconnected", it->second.address);
+  }
+  if (epoll_fd_ >= 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+  close(fd);
+  clients_.erase(it);
+  num_clients_ = clients_.size();
+}
+
+}  // namespace stream
+}  // namespace zetton
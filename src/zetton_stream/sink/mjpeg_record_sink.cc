@@ -0,0 +1,242 @@
+#include "zetton_stream/sink/mjpeg_record_sink.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+}
+
+#include <cstdio>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+std::string AvErrorToStr(int error) {
+  char str[AV_ERROR_MAX_STRING_SIZE] = {0};
+  av_strerror(error, str, sizeof(str));
+  return str;
+}
+
+}  // namespace
+
+MjpegRecordSink::~MjpegRecordSink() { Close(); }
+
+bool MjpegRecordSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_FILE ||
+      options_.resource.location.empty()) {
+    AERROR_F("{} is not a file", options_.resource.string);
+    return false;
+  }
+  path_ = options_.resource.location;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+  av_register_all();
+#endif
+  return true;
+}
+
+bool MjpegRecordSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (packet_ == nullptr) {
+    packet_ = av_packet_alloc();
+    if (packet_ == nullptr) {
+      AERROR_F("cannot allocate packet for {}", path_);
+      return false;
+    }
+  }
+  // the segment is opened with the first frame, which has the image size
+  segment_index_ = 0;
+  is_streaming_ = true;
+  return true;
+}
+
+void MjpegRecordSink::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CloseSegment();
+  av_packet_free(&packet_);
+  is_streaming_ = false;
+}
+
+std::string MjpegRecordSink::GetCurrentPath() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return context_ != nullptr ? GetSegmentPath(segment_index_ - 1) : "";
+}
+
+std::string MjpegRecordSink::GetSegmentPath(uint32_t index) const {
+  if (segment_.max_bytes == 0 && segment_.max_duration_s == 0) {
+    return path_;
+  }
+  // the number goes before the extension
+  const size_t slash = path_.find_last_of('/');
+  size_t dot = path_.find_last_of('.');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    dot = path_.size();
+  }
+  char number[16];
+  snprintf(number, sizeof(number), "_%05u", index);
+  return path_.substr(0, dot) + number + path_.substr(dot);
+}
+
+bool MjpegRecordSink::Render(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  bool written = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    written = packet_ != nullptr && WritePacket(*frame, frame->timestamp_ns);
+  }
+  return BaseStreamSink::Render(frame) && written;
+}
+
+bool MjpegRecordSink::WritePacket(const Frame& frame, uint64_t timestamp_ns) {
+  if (frame.pixel_format != StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    AERROR_F("cannot record {} frames without encoding them",
+             StreamPixelFormatToStr(frame.pixel_format));
+    return false;
+  }
+  const size_t size =
+      frame.bytes_used > 0 && frame.bytes_used < frame.planes[0].size
+          ? frame.bytes_used
+          : frame.planes[0].size;
+  if (timestamp_ns == 0) {
+    timestamp_ns = NowNs();
+  }
+
+  // 1. move on to the next segment when the current one is full
+  if (context_ != nullptr && last_pts_ >= 0 &&
+      ((segment_.max_bytes > 0 &&
+        static_cast<uint64_t>(avio_tell(context_->pb)) + size >
+            segment_.max_bytes) ||
+       (segment_.max_duration_s > 0 &&
+        timestamp_ns - segment_start_ns_ >=
+            segment_.max_duration_s * 1000000000ULL))) {
+    CloseSegment();
+  }
+  if (context_ == nullptr) {
+    if (!OpenSegment(frame)) {
+      return false;
+    }
+    segment_start_ns_ = timestamp_ns;
+  }
+  if (frame.width != width_ || frame.height != height_) {
+    AERROR_F("cannot record {}x{} frame to a recording of {}x{}",
+             frame.width, frame.height, width_, height_);
+    return false;
+  }
+  if (timestamp_ns < segment_start_ns_) {
+    // clock went backwards, e.g. after the device was reopened
+    timestamp_ns = segment_start_ns_;
+  }
+
+  // 2. the JPEG as it is, at the driver timestamp
+  const AVRational ns = {1, 1000000000};
+  int64_t pts = av_rescale_q(
+      static_cast<int64_t>(timestamp_ns - segment_start_ns_), ns,
+      stream_->time_base);
+  if (pts <= last_pts_) {
+    pts = last_pts_ + 1;
+  }
+  av_packet_unref(packet_);
+  // the muxer writes it right away, so it does not need a reference
+  packet_->data = frame.GetData();
+  packet_->size = static_cast<int>(size);
+  packet_->stream_index = stream_->index;
+  packet_->flags |= AV_PKT_FLAG_KEY;
+  packet_->pts = pts;
+  packet_->dts = pts;
+  const int ret = av_write_frame(context_, packet_);
+  packet_->data = nullptr;
+  packet_->size = 0;
+  if (ret < 0) {
+    AERROR_F("cannot write frame to {}: {}",
+             GetSegmentPath(segment_index_ - 1), AvErrorToStr(ret));
+    return false;
+  }
+  last_pts_ = pts;
+  ++frames_written_;
+  return true;
+}
+
+bool MjpegRecordSink::OpenSegment(const Frame& frame) {
+  const std::string path = GetSegmentPath(segment_index_);
+
+  // 1. container from the file name
+  int ret = avformat_alloc_output_context2(&context_, nullptr, nullptr,
+                                           path.c_str());
+  if (ret < 0 || context_ == nullptr) {
+    AERROR_F("cannot find a container for {}: {}", path, AvErrorToStr(ret));
+    context_ = nullptr;
+    return false;
+  }
+
+  // 2. one MJPEG stream, the time base is the frame interval for AVI. other
+  // containers may pick another one when the header is written
+  const AVRational frame_rate = av_d2q(
+      options_.frame_rate > 0 ? options_.frame_rate : 30.0, 1000000);
+  stream_ = avformat_new_stream(context_, nullptr);
+  if (stream_ == nullptr) {
+    AERROR_F("cannot add a stream to {}", path);
+    avformat_free_context(context_);
+    context_ = nullptr;
+    return false;
+  }
+  stream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+  stream_->codecpar->codec_id = AV_CODEC_ID_MJPEG;
+  stream_->codecpar->width = frame.width;
+  stream_->codecpar->height = frame.height;
+  stream_->time_base = av_inv_q(frame_rate);
+  stream_->avg_frame_rate = frame_rate;
+
+  // 3. file and header
+  if (!(context_->oformat->flags & AVFMT_NOFILE)) {
+    ret = avio_open(&context_->pb, path.c_str(), AVIO_FLAG_WRITE);
+    if (ret < 0) {
+      AERROR_F("cannot open {}: {}", path, AvErrorToStr(ret));
+      avformat_free_context(context_);
+      context_ = nullptr;
+      return false;
+    }
+  }
+  ret = avformat_write_header(context_, nullptr);
+  if (ret < 0) {
+    AERROR_F("cannot write header of {}: {}", path, AvErrorToStr(ret));
+    avio_closep(&context_->pb);
+    avformat_free_context(context_);
+    context_ = nullptr;
+    return false;
+  }
+
+  width_ = frame.width;
+  height_ = frame.height;
+  last_pts_ = -1;
+  ++segment_index_;
+  AINFO_F("recording {}x{} MJPEG to {}", width_, height_, path);
+  return true;
+}
+
+void MjpegRecordSink::CloseSegment() {
+  if (context_ == nullptr) {
+    return;
+  }
+  const int ret = av_write_trailer(context_);
+  if (ret < 0) {
+    AERROR_F("cannot write trailer of {}: {}",
+             GetSegmentPath(segment_index_ - 1), AvErrorToStr(ret));
+  }
+  if (!(context_->oformat->flags & AVFMT_NOFILE)) {
+    avio_closep(&context_->pb);
+  }
+  avformat_free_context(context_);
+  context_ = nullptr;
+  stream_ = nullptr;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,308 @@
+#include "zetton_stream/sink/rtp_stream_sink.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// messages and packets of a sendmmsg() batch
+constexpr size_t kMaxMessages = 64;
+constexpr size_t kMaxBatchPackets = 256;
+// packets the kernel segments a message into at most, and the size of it
+constexpr size_t kMaxSegments = 64;
+constexpr size_t kMaxGsoSize = 65000;
+constexpr int kSendBufferSize = 4 << 20;
+
+// 90 kHz clock of video, wrapping like rtp timestamps do
+inline uint32_t NsToRtpTime(uint64_t ns) {
+  const uint64_t seconds = ns / 1000000000;
+  const uint64_t rest = ns % 1000000000;
+  return static_cast<uint32_t>(seconds * kRtpVideoClockRate +
+                               rest * kRtpVideoClockRate / 1000000000);
+}
+
+}  // namespace
+
+RtpStreamSink::~RtpStreamSink() { Close(); }
+
+bool RtpStreamSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_RTP ||
+      options_.resource.port <= 0) {
+    AERROR_F("{} is not an rtp address", options_.resource.string);
+    return false;
+  }
+  return true;
+}
+
+bool RtpStreamSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    return true;
+  }
+
+  // 1. socket of the destination
+  const std::string& address = options_.resource.location;
+  const int port = options_.resource.port;
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    AERROR_F("invalid address {}", address);
+    return false;
+  }
+  fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 ||
+      connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    AERROR_F("cannot connect to {}:{}: {}", address, port, strerror(errno));
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    return false;
+  }
+  if (setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &kSendBufferSize,
+                 sizeof(kSendBufferSize)) < 0) {
+    AWARN_F("cannot set send buffer of {}:{}: {}", address, port,
+            strerror(errno));
+  }
+
+  // 2. segmentation offload, which kernels before 4.18 do not have
+  int segment = 0;
+  socklen_t segment_size = sizeof(segment);
+  gso_enabled_ = gso_ && getsockopt(fd_, IPPROTO_UDP, UDP_SEGMENT, &segment,
+                                    &segment_size) == 0;
+
+  // 3. packets and batches
+  std::random_device random;
+  if (!packetizer_.Init(random(), max_packet_size_)) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  timestamp_offset_ = random();
+  messages_.resize(kMaxMessages);
+  iovecs_.resize(kMaxBatchPackets * (1 + kRtpMaxPayloads));
+  controls_.assign(kMaxMessages * CMSG_SPACE(sizeof(uint16_t)), 0);
+  message_packets_.resize(kMaxMessages);
+  next_send_ns_ = 0;
+
+  is_streaming_ = true;
+  AINFO_F("streaming RTP to {}:{}{}", address, port,
+          gso_enabled_ ? " with segmentation offload" : "");
+  return true;
+}
+
+void RtpStreamSink::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  is_streaming_ = false;
+}
+
+bool RtpStreamSink::Render(const FramePtr& frame) {
+  if (frame == nullptr) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+      AERROR_F("render error. sink is not open");
+      return false;
+    }
+
+    // 1. packets of the frame, on the clock of its timestamp
+    const uint64_t timestamp_ns =
+        frame->timestamp_ns > 0 ? frame->timestamp_ns : NowNs();
+    const uint32_t timestamp = timestamp_offset_ + NsToRtpTime(timestamp_ns);
+    if (!packetizer_.Packetize(*frame, timestamp, &packets_)) {
+      return false;
+    }
+
+    // 2. send
+    if (!Send(packets_)) {
+      return false;
+    }
+    ++frames_sent_;
+  }
+  return BaseStreamSink::Render(frame);
+}
+
+bool RtpStreamSink::Send(const std::vector<RtpPacket>& packets) {
+  // bursts of a millisecond when paced
+  const uint64_t bit_rate = options_.bit_rate;
+  const size_t burst =
+      bit_rate > 0 ? std::max<size_t>(bit_rate / 8000, max_packet_size_)
+                   : kMaxGsoSize * kMaxMessages;
+  size_t next = 0;
+  while (next < packets.size()) {
+    // 1. a batch of messages
+    size_t num_messages = 0;
+    size_t num_iovecs = 0;
+    size_t bytes = 0;
+    size_t batch_packets = 0;
+    while (next + batch_packets < packets.size() &&
+           num_messages < kMaxMessages && bytes < burst) {
+      const size_t first = next + batch_packets;
+      const size_t n = AddMessage(packets, first, burst - bytes,
+                                  num_messages, &num_iovecs);
+      if (n == 0) {
+        break;
+      }
+      for (size_t i = first; i < first + n; ++i) {
+        bytes += packets[i].GetSize();
+      }
+      message_packets_[num_messages++] = n;
+      batch_packets += n;
+    }
+
+    // 2. at the bit rate
+    Pace(bytes);
+    size_t num_sent = 0;
+    const bool sent = SendMessages(num_messages, &num_sent);
+    for (size_t i = 0; i < num_sent; ++i) {
+      next += message_packets_[i];
+      packets_sent_ += message_packets_[i];
+    }
+    if (!sent) {
+      if (errno != EIO || !gso_enabled_) {
+        AERROR_F("cannot send to {}: {}", options_.resource.string,
+                 strerror(errno));
+        return false;
+      }
+      // the device cannot checksum segments, send them one by one
+      AWARN_F("disabled segmentation offload to {}",
+              options_.resource.string);
+      gso_enabled_ = false;
+    }
+  }
+  for (const auto& packet : packets) {
+    bytes_sent_ += packet.GetSize();
+  }
+  return true;
+}
+
+size_t RtpStreamSink::AddMessage(const std::vector<RtpPacket>& packets,
+                                 size_t first, size_t max_bytes,
+                                 size_t num_messages, size_t* num_iovecs) {
+  // 1. packets of the same size, the last one may be shorter
+  const size_t segment_size = packets[first].GetSize();
+  size_t count = 1;
+  if (gso_enabled_) {
+    const size_t max_size = std::min(kMaxGsoSize, max_bytes);
+    while (first + count < packets.size() && count < kMaxSegments &&
+           (count + 1) * segment_size <= max_size) {
+      const size_t size = packets[first + count].GetSize();
+      if (size > segment_size) {
+        break;
+      }
+      ++count;
+      if (size < segment_size) {
+        break;
+      }
+    }
+  }
+  size_t needed = 0;
+  for (size_t i = first; i < first + count; ++i) {
+    needed += 1 + packets[i].num_payloads;
+  }
+  if (*num_iovecs + needed > iovecs_.size()) {
+    if (*num_iovecs > 0) {
+      return 0;
+    }
+    // fewer packets in a message of its own
+    count = 1;
+  }
+
+  // 2. headers and pieces of the frame, without copying them
+  mmsghdr& message = messages_[num_messages];
+  memset(&message, 0, sizeof(message));
+  message.msg_hdr.msg_iov = &iovecs_[*num_iovecs];
+  for (size_t i = first; i < first + count; ++i) {
+    const RtpPacket& packet = packets[i];
+    iovec& header = iovecs_[(*num_iovecs)++];
+    header.iov_base = const_cast<uint8_t*>(packet.header);
+    header.iov_len = packet.header_size;
+    for (int j = 0; j < packet.num_payloads; ++j) {
+      iovec& payload = iovecs_[(*num_iovecs)++];
+      payload.iov_base = const_cast<uint8_t*>(packet.payload[j]);
+      payload.iov_len = packet.payload_size[j];
+    }
+  }
+  message.msg_hdr.msg_iovlen =
+      static_cast<size_t>(&iovecs_[*num_iovecs] - message.msg_hdr.msg_iov);
+
+  // 3. segment size for the kernel
+  if (count > 1) {
+    uint8_t* control = &controls_[num_messages * CMSG_SPACE(sizeof(uint16_t))];
+    message.msg_hdr.msg_control = control;
+    message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    const uint16_t size = static_cast<uint16_t>(segment_size);
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+  }
+  return count;
+}
+
+bool RtpStreamSink::SendMessages(size_t num_messages, size_t* num_sent) {
+  *num_sent = 0;
+  while (*num_sent < num_messages) {
+    const int n = sendmmsg(fd_, &messages_[*num_sent],
+                           static_cast<unsigned int>(num_messages - *num_sent),
+                           0);
+    if (n > 0) {
+      *num_sent += static_cast<size_t>(n);
+      continue;
+    }
+    // a receiver that is not there yet reports an error, keep sending
+    if (n < 0 && (errno == EINTR || errno == ECONNREFUSED)) {
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+void RtpStreamSink::Pace(size_t bytes) {
+  const uint64_t bit_rate = options_.bit_rate;
+  if (bit_rate == 0 || bytes == 0) {
+    return;
+  }
+  // time without frames is not made up for by bursts
+  const uint64_t now = NowNs();
+  if (next_send_ns_ > now) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(next_send_ns_ - now));
+  } else {
+    next_send_ns_ = now;
+  }
+  next_send_ns_ += bytes * 8 * 1000000000ull / bit_rate;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,210 @@
+#include "zetton_stream/sink/shm_stream_sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// planes of a slot start on this boundary
+constexpr size_t kPlaneAlignment = 64;
+
+size_t RoundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+// owner of a frame handed out by AcquireFrame(), gives the slot back if the
+// frame is released without being published
+struct ShmStreamSink::SlotClaim {
+  ShmFrameRingPtr ring;
+  std::shared_ptr<ClaimTable> claims;
+  int slot;
+  uint64_t id;
+
+  ~SlotClaim() {
+    uint64_t expected = id;
+    if ((*claims)[slot].compare_exchange_strong(expected, 0)) {
+      ring->Abort(slot);
+    }
+  }
+};
+
+ShmStreamSink::~ShmStreamSink() { Close(); }
+
+bool ShmStreamSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.location.empty()) {
+    AERROR_F("missing shared memory name in {}", options_.resource.string);
+    return false;
+  }
+  const int bytes_per_pixel = GetBytesPerPixel(options_.output_format);
+  if (options_.width == 0 || options_.height == 0 ||
+      (bytes_per_pixel == 0 &&
+       options_.output_format != StreamPixelFormat::PIXEL_FORMAT_MJPEG)) {
+    AERROR_F("invalid shared memory frames of {}x{} {}", options_.width,
+             options_.height, StreamPixelFormatToStr(options_.output_format));
+    return false;
+  }
+
+  // room for the aligned frame and the alignment of every plane
+  const size_t stride =
+      RoundUp(static_cast<size_t>(options_.width) * bytes_per_pixel,
+              kPlaneAlignment);
+  slot_size_ = GetFrameSize(options_.output_format, options_.width,
+                            options_.height, static_cast<int>(stride)) +
+               kPlaneAlignment * kMaxFramePlanes;
+  return true;
+}
+
+bool ShmStreamSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ring_) {
+    return true;
+  }
+  const int num_slots = std::min(
+      std::max(static_cast<int>(options_.num_buffers), 2), kShmMaxSlots);
+  ring_ = ShmFrameRing::Create(options_.resource.location, num_slots,
+                               slot_size_);
+  if (!ring_) {
+    return false;
+  }
+  claims_ = std::make_shared<ClaimTable>();
+  is_streaming_ = true;
+  return true;
+}
+
+void ShmStreamSink::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // frames still acquired keep the ring mapped until they are released
+  ring_.reset();
+  claims_.reset();
+  is_streaming_ = false;
+}
+
+bool ShmStreamSink::Render(const FramePtr& frame) {
+  if (frame == nullptr) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  const bool published = Publish(*frame);
+  return BaseStreamSink::Render(frame) && published;
+}
+
+int ShmStreamSink::FindClaimedSlot(const Frame& frame) {
+  const uint8_t* data = frame.GetData();
+  for (int i = 0; i < ring_->GetNumSlots(); ++i) {
+    const uint8_t* slot = ring_->GetSlotData(i);
+    if (data >= slot && data < slot + ring_->GetSlotSize()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+FramePtr ShmStreamSink::AcquireFrame() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!ring_) {
+    AERROR_F("shared memory sink is not open");
+    return nullptr;
+  }
+
+  // 1. claim a slot that no reader holds
+  const int slot = ring_->ClaimSlot();
+  if (slot < 0) {
+    ++frames_dropped_;
+    ADEBUG_F("no free slot in shared memory {}", ring_->GetName());
+    return nullptr;
+  }
+
+  // 2. lay out the frame in it, owned by the claim
+  auto claim = std::make_shared<SlotClaim>();
+  claim->ring = ring_;
+  claim->claims = claims_;
+  claim->slot = slot;
+  claim->id = next_claim_++;
+  (*claims_)[slot].store(claim->id);
+  const int bytes_per_pixel = GetBytesPerPixel(options_.output_format);
+  const int stride = static_cast<int>(
+      RoundUp(static_cast<size_t>(options_.width) * bytes_per_pixel,
+              kPlaneAlignment));
+  auto frame = std::make_shared<Frame>();
+  frame->Wrap(options_.output_format, static_cast<int>(options_.width),
+              static_cast<int>(options_.height), ring_->GetSlotData(slot),
+              stride, claim, FrameMemory::MEMORY_BORROWED);
+  return frame;
+}
+
+bool ShmStreamSink::Publish(const Frame& frame) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!ring_) {
+    AERROR_F("shared memory sink is not open");
+    return false;
+  }
+  if (!frame.IsMapped()) {
+    AERROR_F("cannot publish a frame without memory");
+    return false;
+  }
+
+  // 1. frames acquired from this sink are already in their slot
+  ShmFrameInfo info;
+  int slot = FindClaimedSlot(frame);
+  if (slot >= 0) {
+    if ((*claims_)[slot].exchange(0) == 0) {
+      AERROR_F("frame of slot {} was already published", slot);
+      return false;
+    }
+    GetShmFrameInfo(frame, ring_->GetSlotData(slot), &info);
+    ring_->Publish(slot, info);
+    ++frames_published_;
+    return true;
+  }
+
+  // 2. check the frame fits, compressed frames only take their payload
+  Frame copy = frame;
+  size_t size = 0;
+  for (int i = 0; i < frame.num_planes; ++i) {
+    if (frame.num_planes == 1 && frame.bytes_used > 0 &&
+        frame.bytes_used < frame.planes[0].size) {
+      copy.planes[0].size = frame.bytes_used;
+    }
+    size = RoundUp(size, kPlaneAlignment) + copy.planes[i].size;
+  }
+  if (size > ring_->GetSlotSize()) {
+    AERROR_F("{}x{} {} frame of {} bytes does not fit into slots of {} bytes",
+             frame.width, frame.height,
+             StreamPixelFormatToStr(frame.pixel_format), size,
+             ring_->GetSlotSize());
+    return false;
+  }
+
+  // 3. copy it to a slot that no reader holds
+  slot = ring_->ClaimSlot();
+  if (slot < 0) {
+    ++frames_dropped_;
+    ADEBUG_F("no free slot in shared memory {}", ring_->GetName());
+    return false;
+  }
+  uint8_t* data = ring_->GetSlotData(slot);
+  size_t offset = 0;
+  for (int i = 0; i < frame.num_planes; ++i) {
+    offset = RoundUp(offset, kPlaneAlignment);
+    memcpy(data + offset, frame.planes[i].data, copy.planes[i].size);
+    copy.planes[i].data = data + offset;
+    offset += copy.planes[i].size;
+  }
+
+  // 4. make it visible to the readers
+  GetShmFrameInfo(copy, data, &info);
+  ring_->Publish(slot, info);
+  ++frames_published_;
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
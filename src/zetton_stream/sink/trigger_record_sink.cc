@@ -0,0 +1,393 @@
+#include "zetton_stream/sink/trigger_record_sink.h"
+
+#include <strings.h>
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/sink/file_stream_sink.h"
+#include "zetton_stream/sink/mjpeg_record_sink.h"
+#include "zetton_stream/util/clock.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// frames start on cache lines in the ring
+constexpr size_t kSlotAlignment = 64;
+
+inline uint64_t SecondsToNs(double seconds) {
+  return seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0;
+}
+
+// bytes of a frame in the ring, the payload of compressed frames
+size_t GetStoredSize(const Frame& frame) {
+  if (GetBytesPerPixel(frame.pixel_format) == 0) {
+    return frame.bytes_used > 0 && frame.bytes_used < frame.planes[0].size
+               ? frame.bytes_used
+               : frame.planes[0].size;
+  }
+  return frame.GetSize();
+}
+
+}  // namespace
+
+TriggerRecordSink::~TriggerRecordSink() { Close(); }
+
+bool TriggerRecordSink::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_FILE ||
+      options_.resource.location.empty()) {
+    AERROR_F("{} is not a file", options_.resource.string);
+    return false;
+  }
+  path_ = options_.resource.location;
+  return true;
+}
+
+bool TriggerRecordSink::IsMjpegContainer() const {
+  const char* extension = options_.resource.extension.c_str();
+  return strcasecmp(extension, "avi") == 0 ||
+         strcasecmp(extension, "mkv") == 0;
+}
+
+bool TriggerRecordSink::IsFormatSupported(StreamPixelFormat format) const {
+  if (IsMjpegContainer()) {
+    return format == StreamPixelFormat::PIXEL_FORMAT_MJPEG;
+  }
+  FileStreamSink file;
+  return file.Init(options_) && file.IsFormatSupported(format);
+}
+
+bool TriggerRecordSink::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_.joinable()) {
+    return true;
+  }
+  if (trigger_.buffer_size < kSlotAlignment || trigger_.max_frames == 0) {
+    AERROR_F("invalid ring of {} bytes and {} frames", trigger_.buffer_size,
+             trigger_.max_frames);
+    return false;
+  }
+
+  // 1. the ring, touched once so that it is backed by memory
+  buffer_.reset(new (std::nothrow) uint8_t[trigger_.buffer_size]);
+  if (buffer_ == nullptr) {
+    AERROR_F("cannot allocate ring of {} bytes", trigger_.buffer_size);
+    return false;
+  }
+  memset(buffer_.get(), 0, trigger_.buffer_size);
+  slots_.assign(trigger_.max_frames, Slot());
+  for (auto& slot : slots_) {
+    slot.frame = std::make_shared<Frame>();
+  }
+  head_ = 0;
+  count_ = 0;
+  write_offset_ = 0;
+  recording_ = false;
+  last_ns_ = 0;
+  num_pending_ = 0;
+  stop_ = false;
+
+  // 2. writer
+  thread_ = std::thread(&TriggerRecordSink::Run, this);
+  is_streaming_ = true;
+  AINFO_F("keeping {}s of frames in {} bytes for {}", trigger_.pre_seconds,
+          trigger_.buffer_size, path_);
+  return true;
+}
+
+void TriggerRecordSink::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      return;
+    }
+    // the event in progress ends here, what is in the ring is written
+    stop_ = true;
+    recording_ = false;
+  }
+  cond_.notify_all();
+  thread_.join();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  slots_.clear();
+  buffer_.reset();
+  count_ = 0;
+  is_streaming_ = false;
+}
+
+bool TriggerRecordSink::IsRecording() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return recording_ || num_pending_ > 0;
+}
+
+void TriggerRecordSink::Trigger() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffer_ == nullptr) {
+    AERROR_F("cannot trigger {}, not open", path_);
+    return;
+  }
+  const uint64_t post_ns = SecondsToNs(trigger_.post_seconds);
+  end_ns_ = last_ns_ > 0 ? last_ns_ + post_ns : 0;
+  if (recording_) {
+    AINFO_F("event {} of {} extended", event_index_, path_);
+    return;
+  }
+
+  // 1. the frames of the last pre_seconds, the newest ones of the ring. the
+  // frames of an earlier event still waiting for the disk stay in it
+  recording_ = true;
+  event_index_ = num_events_++;
+  const uint64_t pre_ns = SecondsToNs(trigger_.pre_seconds);
+  uint32_t num_frames = 0;
+  for (uint32_t n = count_; n > 0; --n) {
+    Slot& slot = GetSlot(n - 1);
+    if (slot.pending || slot.timestamp_ns + pre_ns < last_ns_) {
+      break;
+    }
+    slot.pending = true;
+    slot.event = event_index_;
+    ++num_frames;
+  }
+  num_pending_ += num_frames;
+  cond_.notify_one();
+  AINFO_F("event {} of {} triggered with {} frames before it", event_index_,
+          path_, num_frames);
+}
+
+bool TriggerRecordSink::Render(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("render error. frame is null");
+    return false;
+  }
+  const uint64_t timestamp_ns =
+      frame->timestamp_ns > 0 ? frame->timestamp_ns : NowNs();
+  bool stored = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_ == nullptr) {
+      AERROR_F("cannot record to {}, not open", path_);
+      return false;
+    }
+    // 1. the event ends with the first frame after it
+    if (recording_) {
+      if (end_ns_ == 0) {
+        end_ns_ = timestamp_ns + SecondsToNs(trigger_.post_seconds);
+      } else if (timestamp_ns > end_ns_) {
+        recording_ = false;
+        cond_.notify_one();
+      }
+    }
+    last_ns_ = timestamp_ns;
+
+    // 2. into the ring
+    stored = Store(*frame, timestamp_ns);
+  }
+  return BaseStreamSink::Render(frame) && stored;
+}
+
+bool TriggerRecordSink::Reserve(size_t size, uint64_t timestamp_ns,
+                                size_t* offset) {
+  // free space follows the newest frame, up to the end of the buffer and
+  // from its start up to the oldest frame
+  auto fits = [&]() {
+    if (count_ == 0) {
+      *offset = 0;
+      return true;
+    }
+    const size_t start = GetSlot(0).offset;
+    if (write_offset_ > start) {
+      if (trigger_.buffer_size - write_offset_ >= size) {
+        *offset = write_offset_;
+        return true;
+      }
+      if (start >= size) {
+        *offset = 0;
+        return true;
+      }
+      return false;
+    }
+    if (start - write_offset_ >= size) {
+      *offset = write_offset_;
+      return true;
+    }
+    return false;
+  };
+
+  // evict written frames while there is no room, and those older than the
+  // pre-trigger window anyway
+  const uint64_t pre_ns = SecondsToNs(trigger_.pre_seconds);
+  while (count_ > 0) {
+    const Slot& oldest = GetSlot(0);
+    const bool is_recent = oldest.timestamp_ns + pre_ns >= timestamp_ns;
+    if (oldest.pending || (count_ < slots_.size() && is_recent && fits())) {
+      break;
+    }
+    head_ = (head_ + 1) % slots_.size();
+    --count_;
+  }
+  return count_ < slots_.size() && fits();
+}
+
+bool TriggerRecordSink::Store(const Frame& frame, uint64_t timestamp_ns) {
+  // 1. room in the ring
+  const size_t size = GetStoredSize(frame);
+  const size_t reserved =
+      (size + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+  size_t offset = 0;
+  if (size == 0 || reserved > trigger_.buffer_size ||
+      !Reserve(reserved, timestamp_ns, &offset)) {
+    ++frames_dropped_;
+    ADEBUG_F("ring of {} is full, dropped frame {}", path_, frame.sequence);
+    return false;
+  }
+
+  // 2. the planes one after the other, strides kept
+  Slot& slot = GetSlot(count_);
+  Frame& view = *slot.frame;
+  view.pixel_format = frame.pixel_format;
+  view.width = frame.width;
+  view.height = frame.height;
+  view.num_planes = frame.num_planes;
+  view.planes.fill(FramePlane());
+  uint8_t* data = buffer_.get() + offset;
+  if (GetBytesPerPixel(frame.pixel_format) == 0) {
+    memcpy(data, frame.GetData(), size);
+    view.planes[0].data = data;
+    view.planes[0].size = size;
+  } else {
+    for (int i = 0; i < frame.num_planes; ++i) {
+      const FramePlane& plane = frame.planes[i];
+      memcpy(data, plane.data, plane.size);
+      view.planes[i].data = data;
+      view.planes[i].stride = plane.stride;
+      view.planes[i].size = plane.size;
+      data += plane.size;
+    }
+  }
+  view.memory = FrameMemory::MEMORY_BORROWED;
+  view.owner.reset();
+  view.timestamp_ns = timestamp_ns;
+  view.system_timestamp_ns = frame.system_timestamp_ns;
+  view.sequence = frame.sequence;
+  view.dropped_frames = frame.dropped_frames;
+  view.flags = frame.flags;
+  view.bytes_used = frame.bytes_used;
+
+  slot.offset = offset;
+  slot.size = reserved;
+  slot.timestamp_ns = timestamp_ns;
+  slot.pending = recording_;
+  slot.event = event_index_;
+  write_offset_ = offset + reserved;
+  ++count_;
+  if (slot.pending) {
+    ++num_pending_;
+    cond_.notify_one();
+  }
+  return true;
+}
+
+std::string TriggerRecordSink::GetEventPath(uint32_t index) const {
+  // the number goes before the extension
+  const size_t slash = path_.find_last_of('/');
+  size_t dot = path_.find_last_of('.');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    dot = path_.size();
+  }
+  char number[16];
+  snprintf(number, sizeof(number), "_%05u", index);
+  return path_.substr(0, dot) + number + path_.substr(dot);
+}
+
+std::unique_ptr<BaseStreamSink> TriggerRecordSink::OpenEvent(uint32_t index) {
+  StreamOptions options = options_;
+  options.resource = "file://" + GetEventPath(index);
+  std::unique_ptr<BaseStreamSink> writer;
+  if (IsMjpegContainer()) {
+    writer.reset(new MjpegRecordSink());
+  } else {
+    // the ring holds the frames while the disk catches up
+    auto* file = new FileStreamSink();
+    file->SetBlocking(true);
+    writer.reset(file);
+  }
+  if (!writer->Init(options) || !writer->Open()) {
+    AERROR_F("cannot record event {} to {}", index, options.resource.string);
+    return nullptr;
+  }
+  return writer;
+}
+
+void TriggerRecordSink::Run() {
+  std::unique_ptr<BaseStreamSink> writer;
+  uint32_t writer_event = 0;
+  bool writer_failed = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto is_event_over = [&] {
+    return !recording_ || writer_event != event_index_;
+  };
+  while (true) {
+    cond_.wait(lock, [&] {
+      return stop_ || num_pending_ > 0 ||
+             ((writer != nullptr || writer_failed) && is_event_over());
+    });
+
+    // 1. the oldest frame waiting, in the file of its event. frames after an
+    // event that are not part of the next one are skipped
+    if (num_pending_ > 0) {
+      uint32_t n = 0;
+      while (!GetSlot(n).pending) {
+        ++n;
+      }
+      Slot* slot = &GetSlot(n);
+      if ((writer == nullptr && !writer_failed) ||
+          slot->event != writer_event) {
+        const uint32_t event = slot->event;
+        lock.unlock();
+        if (writer != nullptr) {
+          writer->Close();
+        }
+        writer = OpenEvent(event);
+        lock.lock();
+        writer_event = event;
+        writer_failed = writer == nullptr;
+      }
+      // the slot is not reused while it is pending
+      const FramePtr frame = slot->frame;
+      lock.unlock();
+      const bool written = writer != nullptr && writer->Render(frame);
+      lock.lock();
+      if (written) {
+        ++frames_written_;
+      }
+      slot->pending = false;
+      --num_pending_;
+      continue;
+    }
+
+    // 2. event over and on disk
+    if (writer != nullptr || writer_failed) {
+      lock.unlock();
+      if (writer != nullptr) {
+        writer->Close();
+        writer.reset();
+      }
+      lock.lock();
+      writer_failed = false;
+      continue;
+    }
+    if (stop_) {
+      break;
+    }
+  }
+}
+
+}  // namespace stream
+}  // namespace zetton
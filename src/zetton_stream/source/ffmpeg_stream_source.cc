@@ -0,0 +1,727 @@
+#include "zetton_stream/source/ffmpeg_stream_source.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// packets the demuxer reads ahead of the decoder at most
+constexpr size_t kMaxPackets = 256;
+constexpr size_t kMaxPacketBytes = 32 << 20;
+// decoded frames waiting for Acquire()
+constexpr size_t kMaxFrames = 2;
+// blocking reads of network streams give up after this
+constexpr uint64_t kIoTimeoutNs = 5000000000ull;
+// a file decoder waiting for a frame of the pool checks for Close() this often
+constexpr int kPoolWaitMs = 100;
+// a lost live stream is reopened after this, doubled after every failure
+constexpr int kMinReconnectMs = 100;
+constexpr int kMaxReconnectMs = 5000;
+
+std::string AvErrorToStr(int error) {
+  char str[AV_ERROR_MAX_STRING_SIZE] = {0};
+  av_strerror(error, str, sizeof(str));
+  return str;
+}
+
+// libav layout of a frame format, AV_PIX_FMT_NONE if it has none
+AVPixelFormat ToAvPixelFormat(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+      return AV_PIX_FMT_YUYV422;
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+      return AV_PIX_FMT_UYVY422;
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+      return AV_PIX_FMT_NV12;
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return AV_PIX_FMT_NV16;
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+      return AV_PIX_FMT_GRAY8;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+      return AV_PIX_FMT_RGB24;
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      return AV_PIX_FMT_BGR24;
+    case StreamPixelFormat::PIXEL_FORMAT_RGBA:
+      return AV_PIX_FMT_RGBA;
+    case StreamPixelFormat::PIXEL_FORMAT_BGRA:
+      return AV_PIX_FMT_BGRA;
+    default:
+      return AV_PIX_FMT_NONE;
+  }
+}
+
+}  // namespace
+
+FfmpegStreamSource::~FfmpegStreamSource() { Close(); }
+
+bool FfmpegStreamSource::Init(const StreamOptions& options) {
+  options_ = options;
+  switch (options_.resource.protocol) {
+    case StreamProtocolType::PROTOCOL_FILE:
+      url_ = options_.resource.location;
+      live_ = false;
+      break;
+    case StreamProtocolType::PROTOCOL_RTSP:
+    case StreamProtocolType::PROTOCOL_RTP:
+      url_ = options_.resource.string;
+      live_ = true;
+      break;
+    default:
+      AERROR_F("cannot decode {}", options_.resource.string);
+      return false;
+  }
+  if (ToAvPixelFormat(options_.pixel_format) == AV_PIX_FMT_NONE) {
+    AERROR_F("cannot decode to {} frames",
+             StreamPixelFormatToStr(options_.pixel_format));
+    return false;
+  }
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+  av_register_all();
+#endif
+  avformat_network_init();
+  return true;
+}
+
+bool FfmpegStreamSource::Open() {
+  if (read_thread_.joinable()) {
+    return true;
+  }
+  // a previous Close() would interrupt the input right away
+  stop_ = false;
+  if (!OpenInput()) {
+    ReleaseInput();
+    return false;
+  }
+
+  // 1. from the start, live streams from their next keyframe
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    serial_ = 0;
+    seek_requested_ = false;
+    skip_pts_ = AV_NOPTS_VALUE;
+    wait_keyframe_ = live_;
+    decoded_all_ = false;
+    position_ = 0;
+    sequence_ = 0;
+    passes_ = 0;
+  }
+
+  // 2. demuxer and decoder threads
+  read_thread_ = std::thread(&FfmpegStreamSource::Read, this);
+  decode_thread_ = std::thread(&FfmpegStreamSource::Decode, this);
+  is_streaming_ = true;
+  return true;
+}
+
+void FfmpegStreamSource::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  packet_cond_.notify_all();
+  frame_cond_.notify_all();
+  if (read_thread_.joinable()) {
+    read_thread_.join();
+  }
+  if (decode_thread_.joinable()) {
+    decode_thread_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ClearPackets();
+    // frames still held keep their buffers until they are released
+    frames_.clear();
+  }
+  ReleaseInput();
+  is_streaming_ = false;
+}
+
+bool FfmpegStreamSource::OpenInput() {
+  return OpenDemuxer() && OpenDecoder();
+}
+
+bool FfmpegStreamSource::OpenDemuxer() {
+  // 1. the container or the stream, network reads time out
+  format_ = avformat_alloc_context();
+  if (format_ == nullptr) {
+    AERROR_F("cannot allocate demuxer for {}", url_);
+    return false;
+  }
+  format_->interrupt_callback.callback = &FfmpegStreamSource::Interrupt;
+  format_->interrupt_callback.opaque = this;
+  AVDictionary* input_options = nullptr;
+  if (options_.resource.protocol == StreamProtocolType::PROTOCOL_RTSP) {
+    av_dict_set(&input_options, "rtsp_transport", rtsp_tcp_ ? "tcp" : "udp",
+                0);
+  }
+  if (options_.resource.extension == "sdp") {
+    // session descriptions of rtp streams
+    av_dict_set(&input_options, "protocol_whitelist", "file,udp,rtp", 0);
+  }
+  io_deadline_ns_ = live_ ? NowNs() + kIoTimeoutNs : 0;
+  int ret = avformat_open_input(&format_, url_.c_str(), nullptr,
+                                &input_options);
+  av_dict_free(&input_options);
+  if (ret < 0) {
+    io_deadline_ns_ = 0;
+    AERROR_F("cannot open {}: {}", url_, AvErrorToStr(ret));
+    return false;
+  }
+  ret = avformat_find_stream_info(format_, nullptr);
+  io_deadline_ns_ = 0;
+  if (ret < 0) {
+    AERROR_F("cannot find streams of {}: {}", url_, AvErrorToStr(ret));
+    return false;
+  }
+
+  // 2. the video stream, nothing else is read
+  stream_index_ = av_find_best_stream(format_, AVMEDIA_TYPE_VIDEO, -1, -1,
+                                      nullptr, 0);
+  if (stream_index_ < 0) {
+    AERROR_F("no video in {}", url_);
+    return false;
+  }
+  for (unsigned int i = 0; i < format_->nb_streams; ++i) {
+    if (static_cast<int>(i) != stream_index_) {
+      format_->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  const AVStream* stream = format_->streams[stream_index_];
+  if (codec_ != nullptr && stream->codecpar->codec_id != codec_->codec_id) {
+    // the decoder is kept across reconnects
+    AERROR_F("the video of {} changed its codec", url_);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  time_base_ = av_q2d(stream->time_base);
+  start_pts_ = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+  return true;
+}
+
+bool FfmpegStreamSource::OpenDecoder() {
+  // 1. the decoder of the video, with a thread per core
+  const AVStream* stream = format_->streams[stream_index_];
+  const AVCodec* decoder = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (decoder == nullptr) {
+    AERROR_F("no decoder for the video of {}", url_);
+    return false;
+  }
+  codec_ = avcodec_alloc_context3(decoder);
+  if (codec_ == nullptr ||
+      avcodec_parameters_to_context(codec_, stream->codecpar) < 0) {
+    AERROR_F("cannot set up {} decoder for {}", decoder->name, url_);
+    return false;
+  }
+  codec_->thread_count = 0;
+  codec_->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  codec_->pkt_timebase = stream->time_base;
+  const int ret = avcodec_open2(codec_, decoder, nullptr);
+  decoded_ = av_frame_alloc();
+  if (ret < 0 || decoded_ == nullptr) {
+    AERROR_F("cannot open {} decoder for {}: {}", decoder->name, url_,
+             AvErrorToStr(ret));
+    return false;
+  }
+  AINFO_F("decoding {}x{} {} from {} with {} threads", codec_->width,
+          codec_->height, decoder->name, url_, codec_->thread_count);
+  return true;
+}
+
+void FfmpegStreamSource::ReleaseInput() {
+  av_frame_free(&decoded_);
+  avcodec_free_context(&codec_);
+  avformat_close_input(&format_);
+  sws_freeContext(sws_);
+  sws_ = nullptr;
+  pool_.reset();
+  stream_index_ = -1;
+}
+
+int FfmpegStreamSource::Interrupt(void* opaque) {
+  auto* source = static_cast<FfmpegStreamSource*>(opaque);
+  const uint64_t deadline = source->io_deadline_ns_;
+  return source->stop_ || (deadline > 0 && NowNs() > deadline) ? 1 : 0;
+}
+
+void FfmpegStreamSource::Read() {
+  AVPacket* packet = av_packet_alloc();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (packet != nullptr && !stop_) {
+    // 1. seek before reading on, the queues were cleared already
+    if (seek_requested_) {
+      seek_requested_ = false;
+      const double seconds = seek_seconds_;
+      lock.unlock();
+      SeekInput(seconds);
+      lock.lock();
+      continue;
+    }
+    const uint32_t serial = serial_;
+    lock.unlock();
+
+    // 2. the next packet of the video
+    io_deadline_ns_ = live_ ? NowNs() + kIoTimeoutNs : 0;
+    const int ret = av_read_frame(format_, packet);
+    io_deadline_ns_ = 0;
+    if (ret >= 0 && packet->stream_index != stream_index_) {
+      av_packet_unref(packet);
+      lock.lock();
+      continue;
+    }
+    if (ret == AVERROR(EAGAIN)) {
+      lock.lock();
+      continue;
+    }
+
+    // 3. the end, from the start again while looping. live streams are
+    // opened again instead
+    if (ret < 0) {
+      lock.lock();
+      if (stop_) {
+        break;
+      }
+      if (live_) {
+        AWARN_F("lost {}: {}", url_, AvErrorToStr(ret));
+        lock.unlock();
+        const bool reconnected = Reconnect();
+        lock.lock();
+        if (!reconnected) {
+          break;
+        }
+        continue;
+      }
+      if (ret != AVERROR_EOF) {
+        AERROR_F("cannot read {}: {}", url_, AvErrorToStr(ret));
+      } else if (serial == serial_ &&
+                 (options_.loop < 0 || passes_ < options_.loop)) {
+        ++passes_;
+        skip_pts_ = AV_NOPTS_VALUE;
+        lock.unlock();
+        const bool rewound = SeekInput(0);
+        lock.lock();
+        if (rewound) {
+          continue;
+        }
+      }
+      // the decoder drains on an empty packet, then it waits for a seek
+      PushPacket(&lock, nullptr, serial);
+      packet_cond_.wait(lock, [this] { return stop_ || seek_requested_; });
+      continue;
+    }
+
+    // 4. to the decoder, which takes over the reference
+    AVPacket* queued = av_packet_alloc();
+    if (queued == nullptr) {
+      av_packet_unref(packet);
+      lock.lock();
+      continue;
+    }
+    av_packet_move_ref(queued, packet);
+    lock.lock();
+    if (!PushPacket(&lock, queued, serial)) {
+      av_packet_free(&queued);
+    }
+  }
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+  av_packet_free(&packet);
+}
+
+bool FfmpegStreamSource::Reconnect() {
+  // 1. packets and frames in flight are of the lost connection, the decoder
+  // is flushed by the new serial and starts again at a keyframe
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++serial_;
+    ClearPackets();
+    frames_.clear();
+    wait_keyframe_ = true;
+    is_streaming_ = false;
+  }
+  frame_cond_.notify_all();
+
+  // 2. the stream again, with exponential backoff until Close()
+  int backoff_ms = kMinReconnectMs;
+  while (true) {
+    avformat_close_input(&format_);
+    if (OpenDemuxer()) {
+      break;
+    }
+    ADEBUG_F("failed to reopen {}, retry in {} ms", url_, backoff_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (packet_cond_.wait_for(lock, std::chrono::milliseconds(backoff_ms),
+                              [this] { return stop_.load(); })) {
+      return false;
+    }
+    backoff_ms = std::min(backoff_ms * 2, kMaxReconnectMs);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_streaming_ = !stop_;
+  AINFO_F("reconnected to {}", url_);
+  return !stop_;
+}
+
+bool FfmpegStreamSource::SeekInput(double seconds) {
+  // the keyframe at or before the position
+  const int64_t target =
+      start_pts_ + static_cast<int64_t>(std::llround(seconds / time_base_));
+  const int ret =
+      av_seek_frame(format_, stream_index_, target, AVSEEK_FLAG_BACKWARD);
+  if (ret < 0) {
+    AERROR_F("cannot seek {} to {}s: {}", url_, seconds, AvErrorToStr(ret));
+    return false;
+  }
+  return true;
+}
+
+bool FfmpegStreamSource::PushPacket(std::unique_lock<std::mutex>* lock,
+                                    AVPacket* packet, uint32_t serial) {
+  // 1. packets read before a seek are dropped
+  if (serial != serial_) {
+    return false;
+  }
+  if (packet == nullptr) {
+    packets_.push_back({nullptr, serial});
+    packet_cond_.notify_all();
+    return true;
+  }
+  const size_t size = static_cast<size_t>(packet->size);
+  auto is_full = [&] {
+    return !packets_.empty() && (packets_.size() >= kMaxPackets ||
+                                 packet_bytes_ + size > kMaxPacketBytes);
+  };
+
+  // 2. a full queue makes files wait for the decoder, and live streams skip
+  // to the next keyframe instead
+  if (live_) {
+    if (is_full()) {
+      packets_dropped_ += packets_.size();
+      ClearPackets();
+      wait_keyframe_ = true;
+    }
+  } else {
+    packet_cond_.wait(*lock, [&] {
+      return stop_ || serial != serial_ || !is_full();
+    });
+    if (stop_ || serial != serial_) {
+      return false;
+    }
+  }
+  if (wait_keyframe_) {
+    if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+      packets_dropped_ += live_ ? 1 : 0;
+      return false;
+    }
+    wait_keyframe_ = false;
+  }
+
+  // 3. queued
+  packets_.push_back({packet, serial});
+  packet_bytes_ += size;
+  packet_cond_.notify_all();
+  return true;
+}
+
+void FfmpegStreamSource::ClearPackets() {
+  for (auto& entry : packets_) {
+    av_packet_free(&entry.packet);
+  }
+  packets_.clear();
+  packet_bytes_ = 0;
+  packet_cond_.notify_all();
+}
+
+void FfmpegStreamSource::Decode() {
+  uint32_t serial = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // 1. the next packet
+    packet_cond_.wait(lock, [this] { return stop_ || !packets_.empty(); });
+    if (stop_) {
+      break;
+    }
+    Packet entry = packets_.front();
+    packets_.pop_front();
+    const bool end = entry.packet == nullptr;
+    if (!end) {
+      packet_bytes_ -= static_cast<size_t>(entry.packet->size);
+    }
+    packet_cond_.notify_all();
+    lock.unlock();
+
+    // 2. decode it, a seek starts over with the decoder flushed
+    if (entry.serial != serial) {
+      avcodec_flush_buffers(codec_);
+      serial = entry.serial;
+    }
+    int ret = avcodec_send_packet(codec_, entry.packet);
+    if (ret == AVERROR(EAGAIN) && ReceiveFrames(serial)) {
+      ret = avcodec_send_packet(codec_, entry.packet);
+    }
+    av_packet_free(&entry.packet);
+    if (ret < 0 && ret != AVERROR_EOF) {
+      AWARN_F("cannot decode a packet of {}: {}", url_, AvErrorToStr(ret));
+    }
+    const bool received = ReceiveFrames(serial);
+
+    // 3. all frames were decoded, the decoder can start over after a seek
+    if (end) {
+      avcodec_flush_buffers(codec_);
+    }
+    lock.lock();
+    if (!received) {
+      break;
+    }
+    if (end && serial == serial_) {
+      decoded_all_ = true;
+      decoded_serial_ = serial;
+      frame_cond_.notify_all();
+    }
+  }
+}
+
+bool FfmpegStreamSource::ReceiveFrames(uint32_t serial) {
+  while (true) {
+    const int ret = avcodec_receive_frame(codec_, decoded_);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      return true;
+    }
+    if (ret < 0) {
+      AWARN_F("cannot decode a frame of {}: {}", url_, AvErrorToStr(ret));
+      return true;
+    }
+
+    // 1. frames before the position of a seek are not shown
+    const int64_t pts = decoded_->best_effort_timestamp;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const bool skipped = serial != serial_ ||
+                           (skip_pts_ != AV_NOPTS_VALUE &&
+                            pts != AV_NOPTS_VALUE && pts < skip_pts_);
+      if (skipped) {
+        av_frame_unref(decoded_);
+        continue;
+      }
+    }
+
+    // 2. in the layout of the options
+    FramePtr frame = Convert(decoded_);
+    av_frame_unref(decoded_);
+    if (stop_) {
+      return false;
+    }
+    if (frame == nullptr) {
+      continue;
+    }
+
+    // 3. for Acquire(), live streams replace the oldest frame
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (live_) {
+      while (frames_.size() >= kMaxFrames) {
+        frames_.pop_front();
+        ++frames_dropped_;
+      }
+    } else {
+      frame_cond_.wait(lock, [&] {
+        return stop_ || serial != serial_ || frames_.size() < kMaxFrames;
+      });
+    }
+    if (stop_) {
+      return false;
+    }
+    if (serial != serial_) {
+      continue;
+    }
+    const double position =
+        pts != AV_NOPTS_VALUE ? (pts - start_pts_) * time_base_ : 0;
+    frames_.push_back({std::move(frame), serial, position});
+    frame_cond_.notify_all();
+  }
+}
+
+FramePtr FfmpegStreamSource::Convert(AVFrame* src) {
+  const StreamPixelFormat format = options_.pixel_format;
+  const AVPixelFormat av_format = ToAvPixelFormat(format);
+  const int width =
+      options_.width > 0 ? static_cast<int>(options_.width) : src->width;
+  const int height =
+      options_.height > 0 ? static_cast<int>(options_.height) : src->height;
+
+  // 1. the reference of the decoded frame when it has the layout already
+  const bool same_layout = src->format == av_format &&
+                           src->width == width && src->height == height &&
+                           src->linesize[0] > 0;
+  if (same_layout) {
+    AVFrame* ref = av_frame_alloc();
+    if (ref != nullptr) {
+      av_frame_move_ref(ref, src);
+      auto frame = std::make_shared<Frame>();
+      frame->pixel_format = format;
+      frame->width = width;
+      frame->height = height;
+      frame->num_planes = GetNumPlanes(format);
+      for (int i = 0; i < frame->num_planes; ++i) {
+        const int rows = i > 0 && format == StreamPixelFormat::PIXEL_FORMAT_NV12
+                             ? (height + 1) / 2
+                             : height;
+        frame->planes[i].data = ref->data[i];
+        frame->planes[i].stride = ref->linesize[i];
+        frame->planes[i].size = static_cast<size_t>(ref->linesize[i]) * rows;
+      }
+      // the decoder may still read the buffer as a reference picture, so it
+      // is borrowed and never written, unless no one else holds it
+      frame->memory = av_frame_is_writable(ref) ? FrameMemory::MEMORY_OWNED
+                                                : FrameMemory::MEMORY_BORROWED;
+      frame->owner = std::shared_ptr<AVFrame>(
+          ref, [](AVFrame* f) { av_frame_free(&f); });
+      frame->bytes_used = static_cast<uint32_t>(frame->GetSize());
+      return frame;
+    }
+  }
+
+  // 2. converted into a frame of the pool, which is made for the first frame
+  // and when the size changes
+  if (!pool_ || pool_width_ != width || pool_height_ != height) {
+    const int num_frames =
+        static_cast<int>(options_.num_buffers) + static_cast<int>(kMaxFrames);
+    pool_ = FramePool::Create(format, width, height, num_frames);
+    if (!pool_) {
+      AERROR_F("cannot allocate {}x{} {} frames", width, height,
+               StreamPixelFormatToStr(format));
+      return nullptr;
+    }
+    pool_width_ = width;
+    pool_height_ = height;
+  }
+  const int flags = width < src->width || height < src->height
+                        ? SWS_AREA
+                        : SWS_FAST_BILINEAR;
+  sws_ = sws_getCachedContext(sws_, src->width, src->height,
+                              static_cast<AVPixelFormat>(src->format), width,
+                              height, av_format, flags, nullptr, nullptr,
+                              nullptr);
+  if (sws_ == nullptr) {
+    AERROR_F("cannot convert {}x{} video of {} to {}", src->width,
+             src->height, url_, StreamPixelFormatToStr(format));
+    return nullptr;
+  }
+  // live streams drop frames while the application holds every frame
+  FramePtr frame;
+  while (!stop_) {
+    frame = pool_->AcquireFrame(live_ ? 0 : kPoolWaitMs);
+    if (frame || live_) {
+      break;
+    }
+  }
+  if (!frame) {
+    frames_dropped_ += live_ ? 1 : 0;
+    return nullptr;
+  }
+  uint8_t* dst[4] = {nullptr, nullptr, nullptr, nullptr};
+  int dst_stride[4] = {0, 0, 0, 0};
+  for (int i = 0; i < frame->num_planes; ++i) {
+    dst[i] = frame->planes[i].data;
+    dst_stride[i] = frame->planes[i].stride;
+  }
+  sws_scale(sws_, src->data, src->linesize, 0, src->height, dst, dst_stride);
+  frame->bytes_used = static_cast<uint32_t>(frame->GetSize());
+  return frame;
+}
+
+FramePtr FfmpegStreamSource::Acquire(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!read_thread_.joinable()) {
+    AERROR_F("capture error. source is not open");
+    return nullptr;
+  }
+
+  // 1. the next frame, unless the stream ended
+  const bool ready = frame_cond_.wait_for(
+      lock, std::chrono::milliseconds(std::max(timeout_ms, 0)), [this] {
+        return stop_ || !frames_.empty() ||
+               (decoded_all_ && decoded_serial_ == serial_);
+      });
+  if (!ready || frames_.empty()) {
+    return nullptr;
+  }
+  Decoded decoded = std::move(frames_.front());
+  frames_.pop_front();
+  frame_cond_.notify_all();
+
+  // 2. captured now, as far as the application can tell
+  position_ = decoded.position;
+  FramePtr frame = std::move(decoded.frame);
+  frame->timestamp_ns = NowNs();
+  frame->system_timestamp_ns = SystemNowNs();
+  frame->sequence = sequence_++;
+  frame->dropped_frames = 0;
+  frame->flags = 0;
+  return frame;
+}
+
+bool FfmpegStreamSource::Seek(double seconds) {
+  if (live_) {
+    AERROR_F("cannot seek live stream {}", url_);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!read_thread_.joinable()) {
+    AERROR_F("cannot seek, source is not open");
+    return false;
+  }
+  // packets and frames in flight are of the old position
+  ++serial_;
+  ClearPackets();
+  frames_.clear();
+  seconds = std::max(seconds, 0.0);
+  seek_requested_ = true;
+  seek_seconds_ = seconds;
+  skip_pts_ = start_pts_ + static_cast<int64_t>(std::llround(seconds /
+                                                             time_base_));
+  wait_keyframe_ = true;
+  decoded_all_ = false;
+  position_ = seconds;
+  packet_cond_.notify_all();
+  frame_cond_.notify_all();
+  return true;
+}
+
+double FfmpegStreamSource::GetPosition() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return position_;
+}
+
+bool FfmpegStreamSource::IsEndOfStream() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return decoded_all_ && decoded_serial_ == serial_ && frames_.empty();
+}
+
+bool FfmpegStreamSource::Capture(const FramePtr& frame) {
+  // nothing is taken from the source for a missing frame
+  return CaptureFrom(frame != nullptr ? Acquire() : nullptr, frame);
+}
+
+bool FfmpegStreamSource::Capture(const CameraImagePtr& raw_image) {
+  return CaptureFrom(raw_image != nullptr ? Acquire() : nullptr, raw_image);
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,642 @@
+#include "zetton_stream/source/file_stream_source.h"
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+constexpr char kY4mMagic[] = "YUV4MPEG2 ";
+constexpr char kY4mFrameMagic[] = "FRAME";
+constexpr double kDefaultFrameRate = 30.0;
+
+bool IsMjpegExtension(const std::string& extension) {
+  return strcasecmp(extension.c_str(), "mjpeg") == 0 ||
+         strcasecmp(extension.c_str(), "mjpg") == 0;
+}
+
+// size of the JPEG at data and its dimensions, 0 if it is not one
+size_t ParseJpeg(const uint8_t* data, size_t size, int* width, int* height) {
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    return 0;
+  }
+  // 1. segments up to the first scan
+  size_t pos = 2;
+  while (pos + 4 <= size) {
+    if (data[pos] != 0xFF) {
+      return 0;
+    }
+    const uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {
+      ++pos;
+      continue;
+    }
+    const size_t length = static_cast<size_t>(data[pos + 2] << 8 |
+                                              data[pos + 3]);
+    if ((marker == 0xC0 || marker == 0xC1 || marker == 0xC2) &&
+        pos + 9 <= size) {
+      *height = data[pos + 5] << 8 | data[pos + 6];
+      *width = data[pos + 7] << 8 | data[pos + 8];
+    }
+    pos += 2 + length;
+    if (marker == 0xDA) {
+      break;
+    }
+  }
+
+  // 2. entropy coded data up to EOI. other markers in it are stuffed bytes,
+  // restarts, or segments between the scans of progressive JPEGs
+  while (pos + 1 < size) {
+    if (data[pos] != 0xFF) {
+      ++pos;
+      continue;
+    }
+    const uint8_t marker = data[pos + 1];
+    if (marker == 0xD9) {
+      return pos + 2;
+    }
+    const bool is_restart = marker >= 0xD0 && marker <= 0xD7;
+    if (marker == 0x00 || marker == 0xFF || is_restart) {
+      pos += marker == 0xFF ? 1 : 2;
+      continue;
+    }
+    if (pos + 4 > size) {
+      break;
+    }
+    pos += 2 + static_cast<size_t>(data[pos + 2] << 8 | data[pos + 3]);
+  }
+  return 0;
+}
+
+// interleave two planes of half the width into one, e.g. u and v into the
+// chroma plane of NV12
+void InterleavePlanes(const uint8_t* u, const uint8_t* v, size_t width,
+                      size_t rows, uint8_t* dst, size_t stride) {
+  for (size_t y = 0; y < rows; ++y) {
+    uint8_t* row = dst + y * stride;
+    for (size_t x = 0; x < width; ++x) {
+      row[x * 2] = u[y * width + x];
+      row[x * 2 + 1] = v[y * width + x];
+    }
+  }
+}
+
+}  // namespace
+
+const char* FilePacingToStr(FilePacing pacing) {
+  switch (pacing) {
+    case FilePacing::PACING_REALTIME:
+      return "realtime";
+    case FilePacing::PACING_FASTEST:
+      return "fastest";
+    case FilePacing::PACING_FIXED:
+      return "fixed";
+    default:
+      return "realtime";
+  }
+}
+
+FilePacing FilePacingFromStr(const char* str) {
+  if (!str) return FilePacing::PACING_REALTIME;
+  for (int n = 0; n < static_cast<int>(FilePacing::PACING_MAX_NUM); ++n) {
+    const auto value = (FilePacing)n;
+    if (strcasecmp(str, FilePacingToStr(value)) == 0) return value;
+  }
+  return FilePacing::PACING_REALTIME;
+}
+
+FileStreamSource::~FileStreamSource() { Close(); }
+
+bool FileStreamSource::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_FILE ||
+      options_.resource.location.empty()) {
+    AERROR_F("{} is not a file", options_.resource.string);
+    return false;
+  }
+  path_ = options_.resource.location;
+  container_ = FileContainerFromStr(options_.resource.extension.c_str());
+  return true;
+}
+
+bool FileStreamSource::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (mapping_) {
+    return true;
+  }
+
+  // 1. map the file, privately so that frames may be written to
+  const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    AERROR_F("cannot open {}: code {}, string [{}]", path_, errno,
+             strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  file_size_ = static_cast<size_t>(st.st_size);
+  void* data = file_size_ > 0 ? mmap(nullptr, file_size_,
+                                     PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                                     fd, 0)
+                              : MAP_FAILED;
+  close(fd);
+  if (data == MAP_FAILED) {
+    AERROR_F("cannot map {}: code {}, string [{}]", path_, errno,
+             strerror(errno));
+    return false;
+  }
+  madvise(data, file_size_, MADV_SEQUENTIAL);
+  const size_t size = file_size_;
+  mapping_ = std::shared_ptr<uint8_t>(
+      static_cast<uint8_t*>(data), [size](uint8_t* p) { munmap(p, size); });
+
+  // 2. the frames in it
+  entries_.clear();
+  has_timestamps_ = false;
+  interval_ns_ = 0;
+  pool_.reset();
+  bool found = false;
+  if (container_ == FileContainer::CONTAINER_Y4M) {
+    found = ScanY4m();
+  } else if (IsMjpegExtension(options_.resource.extension) ||
+             options_.pixel_format == StreamPixelFormat::PIXEL_FORMAT_MJPEG ||
+             options_.codec == StreamCodec::CODEC_MJPEG) {
+    found = ScanMjpeg();
+  } else {
+    found = ScanRaw();
+  }
+  if (!found || entries_.empty()) {
+    AERROR_F("no frames in {}", path_);
+    mapping_.reset();
+    return false;
+  }
+  if (container_ == FileContainer::CONTAINER_Y4M && y4m_chroma_ != 0) {
+    const int num_frames = std::max(static_cast<int>(options_.num_buffers), 2);
+    pool_ = FramePool::Create(pixel_format_, width_, height_, num_frames);
+    if (!pool_) {
+      AERROR_F("cannot allocate {}x{} frames", width_, height_);
+      mapping_.reset();
+      return false;
+    }
+  }
+  if (interval_ns_ == 0) {
+    // rate of a recording that does not tell
+    interval_ns_ = static_cast<uint64_t>(
+        1e9 / (options_.frame_rate > 0 ? options_.frame_rate
+                                       : kDefaultFrameRate));
+  }
+
+  // 3. replay from the start
+  next_ = 0;
+  passes_ = 0;
+  started_ = false;
+  sequence_ = 0;
+  end_of_stream_ = false;
+  is_streaming_ = true;
+  AINFO_F("replaying {} frames of {}x{} {} from {} ({})", entries_.size(),
+          width_, height_, StreamPixelFormatToStr(pixel_format_), path_,
+          FilePacingToStr(pacing_));
+  return true;
+}
+
+void FileStreamSource::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // frames still held keep the file mapped until they are released
+  mapping_.reset();
+  pool_.reset();
+  is_streaming_ = false;
+}
+
+bool FileStreamSource::ReadIndex() {
+  const std::string index_path = path_ + ".idx";
+  FILE* file = fopen(index_path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+
+  // 1. a line per frame, as written by FileStreamSink
+  std::vector<Entry> entries;
+  bool valid = true;
+  bool monotonic = true;
+  char line[256];
+  while (valid && fgets(line, sizeof(line), file) != nullptr) {
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    uint64_t number = 0;
+    uint64_t size = 0;
+    uint32_t sequence = 0;
+    Entry entry;
+    valid = sscanf(line,
+                   "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                   " %" SCNu64 " %" SCNu32 " %" SCNu32,
+                   &number, &entry.offset, &size, &entry.timestamp_ns,
+                   &entry.system_timestamp_ns, &sequence,
+                   &entry.flags) == 7 &&
+            entry.offset + size <= file_size_;
+    entry.size = static_cast<size_t>(size);
+    monotonic = monotonic && entry.timestamp_ns > 0 &&
+                (entries.empty() ||
+                 entry.timestamp_ns >= entries.back().timestamp_ns);
+    entries.push_back(entry);
+  }
+  fclose(file);
+
+  // 2. only an index that matches the file
+  if (!valid || entries.empty()) {
+    AWARN_F("ignored invalid index {}", index_path);
+    return false;
+  }
+  entries_ = std::move(entries);
+  has_timestamps_ = monotonic && entries_.size() > 1;
+  if (has_timestamps_) {
+    // frame interval of the recording, for the end of a pass
+    interval_ns_ = (entries_.back().timestamp_ns -
+                    entries_.front().timestamp_ns) /
+                   (entries_.size() - 1);
+  }
+  return true;
+}
+
+bool FileStreamSource::ScanY4m() {
+  // 1. stream header
+  const char* data = reinterpret_cast<const char*>(mapping_.get());
+  const size_t magic_size = sizeof(kY4mMagic) - 1;
+  const char* end = static_cast<const char*>(
+      memchr(data, '\n', std::min<size_t>(file_size_, 256)));
+  if (end == nullptr || file_size_ < magic_size ||
+      memcmp(data, kY4mMagic, magic_size) != 0) {
+    AERROR_F("{} is not a y4m file", path_);
+    return false;
+  }
+  const std::string header(data + magic_size, end);
+  std::string colorspace = "420";
+  double frame_rate = 0;
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t next = header.find(' ', pos);
+    if (next == std::string::npos) {
+      next = header.size();
+    }
+    const std::string token = header.substr(pos, next - pos);
+    pos = next + 1;
+    if (token.size() < 2) {
+      continue;
+    }
+    const char* value = token.c_str() + 1;
+    switch (token[0]) {
+      case 'W':
+        width_ = atoi(value);
+        break;
+      case 'H':
+        height_ = atoi(value);
+        break;
+      case 'C':
+        colorspace = value;
+        break;
+      case 'F': {
+        unsigned int num = 0;
+        unsigned int den = 0;
+        if (sscanf(value, "%u:%u", &num, &den) == 2 && num > 0 && den > 0) {
+          frame_rate = static_cast<double>(num) / den;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  // 2. frames as the sink records them
+  const size_t luma = static_cast<size_t>(width_) * height_;
+  size_t frame_size = 0;
+  if (colorspace == "mono") {
+    y4m_chroma_ = 0;
+    pixel_format_ = StreamPixelFormat::PIXEL_FORMAT_GRAY8;
+    frame_size = luma;
+  } else if (colorspace.compare(0, 3, "420") == 0) {
+    y4m_chroma_ = 420;
+    pixel_format_ = StreamPixelFormat::PIXEL_FORMAT_NV12;
+    frame_size = luma + luma / 2;
+  } else if (colorspace == "422") {
+    y4m_chroma_ = 422;
+    const StreamPixelFormat format = options_.pixel_format;
+    pixel_format_ = format == StreamPixelFormat::PIXEL_FORMAT_YUYV ||
+                            format == StreamPixelFormat::PIXEL_FORMAT_UYVY
+                        ? format
+                        : StreamPixelFormat::PIXEL_FORMAT_NV16;
+    frame_size = luma * 2;
+  } else {
+    AERROR_F("cannot replay y4m colorspace {}", colorspace);
+    return false;
+  }
+  if (width_ <= 0 || height_ <= 0 || width_ % 2 != 0 || height_ % 2 != 0) {
+    AERROR_F("cannot replay {}x{} y4m frames", width_, height_);
+    return false;
+  }
+  if (frame_rate > 0) {
+    interval_ns_ = static_cast<uint64_t>(1e9 / frame_rate);
+  }
+
+  // 3. the index, or every frame after its header
+  if (ReadIndex()) {
+    for (const auto& entry : entries_) {
+      if (entry.size != frame_size) {
+        AERROR_F("index of {} does not match its frames", path_);
+        return false;
+      }
+    }
+    return true;
+  }
+  size_t offset = static_cast<size_t>(end - data) + 1;
+  const size_t frame_magic_size = sizeof(kY4mFrameMagic) - 1;
+  while (offset + frame_magic_size <= file_size_ &&
+         memcmp(data + offset, kY4mFrameMagic, frame_magic_size) == 0) {
+    const char* line_end = static_cast<const char*>(
+        memchr(data + offset, '\n', file_size_ - offset));
+    if (line_end == nullptr) {
+      break;
+    }
+    Entry entry;
+    entry.offset = static_cast<uint64_t>(line_end - data) + 1;
+    entry.size = frame_size;
+    if (entry.offset + entry.size > file_size_) {
+      // truncated recording
+      break;
+    }
+    entries_.push_back(entry);
+    offset = entry.offset + entry.size;
+  }
+  return true;
+}
+
+bool FileStreamSource::ScanMjpeg() {
+  // 1. the index, or every JPEG one after the other
+  const uint8_t* data = mapping_.get();
+  pixel_format_ = StreamPixelFormat::PIXEL_FORMAT_MJPEG;
+  if (!ReadIndex()) {
+    size_t offset = 0;
+    while (offset < file_size_) {
+      int width = 0;
+      int height = 0;
+      const size_t size =
+          ParseJpeg(data + offset, file_size_ - offset, &width, &height);
+      if (size == 0) {
+        if (offset < file_size_) {
+          AWARN_F("stopped at broken JPEG at {} of {}", offset, path_);
+        }
+        break;
+      }
+      Entry entry;
+      entry.offset = offset;
+      entry.size = size;
+      entries_.push_back(entry);
+      offset += size;
+    }
+  }
+  if (entries_.empty()) {
+    return false;
+  }
+
+  // 2. dimensions from the first JPEG, unless given
+  width_ = static_cast<int>(options_.width);
+  height_ = static_cast<int>(options_.height);
+  if (width_ == 0 || height_ == 0) {
+    const Entry& first = entries_.front();
+    ParseJpeg(data + first.offset, first.size, &width_, &height_);
+  }
+  return width_ > 0 && height_ > 0;
+}
+
+bool FileStreamSource::ScanRaw() {
+  // 1. frames have the layout of the options, without row padding
+  pixel_format_ = options_.pixel_format;
+  width_ = static_cast<int>(options_.width);
+  height_ = static_cast<int>(options_.height);
+  const int bytes_per_pixel = GetBytesPerPixel(pixel_format_);
+  if (bytes_per_pixel == 0 || width_ <= 0 || height_ <= 0) {
+    AERROR_F("cannot replay {}x{} {} frames from {}", width_, height_,
+             StreamPixelFormatToStr(pixel_format_), path_);
+    return false;
+  }
+  const size_t frame_size = GetFrameSize(pixel_format_, width_, height_,
+                                         width_ * bytes_per_pixel);
+
+  // 2. the index, or frames back to back
+  if (ReadIndex()) {
+    for (const auto& entry : entries_) {
+      if (entry.size != frame_size) {
+        AERROR_F("{}x{} {} frames do not match the index of {}", width_,
+                 height_, StreamPixelFormatToStr(pixel_format_), path_);
+        return false;
+      }
+    }
+    return true;
+  }
+  for (size_t offset = 0; offset + frame_size <= file_size_;
+       offset += frame_size) {
+    Entry entry;
+    entry.offset = offset;
+    entry.size = frame_size;
+    entries_.push_back(entry);
+  }
+  if (file_size_ % frame_size != 0) {
+    AWARN_F("{} is not a multiple of {}x{} {} frames", path_, width_,
+            height_, StreamPixelFormatToStr(pixel_format_));
+  }
+  return true;
+}
+
+uint64_t FileStreamSource::GetDueTime(size_t n) const {
+  if (has_timestamps_) {
+    return pass_start_ns_ + (entries_[n].timestamp_ns -
+                             entries_.front().timestamp_ns);
+  }
+  return pass_start_ns_ + n * interval_ns_;
+}
+
+FramePtr FileStreamSource::Acquire(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!mapping_) {
+    AERROR_F("capture error. source is not open");
+    return nullptr;
+  }
+
+  // 1. the next frame, from the start again while looping
+  uint64_t now = NowNs();
+  if (!started_) {
+    pass_start_ns_ = now;
+    last_due_ns_ = now;
+    started_ = true;
+  }
+  if (next_ == entries_.size()) {
+    if (options_.loop == 0 || (options_.loop > 0 && passes_ >= options_.loop)) {
+      if (!end_of_stream_) {
+        AINFO_F("end of {} after {} frames", path_, sequence_);
+      }
+      end_of_stream_ = true;
+      return nullptr;
+    }
+    pass_start_ns_ = GetDueTime(entries_.size() - 1) + interval_ns_;
+    next_ = 0;
+    ++passes_;
+  }
+
+  // 2. wait until it is due, without holding the lock
+  uint64_t due = now;
+  if (pacing_ == FilePacing::PACING_REALTIME) {
+    due = GetDueTime(next_);
+  } else if (pacing_ == FilePacing::PACING_FIXED) {
+    const uint64_t interval_ns =
+        options_.frame_rate > 0
+            ? static_cast<uint64_t>(1e9 / options_.frame_rate)
+            : interval_ns_;
+    due = sequence_ > 0 ? last_due_ns_ + interval_ns : now;
+  }
+  if (due > now) {
+    const uint64_t timeout_ns =
+        static_cast<uint64_t>(std::max(timeout_ms, 0)) * 1000000;
+    lock.unlock();
+    std::this_thread::sleep_for(
+        std::chrono::nanoseconds(std::min(due - now, timeout_ns)));
+    if (due - now > timeout_ns) {
+      return nullptr;
+    }
+    lock.lock();
+    if (!mapping_) {
+      return nullptr;
+    }
+    now = NowNs();
+  }
+
+  // 3. a camera drops the frames of a reader that fell behind
+  uint32_t dropped = 0;
+  if (pacing_ == FilePacing::PACING_REALTIME) {
+    while (next_ + 1 < entries_.size() && GetDueTime(next_ + 1) <= now) {
+      ++next_;
+      ++dropped;
+    }
+  }
+  // a fixed rate never catches up in bursts
+  last_due_ns_ = std::max(due, now);
+
+  // 4. the frame, and read ahead the one after it
+  const Entry& entry = entries_[next_];
+  FramePtr frame = GetFrame(entry, timeout_ms);
+  if (!frame) {
+    return nullptr;
+  }
+  ++next_;
+  if (next_ < entries_.size()) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t start = entries_[next_].offset / page * page;
+    madvise(mapping_.get() + start,
+            entries_[next_].offset + entries_[next_].size - start,
+            MADV_WILLNEED);
+  }
+  if (has_timestamps_) {
+    // recorded, one recording later on every pass
+    const uint64_t pass_ns = entries_.back().timestamp_ns -
+                             entries_.front().timestamp_ns + interval_ns_;
+    frame->timestamp_ns = entry.timestamp_ns + passes_ * pass_ns;
+    frame->system_timestamp_ns =
+        entry.system_timestamp_ns > 0
+            ? entry.system_timestamp_ns + passes_ * pass_ns
+            : 0;
+  } else {
+    frame->timestamp_ns = now;
+    frame->system_timestamp_ns = SystemNowNs();
+  }
+  frame->sequence = sequence_++;
+  frame->dropped_frames = dropped;
+  frame->flags = entry.flags;
+  return frame;
+}
+
+FramePtr FileStreamSource::GetFrame(const Entry& entry, int timeout_ms) {
+  uint8_t* data = mapping_.get() + entry.offset;
+
+  // 1. view of the mapping
+  if (!pool_) {
+    auto frame = std::make_shared<Frame>();
+    const int stride = pixel_format_ == StreamPixelFormat::PIXEL_FORMAT_MJPEG
+                           ? 0
+                           : width_ * GetBytesPerPixel(pixel_format_);
+    if (!frame->Wrap(pixel_format_, width_, height_, data, stride, mapping_)) {
+      return nullptr;
+    }
+    if (stride == 0) {
+      frame->planes[0].size = entry.size;
+    }
+    frame->bytes_used = static_cast<uint32_t>(entry.size);
+    return frame;
+  }
+
+  // 2. planar y4m interleaved into a frame of the pool
+  FramePtr frame = pool_->AcquireFrame(timeout_ms);
+  if (!frame) {
+    return nullptr;
+  }
+  const size_t width = static_cast<size_t>(width_);
+  const size_t height = static_cast<size_t>(height_);
+  const size_t chroma_height = y4m_chroma_ == 420 ? height / 2 : height;
+  const uint8_t* u = data + width * height;
+  const uint8_t* v = u + width / 2 * chroma_height;
+  if (pixel_format_ == StreamPixelFormat::PIXEL_FORMAT_YUYV ||
+      pixel_format_ == StreamPixelFormat::PIXEL_FORMAT_UYVY) {
+    const bool yuyv = pixel_format_ == StreamPixelFormat::PIXEL_FORMAT_YUYV;
+    const size_t y_offset = yuyv ? 0 : 1;
+    const size_t u_offset = yuyv ? 1 : 0;
+    const size_t v_offset = yuyv ? 3 : 2;
+    for (size_t y = 0; y < height; ++y) {
+      uint8_t* row = frame->GetData() + y * frame->GetStride();
+      const uint8_t* luma = data + y * width;
+      for (size_t x = 0; x < width; x += 2) {
+        row[x * 2 + y_offset] = luma[x];
+        row[x * 2 + y_offset + 2] = luma[x + 1];
+        row[x * 2 + u_offset] = u[y * width / 2 + x / 2];
+        row[x * 2 + v_offset] = v[y * width / 2 + x / 2];
+      }
+    }
+  } else {
+    copy_rows(data, static_cast<int>(width), frame->GetData(0),
+              frame->GetStride(0), static_cast<unsigned int>(width),
+              static_cast<unsigned int>(height));
+    InterleavePlanes(u, v, width / 2, chroma_height, frame->GetData(1),
+                     static_cast<size_t>(frame->GetStride(1)));
+  }
+  frame->bytes_used = static_cast<uint32_t>(frame->GetSize());
+  return frame;
+}
+
+bool FileStreamSource::Capture(const FramePtr& frame) {
+  // nothing is taken from the source for a missing frame
+  return CaptureFrom(frame != nullptr ? Acquire() : nullptr, frame);
+}
+
+bool FileStreamSource::Capture(const CameraImagePtr& raw_image) {
+  return CaptureFrom(raw_image != nullptr ? Acquire() : nullptr, raw_image);
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -32,9 +32,10 @@ LegacyV4l2StreamSource::LegacyV4l2StreamSource()
       n_buffers_(0),
       is_capturing_(false),
       image_seq_(0),
+      last_sequence_(-1),
       device_wait_sec_(2) {}
 
-LegacyV4l2StreamSource::~LegacyV4l2StreamSource() { shutdown(); }
+LegacyV4l2StreamSource::~LegacyV4l2StreamSource() { Close(); }
 
 bool LegacyV4l2StreamSource::Init(const StreamOptions& options) {
   options_ = options;
@@ -64,10 +65,8 @@ bool LegacyV4l2StreamSource::Init(const StreamOptions& options) {
     return false;
   }
 
-  // Warning when diff with last > 1.5* interval
-  frame_warning_interval_ = static_cast<float>(1.5 / options_.frame_rate);
-  // now max fps 30, we use an appox time 0.9 to drop image.
-  frame_drop_interval_ = static_cast<float>(0.9 / options_.frame_rate);
+  // jitter, drop and clock offset statistics with frame-rate decimation
+  statistics_.Init(options_.frame_rate, options_.resource.location);
 
   return true;
 }
@@ -77,37 +76,59 @@ bool LegacyV4l2StreamSource::Capture(const CameraImagePtr& raw_image) {
   // free memory in this struct desturctor
   memset(raw_image->image, 0, raw_image->image_size * sizeof(char));
 
-  fd_set fds;
-  struct timeval tv;
-  int r = 0;
+  // in async mode return right away while the supervisor is reconnecting
+  std::unique_lock<std::mutex> lock(device_mutex_, std::defer_lock);
+  if (options_.async) {
+    if (!lock.try_lock()) {
+      return false;
+    }
+  } else {
+    lock.lock();
+  }
+  if (!is_capturing_) {
+    return false;
+  }
 
-  FD_ZERO(&fds);
-  FD_SET(fd_, &fds);
+  // frames dropped by decimation are skipped until the next one is due
+  ReadResult result = ReadResult::READ_SKIPPED;
+  while (result == ReadResult::READ_SKIPPED) {
+    fd_set fds;
+    struct timeval tv;
+    int r = 0;
 
-  /* Timeout. */
-  tv.tv_sec = 2;
-  tv.tv_usec = 0;
+    FD_ZERO(&fds);
+    FD_SET(fd_, &fds);
 
-  r = select(fd_ + 1, &fds, nullptr, nullptr, &tv);
+    /* Timeout. */
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
 
-  if (-1 == r) {
-    if (EINTR == errno) {
-      return false;
-    }
+    r = select(fd_ + 1, &fds, nullptr, nullptr, &tv);
 
-    // errno_exit("select");
-    reconnect();
-  }
+    if (-1 == r) {
+      if (EINTR == errno) {
+        return false;
+      }
 
-  if (0 == r) {
-    AERROR_F("select timeout: code {} msg {}", errno, strerror(errno));
-    reconnect();
-  }
+      // errno_exit("select");
+      handle_device_lost();
+      return false;
+    }
 
-  int get_new_image = read_frame(raw_image);
+    if (0 == r) {
+      AERROR_F("select timeout: code {} msg {}", errno, strerror(errno));
+      handle_device_lost();
+      return false;
+    }
 
-  if (!get_new_image) {
-    return false;
+    result = read_frame(raw_image);
+    if (result == ReadResult::READ_ERROR) {
+      return false;
+    }
+    // the device may be lost while reading
+    if (!is_capturing_) {
+      return false;
+    }
   }
 
   raw_image->is_new = 1;
@@ -137,6 +158,13 @@ bool LegacyV4l2StreamSource::open_device() {
     return false;
   }
 
+  // controls go through a wrapper of a descriptor of its own, which it may
+  // close on failure without closing the device
+  if (control_fd_.s_fd(dup(fd_), options_.resource.location.c_str(), true) <
+      0) {
+    AWARN_F("cannot query controls of {}", options_.resource.location);
+  }
+
   AINFO_F("open device {} success", options_.resource.location);
 
   return true;
@@ -192,9 +220,17 @@ bool LegacyV4l2StreamSource::init_device() {
 
   cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
+  bool roi_cropped = false;
   if (0 == xioctl(fd_, VIDIOC_CROPCAP, &cropcap)) {
     crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     crop.c = cropcap.defrect; /* reset to default */
+    if (options_.roi.width > 0 && options_.roi.height > 0) {
+      /* Crop to the region of interest on the device. */
+      crop.c.left = cropcap.defrect.left + options_.roi.x;
+      crop.c.top = cropcap.defrect.top + options_.roi.y;
+      crop.c.width = options_.roi.width;
+      crop.c.height = options_.roi.height;
+    }
 
     if (-1 == xioctl(fd_, VIDIOC_S_CROP, &crop)) {
       switch (errno) {
@@ -205,16 +241,22 @@ bool LegacyV4l2StreamSource::init_device() {
           /* Errors ignored. */
           break;
       }
+    } else {
+      roi_cropped = options_.roi.width > 0 && options_.roi.height > 0;
     }
   } else {
     /* Errors ignored. */
   }
+  if (options_.roi.width > 0 && options_.roi.height > 0 && !roi_cropped) {
+    AWARN_F("{} cannot crop, capturing the full frame",
+            options_.resource.location);
+  }
 
   CLEAR(fmt);
 
   fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  fmt.fmt.pix.width = options_.width;
-  fmt.fmt.pix.height = options_.height;
+  fmt.fmt.pix.width = roi_cropped ? options_.roi.width : options_.width;
+  fmt.fmt.pix.height = roi_cropped ? options_.roi.height : options_.height;
   fmt.fmt.pix.pixelformat = pixel_format_;
   fmt.fmt.pix.field = V4L2_FIELD_INTERLACED;
 
@@ -417,6 +459,10 @@ bool LegacyV4l2StreamSource::start_capturing() {
   unsigned int i = 0;
   enum v4l2_buf_type type;
 
+  // the driver restarts its sequence counter on every stream on
+  last_sequence_ = -1;
+  image_seq_ = 0;
+
   switch (options_.io_method) {
     case StreamIoMethod::IO_METHOD_READ:
       /* Nothing to do. */
@@ -482,59 +528,21 @@ bool LegacyV4l2StreamSource::start_capturing() {
   return true;
 }
 
-void LegacyV4l2StreamSource::set_device_config() {
-  if (options_.camera.brightness >= 0) {
-    set_v4l_parameter("brightness", options_.camera.brightness);
-  }
-
-  if (options_.camera.contrast >= 0) {
-    set_v4l_parameter("contrast", options_.camera.contrast);
-  }
-
-  if (options_.camera.saturation >= 0) {
-    set_v4l_parameter("saturation", options_.camera.saturation);
-  }
-
-  if (options_.camera.sharpness >= 0) {
-    set_v4l_parameter("sharpness", options_.camera.sharpness);
-  }
-
-  if (options_.camera.gain >= 0) {
-    set_v4l_parameter("gain", options_.camera.gain);
-  }
-
-  // check auto white balance
-  if (options_.camera.auto_white_balance) {
-    set_v4l_parameter("white_balance_temperature_auto", 1);
-  } else {
-    set_v4l_parameter("white_balance_temperature_auto", 0);
-    set_v4l_parameter("white_balance_temperature",
-                      options_.camera.white_balance);
-  }
-
-  // check auto exposure
-  if (!options_.camera.auto_exposure) {
-    // turn down exposure control (from max of 3)
-    set_v4l_parameter("auto_exposure", 1);
-    // change the exposure level
-    set_v4l_parameter("exposure_absolute", options_.camera.exposure);
-  }
-
-  // check auto focus
-  if (options_.camera.auto_focus) {
-    set_auto_focus(1);
-    set_v4l_parameter("focus_auto", 1);
-  } else {
-    set_v4l_parameter("focus_auto", 0);
-    if (options_.camera.focus >= 0) {
-      set_v4l_parameter("focus_absolute", options_.camera.focus);
-    }
+bool LegacyV4l2StreamSource::set_device_config() {
+  if (control_fd_.g_fd() < 0) {
+    return false;
   }
+  controls_.Enumerate(&control_fd_);
+  return controls_.Apply(&control_fd_, options_.camera);
 }
 
 bool LegacyV4l2StreamSource::uninit_device() {
   unsigned int i = 0;
 
+  if (buffers_ == nullptr) {
+    return true;
+  }
+
   switch (options_.io_method) {
     case StreamIoMethod::IO_METHOD_READ:
       free(buffers_[0].start);
@@ -562,10 +570,19 @@ bool LegacyV4l2StreamSource::uninit_device() {
       break;
   }
 
+  free(buffers_);
+  buffers_ = nullptr;
+  n_buffers_ = 0;
   return true;
 }
 
 bool LegacyV4l2StreamSource::close_device() {
+  if (control_fd_.g_fd() >= 0) {
+    control_fd_.close();
+  }
+  if (fd_ < 0) {
+    return true;
+  }
   if (-1 == close(fd_)) {
     AERROR << "close";
     return false;
@@ -607,7 +624,8 @@ bool LegacyV4l2StreamSource::stop_capturing() {
   return true;
 }
 
-bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
+LegacyV4l2StreamSource::ReadResult LegacyV4l2StreamSource::read_frame(
+    CameraImagePtr raw_image) {
   struct v4l2_buffer buf;
   unsigned int i = 0;
   int len = 0;
@@ -620,16 +638,25 @@ bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
         switch (errno) {
           case EAGAIN:
             AINFO << "EAGAIN";
-            return false;
+            return ReadResult::READ_ERROR;
           case EIO:
             /* Could ignore EIO, see spec. */
             /* fall through */
           default:
             AERROR_F("read");
-            return false;
+            return ReadResult::READ_ERROR;
         }
       }
 
+      // read() has no buffer metadata, number the frames and stamp them with
+      // the time of the read
+      CLEAR(buf);
+      buf.sequence = static_cast<uint32_t>(image_seq_++);
+      FillCaptureMetadata(buf, static_cast<uint32_t>(len), &last_sequence_,
+                          raw_image.get());
+      if (!statistics_.Update(*raw_image)) {
+        return ReadResult::READ_SKIPPED;
+      }
       process_image(buffers_[0].start, len, raw_image);
 
       break;
@@ -643,58 +670,30 @@ bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
       if (-1 == xioctl(fd_, VIDIOC_DQBUF, &buf)) {
         switch (errno) {
           case EAGAIN:
-            return false;
+            return ReadResult::READ_ERROR;
           case EIO:
             /* Could ignore EIO, see spec. */
             /* fall through */
           default:
             AERROR << "VIDIOC_DQBUF";
-            reconnect();
-            return false;
+            handle_device_lost();
+            return ReadResult::READ_ERROR;
         }
       }
 
       assert(buf.index < n_buffers_);
       len = buf.bytesused;
-      raw_image->tv_sec = static_cast<int>(buf.timestamp.tv_sec);
-      raw_image->tv_usec = static_cast<int>(buf.timestamp.tv_usec);
-
-#if 0
-      // check the timestamp from buffer
-      {
-        common::Time image_time(raw_image->tv_sec, 1000 * raw_image->tv_usec);
-        uint64_t camera_timestamp = image_time.ToNanosecond();
-        if (last_nsec_ == 0) {
-          last_nsec_ = camera_timestamp;
-        } else {
-          double diff =
-              static_cast<double>(camera_timestamp - last_nsec_) / 1e9;
-          // drop image by frame_rate
-          if (diff < frame_drop_interval_) {
-            AINFO << "drop image:" << camera_timestamp;
-            if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
-              AERROR << "VIDIOC_QBUF ERROR";
-            }
-            return false;
-          }
-          if (frame_warning_interval_ < diff) {
-            AWARN << "stamp jump.last stamp:" << last_nsec_
-                  << " current stamp:" << camera_timestamp;
-          }
-          last_nsec_ = camera_timestamp;
-        }
+      FillCaptureMetadata(buf, buf.bytesused, &last_sequence_,
+                          raw_image.get());
 
-        double now_s = static_cast<double>(common::Time::Now().ToSecond());
-        double image_s = static_cast<double>(camera_timestamp) / 1e9;
-        double diff = now_s - image_s;
-        if (diff > 0.5 || diff < 0) {
-          AWARN_F(
-              "camera time diff exception, diff: {:.6f}, now: {:.6f}, image: "
-              "{:.6f}; dev: {}",
-              diff, now_s, image_s, options_.resource.location);
+      // account the frame and drop it when decimating the frame rate
+      if (!statistics_.Update(*raw_image)) {
+        if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
+          AERROR << "VIDIOC_QBUF";
+          return ReadResult::READ_ERROR;
         }
+        return ReadResult::READ_SKIPPED;
       }
-#endif
       if (len < raw_image->width * raw_image->height &&
           pixel_format_ != V4L2_PIX_FMT_MJPEG) {
         AERROR << "Wrong Buffer Len: " << len
@@ -705,7 +704,7 @@ bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
 
       if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
         AERROR << "VIDIOC_QBUF";
-        return false;
+        return ReadResult::READ_ERROR;
       }
 
       break;
@@ -719,13 +718,13 @@ bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
       if (-1 == xioctl(fd_, VIDIOC_DQBUF, &buf)) {
         switch (errno) {
           case EAGAIN:
-            return false;
+            return ReadResult::READ_ERROR;
           case EIO:
             /* Could ignore EIO, see spec. */
             /* fall through */
           default:
             AERROR << "VIDIOC_DQBUF";
-            return false;
+            return ReadResult::READ_ERROR;
         }
       }
 
@@ -738,22 +737,31 @@ bool LegacyV4l2StreamSource::read_frame(CameraImagePtr raw_image) {
 
       assert(i < n_buffers_);
       len = buf.bytesused;
+      FillCaptureMetadata(buf, buf.bytesused, &last_sequence_,
+                          raw_image.get());
+      if (!statistics_.Update(*raw_image)) {
+        if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
+          AERROR << "VIDIOC_QBUF";
+          return ReadResult::READ_ERROR;
+        }
+        return ReadResult::READ_SKIPPED;
+      }
       process_image(reinterpret_cast<void*>(buf.m.userptr), len, raw_image);
 
       if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
         AERROR << "VIDIOC_QBUF";
-        return false;
+        return ReadResult::READ_ERROR;
       }
 
       break;
 
     case StreamIoMethod::IO_METHOD_UNKNOWN:
       AERROR << "unknown IO";
-      return false;
+      return ReadResult::READ_ERROR;
       break;
   }
 
-  return true;
+  return ReadResult::READ_FRAME;
 }
 
 bool LegacyV4l2StreamSource::process_image(void* src, int len,
@@ -841,83 +849,74 @@ bool LegacyV4l2StreamSource::process_image(void* src, int len,
 
 bool LegacyV4l2StreamSource::IsCapturing() { return is_capturing_; }
 
-// enables/disables auto focus
-void LegacyV4l2StreamSource::set_auto_focus(int value) {
-  struct v4l2_queryctrl queryctrl;
-  struct v4l2_ext_control control;
+FrameStatisticsSnapshot LegacyV4l2StreamSource::GetStatistics() const {
+  return statistics_.GetSnapshot();
+}
 
-  memset(&queryctrl, 0, sizeof(queryctrl));
-  queryctrl.id = V4L2_CID_FOCUS_AUTO;
+const std::vector<V4l2ControlInfo>& LegacyV4l2StreamSource::GetControls()
+    const {
+  return controls_.GetControls();
+}
 
-  if (-1 == xioctl(fd_, VIDIOC_QUERYCTRL, &queryctrl)) {
-    if (errno != EINVAL) {
-      perror("VIDIOC_QUERYCTRL");
-      return;
-    } else {
-      AINFO << "V4L2_CID_FOCUS_AUTO is not supported";
-      return;
-    }
-  } else if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
-    AINFO << "V4L2_CID_FOCUS_AUTO is not supported";
-    return;
-  } else {
-    memset(&control, 0, sizeof(control));
-    control.id = V4L2_CID_FOCUS_AUTO;
-    control.value = value;
+bool LegacyV4l2StreamSource::GetControl(const std::string& name,
+                                        int64_t* value) {
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  const auto* info = controls_.Find(name);
+  if (control_fd_.g_fd() < 0 || info == nullptr) {
+    AERROR_F("control {} is not available on {}", name,
+             options_.resource.location);
+    return false;
+  }
+  return controls_.GetControl(&control_fd_, info->id, value);
+}
+
+bool LegacyV4l2StreamSource::SetControl(const std::string& name,
+                                        int64_t value) {
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  const auto* info = controls_.Find(name);
+  if (control_fd_.g_fd() < 0 || info == nullptr) {
+    AERROR_F("control {} is not available on {}", name,
+             options_.resource.location);
+    return false;
+  }
+  return controls_.SetControl(&control_fd_, info->id, value);
+}
 
-    if (-1 == xioctl(fd_, VIDIOC_S_CTRL, &control)) {
-      perror("VIDIOC_S_CTRL");
-      return;
+bool LegacyV4l2StreamSource::WaitForDevice() {
+  if (options_.async) {
+    // the device is (re)opened by the supervisor in background, so never block
+    // the capture thread here
+    if (!supervisor_.IsRunning()) {
+      supervisor_.Start(
+          options_.resource.location,
+          [this]() {
+            std::lock_guard<std::mutex> lock(device_mutex_);
+            return reopen();
+          },
+          state_callback_);
     }
+    return is_capturing_;
   }
+
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  return reopen();
 }
 
-/**
- * Set video device parameter via call to v4l-utils.
- *
- * @param param The name of the parameter to set
- * @param param The value to assign
- */
-void LegacyV4l2StreamSource::set_v4l_parameter(const std::string& param,
-                                               int value) {
-  set_v4l_parameter(param, std::to_string(value));
+void LegacyV4l2StreamSource::Close() {
+  supervisor_.Stop();
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  shutdown();
 }
-/**
- * Set video device parameter via call to v4l-utils.
- *
- * @param param The name of the parameter to set
- * @param param The value to assign
- */
-void LegacyV4l2StreamSource::set_v4l_parameter(const std::string& param,
-                                               const std::string& value) {
-  // build the command
-  std::stringstream ss;
-  ss << "v4l2-ctl --device=" << options_.resource.location << " -c " << param
-     << "=" << value << " 2>&1";
-  std::string cmd = ss.str();
-
-  // capture the output
-  std::string output;
-  char buffer[256];
-  FILE* stream = popen(cmd.c_str(), "r");
-  if (stream) {
-    while (!feof(stream)) {
-      if (fgets(buffer, 256, stream) != nullptr) {
-        output.append(buffer);
-      }
-    }
 
-    pclose(stream);
-    // any output should be an error
-    if (output.length() > 0) {
-      AERROR << output.c_str();
-    }
-  } else {
-    AERROR << "usb_cam_node could not run " << cmd.c_str();
+StreamState LegacyV4l2StreamSource::GetState() const {
+  if (supervisor_.IsRunning()) {
+    return supervisor_.GetState();
   }
+  return is_capturing_ ? StreamState::STATE_STREAMING
+                       : StreamState::STATE_CLOSED;
 }
 
-bool LegacyV4l2StreamSource::WaitForDevice() {
+bool LegacyV4l2StreamSource::reopen() {
   if (is_capturing_) {
     ADEBUG << "is capturing";
     return true;
@@ -931,6 +930,10 @@ bool LegacyV4l2StreamSource::WaitForDevice() {
     close_device();
     return false;
   }
+  if (!set_device_config()) {
+    AWARN_F("failed to apply camera controls to {}",
+            options_.resource.location);
+  }
   if (!start_capturing()) {
     AERROR_F("start capturing failed");
     uninit_device();
@@ -946,6 +949,13 @@ void LegacyV4l2StreamSource::reconnect() {
   close_device();
 }
 
+void LegacyV4l2StreamSource::handle_device_lost() {
+  reconnect();
+  if (options_.async) {
+    supervisor_.NotifyLost();
+  }
+}
+
 void LegacyV4l2StreamSource::shutdown() {
   stop_capturing();
   uninit_device();
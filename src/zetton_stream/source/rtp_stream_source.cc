@@ -0,0 +1,214 @@
+#include "zetton_stream/source/rtp_stream_source.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// packets of a recvmmsg() batch, and the largest packet of a sender
+constexpr size_t kMaxMessages = 64;
+constexpr size_t kMaxPacketSize = 2048;
+constexpr int kReceiveBufferSize = 8 << 20;
+constexpr int kNumFrames = 4;
+
+}  // namespace
+
+RtpStreamSource::~RtpStreamSource() { Close(); }
+
+bool RtpStreamSource::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.protocol != StreamProtocolType::PROTOCOL_RTP ||
+      options_.resource.port < 0) {
+    AERROR_F("{} is not an rtp address", options_.resource.string);
+    return false;
+  }
+  // JPEG for the MJPEG codec, otherwise raw frames of the pixel format
+  const StreamPixelFormat format =
+      options_.codec == StreamCodec::CODEC_MJPEG
+          ? StreamPixelFormat::PIXEL_FORMAT_MJPEG
+          : options_.pixel_format;
+  const int num_frames = options_.num_buffers > 0
+                             ? static_cast<int>(options_.num_buffers)
+                             : kNumFrames;
+  return depacketizer_.Init(format, static_cast<int>(options_.width),
+                            static_cast<int>(options_.height), num_frames);
+}
+
+bool RtpStreamSource::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    return true;
+  }
+
+  // 1. socket bound to the port, and to the group of a multicast address
+  const std::string& address = options_.resource.location;
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(options_.resource.port));
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    AERROR_F("invalid address {}", address);
+    return false;
+  }
+  const bool multicast = IN_MULTICAST(ntohl(addr.sin_addr.s_addr));
+  fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  const int enable = 1;
+  bool opened = fd_ >= 0 &&
+                setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &enable,
+                           sizeof(enable)) == 0 &&
+                bind(fd_, reinterpret_cast<sockaddr*>(&addr),
+                     sizeof(addr)) == 0;
+  if (opened && multicast) {
+    ip_mreq group;
+    memset(&group, 0, sizeof(group));
+    group.imr_multiaddr = addr.sin_addr;
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    opened = setsockopt(fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group,
+                        sizeof(group)) == 0;
+  }
+  if (!opened) {
+    AERROR_F("cannot receive on {}:{}: {}", address,
+             options_.resource.port, strerror(errno));
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    return false;
+  }
+  // frames arrive in bursts of packets
+  if (setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &kReceiveBufferSize,
+                 sizeof(kReceiveBufferSize)) < 0) {
+    AWARN_F("cannot set receive buffer of {}:{}: {}", address,
+            options_.resource.port, strerror(errno));
+  }
+  socklen_t addr_size = sizeof(addr);
+  if (getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &addr_size) ==
+      0) {
+    port_ = ntohs(addr.sin_port);
+  }
+
+  // 2. batch of packets
+  buffer_.resize(kMaxMessages * kMaxPacketSize);
+  messages_.resize(kMaxMessages);
+  iovecs_.resize(kMaxMessages);
+  for (size_t i = 0; i < kMaxMessages; ++i) {
+    iovecs_[i].iov_base = &buffer_[i * kMaxPacketSize];
+    iovecs_[i].iov_len = kMaxPacketSize;
+  }
+  num_received_ = 0;
+  next_ = 0;
+
+  is_streaming_ = true;
+  AINFO_F("receiving RTP on {}:{}", address, port_);
+  return true;
+}
+
+void RtpStreamSource::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  is_streaming_ = false;
+}
+
+bool RtpStreamSource::Receive(int timeout_ms, const uint8_t** packet,
+                              size_t* size) {
+  // 1. next packet of the batch
+  if (next_ < num_received_) {
+    *packet = &buffer_[next_ * kMaxPacketSize];
+    *size = messages_[next_].msg_len;
+    ++next_;
+    return true;
+  }
+
+  // 2. a new batch, as many packets as are there
+  pollfd fds;
+  fds.fd = fd_;
+  fds.events = POLLIN;
+  fds.revents = 0;
+  const int ready = poll(&fds, 1, timeout_ms);
+  if (ready <= 0) {
+    if (ready < 0 && errno != EINTR) {
+      AERROR_F("cannot poll {}: {}", options_.resource.string,
+               strerror(errno));
+    }
+    return false;
+  }
+  for (size_t i = 0; i < kMaxMessages; ++i) {
+    memset(&messages_[i], 0, sizeof(messages_[i]));
+    messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+    messages_[i].msg_hdr.msg_iovlen = 1;
+  }
+  const int n = recvmmsg(fd_, messages_.data(),
+                         static_cast<unsigned int>(kMaxMessages),
+                         MSG_DONTWAIT, nullptr);
+  if (n <= 0) {
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      AERROR_F("cannot receive from {}: {}", options_.resource.string,
+               strerror(errno));
+    }
+    return false;
+  }
+  num_received_ = static_cast<size_t>(n);
+  next_ = 1;
+  *packet = &buffer_[0];
+  *size = messages_[0].msg_len;
+  return true;
+}
+
+FramePtr RtpStreamSource::Acquire(int timeout_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ < 0) {
+    AERROR_F("capture error. source is not open");
+    return nullptr;
+  }
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    // 1. the next packet, until the deadline
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    const uint8_t* packet = nullptr;
+    size_t size = 0;
+    if (!Receive(static_cast<int>(std::max<int64_t>(left.count(), 0)),
+                 &packet, &size)) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return nullptr;
+      }
+      continue;
+    }
+
+    // 2. into the frame it belongs to
+    FramePtr frame = depacketizer_.Push(packet, size);
+    packets_lost_ = depacketizer_.GetNumLost();
+    frames_dropped_ = depacketizer_.GetNumDropped();
+    if (frame != nullptr) {
+      return frame;
+    }
+  }
+}
+
+bool RtpStreamSource::Capture(const FramePtr& frame) {
+  // nothing is taken from the source for a missing frame
+  return CaptureFrom(frame != nullptr ? Acquire() : nullptr, frame);
+}
+
+bool RtpStreamSource::Capture(const CameraImagePtr& raw_image) {
+  return CaptureFrom(raw_image != nullptr ? Acquire() : nullptr, raw_image);
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,104 @@
+#include "zetton_stream/source/shm_stream_source.h"
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+ShmStreamSource::~ShmStreamSource() { Close(); }
+
+bool ShmStreamSource::Init(const StreamOptions& options) {
+  options_ = options;
+  if (options_.resource.location.empty()) {
+    AERROR_F("missing shared memory name in {}", options_.resource.string);
+    return false;
+  }
+  return true;
+}
+
+bool ShmStreamSource::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Attach();
+}
+
+void ShmStreamSource::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // frames still held keep the ring mapped until they are released
+  ring_.reset();
+  is_streaming_ = false;
+}
+
+bool ShmStreamSource::Attach() {
+  if (ring_ && !ring_->IsWriterGone()) {
+    return true;
+  }
+  ring_ = ShmFrameRing::Open(options_.resource.location);
+  is_streaming_ = ring_ != nullptr;
+  if (!ring_) {
+    return false;
+  }
+  // a restarted writer numbers its frames from the start again
+  last_number_ = 0;
+  AINFO_F("attached to shared memory {} of {} slots", ring_->GetName(),
+          ring_->GetNumSlots());
+  return true;
+}
+
+FramePtr ShmStreamSource::Acquire(int timeout_ms) {
+  // 1. (re)attach to the writer
+  ShmFrameRingPtr ring;
+  uint64_t after = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!Attach()) {
+      return nullptr;
+    }
+    ring = ring_;
+    after = last_number_;
+  }
+
+  // 2. wait for a newer frame and hold its slot
+  if (!ring->Wait(after, timeout_ms)) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ring != ring_) {
+    return nullptr;
+  }
+  uint64_t number = 0;
+  ShmFrameInfo info;
+  const int slot = ring->Acquire(last_number_, read_all_, &number, &info);
+  if (slot < 0) {
+    return nullptr;
+  }
+
+  // 3. view of the slot, released when the last copy of the frame is gone
+  auto frame = std::make_shared<Frame>();
+  if (!SetShmFrameInfo(info, ring->GetSlotData(slot), ring->GetSlotSize(),
+                       frame.get())) {
+    AERROR_F("invalid frame {} in shared memory {}", number, ring->GetName());
+    ring->Release(slot);
+    last_number_ = number;
+    return nullptr;
+  }
+  frame->memory = FrameMemory::MEMORY_BORROWED;
+  frame->owner = std::shared_ptr<void>(
+      ring->GetSlotData(slot), [ring, slot](void*) { ring->Release(slot); });
+  if (last_number_ > 0 && number > last_number_ + 1) {
+    frames_skipped_ += number - last_number_ - 1;
+  }
+  last_number_ = number;
+  return frame;
+}
+
+bool ShmStreamSource::Capture(const FramePtr& frame) {
+  // nothing is taken from the source for a missing frame
+  return CaptureFrom(frame != nullptr ? Acquire() : nullptr, frame);
+}
+
+bool ShmStreamSource::Capture(const CameraImagePtr& raw_image) {
+  return CaptureFrom(raw_image != nullptr ? Acquire() : nullptr, raw_image);
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -1,17 +1,57 @@
 #include "zetton_stream/source/v4l2_stream_source.h"
 
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
 
 #include "zetton_stream/util/pixel_format.h"
 
 namespace zetton {
 namespace stream {
 
+namespace {
+
+// read until size bytes are read or the end of file is reached, returns the
+// number of bytes read or -1 on error
+ssize_t ReadFull(int fd, char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size) {
+    const ssize_t r = read(fd, data + offset, size - offset);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (r == 0) break;
+    offset += r;
+  }
+  return static_cast<ssize_t>(offset);
+}
+
+}  // namespace
+
 V4l2StreamSource::V4l2StreamSource()
-    : fd_(), buffers_(nullptr), n_buffers_(4), is_capturing_(false) {}
+    : fd_(),
+      buffers_(nullptr),
+      n_buffers_(4),
+      num_planes_(1),
+      bytesperline_(),
+      width_(0),
+      height_(0),
+      file_fd_(-1),
+      file_input_(false),
+      frame_size_(0),
+      read_sequence_(0),
+      file_loops_(0),
+      is_capturing_(false),
+      mjpeg_decoder_ready_(false),
+      decoder_width_(0),
+      decoder_height_(0),
+      last_sequence_(-1) {}
 
-V4l2StreamSource::~V4l2StreamSource() { Shutdown(); }
+V4l2StreamSource::~V4l2StreamSource() { Close(); }
 
 bool V4l2StreamSource::Init(const StreamOptions& options) {
   options_ = options;
@@ -23,7 +63,6 @@ bool V4l2StreamSource::Init(const StreamOptions& options) {
     pixel_format_ = V4L2_PIX_FMT_UYVY;
   } else if (options_.pixel_format == StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
     pixel_format_ = V4L2_PIX_FMT_MJPEG;
-    mjpeg_decoder_.Init(options_.width, options_.height);
   } else if (options_.pixel_format ==
              StreamPixelFormat::PIXEL_FORMAT_YUVMONO10) {
     // actually format V4L2_PIX_FMT_Y16 (10-bit mono expresed as 16-bit pixels),
@@ -35,18 +74,76 @@ bool V4l2StreamSource::Init(const StreamOptions& options) {
   } else if (options_.pixel_format == StreamPixelFormat::PIXEL_FORMAT_GRAY8) {
     pixel_format_ = V4L2_PIX_FMT_GREY;
     monochrome_ = true;
+  } else if (options_.pixel_format == StreamPixelFormat::PIXEL_FORMAT_NV12) {
+    pixel_format_ = V4L2_PIX_FMT_NV12;
+  } else if (options_.pixel_format == StreamPixelFormat::PIXEL_FORMAT_NV16) {
+    pixel_format_ = V4L2_PIX_FMT_NV16;
   } else {
     AERROR_F("Unsupported pixel format: {}",
              StreamPixelFormatToStr(options_.pixel_format));
     return false;
   }
 
+  // pixel formats the negotiation may fall back to, the requested one first.
+  // monochrome input stays monochrome since it changes the conversion
+  pixel_formats_ = {pixel_format_};
+  if (!monochrome_) {
+    std::vector<uint32_t> fallbacks;
+    if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_RGB) {
+      // multi-planar drivers usually expose NV12M/NV16M only
+      fallbacks = {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY,
+                   V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV12M,
+                   V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV16M};
+    } else if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
+      fallbacks = {V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY};
+    }
+    for (const auto fallback : fallbacks) {
+      if (fallback != pixel_format_) pixel_formats_.push_back(fallback);
+    }
+  }
+
+  // jitter, drop and clock offset statistics with frame-rate decimation
+  statistics_.Init(options_.frame_rate, options_.resource.location);
+
   return true;
 }
 
 bool V4l2StreamSource::WaitForDevice() {
+  if (options_.async) {
+    // the device is (re)opened by the supervisor in background, so never block
+    // the capture thread here
+    if (!supervisor_.IsRunning()) {
+      supervisor_.Start(
+          options_.resource.location,
+          [this]() {
+            std::lock_guard<std::mutex> lock(device_mutex_);
+            return Reopen();
+          },
+          state_callback_);
+    }
+    return is_capturing_;
+  }
+
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  return Reopen();
+}
+
+void V4l2StreamSource::Close() {
+  supervisor_.Stop();
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  Shutdown();
+}
+
+StreamState V4l2StreamSource::GetState() const {
+  if (supervisor_.IsRunning()) {
+    return supervisor_.GetState();
+  }
+  return is_capturing_ ? StreamState::STATE_STREAMING
+                       : StreamState::STATE_CLOSED;
+}
+
+bool V4l2StreamSource::Reopen() {
   if (is_capturing_) {
-    ADEBUG << "is capturing";
     ADEBUG_F("device {} is already capturing", options_.resource.location);
     return true;
   }
@@ -74,53 +171,181 @@ bool V4l2StreamSource::Capture(const CameraImagePtr& raw_image) {
   raw_image->is_new = 0;
   // 0.2. free memory in this struct desturctor
   memset(raw_image->image, 0, raw_image->image_size * sizeof(char));
+  // 0.3. view of the image as a frame, nothing is copied
+  Frame frame;
+  if (!frame.Wrap(GetOutputPixelFormat(), raw_image->width, raw_image->height,
+                  raw_image->image, raw_image->GetStride()) ||
+      frame.GetStride() <
+          raw_image->width * GetBytesPerPixel(frame.pixel_format) ||
+      frame.GetSize() > static_cast<size_t>(raw_image->image_size)) {
+    AERROR_F("cannot capture into a {}x{} image", raw_image->width,
+             raw_image->height);
+    return false;
+  }
 
-  // 1. select device
-  fd_set fds;
-  struct timeval tv;
-  int r = 0;
-
-  FD_ZERO(&fds);
-  FD_SET(fd_.g_fd(), &fds);
+  // 1. capture
+  if (!CaptureFrame(&frame)) {
+    return false;
+  }
+  CopyMetadata(frame, raw_image.get());
+  raw_image->is_new = 1;
 
-  /* Timeout. */
-  tv.tv_sec = 2;
-  tv.tv_usec = 0;
+  return true;
+}
 
-  r = select(fd_.g_fd() + 1, &fds, nullptr, nullptr, &tv);
-  if (-1 == r) {
-    AERROR_F("failed to select device {}: code {} string [{}]",
-             options_.resource.location, errno, strerror(errno));
-    if (EINTR == errno) {
+bool V4l2StreamSource::Capture(const FramePtr& frame) {
+  // 0. provide memory on first use, it is reused by the next captures
+  if (frame == nullptr) {
+    AERROR_F("capture error. frame is null");
+    return false;
+  }
+  if (!frame->IsMapped()) {
+    int width = 0;
+    int height = 0;
+    GetOutputSize(&width, &height);
+    if (!frame->Allocate(GetOutputPixelFormat(), width, height)) {
+      AERROR_F("cannot allocate {}x{} frame for device {}", width, height,
+               options_.resource.location);
       return false;
     }
-    Shutdown();
   }
-  if (0 == r) {
-    AERROR_F("timeout to select device {}: code {} string [{}]",
-             options_.resource.location, errno, strerror(errno));
-    Shutdown();
+  if (frame->pixel_format != GetOutputPixelFormat()) {
+    AERROR_F("frame format {} does not match the output format {}",
+             StreamPixelFormatToStr(frame->pixel_format),
+             StreamPixelFormatToStr(GetOutputPixelFormat()));
+    return false;
   }
 
-  // 2. read frame
-  int get_new_image = ReadFrame(raw_image);
-  if (!get_new_image) {
-    AERROR_F("failed to read frame from device {}", options_.resource.location);
+  // 1. capture
+  return CaptureFrame(frame.get());
+}
+
+bool V4l2StreamSource::CaptureFrame(Frame* frame) {
+  // 0. lock the device, in async mode return right away while the
+  // supervisor is reconnecting
+  std::unique_lock<std::mutex> lock(device_mutex_, std::defer_lock);
+  if (options_.async) {
+    if (!lock.try_lock()) {
+      return false;
+    }
+  } else {
+    lock.lock();
+  }
+  if (!is_capturing_) {
     return false;
   }
-  raw_image->is_new = 1;
+
+  // frames dropped by decimation are skipped until the next one is due
+  ReadResult result = ReadResult::READ_SKIPPED;
+  while (result == ReadResult::READ_SKIPPED) {
+    // 1. select device
+    fd_set fds;
+    struct timeval tv;
+    int r = 0;
+
+    const int fd = file_input_ ? file_fd_ : fd_.g_fd();
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    /* Timeout. */
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
+
+    r = select(fd + 1, &fds, nullptr, nullptr, &tv);
+    if (-1 == r) {
+      AERROR_F("failed to select device {}: code {} string [{}]",
+               options_.resource.location, errno, strerror(errno));
+      if (EINTR == errno) {
+        return false;
+      }
+      HandleDeviceLost();
+      return false;
+    }
+    if (0 == r) {
+      AERROR_F("timeout to select device {}: code {} string [{}]",
+               options_.resource.location, errno, strerror(errno));
+      HandleDeviceLost();
+      return false;
+    }
+
+    // 2. read frame
+    result = ReadFrame(frame);
+    if (result == ReadResult::READ_ERROR) {
+      AERROR_F("failed to read frame from device {}",
+               options_.resource.location);
+      return false;
+    }
+    // the device may be lost while reading
+    if (!is_capturing_) {
+      return false;
+    }
+  }
 
   return true;
 }
 
 bool V4l2StreamSource::IsCaptuering() { return is_capturing_; }
 
+StreamPixelFormat V4l2StreamSource::GetOutputPixelFormat() const {
+  // monochrome input is converted to one byte per pixel
+  return monochrome_ ? StreamPixelFormat::PIXEL_FORMAT_GRAY8
+                     : options_.output_format;
+}
+
+void V4l2StreamSource::GetOutputSize(int* width, int* height) const {
+  // a software crop only moves the first pixel
+  if (sw_roi_.width > 0) {
+    *width = static_cast<int>(sw_roi_.width);
+    *height = static_cast<int>(sw_roi_.height);
+  } else {
+    *width = static_cast<int>(width_);
+    *height = static_cast<int>(height_);
+  }
+}
+
+FrameStatisticsSnapshot V4l2StreamSource::GetStatistics() const {
+  return statistics_.GetSnapshot();
+}
+
+const std::vector<V4l2ControlInfo>& V4l2StreamSource::GetControls() const {
+  return controls_.GetControls();
+}
+
+bool V4l2StreamSource::GetControl(const std::string& name, int64_t* value) {
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  const auto* info = controls_.Find(name);
+  if (fd_.g_fd() < 0 || info == nullptr) {
+    AERROR_F("control {} is not available on {}", name,
+             options_.resource.location);
+    return false;
+  }
+  return controls_.GetControl(&fd_, info->id, value);
+}
+
+bool V4l2StreamSource::SetControl(const std::string& name, int64_t value) {
+  std::lock_guard<std::mutex> lock(device_mutex_);
+  const auto* info = controls_.Find(name);
+  if (fd_.g_fd() < 0 || info == nullptr) {
+    AERROR_F("control {} is not available on {}", name,
+             options_.resource.location);
+    return false;
+  }
+  return controls_.SetControl(&fd_, info->id, value);
+}
+
 void V4l2StreamSource::Shutdown() {
   StopCapturing();
   UninitDevice();
   CloseDevice();
 }
 
+void V4l2StreamSource::HandleDeviceLost() {
+  Shutdown();
+  if (options_.async) {
+    supervisor_.NotifyLost();
+  }
+}
+
 bool V4l2StreamSource::OpenDevice() {
   // 0. check if device exists
   struct stat st;
@@ -132,8 +357,24 @@ bool V4l2StreamSource::OpenDevice() {
   }
 
   if (!S_ISCHR(st.st_mode)) {
-    AERROR_F("{} is no device", options_.resource.location);
-    return false;
+    // a FIFO or regular file of raw frames may stand in for a read() device
+    if (options_.io_method != StreamIoMethod::IO_METHOD_READ ||
+        !(S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode))) {
+      AERROR_F("{} is no device", options_.resource.location);
+      return false;
+    }
+    // do not block on a FIFO without writer, reads block again once opened
+    file_fd_ = open(options_.resource.location.c_str(),
+                    O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (file_fd_ < 0) {
+      AERROR_F("cannot open file {}: code {}, string [{}]",
+               options_.resource.location, errno, strerror(errno));
+      return false;
+    }
+    fcntl(file_fd_, F_SETFL, fcntl(file_fd_, F_GETFL) & ~O_NONBLOCK);
+    file_input_ = true;
+    AINFO_F("file {} opened in place of a device", options_.resource.location);
+    return true;
   }
 
   // 1. open device as a file descriptor
@@ -150,6 +391,15 @@ bool V4l2StreamSource::OpenDevice() {
 }
 
 bool V4l2StreamSource::CloseDevice() {
+  if (file_input_) {
+    close(file_fd_);
+    file_fd_ = -1;
+    file_input_ = false;
+    return true;
+  }
+  if (fd_.g_fd() < 0) {
+    return true;
+  }
   if (fd_.close() != 0) {
     AERROR_F("failed to close device {}", options_.resource.location);
     return false;
@@ -158,6 +408,11 @@ bool V4l2StreamSource::CloseDevice() {
 }
 
 bool V4l2StreamSource::InitDevice() {
+  // 0. files have no capabilities to query
+  if (file_input_) {
+    return InitFileInput();
+  }
+
   // 1. check device capabilities
   // 1.1. check if device supports v4l2
   if (!fd_.is_v4l2()) {
@@ -199,47 +454,113 @@ bool V4l2StreamSource::InitDevice() {
   }
 
   // 2. set device format
-  // 2.1. set image size and pixel format
+  // 2.1. negotiate image size, pixel format and frame rate
+  V4l2Mode mode;
+  if (!negotiator_.Negotiate(&fd_, options_, pixel_formats_, &mode)) {
+    AWARN_F("cannot negotiate capture mode for device {}, use the requested "
+            "one",
+            options_.resource.location);
+    mode.pixel_format = pixel_formats_.front();
+    mode.width = options_.width;
+    mode.height = options_.height;
+    if (options_.frame_rate > 0) {
+      mode.interval.numerator = 1;
+      mode.interval.denominator = static_cast<uint32_t>(options_.frame_rate);
+    }
+  }
+  // 2.2. set image size and pixel format
   cv4l_fmt fmt;
   fd_.g_fmt(fmt);
-  fmt.s_width(options_.width);
-  fmt.s_height(options_.height);
-  fmt.s_pixelformat(pixel_format_);
+  fmt.s_width(mode.width);
+  fmt.s_height(mode.height);
+  fmt.s_pixelformat(mode.pixel_format);
   if (fd_.s_fmt(fmt) != 0) {
-    AWARN_F("cannot set format for device {}: code {}, string [{}]",
-            options_.resource.location, errno, strerror(errno));
-    // return false;
-  }
-  // note that VIDIOC_S_FMT may change width and height
-  // workaround for buggy driver paranoia.
-  unsigned int min = fmt.g_width() * 2;
-  if (fmt.g_bytesperline() < min) {
-    fmt.s_bytesperline(min);
-  }
-  min = fmt.g_bytesperline() * fmt.g_height();
-  if (fmt.g_sizeimage() < min) {
-    fmt.s_sizeimage(min);
-  }
-  options_.width = fmt.g_width();
-  options_.height = fmt.g_height();
-  AINFO_F("image size set to {}x{} and pixel format set to {} for device {}",
-          options_.width, options_.height, pixel_format_,
-          options_.resource.location);
-  // 2.2. set frame rate
-  v4l2_fract frame_rate;
-  if (fd_.get_interval(frame_rate) != 0) {
-    AWARN_F("cannot get frame rate for device {}: code {}, string [{}]",
-            options_.resource.location, errno, strerror(errno));
-    Shutdown();
-    // return false;
-  }
-  frame_rate.numerator = 1;
-  frame_rate.denominator = options_.frame_rate;
-  if (fd_.set_interval(frame_rate) != 0) {
-    AWARN_F("cannot set frame rate for device {}: code {}, string [{}]",
-            options_.resource.location, errno, strerror(errno));
-  } else {
-    AINFO_F("frame rate set to {} for device {}", options_.frame_rate,
+    AERROR_F("cannot set format for device {}: code {}, string [{}]",
+             options_.resource.location, errno, strerror(errno));
+    return false;
+  }
+  // note that VIDIOC_S_FMT may change the pixel format, width and height
+  if (fmt.g_pixelformat() != mode.pixel_format) {
+    AERROR_F("device {} rejected pixel format {}", options_.resource.location,
+             V4l2ModeToStr(mode));
+    return false;
+  }
+  pixel_format_ = mode.pixel_format;
+  // 2.3. crop to the region of interest, on the device if possible
+  if (!ApplyRoi(&fmt)) {
+    return false;
+  }
+  // workaround for buggy driver paranoia, packed yuv only
+  if (pixel_format_ == V4L2_PIX_FMT_YUYV ||
+      pixel_format_ == V4L2_PIX_FMT_UYVY) {
+    unsigned int min = fmt.g_width() * 2;
+    if (fmt.g_bytesperline() < min) {
+      fmt.s_bytesperline(min);
+    }
+    min = fmt.g_bytesperline() * fmt.g_height();
+    if (fmt.g_sizeimage() < min) {
+      fmt.s_sizeimage(min);
+    }
+  }
+  // keep the stride of every plane, rows may be padded by the driver
+  num_planes_ = fmt.g_num_planes();
+  bytesperline_.fill(0);
+  for (unsigned int i = 0; i < fmt.g_num_planes(); ++i) {
+    bytesperline_[i] = fmt.g_bytesperline(i);
+  }
+  if (bytesperline_[0] == 0) {
+    bytesperline_[0] = fmt.g_width();
+  }
+  // the requested size stays in the options, the negotiated one may differ
+  width_ = fmt.g_width();
+  height_ = fmt.g_height();
+  AINFO_F(
+      "image size set to {}x{} and pixel format set to {} ({} planes) for "
+      "device {}",
+      width_, height_, pixel_format_, fmt.g_num_planes(),
+      options_.resource.location);
+  if (options_.width > 0 && options_.height > 0 && options_.roi.width == 0 &&
+      (width_ != options_.width || height_ != options_.height)) {
+    AWARN_F("device {} delivers {}x{} instead of the requested {}x{}",
+            options_.resource.location, width_, height_, options_.width,
+            options_.height);
+  }
+  // 2.4. set frame rate
+  if (mode.interval.numerator > 0) {
+    v4l2_fract frame_rate = mode.interval;
+    if (fd_.set_interval(frame_rate) != 0) {
+      AWARN_F("cannot set frame rate for device {}: code {}, string [{}]",
+              options_.resource.location, errno, strerror(errno));
+    } else if (fd_.get_interval(frame_rate) == 0 && frame_rate.numerator > 0) {
+      AINFO_F("frame rate set to {} for device {}",
+              static_cast<float>(frame_rate.denominator) /
+                  frame_rate.numerator,
+              options_.resource.location);
+    }
+  }
+  // 2.5. the decoder follows the negotiated image size, which may change on
+  // reconnect, compressed output needs none
+  if (mjpeg_decoder_ready_ &&
+      (decoder_width_ != width_ || decoder_height_ != height_)) {
+    mjpeg_decoder_ready_ = false;
+  }
+  if (pixel_format_ == V4L2_PIX_FMT_MJPEG &&
+      options_.output_format != StreamPixelFormat::PIXEL_FORMAT_MJPEG &&
+      !mjpeg_decoder_ready_) {
+    mjpeg_decoder_ready_ = mjpeg_decoder_.Init(width_, height_);
+    decoder_width_ = width_;
+    decoder_height_ = height_;
+    if (!mjpeg_decoder_ready_) {
+      AERROR_F("cannot init mjpeg decoder for device {}",
+               options_.resource.location);
+      return false;
+    }
+  }
+
+  // 2.6. apply camera controls in one batch
+  controls_.Enumerate(&fd_);
+  if (!controls_.Apply(&fd_, options_.camera)) {
+    AWARN_F("failed to apply camera controls to {}",
             options_.resource.location);
   }
 
@@ -256,11 +577,23 @@ bool V4l2StreamSource::InitDevice() {
       if (buffers_->obtain_bufs(&fd_) != 0) {
         AERROR_F("cannot obtain buffers for device {}: code {}, string [{}]",
                  options_.resource.location, errno, strerror(errno));
+        Shutdown();
         return false;
       }
       break;
 
     case StreamIoMethod::IO_METHOD_READ:
+      // a single read() returns at most one frame, compressed frames are
+      // smaller than sizeimage
+      if (num_planes_ != 1) {
+        AERROR_F("read i/o of multi-planar device {} is not supported",
+                 options_.resource.location);
+        return false;
+      }
+      frame_size_ = fmt.g_sizeimage();
+      read_buffer_.resize(frame_size_);
+      break;
+
     case StreamIoMethod::IO_METHOD_USERPTR:
       AERROR_F("unimplemented i/o method: {}",
                StreamIoMethodToStr(options_.io_method));
@@ -278,7 +611,81 @@ bool V4l2StreamSource::InitDevice() {
   return true;
 }
 
+bool V4l2StreamSource::InitFileInput() {
+  // 1. frames are stored back to back in the requested format, without row
+  // padding
+  const unsigned int width = options_.width;
+  const unsigned int height = options_.height;
+  width_ = width;
+  height_ = height;
+  if (width == 0 || height == 0) {
+    AERROR_F("image size of file {} is not set", options_.resource.location);
+    return false;
+  }
+  pixel_format_ = pixel_formats_.front();
+  bytesperline_.fill(0);
+  switch (pixel_format_) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+      bytesperline_[0] = width * 2;
+      frame_size_ = static_cast<size_t>(bytesperline_[0]) * height;
+      break;
+    case V4L2_PIX_FMT_RGB24:
+      bytesperline_[0] = width * 3;
+      frame_size_ = static_cast<size_t>(bytesperline_[0]) * height;
+      break;
+    case V4L2_PIX_FMT_GREY:
+      bytesperline_[0] = width;
+      frame_size_ = static_cast<size_t>(bytesperline_[0]) * height;
+      break;
+    case V4L2_PIX_FMT_NV12:
+      bytesperline_[0] = width;
+      frame_size_ = static_cast<size_t>(width) * (height + (height + 1) / 2);
+      break;
+    case V4L2_PIX_FMT_NV16:
+      bytesperline_[0] = width;
+      frame_size_ = static_cast<size_t>(width) * height * 2;
+      break;
+    default:
+      // compressed frames cannot be split without a container
+      AERROR_F("pixel format {} cannot be read from file {}",
+               StreamPixelFormatToStr(options_.pixel_format),
+               options_.resource.location);
+      return false;
+  }
+  num_planes_ = 1;
+
+  // 2. files are always cropped in software
+  sw_roi_ = StreamRoi();
+  const StreamRoi& roi = options_.roi;
+  if (roi.width > 0 && roi.height > 0) {
+    if (roi.x + roi.width > width || roi.y + roi.height > height) {
+      AERROR_F("roi {}x{}+{}+{} is out of the {}x{} frame of file {}",
+               roi.width, roi.height, roi.x, roi.y, width, height,
+               options_.resource.location);
+      return false;
+    }
+    if (!SetSoftwareRoi(roi)) {
+      return false;
+    }
+  }
+
+  // 3. staging buffer for frames that need a conversion
+  read_buffer_.resize(frame_size_);
+  AINFO_F("reading {}x{} frames of {} bytes from file {}", width, height,
+          frame_size_, options_.resource.location);
+  return true;
+}
+
 bool V4l2StreamSource::UninitDevice() {
+  if (options_.io_method == StreamIoMethod::IO_METHOD_READ) {
+    std::vector<char>().swap(read_buffer_);
+    frame_size_ = 0;
+    return true;
+  }
+  if (buffers_ == nullptr) {
+    return true;
+  }
   switch (options_.io_method) {
     case StreamIoMethod::IO_METHOD_MMAP:
       if (buffers_->munmap_bufs(&fd_) != 0) {
@@ -286,6 +693,8 @@ bool V4l2StreamSource::UninitDevice() {
                  options_.resource.location, errno, strerror(errno));
         return false;
       }
+      delete buffers_;
+      buffers_ = nullptr;
       break;
 
     case StreamIoMethod::IO_METHOD_READ:
@@ -311,6 +720,17 @@ bool V4l2StreamSource::StartCapturing() {
     return true;
   }
 
+  // the driver restarts its sequence counter on every stream on
+  last_sequence_ = -1;
+  read_sequence_ = 0;
+  file_loops_ = 0;
+
+  // 0.1. read() starts streaming on the first read
+  if (options_.io_method == StreamIoMethod::IO_METHOD_READ) {
+    is_capturing_ = true;
+    return true;
+  }
+
   // 1. init buffers
   if (buffers_->queue_all(&fd_) != 0) {
     AERROR_F("cannot queue buffers for device {}: code {}, string [{}]",
@@ -361,10 +781,12 @@ bool V4l2StreamSource::StopCapturing() {
   return true;
 }
 
-bool V4l2StreamSource::ReadFrame(CameraImagePtr raw_image) {
+V4l2StreamSource::ReadResult V4l2StreamSource::ReadFrame(Frame* dest) {
   cv4l_buffer buf(fd_.g_type());
   std::array<void*, VIDEO_MAX_PLANES> mplane_data;
   std::array<unsigned int, VIDEO_MAX_PLANES> mplane_size;
+  uint32_t bytes_used = 0;
+  bool processed = false;
 
   switch (options_.io_method) {
     case StreamIoMethod::IO_METHOD_MMAP:
@@ -374,146 +796,475 @@ bool V4l2StreamSource::ReadFrame(CameraImagePtr raw_image) {
                  options_.resource.location, errno, strerror(errno));
         switch (errno) {
           case EAGAIN:
-            return false;
+            return ReadResult::READ_ERROR;
           case EIO:
             /* Could ignore EIO, see spec. */
             /* fall through */
           default:
-            Shutdown();
-            return false;
+            HandleDeviceLost();
+            return ReadResult::READ_ERROR;
         }
       }
       if (buf.g_index() >= n_buffers_) {
         AERROR_F("invalid buffer index: {} for device {}", buf.g_index(),
                  options_.resource.location);
-        return false;
+        return ReadResult::READ_ERROR;
       }
-      // get timestamp
-      raw_image->tv_sec = static_cast<int>(buf.g_timestamp().tv_sec);
-      raw_image->tv_usec = static_cast<int>(buf.g_timestamp().tv_usec);
-      // get data
+      // get timestamp, sequence and flags
+      bytes_used = 0;
       for (unsigned int i = 0; i < buf.g_num_planes(); ++i) {
-        mplane_data[i] = buffers_->g_dataptr(buf.g_index(), i);
-        mplane_size[i] = buf.g_bytesused(i);
+        bytes_used += buf.g_bytesused(i);
       }
-      // process data
-      ProcessImage(mplane_data, mplane_size, raw_image);
+      FillCaptureMetadata(buf.buf, bytes_used, &last_sequence_, dest);
+      // account the frame and drop it when decimating the frame rate
+      if (!statistics_.Update(*dest)) {
+        if (fd_.qbuf(buf) != 0) {
+          AERROR_F("cannot enqueue buffer for device {}: code {}, string [{}]",
+                   options_.resource.location, errno, strerror(errno));
+          return ReadResult::READ_ERROR;
+        }
+        return ReadResult::READ_SKIPPED;
+      }
+      // get data, planes of multi-planar buffers may start at an offset
+      mplane_data.fill(nullptr);
+      mplane_size.fill(0);
+      for (unsigned int i = 0; i < buf.g_num_planes(); ++i) {
+        const unsigned int offset =
+            fd_.g_type() == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                ? buf.g_data_offset(i)
+                : 0;
+        mplane_data[i] =
+            static_cast<char*>(buffers_->g_dataptr(buf.g_index(), i)) + offset;
+        mplane_size[i] = buf.g_bytesused(i) - offset;
+      }
+      // process data, the buffer goes back to the driver either way
+      processed = ProcessImage(mplane_data, mplane_size, dest);
       // enqueue buffer
       if (fd_.qbuf(buf) != 0) {
         AERROR_F("cannot enqueue buffer for device {}: code {}, string [{}]",
                  options_.resource.location, errno, strerror(errno));
-        return false;
+        return ReadResult::READ_ERROR;
+      }
+      if (!processed) {
+        // the size of the driver buffer does not describe the frame
+        dest->bytes_used = 0;
+        return ReadResult::READ_ERROR;
       }
       break;
 
     case StreamIoMethod::IO_METHOD_READ:
+      return ReadFrameDirect(dest);
+      break;
+
     case StreamIoMethod::IO_METHOD_USERPTR:
       AERROR_F("unimplemented i/o method: {}",
                StreamIoMethodToStr(options_.io_method));
-      return false;
+      return ReadResult::READ_ERROR;
       break;
 
     case StreamIoMethod::IO_METHOD_UNKNOWN:
     default:
       AERROR_F("unsupported i/o method: {}",
                StreamIoMethodToStr(options_.io_method));
-      return false;
+      return ReadResult::READ_ERROR;
       break;
   }
 
-  return true;
+  return ReadResult::READ_FRAME;
+}
+
+V4l2StreamSource::ReadResult V4l2StreamSource::ReadFrameDirect(Frame* dest) {
+  // 1. read into the destination when the conversion would be a plain copy
+  const bool in_place = CanReadInPlace(*dest);
+  char* data = in_place ? reinterpret_cast<char*>(dest->GetData())
+                        : read_buffer_.data();
+  ssize_t len = 0;
+  if (file_input_) {
+    // 1.1. files have no frame boundaries, read exactly one frame and rewind
+    // at the end when looping
+    len = ReadFull(file_fd_, data, frame_size_);
+    if (len >= 0 && static_cast<size_t>(len) < frame_size_) {
+      struct stat st;
+      const bool regular = fstat(file_fd_, &st) == 0 && S_ISREG(st.st_mode);
+      if (len > 0) {
+        AWARN_F("dropped truncated frame of {} bytes at the end of file {}",
+                len, options_.resource.location);
+      }
+      if (!regular) {
+        AWARN_F("writer of {} closed", options_.resource.location);
+        HandleDeviceLost();
+        return ReadResult::READ_ERROR;
+      }
+      if (options_.loop >= 0 && file_loops_ >= options_.loop) {
+        AINFO_F("end of file {}", options_.resource.location);
+        return ReadResult::READ_ERROR;
+      }
+      file_loops_ += 1;
+      if (lseek(file_fd_, 0, SEEK_SET) < 0) {
+        AERROR_F("cannot rewind file {}: code {}, string [{}]",
+                 options_.resource.location, errno, strerror(errno));
+        return ReadResult::READ_ERROR;
+      }
+      len = ReadFull(file_fd_, data, frame_size_);
+      if (len >= 0 && static_cast<size_t>(len) < frame_size_) {
+        AERROR_F("file {} holds no complete frame", options_.resource.location);
+        return ReadResult::READ_ERROR;
+      }
+    }
+  } else {
+    // 1.2. devices return one frame per read(), the rest is discarded
+    do {
+      len = read(fd_.g_fd(), data, frame_size_);
+    } while (len < 0 && errno == EINTR);
+  }
+  if (len < 0) {
+    AERROR_F("cannot read frame from {}: code {}, string [{}]",
+             options_.resource.location, errno, strerror(errno));
+    switch (errno) {
+      case EAGAIN:
+        return ReadResult::READ_ERROR;
+      case EIO:
+        /* Could ignore EIO, see spec. */
+        /* fall through */
+      default:
+        HandleDeviceLost();
+        return ReadResult::READ_ERROR;
+    }
+  }
+  if (pixel_format_ != V4L2_PIX_FMT_MJPEG &&
+      static_cast<size_t>(len) <
+          static_cast<size_t>(bytesperline_[0]) * height_) {
+    AERROR_F("wrong frame length {} from {}", len, options_.resource.location);
+    return ReadResult::READ_ERROR;
+  }
+
+  // 2. read() has no buffer metadata, number the frames and stamp them with
+  // the time of the read
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.sequence = read_sequence_++;
+  FillCaptureMetadata(buf, static_cast<uint32_t>(len), &last_sequence_, dest);
+  if (!statistics_.Update(*dest)) {
+    return ReadResult::READ_SKIPPED;
+  }
+
+  // 3. convert from the staging buffer
+  if (in_place) {
+    return ReadResult::READ_FRAME;
+  }
+  std::array<void*, VIDEO_MAX_PLANES> mplane_data;
+  std::array<unsigned int, VIDEO_MAX_PLANES> mplane_size;
+  mplane_data.fill(nullptr);
+  mplane_size.fill(0);
+  mplane_data[0] = data;
+  mplane_size[0] = static_cast<unsigned int>(len);
+  if (!ProcessImage(mplane_data, mplane_size, dest)) {
+    dest->bytes_used = 0;
+    return ReadResult::READ_ERROR;
+  }
+  return ReadResult::READ_FRAME;
+}
+
+bool V4l2StreamSource::CanReadInPlace(const Frame& dest) const {
+  if (sw_roi_.width > 0 || num_planes_ != 1 || !dest.IsMapped() ||
+      dest.GetStride() != static_cast<int>(bytesperline_[0]) ||
+      dest.planes[0].size < frame_size_ ||
+      dest.width != static_cast<int>(width_) ||
+      dest.height != static_cast<int>(height_)) {
+    return false;
+  }
+  // same cases as the plain copies of ProcessImage()
+  if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_RGB) {
+    return pixel_format_ == V4L2_PIX_FMT_RGB24 ||
+           pixel_format_ == V4L2_PIX_FMT_GREY;
+  }
+  if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
+    return pixel_format_ == V4L2_PIX_FMT_YUYV && !monochrome_;
+  }
+  return false;
 }
 
 bool V4l2StreamSource::ProcessImage(
     std::array<void*, VIDEO_MAX_PLANES> mplane_data,
-    std::array<unsigned int, VIDEO_MAX_PLANES> mplane_size,
-    CameraImagePtr dest) {
+    std::array<unsigned int, VIDEO_MAX_PLANES> mplane_size, Frame* dest) {
   // 0. check validiy of image pointers
-  if (mplane_data[0] == nullptr || dest == nullptr) {
+  if (mplane_data[0] == nullptr || dest == nullptr || !dest->IsMapped()) {
     AERROR_F("process image error. src or dest is null");
     return false;
   }
 
-  // 1. do conversion
-  if (buffers_->g_num_planes() == 1) {
-    auto src = mplane_data[0];
-    auto len = mplane_size[0];
-    if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_RGB) {
-      // 1.1. convert to RGB
-      if (pixel_format_ == V4L2_PIX_FMT_YUYV) {
-        if (monochrome_) {
-          // 1.1.1. convert Y16 to RGB
-          // actually format V4L2_PIX_FMT_Y16, but xioctl gets
-          // unhappy if you don't use the advertised type (yuyv)
-          mono102mono8((char*)src, dest->image, dest->width * dest->height);
-        } else {
-          // 1.1.2. convert YUYV to RGB
-#if 0
-        yuyv2rgb((char*)src, dest->image, dest->width * dest->height);
-#else
+  // 1. check the output size, a software crop only moves the first pixel
+  int frame_width = 0;
+  int frame_height = 0;
+  GetOutputSize(&frame_width, &frame_height);
+  const unsigned int width = frame_width;
+  const unsigned int height = frame_height;
+  if (dest->width != frame_width || dest->height != frame_height) {
+    AERROR_F("image size {}x{} does not match the frame size {}x{}",
+             dest->width, dest->height, width, height);
+    return false;
+  }
+  if (IsSemiPlanar(pixel_format_)) {
+    // 1.1. semi-planar formats come in one buffer (NV12, NV16) or in one
+    // buffer per plane (NV12M, NV16M)
+    return ProcessSemiPlanarImage(mplane_data, dest);
+  }
+  if (num_planes_ != 1) {
+    AERROR_F("unimplemented proceessing function for plane number: {} ",
+             num_planes_);
+    return false;
+  }
+  if (pixel_format_ == V4L2_PIX_FMT_MJPEG &&
+      options_.output_format == StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    // 1.2. compressed frames are passed through, e.g. to be recorded
+    if (mplane_size[0] > dest->planes[0].size) {
+      AERROR_F("compressed frame of {} bytes exceeds the frame of {} bytes",
+               mplane_size[0], dest->planes[0].size);
+      return false;
+    }
+    memcpy(dest->GetData(), mplane_data[0], mplane_size[0]);
+    dest->bytes_used = mplane_size[0];
+    return true;
+  }
+
+  // 2. locate the first pixel, rows of source and destination may be padded
+  auto* src = static_cast<const unsigned char*>(mplane_data[0]);
+  unsigned int src_stride = bytesperline_[0];
+  unsigned int src_bpp = 2;
+  auto* dst = dest->GetData();
+  const unsigned int dst_stride = dest->GetStride();
+  if (pixel_format_ == V4L2_PIX_FMT_MJPEG &&
+      options_.output_format == StreamPixelFormat::PIXEL_FORMAT_RGB) {
+    // 2.1. compressed frames are decoded as a whole
+    if (sw_roi_.width == 0 && dst_stride == width * 3) {
+      mjpeg_decoder_.ToRGB(static_cast<char*>(mplane_data[0]), mplane_size[0],
+                           reinterpret_cast<char*>(dst), width * height);
+      return true;
+    }
+    decode_buffer_.resize(static_cast<size_t>(width_) * height_ * 3);
+    mjpeg_decoder_.ToRGB(static_cast<char*>(mplane_data[0]), mplane_size[0],
+                         decode_buffer_.data(),
+                         width_ * height_);
+    src = reinterpret_cast<const unsigned char*>(decode_buffer_.data());
+    src_stride = width_ * 3;
+    src_bpp = 3;
+  } else if (pixel_format_ == V4L2_PIX_FMT_RGB24) {
+    src_bpp = 3;
+  } else if (pixel_format_ == V4L2_PIX_FMT_GREY) {
+    src_bpp = 1;
+  }
+  if (sw_roi_.width > 0) {
+    src += static_cast<size_t>(sw_roi_.y) * src_stride + sw_roi_.x * src_bpp;
+  }
+
+  // 3. do conversion
+  if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_RGB) {
+    // 3.1. convert to RGB
+    if (pixel_format_ == V4L2_PIX_FMT_YUYV) {
+      if (monochrome_) {
+        // 3.1.1. convert Y16 to RGB
+        // actually format V4L2_PIX_FMT_Y16, but xioctl gets
+        // unhappy if you don't use the advertised type (yuyv)
+        mono10_to_mono8(src, src_stride, dst, dst_stride, width, height);
+      } else {
+        // 3.1.2. convert YUYV to RGB
 #ifdef WITH_AVX
-          yuyv2rgb_avx((unsigned char*)src, (unsigned char*)dest->image,
-                       dest->width * dest->height);
+        yuyv_to_rgb_avx(src, src_stride, dst, dst_stride, width, height);
 #else
-          convert_yuv_to_rgb_buffer((unsigned char*)src,
-                                    (unsigned char*)dest->image, dest->width,
-                                    dest->height);
-#endif
+        yuyv_to_rgb(src, src_stride, dst, dst_stride, width, height);
 #endif
-        }
-      } else if (pixel_format_ == V4L2_PIX_FMT_UYVY) {
-// 1.1.3. convert UYUV to RGB
-#if 0
-      uyvy2rgb((char*)src, dest->image, dest->width * dest->height);
-#else
-        uyvy2yuyv((char*)src, len);
+      }
+    } else if (pixel_format_ == V4L2_PIX_FMT_UYVY) {
+      // 3.1.3. convert UYUV to RGB, without repacking the driver buffer
 #ifdef WITH_AVX
-        yuyv2rgb_avx((unsigned char*)src, (unsigned char*)dest->image,
-                     dest->width * dest->height);
+      uyvy_to_rgb_avx(src, src_stride, dst, dst_stride, width, height);
 #else
-        convert_yuv_to_rgb_buffer((unsigned char*)src,
-                                  (unsigned char*)dest->image, dest->width,
-                                  dest->height);
+      uyvy_to_rgb(src, src_stride, dst, dst_stride, width, height);
 #endif
+    } else if (pixel_format_ == V4L2_PIX_FMT_MJPEG ||
+               pixel_format_ == V4L2_PIX_FMT_RGB24) {
+      // 3.1.4. copy decoded MJPEG or RGB to RGB
+      copy_rows(src, src_stride, dst, dst_stride, width * 3, height);
+    } else if (pixel_format_ == V4L2_PIX_FMT_GREY) {
+      // 3.1.5. convert GRAY to RGB
+      copy_rows(src, src_stride, dst, dst_stride, width, height);
+    } else {
+      AERROR << "unsupported pixel format:" << pixel_format_;
+      return false;
+    }
+  } else if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
+    // 3.2. convert to YUYV
+    if (pixel_format_ == V4L2_PIX_FMT_YUYV && !monochrome_) {
+      // 3.2.1. convert YUYV to YUYV
+      copy_rows(src, src_stride, dst, dst_stride, width * 2, height);
+    } else if (pixel_format_ == V4L2_PIX_FMT_UYVY) {
+      // 3.2.2. convert UYUV to YUYV
+#ifdef WITH_AVX
+      uyvy_to_yuyv_avx(src, src_stride, dst, dst_stride, width, height);
+#else
+      uyvy_to_yuyv(src, src_stride, dst, dst_stride, width, height);
 #endif
-      } else if (pixel_format_ == V4L2_PIX_FMT_MJPEG) {
-        // 1.1.4. convert MJPEG to RGB
-        mjpeg_decoder_.ToRGB((char*)src, len, dest->image,
-                             dest->width * dest->height);
-      } else if (pixel_format_ == V4L2_PIX_FMT_RGB24) {
-        // 1.1.5. convert RGB to RGB
-        rgb242rgb((char*)src, dest->image, dest->width * dest->height);
-      } else if (pixel_format_ == V4L2_PIX_FMT_GREY) {
-        // 1.1.6. convert GRAY to RGB
-        memcpy(dest->image, (char*)src, dest->width * dest->height);
-      } else {
-        AERROR << "unsupported pixel format:" << pixel_format_;
-        return false;
-      }
-    } else if (options_.output_format == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
-      // 1.2. convert to YUYV
-      if (pixel_format_ == V4L2_PIX_FMT_YUYV && !monochrome_) {
-        // 1.2.1. convert YUYV to YUYV
-        memcpy(dest->image, src, dest->width * dest->height * 2);
-      } else if (pixel_format_ == V4L2_PIX_FMT_UYVY) {
-        // 1.2.2. convert UYUV to YUYV
-        uyvy2yuyv((char*)src, len);
-        memcpy(dest->image, src, dest->width * dest->height * 2);
-      } else {
-        AERROR << "unsupported pixel format:" << pixel_format_;
-        return false;
-      }
     } else {
-      AERROR << "unsupported output format:"
-             << StreamPixelFormatToStr(options_.output_format);
+      AERROR << "unsupported pixel format:" << pixel_format_;
       return false;
     }
   } else {
-    AERROR_F("unimplemented proceessing function for plane number: {} ",
-             buffers_->g_num_planes());
+    AERROR << "unsupported output format:"
+           << StreamPixelFormatToStr(options_.output_format);
+    return false;
+  }
+
+  return true;
+}
+
+bool V4l2StreamSource::ApplyRoi(cv4l_fmt* fmt) {
+  sw_roi_ = StreamRoi();
+  StreamRoi roi = options_.roi;
+  if (roi.width == 0 || roi.height == 0) {
+    return true;
+  }
+
+  // 1. check the roi against the negotiated frame
+  const unsigned int frame_width = fmt->g_width();
+  const unsigned int frame_height = fmt->g_height();
+  if (roi.x + roi.width > frame_width || roi.y + roi.height > frame_height) {
+    AERROR_F("roi {}x{}+{}+{} is out of the {}x{} frame of device {}",
+             roi.width, roi.height, roi.x, roi.y, frame_width, frame_height,
+             options_.resource.location);
+    return false;
+  }
+
+  // 2. crop on the device, so that only the roi is transferred
+  v4l2_selection sel;
+  memset(&sel, 0, sizeof(sel));
+  sel.type = fd_.g_selection_type();
+  sel.target = V4L2_SEL_TGT_CROP;
+  sel.r.left = static_cast<int32_t>(roi.x);
+  sel.r.top = static_cast<int32_t>(roi.y);
+  sel.r.width = roi.width;
+  sel.r.height = roi.height;
+  if (fd_.s_selection(sel) == 0 && sel.r.left == static_cast<int32_t>(roi.x) &&
+      sel.r.top == static_cast<int32_t>(roi.y) && sel.r.width == roi.width &&
+      sel.r.height == roi.height) {
+    // the frame size follows the crop rectangle unless the driver scales
+    fd_.g_fmt(*fmt);
+    if (fmt->g_width() != roi.width || fmt->g_height() != roi.height) {
+      fmt->s_width(roi.width);
+      fmt->s_height(roi.height);
+      fd_.s_fmt(*fmt);
+    }
+    if (fmt->g_width() == roi.width && fmt->g_height() == roi.height &&
+        fmt->g_pixelformat() == pixel_format_) {
+      AINFO_F("roi {}x{}+{}+{} cropped by device {}", roi.width, roi.height,
+              roi.x, roi.y, options_.resource.location);
+      return true;
+    }
+  }
+
+  // 3. restore the full frame and crop in software instead
+  memset(&sel, 0, sizeof(sel));
+  sel.type = fd_.g_selection_type();
+  sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+  if (fd_.g_selection(sel) == 0) {
+    sel.target = V4L2_SEL_TGT_CROP;
+    fd_.s_selection(sel);
+  }
+  fd_.g_fmt(*fmt);
+  fmt->s_width(frame_width);
+  fmt->s_height(frame_height);
+  fmt->s_pixelformat(pixel_format_);
+  if (fd_.s_fmt(*fmt) != 0 || fmt->g_width() != frame_width ||
+      fmt->g_height() != frame_height) {
+    AERROR_F("cannot restore the {}x{} frame of device {}", frame_width,
+             frame_height, options_.resource.location);
+    return false;
+  }
+  return SetSoftwareRoi(roi);
+}
+
+bool V4l2StreamSource::SetSoftwareRoi(StreamRoi roi) {
+  // keep whole chroma samples: even columns, and even rows for 4:2:0
+  roi.x &= ~1u;
+  roi.width &= ~1u;
+  if (pixel_format_ == V4L2_PIX_FMT_NV12 ||
+      pixel_format_ == V4L2_PIX_FMT_NV12M) {
+    roi.y &= ~1u;
+    roi.height &= ~1u;
+  }
+  if (roi.width == 0 || roi.height == 0) {
+    AERROR_F("roi of device {} is too small", options_.resource.location);
+    return false;
+  }
+  sw_roi_ = roi;
+  AINFO_F("roi {}x{}+{}+{} cropped in software for device {}", roi.width,
+          roi.height, roi.x, roi.y, options_.resource.location);
+  return true;
+}
+
+bool V4l2StreamSource::IsSemiPlanar(unsigned int pixel_format) {
+  return pixel_format == V4L2_PIX_FMT_NV12 ||
+         pixel_format == V4L2_PIX_FMT_NV12M ||
+         pixel_format == V4L2_PIX_FMT_NV16 ||
+         pixel_format == V4L2_PIX_FMT_NV16M;
+}
+
+bool V4l2StreamSource::ProcessSemiPlanarImage(
+    std::array<void*, VIDEO_MAX_PLANES> mplane_data, Frame* dest) {
+  if (options_.output_format != StreamPixelFormat::PIXEL_FORMAT_RGB) {
+    AERROR << "unsupported output format:"
+           << StreamPixelFormatToStr(options_.output_format);
     return false;
   }
 
+  // 1. locate the luma and chroma planes
+  const bool nv12 = pixel_format_ == V4L2_PIX_FMT_NV12 ||
+                    pixel_format_ == V4L2_PIX_FMT_NV12M;
+  const auto* y = static_cast<const unsigned char*>(mplane_data[0]);
+  const unsigned int y_stride = bytesperline_[0];
+  const unsigned char* uv = nullptr;
+  unsigned int uv_stride = y_stride;
+  if (num_planes_ >= 2) {
+    uv = static_cast<const unsigned char*>(mplane_data[1]);
+    if (bytesperline_[1] != 0) uv_stride = bytesperline_[1];
+  } else {
+    uv = y + static_cast<size_t>(y_stride) * height_;
+  }
+  if (uv == nullptr) {
+    AERROR_F("missing chroma plane for device {}", options_.resource.location);
+    return false;
+  }
+
+  // 2. only convert the rows and columns of the software crop, the roi is
+  // aligned to the chroma subsampling
+  unsigned int width = width_;
+  unsigned int height = height_;
+  if (sw_roi_.width > 0) {
+    y += static_cast<size_t>(sw_roi_.y) * y_stride + sw_roi_.x;
+    uv += static_cast<size_t>(nv12 ? sw_roi_.y / 2 : sw_roi_.y) * uv_stride +
+          sw_roi_.x;
+    width = sw_roi_.width;
+    height = sw_roi_.height;
+  }
+
+  // 3. convert both planes at once, without repacking
+  auto* rgb = dest->GetData();
+  const unsigned int rgb_stride = dest->GetStride();
+  if (nv12) {
+#ifdef WITH_AVX
+    nv12_to_rgb_avx(y, y_stride, uv, uv_stride, rgb, rgb_stride, width,
+                    height);
+#else
+    nv12_to_rgb(y, y_stride, uv, uv_stride, rgb, rgb_stride, width, height);
+#endif
+  } else {
+#ifdef WITH_AVX
+    nv16_to_rgb_avx(y, y_stride, uv, uv_stride, rgb, rgb_stride, width,
+                    height);
+#else
+    nv16_to_rgb(y, y_stride, uv, uv_stride, rgb, rgb_stride, width, height);
+#endif
+  }
+
   return true;
 }
 
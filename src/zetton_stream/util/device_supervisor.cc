@@ -0,0 +1,202 @@
+#include "zetton_stream/util/device_supervisor.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+DeviceSupervisor::~DeviceSupervisor() { Stop(); }
+
+bool DeviceSupervisor::Start(const std::string& device, ReopenFunc reopen,
+                             StreamStateCallback callback) {
+  if (IsRunning()) {
+    AWARN_F("supervisor of device {} is already running", device_);
+    return true;
+  }
+
+  device_ = device;
+  reopen_ = std::move(reopen);
+  callback_ = std::move(callback);
+
+  // 1. create the wake-up event used to interrupt waiting on stop
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    AERROR_F("cannot create eventfd for device {}: code {}, string [{}]",
+             device_, errno, strerror(errno));
+    return false;
+  }
+
+  // 2. watch the parent directory of the device node for hot-plug, fall back
+  // to plain backoff if it is not possible
+  const std::size_t pos = device_.find_last_of('/');
+  const std::string directory =
+      pos == std::string::npos ? "." : device_.substr(0, pos > 0 ? pos : 1);
+  device_name_ = pos == std::string::npos ? device_ : device_.substr(pos + 1);
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0 ||
+      inotify_add_watch(inotify_fd_, directory.c_str(),
+                        IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE) < 0) {
+    AWARN_F("cannot watch {} for hot-plug: code {}, string [{}]", directory,
+            errno, strerror(errno));
+    if (inotify_fd_ >= 0) close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+
+  // 3. start in lost state, so that the first open happens in background
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    state_ = StreamState::STATE_LOST;
+  }
+  thread_ = std::thread(&DeviceSupervisor::Run, this);
+
+  return true;
+}
+
+void DeviceSupervisor::Stop() {
+  if (!IsRunning()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  uint64_t value = 1;
+  if (write(wake_fd_, &value, sizeof(value)) < 0) {
+    AWARN_F("cannot wake up supervisor of device {}", device_);
+  }
+  thread_.join();
+
+  if (inotify_fd_ >= 0) close(inotify_fd_);
+  inotify_fd_ = -1;
+  close(wake_fd_);
+  wake_fd_ = -1;
+
+  SetState(StreamState::STATE_CLOSED);
+}
+
+void DeviceSupervisor::NotifyLost() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || state_ == StreamState::STATE_LOST) {
+      return;
+    }
+    state_ = StreamState::STATE_LOST;
+  }
+  cond_.notify_all();
+  AWARN_F("device {} lost, reconnecting in background", device_);
+  if (callback_) callback_(StreamState::STATE_LOST);
+}
+
+void DeviceSupervisor::SetState(StreamState state) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == state) {
+      return;
+    }
+    state_ = state;
+  }
+  if (callback_) callback_(state);
+}
+
+void DeviceSupervisor::Run() {
+  while (true) {
+    // 1. wait until the device is lost
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] {
+        return stop_ || state_ == StreamState::STATE_LOST;
+      });
+      if (stop_) break;
+    }
+
+    // 2. reopen with exponential backoff
+    SetState(StreamState::STATE_RECONNECTING);
+    int backoff_ms = min_backoff_ms_;
+    while (true) {
+      if (reopen_()) {
+        bool streaming = false;
+        {
+          // the capture path may have lost the device again meanwhile
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (state_ == StreamState::STATE_RECONNECTING) {
+            state_ = StreamState::STATE_STREAMING;
+            streaming = true;
+          }
+        }
+        if (streaming) {
+          AINFO_F("device {} reconnected", device_);
+          if (callback_) callback_(StreamState::STATE_STREAMING);
+        }
+        break;
+      }
+
+      ADEBUG_F("failed to reopen device {}, retry in {} ms", device_,
+               backoff_ms);
+      if (WaitForDeviceEvent(backoff_ms)) {
+        // the device node appeared or changed, retry right away
+        backoff_ms = min_backoff_ms_;
+      } else {
+        backoff_ms = std::min(backoff_ms * 2, max_backoff_ms_);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) break;
+    }
+  }
+}
+
+bool DeviceSupervisor::WaitForDeviceEvent(int timeout_ms) {
+  struct pollfd fds[2];
+  nfds_t num_fds = 0;
+  fds[num_fds].fd = wake_fd_;
+  fds[num_fds].events = POLLIN;
+  num_fds += 1;
+  if (inotify_fd_ >= 0) {
+    fds[num_fds].fd = inotify_fd_;
+    fds[num_fds].events = POLLIN;
+    num_fds += 1;
+  }
+
+  int r = poll(fds, num_fds, timeout_ms);
+  if (r <= 0 || (fds[0].revents & POLLIN)) {
+    // timeout, interrupted or stopped
+    return false;
+  }
+
+  // drain the inotify events and look for our device node
+  bool changed = false;
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t len = 0;
+  while ((len = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+    for (char* ptr = buffer; ptr < buffer + len;) {
+      const auto* event = reinterpret_cast<const struct inotify_event*>(ptr);
+      if (event->len > 0 && device_name_ == event->name) {
+        if (event->mask & IN_DELETE) {
+          ADEBUG_F("device node {} removed", device_);
+        } else {
+          ADEBUG_F("device node {} appeared", device_);
+          changed = true;
+        }
+      }
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  return changed;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,258 @@
+#include "zetton_stream/util/frame_batcher.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+std::shared_ptr<FrameBatcher> FrameBatcher::Create(
+    const BatchOptions& options, const PreprocessOptions& preprocess) {
+  std::shared_ptr<FrameBatcher> batcher(new FrameBatcher());
+  if (!batcher->Init(options, preprocess)) {
+    return nullptr;
+  }
+  return batcher;
+}
+
+FrameBatcher::~FrameBatcher() { Stop(); }
+
+bool FrameBatcher::Init(const BatchOptions& options,
+                        const PreprocessOptions& preprocess) {
+  // 1. check options
+  if (options.batch_size <= 0 || options.num_buffers <= 0 ||
+      options.max_latency_ms < 0) {
+    AERROR_F("invalid batches of {} frames with {} buffers",
+             options.batch_size, options.num_buffers);
+    return false;
+  }
+  options_ = options;
+  if (!preprocessor_.Init(preprocess)) {
+    return false;
+  }
+
+  // 2. allocate every batch as one aligned block
+  const size_t tensor_size = preprocessor_.GetTensorSize();
+  buffers_.reserve(options.num_buffers);
+  free_buffers_.reserve(options.num_buffers);
+  for (int i = 0; i < options.num_buffers; ++i) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, kImageRowAlignment,
+                       tensor_size * options.batch_size) != 0) {
+      AERROR_F("cannot allocate batch of {} bytes",
+               tensor_size * options.batch_size);
+      return false;
+    }
+    std::unique_ptr<Buffer> buffer(new Buffer());
+    buffer->memory = std::shared_ptr<void>(memory, free);
+    buffer->batch.data = static_cast<uint8_t*>(memory);
+    buffer->batch.tensor_size = tensor_size;
+    buffer->batch.batch_size = options.batch_size;
+    buffer->batch.entries.resize(options.batch_size);
+    free_buffers_.push_back(buffer.get());
+    buffers_.push_back(std::move(buffer));
+  }
+
+  AINFO_F("batching {} frames {} into {} buffers of {} bytes, latency {} ms",
+          options.batch_size, options.per_source ? "per source" : "in order",
+          options.num_buffers, tensor_size * options.batch_size,
+          options.max_latency_ms);
+  return true;
+}
+
+FrameBatcher::Buffer* FrameBatcher::OpenBuffer() {
+  // 1. take a free buffer, or the oldest batch nobody has picked up yet
+  Buffer* buffer = nullptr;
+  if (!free_buffers_.empty()) {
+    buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+  } else if (!ready_buffers_.empty()) {
+    buffer = ready_buffers_.front();
+    ready_buffers_.pop_front();
+    ++statistics_.batches_dropped;
+    ADEBUG_F("batch consumer fell behind, dropped a batch of {} frames",
+             buffer->batch.num_frames);
+  } else {
+    // all buffers are handed out or being filled
+    return nullptr;
+  }
+
+  // 2. start over
+  buffer->batch.num_frames = 0;
+  buffer->batch.expired = false;
+  std::fill(buffer->batch.entries.begin(), buffer->batch.entries.end(),
+            BatchEntry());
+  buffer->open_time = Clock::now();
+  buffer->reserved = 0;
+  buffer->writers = 0;
+  buffer->closed = false;
+  open_buffer_ = buffer;
+  return buffer;
+}
+
+void FrameBatcher::CloseBuffer(Buffer* buffer, bool expired) {
+  if (buffer->closed) {
+    return;
+  }
+  buffer->closed = true;
+  buffer->batch.expired = expired;
+  if (open_buffer_ == buffer) {
+    open_buffer_ = nullptr;
+  }
+  FinishBuffer(buffer);
+}
+
+void FrameBatcher::FinishBuffer(Buffer* buffer) {
+  // hand out a closed batch once its last frame is written
+  if (!buffer->closed || buffer->writers > 0) {
+    return;
+  }
+  if (buffer->batch.num_frames == 0) {
+    Recycle(buffer);
+    return;
+  }
+  if (buffer->batch.expired) {
+    ++statistics_.batches_expired;
+  } else {
+    ++statistics_.batches_full;
+  }
+  ready_buffers_.push_back(buffer);
+  cond_.notify_one();
+}
+
+void FrameBatcher::Recycle(Buffer* buffer) {
+  free_buffers_.push_back(buffer);
+}
+
+bool FrameBatcher::Add(const Frame& frame, int source) {
+  Buffer* buffer = nullptr;
+  int slot = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return false;
+    }
+    if (options_.per_source &&
+        (source < 0 || source >= options_.batch_size)) {
+      AERROR_F("invalid source {} for batches of {}", source,
+               options_.batch_size);
+      return false;
+    }
+
+    // 1. a source that is ahead of the others starts the next batch
+    buffer = open_buffer_;
+    if (buffer && options_.per_source &&
+        buffer->batch.entries[source].source >= 0) {
+      CloseBuffer(buffer, true);
+      buffer = nullptr;
+    }
+    if (buffer == nullptr) {
+      buffer = OpenBuffer();
+      if (buffer == nullptr) {
+        ++statistics_.frames_failed;
+        return false;
+      }
+    }
+
+    // 2. reserve the slot, a full batch is closed right away so that the
+    // next frame goes to a new one
+    slot = options_.per_source ? source : buffer->reserved;
+    buffer->batch.entries[slot].source = source;
+    ++buffer->reserved;
+    ++buffer->writers;
+    if (buffer->reserved == options_.batch_size) {
+      CloseBuffer(buffer, false);
+    }
+  }
+
+  // 3. preprocess straight into the slot, without holding the lock
+  BatchEntry& entry = buffer->batch.entries[slot];
+  const bool success = preprocessor_.Process(
+      frame, buffer->batch.GetTensor(slot), &entry.transform);
+  entry.timestamp_ns = frame.timestamp_ns;
+  entry.sequence = frame.sequence;
+
+  // 4. publish the slot
+  std::lock_guard<std::mutex> lock(mutex_);
+  --buffer->writers;
+  if (success) {
+    entry.valid = true;
+    ++buffer->batch.num_frames;
+    ++statistics_.frames_added;
+  } else {
+    ++statistics_.frames_failed;
+  }
+  FinishBuffer(buffer);
+  return success;
+}
+
+FrameBatchPtr FrameBatcher::Wait(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto timeout = Clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    // 1. hand out the oldest ready batch, it comes back when released
+    if (stop_) {
+      return nullptr;
+    }
+    if (!ready_buffers_.empty()) {
+      Buffer* buffer = ready_buffers_.front();
+      ready_buffers_.pop_front();
+      auto self = shared_from_this();
+      return FrameBatchPtr(&buffer->batch, [self, buffer](FrameBatch*) {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        self->Recycle(buffer);
+      });
+    }
+
+    // 2. close the open batch when its deadline has passed
+    const auto now = Clock::now();
+    bool has_deadline = timeout_ms >= 0;
+    auto deadline = timeout;
+    if (open_buffer_ && options_.max_latency_ms > 0) {
+      const auto expiry = open_buffer_->open_time +
+                          std::chrono::milliseconds(options_.max_latency_ms);
+      if (now >= expiry) {
+        CloseBuffer(open_buffer_, true);
+        continue;
+      }
+      deadline = has_deadline ? std::min(deadline, expiry) : expiry;
+      has_deadline = true;
+    }
+    if (timeout_ms >= 0 && now >= timeout) {
+      return nullptr;
+    }
+
+    // 3. sleep until a batch is ready or the next deadline
+    if (has_deadline) {
+      cond_.wait_until(lock, deadline);
+    } else {
+      cond_.wait(lock);
+    }
+  }
+}
+
+void FrameBatcher::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (open_buffer_) {
+    CloseBuffer(open_buffer_, true);
+  }
+}
+
+void FrameBatcher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+}
+
+BatchStatistics FrameBatcher::GetStatistics() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,621 @@
+#include "zetton_stream/util/frame_preprocessor.h"
+
+#include <strings.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// tensor rows below which another thread does not pay off
+constexpr int kMinRowsPerThread = 8;
+// slack after a converted row, gathers read one byte past the last pixel
+constexpr size_t kRowPadding = 32;
+
+// round to nearest even, same as the f16c instructions
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 112;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff) {
+    // inf and nan
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+  }
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  if (exponent <= 0) {
+    // subnormal or zero
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  // a carry into the exponent is still correct, up to infinity
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+  return static_cast<uint16_t>(sign | half);
+}
+
+int8_t FloatToInt8(float value, float inv_scale, int zero_point) {
+  const long q = std::lrint(value * inv_scale) + zero_point;  // NOLINT
+  return static_cast<int8_t>(q < -128 ? -128 : (q > 127 ? 127 : q));
+}
+
+// dst = (top + weight * (bottom - top)) * scale + bias
+void BlendRows(const float* top, const float* bottom, float weight,
+               float scale, float bias, float* dst, int count) {
+  int x = 0;
+#ifdef WITH_AVX
+  const __m256 w = _mm256_set1_ps(weight);
+  const __m256 s = _mm256_set1_ps(scale);
+  const __m256 b = _mm256_set1_ps(bias);
+  for (; x + 8 <= count; x += 8) {
+    const __m256 t = _mm256_loadu_ps(top + x);
+    const __m256 v = _mm256_add_ps(
+        t, _mm256_mul_ps(w, _mm256_sub_ps(_mm256_loadu_ps(bottom + x), t)));
+    _mm256_storeu_ps(dst + x, _mm256_add_ps(_mm256_mul_ps(v, s), b));
+  }
+#endif
+  for (; x < count; ++x) {
+    const float v = top[x] + weight * (bottom[x] - top[x]);
+    dst[x] = v * scale + bias;
+  }
+}
+
+void StoreHalf(const float* values, uint16_t* dst, int count) {
+  int x = 0;
+#if defined(WITH_AVX) && defined(__F16C__)
+  for (; x + 8 <= count; x += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(values + x),
+                                     _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for (; x < count; ++x) {
+    dst[x] = FloatToHalf(values[x]);
+  }
+}
+
+void StoreInt8(const float* values, int8_t* dst, int count, float inv_scale,
+               int zero_point) {
+  int x = 0;
+#ifdef WITH_AVX
+  // 32 values per step, packing interleaves the lanes which the final
+  // permutation undoes
+  const __m256 s = _mm256_set1_ps(inv_scale);
+  const __m256i z = _mm256_set1_epi32(zero_point);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  for (; x + 32 <= count; x += 32) {
+    __m256i q[4];
+    for (int i = 0; i < 4; ++i) {
+      q[i] = _mm256_add_epi32(
+          _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(values + x + 8 * i),
+                                           s)),
+          z);
+    }
+    const __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(q[0], q[1]),
+                                              _mm256_packs_epi32(q[2], q[3]));
+    Store<false>(reinterpret_cast<__m256i*>(dst + x),
+                 _mm256_permutevar8x32_epi32(packed, order));
+  }
+#endif
+  for (; x < count; ++x) {
+    dst[x] = FloatToInt8(values[x], inv_scale, zero_point);
+  }
+}
+
+}  // namespace
+
+const char* TensorDataTypeToStr(TensorDataType type) {
+  switch (type) {
+    case TensorDataType::DATA_TYPE_FLOAT32:
+      return "float32";
+    case TensorDataType::DATA_TYPE_FLOAT16:
+      return "float16";
+    case TensorDataType::DATA_TYPE_INT8:
+      return "int8";
+    default:
+      return "unknown";
+  }
+}
+
+TensorDataType TensorDataTypeFromStr(const char* str) {
+  if (!str) return TensorDataType::DATA_TYPE_FLOAT32;
+  for (int n = 0; n < static_cast<int>(TensorDataType::DATA_TYPE_MAX_NUM);
+       ++n) {
+    const auto value = (TensorDataType)n;
+    if (strcasecmp(str, TensorDataTypeToStr(value)) == 0) return value;
+  }
+  return TensorDataType::DATA_TYPE_FLOAT32;
+}
+
+size_t GetTensorElementSize(TensorDataType type) {
+  switch (type) {
+    case TensorDataType::DATA_TYPE_FLOAT16:
+      return 2;
+    case TensorDataType::DATA_TYPE_INT8:
+      return 1;
+    case TensorDataType::DATA_TYPE_FLOAT32:
+    default:
+      return 4;
+  }
+}
+
+FramePreprocessor::~FramePreprocessor() { Shutdown(); }
+
+bool FramePreprocessor::IsSupported(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool FramePreprocessor::Init(const PreprocessOptions& options) {
+  Shutdown();
+
+  // 1. check options
+  if (options.width <= 0 || options.height <= 0) {
+    AERROR_F("invalid tensor size {}x{}", options.width, options.height);
+    return false;
+  }
+  if (options.data_type == TensorDataType::DATA_TYPE_MAX_NUM) {
+    AERROR_F("invalid tensor data type");
+    return false;
+  }
+  for (int c = 0; c < 3; ++c) {
+    if (options.std[c] == 0.0f) {
+      AERROR_F("invalid std of channel {}", c);
+      return false;
+    }
+  }
+  if (options.data_type == TensorDataType::DATA_TYPE_INT8 &&
+      options.quant_scale <= 0.0f) {
+    AERROR_F("invalid quantization scale {}", options.quant_scale);
+    return false;
+  }
+  options_ = options;
+  element_size_ = GetTensorElementSize(options.data_type);
+
+  // 2. normalization folded into one multiply-add, and the normalized value
+  // of the padding in the element type
+  for (int c = 0; c < 3; ++c) {
+    scale_[c] = 1.0f / options.std[c];
+    bias_[c] = -options.mean[c] / options.std[c];
+    const float pad = options.pad_value[c] * scale_[c] + bias_[c];
+    pad_[c].fill(0);
+    switch (options.data_type) {
+      case TensorDataType::DATA_TYPE_FLOAT16: {
+        const uint16_t half = FloatToHalf(pad);
+        memcpy(pad_[c].data(), &half, sizeof(half));
+        break;
+      }
+      case TensorDataType::DATA_TYPE_INT8:
+        pad_[c][0] = static_cast<uint8_t>(FloatToInt8(
+            pad, 1.0f / options.quant_scale, options.quant_zero_point));
+        break;
+      case TensorDataType::DATA_TYPE_FLOAT32:
+      default:
+        memcpy(pad_[c].data(), &pad, sizeof(pad));
+        break;
+    }
+  }
+
+  // 3. split the tensor rows between the threads
+  int num_threads = options.num_threads;
+  if (num_threads <= 0) {
+    num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  num_threads = std::max(
+      1, std::min(num_threads, options.height / kMinRowsPerThread));
+  bands_.clear();
+  bands_.resize(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    bands_[i].row_begin = options.height * i / num_threads;
+    bands_[i].row_end = options.height * (i + 1) / num_threads;
+  }
+  source_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  source_width_ = 0;
+  source_height_ = 0;
+
+  // 4. the caller works on the first band
+  stop_ = false;
+  for (size_t i = 1; i < bands_.size(); ++i) {
+    workers_.emplace_back(&FramePreprocessor::WorkerLoop, this, i);
+  }
+
+  AINFO_F("preprocessing to {}x{} {} tensors with {} threads", options.width,
+          options.height, TensorDataTypeToStr(options.data_type),
+          bands_.size());
+  return true;
+}
+
+void FramePreprocessor::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+
+  // new workers start from generation 0, a stale one would run them on no
+  // frame
+  generation_ = 0;
+  pending_ = 0;
+  frame_ = nullptr;
+  dst_ = nullptr;
+}
+
+void FramePreprocessor::WorkerLoop(size_t band) {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [&] { return stop_ || generation_ != generation; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+    }
+    ProcessBand(&bands_[band]);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--pending_ == 0) {
+      done_cond_.notify_one();
+    }
+  }
+}
+
+bool FramePreprocessor::Process(const Frame& frame, void* dst,
+                                PreprocessTransform* transform) {
+  std::lock_guard<std::mutex> process_lock(process_mutex_);
+
+  // 1. check frame
+  if (bands_.empty()) {
+    AERROR_F("frame preprocessor is not initialized");
+    return false;
+  }
+  if (dst == nullptr || !frame.IsMapped() || frame.width <= 0 ||
+      frame.height <= 0) {
+    AERROR_F("invalid frame or tensor");
+    return false;
+  }
+  if (!IsSupported(frame.pixel_format)) {
+    AERROR_F("cannot preprocess {} frames",
+             StreamPixelFormatToStr(frame.pixel_format));
+    return false;
+  }
+
+  // 2. sampling tables and scratch rows, only rebuilt when the source changes
+  if (frame.pixel_format != source_format_ || frame.width != source_width_ ||
+      frame.height != source_height_) {
+    Configure(frame.pixel_format, frame.width, frame.height);
+  }
+
+  // 3. run all bands, the caller takes the first one
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_ = &frame;
+    dst_ = static_cast<uint8_t*>(dst);
+    pending_ = workers_.size();
+    ++generation_;
+  }
+  cond_.notify_all();
+  ProcessBand(&bands_[0]);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this] { return pending_ == 0; });
+    frame_ = nullptr;
+    dst_ = nullptr;
+  }
+
+  if (transform) {
+    *transform = transform_;
+  }
+  return true;
+}
+
+void FramePreprocessor::Configure(StreamPixelFormat format, int width,
+                                  int height) {
+  source_format_ = format;
+  source_width_ = width;
+  source_height_ = height;
+
+  // 1. size and position of the resized frame
+  int resized_width = options_.width;
+  int resized_height = options_.height;
+  if (options_.letterbox) {
+    const double scale =
+        std::min(static_cast<double>(options_.width) / width,
+                 static_cast<double>(options_.height) / height);
+    resized_width = static_cast<int>(std::lround(width * scale));
+    resized_height = static_cast<int>(std::lround(height * scale));
+    resized_width = std::max(1, std::min(options_.width, resized_width));
+    resized_height = std::max(1, std::min(options_.height, resized_height));
+  }
+  transform_.width = resized_width;
+  transform_.height = resized_height;
+  transform_.offset_x = (options_.width - resized_width) / 2;
+  transform_.offset_y = (options_.height - resized_height) / 2;
+  transform_.scale_x = static_cast<float>(resized_width) / width;
+  transform_.scale_y = static_cast<float>(resized_height) / height;
+
+  // 2. bilinear sampling with pixel centers aligned, as cv::INTER_LINEAR
+  auto sample = [](int dst, int dst_size, int src_size, int* src0, int* src1,
+                   float* weight) {
+    double pos = (dst + 0.5) * src_size / dst_size - 0.5;
+    pos = std::max(pos, 0.0);
+    int index = static_cast<int>(pos);
+    double fraction = pos - index;
+    if (index >= src_size - 1) {
+      index = src_size - 1;
+      fraction = 0.0;
+    }
+    *src0 = index;
+    *src1 = std::min(index + 1, src_size - 1);
+    *weight = static_cast<float>(fraction);
+  };
+  x_offset0_.resize(resized_width);
+  x_offset1_.resize(resized_width);
+  x_weight_.resize(resized_width);
+  gather_end_ = 0;
+  for (int x = 0; x < resized_width; ++x) {
+    int x0, x1;
+    sample(x, resized_width, width, &x0, &x1, &x_weight_[x]);
+    x_offset0_[x] = 3 * x0;
+    x_offset1_[x] = 3 * x1;
+    // a 32-bit word at the right neighbour stays inside the row
+    if (x1 <= width - 2) {
+      gather_end_ = x + 1;
+    }
+  }
+  y_row0_.resize(resized_height);
+  y_row1_.resize(resized_height);
+  y_weight_.resize(resized_height);
+  for (int y = 0; y < resized_height; ++y) {
+    sample(y, resized_height, height, &y_row0_[y], &y_row1_[y], &y_weight_[y]);
+  }
+
+  // 3. converted rows come in rgb order, except for bgr frames
+  const bool source_bgr = format == StreamPixelFormat::PIXEL_FORMAT_BGR;
+  for (int c = 0; c < 3; ++c) {
+    channel_plane_[c] = source_bgr != options_.bgr ? 2 - c : c;
+  }
+
+  // 4. scratch rows of every band
+  for (auto& band : bands_) {
+    band.rgb_row.assign(static_cast<size_t>(width) * 3 + kRowPadding, 0);
+    for (auto& row : band.rows) {
+      row.assign(static_cast<size_t>(resized_width) * 3, 0.0f);
+    }
+    band.source_rows = {{-1, -1}};
+    band.values.assign(resized_width, 0.0f);
+  }
+
+  ADEBUG_F("preprocessing {}x{} {} frames into {}x{} at ({}, {})", width,
+           height, StreamPixelFormatToStr(format), resized_width,
+           resized_height, transform_.offset_x, transform_.offset_y);
+}
+
+const uint8_t* FramePreprocessor::ConvertRow(const Frame& frame, int row,
+                                             Band* band) const {
+  const unsigned int width = static_cast<unsigned int>(frame.width);
+  const uint8_t* src = frame.planes[0].data +
+                       static_cast<size_t>(row) * frame.planes[0].stride;
+  uint8_t* rgb = band->rgb_row.data();
+  switch (frame.pixel_format) {
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      // sampled in place
+      return src;
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+#ifdef WITH_AVX
+      yuyv_to_rgb_avx(src, 0, rgb, 0, width, 1);
+#else
+      yuyv_to_rgb(src, 0, rgb, 0, width, 1);
+#endif
+      return rgb;
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+#ifdef WITH_AVX
+      uyvy_to_rgb_avx(src, 0, rgb, 0, width, 1);
+#else
+      uyvy_to_rgb(src, 0, rgb, 0, width, 1);
+#endif
+      return rgb;
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16: {
+      // one chroma row per two rows for nv12
+      const int uv_row =
+          frame.pixel_format == StreamPixelFormat::PIXEL_FORMAT_NV12 ? row / 2
+                                                                     : row;
+      const uint8_t* uv = frame.planes[1].data +
+                          static_cast<size_t>(uv_row) * frame.planes[1].stride;
+#ifdef WITH_AVX
+      nv16_to_rgb_avx(src, 0, uv, 0, rgb, 0, width, 1);
+#else
+      nv16_to_rgb(src, 0, uv, 0, rgb, 0, width, 1);
+#endif
+      return rgb;
+    }
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+    default:
+      for (unsigned int x = 0; x < width; ++x) {
+        rgb[3 * x] = rgb[3 * x + 1] = rgb[3 * x + 2] = src[x];
+      }
+      return rgb;
+  }
+}
+
+void FramePreprocessor::ResampleRow(const uint8_t* rgb, float* dst) const {
+  const int width = transform_.width;
+  float* r = dst;
+  float* g = dst + width;
+  float* b = dst + 2 * width;
+  int x = 0;
+#ifdef WITH_AVX
+  // 8 pixels per step, every gather fetches the 3 channels of a neighbour
+  // and one byte of the next pixel
+  const auto* base = reinterpret_cast<const int*>(rgb);
+  for (; x + 8 <= gather_end_; x += 8) {
+    const __m256i p0 = _mm256_i32gather_epi32(
+        base, Load<false>(reinterpret_cast<const __m256i*>(&x_offset0_[x])), 1);
+    const __m256i p1 = _mm256_i32gather_epi32(
+        base, Load<false>(reinterpret_cast<const __m256i*>(&x_offset1_[x])), 1);
+    const __m256 w = _mm256_loadu_ps(&x_weight_[x]);
+    float* channels[3] = {r, g, b};
+    for (int c = 0; c < 3; ++c) {
+      const __m256 c0 = _mm256_cvtepi32_ps(
+          _mm256_and_si256(_mm256_srli_epi32(p0, 8 * c), K32_000000FF));
+      const __m256 c1 = _mm256_cvtepi32_ps(
+          _mm256_and_si256(_mm256_srli_epi32(p1, 8 * c), K32_000000FF));
+      _mm256_storeu_ps(
+          channels[c] + x,
+          _mm256_add_ps(c0, _mm256_mul_ps(w, _mm256_sub_ps(c1, c0))));
+    }
+  }
+#endif
+  for (; x < width; ++x) {
+    const uint8_t* p0 = rgb + x_offset0_[x];
+    const uint8_t* p1 = rgb + x_offset1_[x];
+    const float w = x_weight_[x];
+    r[x] = p0[0] + w * (p1[0] - p0[0]);
+    g[x] = p0[1] + w * (p1[1] - p0[1]);
+    b[x] = p0[2] + w * (p1[2] - p0[2]);
+  }
+}
+
+void FramePreprocessor::LoadRows(const Frame& frame, int row0, int row1,
+                                 Band* band) const {
+  // consecutive tensor rows share source rows, keep what is still needed
+  if (band->source_rows[0] != row0) {
+    if (band->source_rows[1] == row0) {
+      std::swap(band->rows[0], band->rows[1]);
+      std::swap(band->source_rows[0], band->source_rows[1]);
+    } else {
+      ResampleRow(ConvertRow(frame, row0, band), band->rows[0].data());
+      band->source_rows[0] = row0;
+    }
+  }
+  if (row1 != row0 && band->source_rows[1] != row1) {
+    ResampleRow(ConvertRow(frame, row1, band), band->rows[1].data());
+    band->source_rows[1] = row1;
+  }
+}
+
+void FramePreprocessor::FillPadding(uint8_t* dst, int plane, int count) const {
+  if (count <= 0) {
+    return;
+  }
+  switch (element_size_) {
+    case 1:
+      memset(dst, pad_[plane][0], count);
+      break;
+    case 2: {
+      uint16_t value;
+      memcpy(&value, pad_[plane].data(), sizeof(value));
+      std::fill_n(reinterpret_cast<uint16_t*>(dst), count, value);
+      break;
+    }
+    default: {
+      float value;
+      memcpy(&value, pad_[plane].data(), sizeof(value));
+      std::fill_n(reinterpret_cast<float*>(dst), count, value);
+      break;
+    }
+  }
+}
+
+void FramePreprocessor::StoreValues(const float* values, uint8_t* dst,
+                                    int count) const {
+  switch (options_.data_type) {
+    case TensorDataType::DATA_TYPE_FLOAT16:
+      StoreHalf(values, reinterpret_cast<uint16_t*>(dst), count);
+      break;
+    case TensorDataType::DATA_TYPE_INT8:
+      StoreInt8(values, reinterpret_cast<int8_t*>(dst), count,
+                1.0f / options_.quant_scale, options_.quant_zero_point);
+      break;
+    case TensorDataType::DATA_TYPE_FLOAT32:
+    default:
+      memcpy(dst, values, sizeof(float) * count);
+      break;
+  }
+}
+
+void FramePreprocessor::ProcessBand(Band* band) {
+  const Frame& frame = *frame_;
+  const size_t row_bytes = static_cast<size_t>(options_.width) * element_size_;
+  const size_t plane_bytes = row_bytes * options_.height;
+  const int width = transform_.width;
+  const int left = transform_.offset_x;
+  const int right = options_.width - left - width;
+  const bool in_place =
+      options_.data_type == TensorDataType::DATA_TYPE_FLOAT32;
+
+  // the cached rows belong to the previous frame
+  band->source_rows = {{-1, -1}};
+  for (int y = band->row_begin; y < band->row_end; ++y) {
+    const int resized_y = y - transform_.offset_y;
+    // 1. letterbox rows above and below the frame
+    if (resized_y < 0 || resized_y >= transform_.height) {
+      for (int plane = 0; plane < 3; ++plane) {
+        FillPadding(dst_ + plane * plane_bytes + y * row_bytes, plane,
+                    options_.width);
+      }
+      continue;
+    }
+
+    // 2. horizontally resampled source rows around this row
+    const int row0 = y_row0_[resized_y];
+    const int row1 = y_row1_[resized_y];
+    LoadRows(frame, row0, row1, band);
+    const float weight = row1 == row0 ? 0.0f : y_weight_[resized_y];
+    const auto& top = band->rows[0];
+    const auto& bottom = row1 == row0 ? band->rows[0] : band->rows[1];
+
+    // 3. vertical blend and normalization, straight into float tensors
+    for (int c = 0; c < 3; ++c) {
+      const int plane = channel_plane_[c];
+      uint8_t* dst = dst_ + plane * plane_bytes + y * row_bytes;
+      FillPadding(dst, plane, left);
+      uint8_t* pixels = dst + left * element_size_;
+      float* values =
+          in_place ? reinterpret_cast<float*>(pixels) : band->values.data();
+      BlendRows(top.data() + c * width, bottom.data() + c * width, weight,
+                scale_[plane], bias_[plane], values, width);
+      if (!in_place) {
+        StoreValues(values, pixels, width);
+      }
+      FillPadding(pixels + width * element_size_, plane, right);
+    }
+  }
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,158 @@
+#include "zetton_stream/util/frame_statistics.h"
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+
+namespace zetton {
+namespace stream {
+
+void FrameStatistics::Init(float frame_rate, const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  name_ = name;
+  if (frame_rate > 0) {
+    expected_interval_ns_ = static_cast<uint64_t>(1e9 / frame_rate);
+    warning_interval_ns_ = static_cast<uint64_t>(1.5e9 / frame_rate);
+    // now max fps 30, we use an appox time 0.9 to drop image.
+    drop_interval_ns_ = static_cast<uint64_t>(0.9e9 / frame_rate);
+  } else {
+    expected_interval_ns_ = 0;
+    warning_interval_ns_ = 0;
+    drop_interval_ns_ = 0;
+  }
+  ResetLocked();
+}
+
+void FrameStatistics::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ResetLocked();
+}
+
+void FrameStatistics::ResetLocked() {
+  stats_ = FrameStatisticsSnapshot();
+  last_timestamp_ns_ = 0;
+  last_delivered_ns_ = 0;
+  interval_sum_ms_ = 0.0;
+  interval_sq_sum_ms_ = 0.0;
+  num_intervals_ = 0;
+}
+
+bool FrameStatistics::Update(const CameraImage& image) {
+  Frame frame;
+  CopyMetadata(image, &frame);
+  return Update(frame);
+}
+
+bool FrameStatistics::Update(const Frame& frame) {
+  const uint64_t now_ns = SystemNowNs();
+  const uint64_t timestamp_ns =
+      frame.timestamp_ns != 0 ? frame.timestamp_ns : frame.system_timestamp_ns;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.frames_received += 1;
+
+  // 1. driver-side drops and errors
+  if (frame.dropped_frames > 0) {
+    stats_.frames_dropped += frame.dropped_frames;
+    stats_.sequence_gaps += 1;
+    if (ShouldWarn(&last_gap_warn_ns_, now_ns)) {
+      AWARN_F("{} dropped {} frames before sequence {} ({} in total)", name_,
+              frame.dropped_frames, frame.sequence, stats_.frames_dropped);
+    }
+  }
+  if (frame.flags & V4L2_BUF_FLAG_ERROR) {
+    stats_.error_frames += 1;
+  }
+
+  // 2. inter-frame interval and jitter
+  if (last_timestamp_ns_ != 0 && timestamp_ns > last_timestamp_ns_) {
+    const uint64_t interval_ns = timestamp_ns - last_timestamp_ns_;
+    const double interval_ms = static_cast<double>(interval_ns) / 1e6;
+
+    num_intervals_ += 1;
+    interval_sum_ms_ += interval_ms;
+    interval_sq_sum_ms_ += interval_ms * interval_ms;
+    stats_.last_interval_ms = interval_ms;
+    stats_.min_interval_ms = num_intervals_ == 1
+                                 ? interval_ms
+                                 : std::min(stats_.min_interval_ms, interval_ms);
+    stats_.max_interval_ms = std::max(stats_.max_interval_ms, interval_ms);
+    stats_.mean_interval_ms = interval_sum_ms_ / num_intervals_;
+    const double variance = interval_sq_sum_ms_ / num_intervals_ -
+                            stats_.mean_interval_ms * stats_.mean_interval_ms;
+    stats_.jitter_ms = variance > 0.0 ? std::sqrt(variance) : 0.0;
+
+    if (expected_interval_ns_ > 0) {
+      const double deviation_ms = std::fabs(
+          interval_ms - static_cast<double>(expected_interval_ns_) / 1e6);
+      size_t bin = 0;
+      while (bin < kJitterHistogramBounds.size() &&
+             deviation_ms >= kJitterHistogramBounds[bin]) {
+        ++bin;
+      }
+      stats_.jitter_histogram[bin] += 1;
+
+      if (interval_ns > warning_interval_ns_) {
+        stats_.timestamp_jumps += 1;
+        if (ShouldWarn(&last_jump_warn_ns_, now_ns)) {
+          AWARN_F("{} stamp jump, last stamp: {} current stamp: {}", name_,
+                  last_timestamp_ns_, timestamp_ns);
+        }
+      }
+    }
+  }
+  last_timestamp_ns_ = timestamp_ns;
+
+  // 3. camera vs system clock
+  if (frame.system_timestamp_ns != 0) {
+    const int64_t offset_ns = static_cast<int64_t>(now_ns) -
+                              static_cast<int64_t>(frame.system_timestamp_ns);
+    stats_.clock_offset_ms = static_cast<double>(offset_ns) / 1e6;
+    stats_.max_clock_offset_ms =
+        std::max(stats_.max_clock_offset_ms, std::fabs(stats_.clock_offset_ms));
+    if (offset_ns > max_clock_offset_ns_ || offset_ns < 0) {
+      stats_.clock_offset_exceptions += 1;
+      if (ShouldWarn(&last_clock_warn_ns_, now_ns)) {
+        AWARN_F(
+            "camera time diff exception, diff: {:.6f}, now: {:.6f}, image: "
+            "{:.6f}; dev: {}",
+            static_cast<double>(offset_ns) / 1e9,
+            static_cast<double>(now_ns) / 1e9,
+            static_cast<double>(frame.system_timestamp_ns) / 1e9, name_);
+      }
+    }
+  }
+
+  // 4. software frame-rate decimation
+  if (drop_interval_ns_ > 0 && last_delivered_ns_ != 0 &&
+      timestamp_ns > last_delivered_ns_ &&
+      timestamp_ns - last_delivered_ns_ < drop_interval_ns_) {
+    stats_.frames_decimated += 1;
+    return false;
+  }
+  last_delivered_ns_ = timestamp_ns;
+  stats_.frames_delivered += 1;
+
+  return true;
+}
+
+FrameStatisticsSnapshot FrameStatistics::GetSnapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+bool FrameStatistics::ShouldWarn(uint64_t* last_warn_ns,
+                                 uint64_t now_ns) const {
+  if (now_ns - *last_warn_ns < 1000000000ULL) {
+    return false;
+  }
+  *last_warn_ns = now_ns;
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
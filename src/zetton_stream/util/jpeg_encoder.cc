@@ -0,0 +1,210 @@
+#include "zetton_stream/util/jpeg_encoder.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <memory>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// swscale layout of a frame format, AV_PIX_FMT_NONE if it has none
+AVPixelFormat ToAvPixelFormat(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+      return AV_PIX_FMT_YUYV422;
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+      return AV_PIX_FMT_UYVY422;
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+      return AV_PIX_FMT_NV12;
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+      return AV_PIX_FMT_NV16;
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+      return AV_PIX_FMT_GRAY8;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+      return AV_PIX_FMT_RGB24;
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      return AV_PIX_FMT_BGR24;
+    default:
+      return AV_PIX_FMT_NONE;
+  }
+}
+
+}  // namespace
+
+JpegEncoder::~JpegEncoder() { Release(); }
+
+bool JpegEncoder::Init(const JpegOptions& options) {
+  if (options.quality < 1 || options.quality > 100 || options.width < 0 ||
+      options.height < 0) {
+    AERROR_F("invalid jpeg options, quality {} size {}x{}", options.quality,
+             options.width, options.height);
+    return false;
+  }
+  options_ = options;
+  // the codec is opened with the first frame
+  Release();
+  return true;
+}
+
+bool JpegEncoder::IsSupported(StreamPixelFormat format) {
+  return ToAvPixelFormat(format) != AV_PIX_FMT_NONE;
+}
+
+void JpegEncoder::Release() {
+  avcodec_free_context(&context_);
+  av_frame_free(&picture_);
+  sws_freeContext(sws_);
+  sws_ = nullptr;
+  source_format_ = StreamPixelFormat::PIXEL_FORMAT_UNKNOWN;
+  source_width_ = 0;
+  source_height_ = 0;
+}
+
+bool JpegEncoder::Configure(const Frame& frame) {
+  Release();
+
+  // 1. size of the JPEG, even for the 4:2:0 chroma
+  int width = options_.width;
+  int height = options_.height;
+  if (width == 0 && height == 0) {
+    width = frame.width;
+    height = frame.height;
+  } else if (width == 0) {
+    width = frame.width * height / frame.height;
+  } else if (height == 0) {
+    height = frame.height * width / frame.width;
+  }
+  width = std::max(width & ~1, 2);
+  height = std::max(height & ~1, 2);
+
+  // 2. encoder at a fixed quantizer, 1 (best) to 31
+  const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+  if (codec == nullptr) {
+    AERROR_F("Could not find MJPEG encoder");
+    return false;
+  }
+  context_ = avcodec_alloc_context3(codec);
+  if (context_ == nullptr) {
+    return false;
+  }
+  const int qscale = 1 + (100 - options_.quality) * 30 / 99;
+  context_->width = width;
+  context_->height = height;
+  context_->pix_fmt = AV_PIX_FMT_YUVJ420P;
+  context_->time_base = {1, 30};
+  context_->flags |= AV_CODEC_FLAG_QSCALE;
+  context_->global_quality = FF_QP2LAMBDA * qscale;
+  context_->qmin = qscale;
+  context_->qmax = qscale;
+  context_->thread_count = 1;
+  // the tables of the standard, which RTP receivers assume
+  av_opt_set(context_->priv_data, "huffman", "default", 0);
+  if (avcodec_open2(context_, codec, nullptr) < 0) {
+    AERROR_F("cannot open MJPEG encoder for {}x{}", width, height);
+    Release();
+    return false;
+  }
+
+  // 3. planar picture, filled and scaled in one pass
+  picture_ = av_frame_alloc();
+  if (picture_ == nullptr) {
+    Release();
+    return false;
+  }
+  picture_->format = AV_PIX_FMT_YUVJ420P;
+  picture_->width = width;
+  picture_->height = height;
+  if (av_frame_get_buffer(picture_, 32) < 0) {
+    AERROR_F("cannot allocate {}x{} picture", width, height);
+    Release();
+    return false;
+  }
+  sws_ = sws_getContext(frame.width, frame.height,
+                        ToAvPixelFormat(frame.pixel_format), width, height,
+                        AV_PIX_FMT_YUVJ420P,
+                        width < frame.width ? SWS_AREA : SWS_FAST_BILINEAR,
+                        nullptr, nullptr, nullptr);
+  if (sws_ == nullptr) {
+    AERROR_F("cannot convert {}x{} {} frames to {}x{} jpeg", frame.width,
+             frame.height, StreamPixelFormatToStr(frame.pixel_format), width,
+             height);
+    Release();
+    return false;
+  }
+
+  source_format_ = frame.pixel_format;
+  source_width_ = frame.width;
+  source_height_ = frame.height;
+  return true;
+}
+
+FramePtr JpegEncoder::Encode(const Frame& frame) {
+  if (!frame.IsMapped() || !IsSupported(frame.pixel_format)) {
+    AERROR_F("cannot encode {} frames to jpeg",
+             StreamPixelFormatToStr(frame.pixel_format));
+    return nullptr;
+  }
+  if ((frame.pixel_format != source_format_ || frame.width != source_width_ ||
+       frame.height != source_height_) &&
+      !Configure(frame)) {
+    return nullptr;
+  }
+
+  // 1. resample to planar 4:2:0
+  if (av_frame_make_writable(picture_) < 0) {
+    return nullptr;
+  }
+  const uint8_t* src[kMaxFramePlanes] = {};
+  int src_stride[kMaxFramePlanes] = {};
+  for (int i = 0; i < frame.num_planes; ++i) {
+    src[i] = frame.planes[i].data;
+    src_stride[i] = frame.planes[i].stride;
+  }
+  sws_scale(sws_, src, src_stride, 0, frame.height, picture_->data,
+            picture_->linesize);
+  picture_->quality = context_->global_quality;
+  picture_->pict_type = AV_PICTURE_TYPE_I;
+
+  // 2. encode, the codec has no delay
+  int ret = avcodec_send_frame(context_, picture_);
+  AVPacket* packet = av_packet_alloc();
+  if (ret >= 0 && packet != nullptr) {
+    ret = avcodec_receive_packet(context_, packet);
+  }
+  if (ret < 0 || packet == nullptr) {
+    AERROR_F("cannot encode {}x{} jpeg: code {}", context_->width,
+             context_->height, ret);
+    av_packet_free(&packet);
+    return nullptr;
+  }
+
+  // 3. the packet becomes the payload of the frame, which holds it
+  std::shared_ptr<AVPacket> owner(packet,
+                                  [](AVPacket* p) { av_packet_free(&p); });
+  auto jpeg = std::make_shared<Frame>();
+  if (!jpeg->Wrap(StreamPixelFormat::PIXEL_FORMAT_MJPEG, context_->width,
+                  context_->height, packet->data, 0, owner)) {
+    return nullptr;
+  }
+  jpeg->planes[0].size = static_cast<size_t>(packet->size);
+  jpeg->timestamp_ns = frame.timestamp_ns;
+  jpeg->system_timestamp_ns = frame.system_timestamp_ns;
+  jpeg->sequence = frame.sequence;
+  jpeg->dropped_frames = frame.dropped_frames;
+  jpeg->flags = frame.flags;
+  jpeg->bytes_used = static_cast<uint32_t>(packet->size);
+  return jpeg;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -15,7 +15,9 @@ MjpegDecoder::MjpegDecoder()
       avframe_rgb_size_(0),
       video_sws_(nullptr) {}
 
-MjpegDecoder::~MjpegDecoder() {
+MjpegDecoder::~MjpegDecoder() { Release(); }
+
+void MjpegDecoder::Release() {
   if (avcodec_context_) {
     avcodec_close(avcodec_context_);
     av_free(avcodec_context_);
@@ -23,11 +25,16 @@ MjpegDecoder::~MjpegDecoder() {
   }
   if (avframe_camera_) av_free(avframe_camera_);
   avframe_camera_ = nullptr;
-  if (avframe_rgb_) av_free(avframe_rgb_);
+  if (avframe_rgb_) {
+    avpicture_free(reinterpret_cast<AVPicture*>(avframe_rgb_));
+    av_free(avframe_rgb_);
+  }
   avframe_rgb_ = nullptr;
 }
 
 bool MjpegDecoder::Init(int image_width, int image_height) {
+  // a new image size replaces the previous decoder
+  Release();
   avcodec_register_all();
 
   avcodec_ = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
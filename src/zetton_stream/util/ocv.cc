@@ -1,10 +1,87 @@
 #include "zetton_stream/util/ocv.h"
 
+#include <memory>
+#include <utility>
+
 #include "zetton_common/util/log.h"
 
 namespace zetton {
 namespace stream {
 
+namespace {
+
+// allocator of matrices viewing frame memory. the UMatData of a view holds a
+// reference to the frame (or camera image) in its userdata, which is dropped
+// with the last matrix sharing it. the memory itself is never freed here
+class FrameMatAllocator : public cv::MatAllocator {
+ public:
+  cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0,
+                         size_t* step, cv::AccessFlag flags,
+                         cv::UMatUsageFlags usage_flags) const override {
+    if (data0 == nullptr) {
+      // new memory, e.g. the output of an operation on a view
+      return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0,
+                                                  step, flags, usage_flags);
+    }
+    // another header on the memory of a view, see cv::Mat::getUMat(). the
+    // view it originates from keeps the frame alive
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i) {
+      if (step) {
+        if (step[i] != CV_AUTOSTEP) {
+          CV_Assert(total <= step[i]);
+          total = step[i];
+        } else {
+          step[i] = total;
+        }
+      }
+      total *= sizes[i];
+    }
+    auto* u = new cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(data0);
+    u->size = total;
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+  }
+
+  bool allocate(cv::UMatData* u, cv::AccessFlag,
+                cv::UMatUsageFlags) const override {
+    return u != nullptr;
+  }
+
+  void deallocate(cv::UMatData* u) const override {
+    if (u == nullptr) {
+      return;
+    }
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    delete static_cast<std::shared_ptr<void>*>(u->userdata);
+    u->userdata = nullptr;
+    delete u;
+  }
+
+  static FrameMatAllocator* Instance() {
+    static FrameMatAllocator allocator;
+    return &allocator;
+  }
+};
+
+cv::Mat MakeView(int rows, int cols, int type, void* data, size_t step,
+                 std::shared_ptr<void> owner) {
+  cv::Mat mat(rows, cols, type, data, step);
+  auto* u = new cv::UMatData(FrameMatAllocator::Instance());
+  u->data = u->origdata = static_cast<uchar*>(data);
+  u->size = step * rows;
+  u->flags |= cv::UMatData::USER_ALLOCATED;
+  u->refcount = 1;
+  u->userdata = new std::shared_ptr<void>(std::move(owner));
+  mat.u = u;
+  mat.allocator = FrameMatAllocator::Instance();
+  return mat;
+}
+
+}  // namespace
+
 bool CheckFrame(const cv::Mat& frame, const StreamOptions& options) {
   // check empty
   if (frame.empty()) {
@@ -38,5 +115,119 @@ bool CheckFrame(const cv::Mat& frame, const StreamOptions& options) {
   return true;
 }
 
+int GetMatType(StreamPixelFormat format) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY8:
+    case StreamPixelFormat::PIXEL_FORMAT_NV12:
+    case StreamPixelFormat::PIXEL_FORMAT_NV16:
+    case StreamPixelFormat::PIXEL_FORMAT_MJPEG:
+      return CV_8UC1;
+    case StreamPixelFormat::PIXEL_FORMAT_GRAY16_LE:
+      return CV_16UC1;
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+    case StreamPixelFormat::PIXEL_FORMAT_YUVMONO10:
+      return CV_8UC2;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      return CV_8UC3;
+    case StreamPixelFormat::PIXEL_FORMAT_RGBA:
+    case StreamPixelFormat::PIXEL_FORMAT_BGRA:
+      return CV_8UC4;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB16:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR16:
+      return CV_16UC3;
+    case StreamPixelFormat::PIXEL_FORMAT_RGBA16:
+    case StreamPixelFormat::PIXEL_FORMAT_BGRA16:
+      return CV_16UC4;
+    default:
+      return -1;
+  }
+}
+
+cv::Mat ToMat(const FramePtr& frame) {
+  if (frame == nullptr || !frame->IsMapped()) {
+    AERROR_F("cannot view a frame without mapped memory");
+    return cv::Mat();
+  }
+
+  // 1. compressed payload as a single row, e.g. for cv::imdecode()
+  if (frame->pixel_format == StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    const int bytes_used = static_cast<int>(frame->bytes_used);
+    if (bytes_used == 0) {
+      return cv::Mat();
+    }
+    return MakeView(1, bytes_used, CV_8UC1, frame->GetData(), bytes_used,
+                    frame);
+  }
+
+  // 2. all planes of a semi-planar frame at once, only if they follow each
+  // other with the same stride
+  if (frame->num_planes == 2) {
+    const FramePlane& luma = frame->planes[0];
+    const FramePlane& chroma = frame->planes[1];
+    if (chroma.data != luma.data + luma.size || chroma.stride != luma.stride) {
+      AERROR_F("planes of the {} frame are not contiguous, view them one by "
+               "one",
+               StreamPixelFormatToStr(frame->pixel_format));
+      return cv::Mat();
+    }
+    const int rows =
+        static_cast<int>((luma.size + chroma.size) / luma.stride);
+    return MakeView(rows, frame->width, CV_8UC1, luma.data, luma.stride,
+                    frame);
+  }
+
+  return ToMat(frame, 0);
+}
+
+cv::Mat ToMat(const FramePtr& frame, int plane) {
+  if (frame == nullptr || plane < 0 || plane >= frame->num_planes ||
+      frame->planes[plane].data == nullptr) {
+    AERROR_F("cannot view plane {} of the frame", plane);
+    return cv::Mat();
+  }
+  const int type = GetMatType(frame->pixel_format);
+  if (type < 0 || frame->GetStride(plane) == 0) {
+    AERROR_F("cannot view {} frames as matrices",
+             StreamPixelFormatToStr(frame->pixel_format));
+    return cv::Mat();
+  }
+
+  // the chroma plane of semi-planar formats holds interleaved UV pairs
+  const FramePlane& data = frame->planes[plane];
+  if (plane == 1) {
+    const int rows = static_cast<int>(data.size / data.stride);
+    return MakeView(rows, (frame->width + 1) / 2, CV_8UC2, data.data,
+                    data.stride, frame);
+  }
+  return MakeView(frame->height, frame->width, type, data.data, data.stride,
+                  frame);
+}
+
+cv::Mat ToMat(const CameraImagePtr& image) {
+  if (image == nullptr || image->image == nullptr) {
+    AERROR_F("cannot view an empty camera image");
+    return cv::Mat();
+  }
+  if (image->bytes_per_pixel < 1 || image->bytes_per_pixel > 4) {
+    AERROR_F("cannot view images of {} bytes per pixel",
+             image->bytes_per_pixel);
+    return cv::Mat();
+  }
+  return MakeView(image->height, image->width,
+                  CV_8UC(image->bytes_per_pixel), image->image,
+                  image->GetStride(), image);
+}
+
+cv::UMat ToUMat(const FramePtr& frame, cv::AccessFlag access_flags) {
+  // the umat shares the view and with it the reference to the frame
+  cv::Mat mat = ToMat(frame);
+  if (mat.empty()) {
+    return cv::UMat();
+  }
+  return mat.getUMat(access_flags);
+}
+
 }  // namespace stream
 }  // namespace zetton
@@ -251,6 +251,125 @@ int convert_yuv_to_rgb_buffer(unsigned char* yuv, unsigned char* rgb,
   return 0;
 }
 
+namespace {
+
+// same fixed-point weights as the avx kernels, see YUV_TO_BGR_AVERAGING_SHIFT
+inline void yuv2rgb_fixed(int y, int u, int v, unsigned char* rgb) {
+  const int y2 = y << 13;
+  const int u2 = u - 128;
+  const int v2 = v - 128;
+  const int r = (y2 + 11522 * v2) >> 13;
+  const int g = (y2 - 2830 * u2 - 5872 * v2) >> 13;
+  const int b = (y2 + 16719 * u2) >> 13;
+  rgb[0] = static_cast<unsigned char>(r < 0 ? 0 : (r > 255 ? 255 : r));
+  rgb[1] = static_cast<unsigned char>(g < 0 ? 0 : (g > 255 ? 255 : g));
+  rgb[2] = static_cast<unsigned char>(b < 0 ? 0 : (b > 255 ? 255 : b));
+}
+
+// convert pixels [begin, width) of one semi-planar row
+inline void nv_row_to_rgb(const unsigned char* y, const unsigned char* uv,
+                          unsigned char* rgb, unsigned int begin,
+                          unsigned int width) {
+  for (unsigned int x = begin; x < width; ++x) {
+    const unsigned int c = x & ~1u;
+    yuv2rgb_fixed(y[x], uv[c], uv[c + 1], rgb + 3 * x);
+  }
+}
+
+// convert pixels [begin, width) of one packed 4:2:2 row, the offsets give the
+// position of y0, u, y1 and v in every macropixel
+template <int Y0, int U, int Y1, int V>
+inline void packed_row_to_rgb(const unsigned char* src, unsigned char* rgb,
+                              unsigned int begin, unsigned int width) {
+  for (unsigned int x = begin; x < width; ++x) {
+    const unsigned char* macropixel = src + 2 * (x & ~1u);
+    yuv2rgb_fixed(macropixel[(x & 1) ? Y1 : Y0], macropixel[U], macropixel[V],
+                  rgb + 3 * x);
+  }
+}
+
+inline void uyvy_row_to_yuyv(const unsigned char* src, unsigned char* dst,
+                             unsigned int begin, unsigned int width) {
+  for (unsigned int i = 2 * begin; i < 2 * width; i += 2) {
+    dst[i] = src[i + 1];
+    dst[i + 1] = src[i];
+  }
+}
+
+}  // namespace
+
+void nv12_to_rgb(const unsigned char* y, unsigned int y_stride,
+                 const unsigned char* uv, unsigned int uv_stride,
+                 unsigned char* rgb, unsigned int rgb_stride,
+                 unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    nv_row_to_rgb(y + row * y_stride, uv + (row >> 1) * uv_stride,
+                  rgb + row * rgb_stride, 0, width);
+  }
+}
+
+void nv16_to_rgb(const unsigned char* y, unsigned int y_stride,
+                 const unsigned char* uv, unsigned int uv_stride,
+                 unsigned char* rgb, unsigned int rgb_stride,
+                 unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    nv_row_to_rgb(y + row * y_stride, uv + row * uv_stride,
+                  rgb + row * rgb_stride, 0, width);
+  }
+}
+
+void yuyv_to_rgb(const unsigned char* src, unsigned int src_stride,
+                 unsigned char* dst, unsigned int dst_stride,
+                 unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    packed_row_to_rgb<0, 1, 2, 3>(src + row * src_stride,
+                                  dst + row * dst_stride, 0, width);
+  }
+}
+
+void uyvy_to_rgb(const unsigned char* src, unsigned int src_stride,
+                 unsigned char* dst, unsigned int dst_stride,
+                 unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    packed_row_to_rgb<1, 0, 3, 2>(src + row * src_stride,
+                                  dst + row * dst_stride, 0, width);
+  }
+}
+
+void uyvy_to_yuyv(const unsigned char* src, unsigned int src_stride,
+                  unsigned char* dst, unsigned int dst_stride,
+                  unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    uyvy_row_to_yuyv(src + row * src_stride, dst + row * dst_stride, 0, width);
+  }
+}
+
+void mono10_to_mono8(const unsigned char* src, unsigned int src_stride,
+                     unsigned char* dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    const unsigned char* raw = src + row * src_stride;
+    unsigned char* mono = dst + row * dst_stride;
+    for (unsigned int x = 0; x < width; ++x) {
+      // same bit layout as mono102mono8
+      mono[x] = static_cast<unsigned char>(((raw[2 * x] >> 2) & 0x3F) |
+                                           ((raw[2 * x + 1] << 6) & 0xC0));
+    }
+  }
+}
+
+void copy_rows(const unsigned char* src, unsigned int src_stride,
+               unsigned char* dst, unsigned int dst_stride,
+               unsigned int row_bytes, unsigned int height) {
+  if (src_stride == row_bytes && dst_stride == row_bytes) {
+    memcpy(dst, src, static_cast<size_t>(row_bytes) * height);
+    return;
+  }
+  for (unsigned int row = 0; row < height; ++row) {
+    memcpy(dst + row * dst_stride, src + row * src_stride, row_bytes);
+  }
+}
+
 #ifdef WITH_AVX
 void print_m256(__m256i a) {
   unsigned char snoop[32];
@@ -380,6 +499,138 @@ void yuyv2rgb_avx(unsigned char* YUV, unsigned char* RGB, int NumPixels) {
     }
   }
 }
+
+namespace {
+
+// even bytes to the low half, odd bytes to the high half of every lane
+const __m256i UV_DEINTERLEAVE = SIMD_MM256_SETR_EPI8(
+    0x0, 0x2, 0x4, 0x6, 0x8, 0xA, 0xC, 0xE, 0x1, 0x3, 0x5, 0x7, 0x9, 0xB, 0xD,
+    0xF, 0x0, 0x2, 0x4, 0x6, 0x8, 0xA, 0xC, 0xE, 0x1, 0x3, 0x5, 0x7, 0x9, 0xB,
+    0xD, 0xF);
+
+// 32 pixels per step: 32 luma bytes and 16 interleaved chroma pairs, every
+// chroma sample is duplicated for its two horizontal neighbours
+void nv_row_to_rgb_avx(const unsigned char* y, const unsigned char* uv,
+                       unsigned char* rgb, unsigned int width) {
+  unsigned int x = 0;
+  for (; x + A <= width; x += A) {
+    const __m256i y0 = Load<false>(reinterpret_cast<const __m256i*>(y + x));
+    const __m256i uv0 = _mm256_permute4x64_epi64(
+        _mm256_shuffle_epi8(
+            Load<false>(reinterpret_cast<const __m256i*>(uv + x)),
+            UV_DEINTERLEAVE),
+        0xD8);
+    const __m256i u16 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(uv0));
+    const __m256i v16 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(uv0, 1));
+    yuv2rgb_avx2<false>(y0, _mm256_or_si256(u16, _mm256_slli_epi16(u16, 8)),
+                        _mm256_or_si256(v16, _mm256_slli_epi16(v16, 8)),
+                        rgb + 3 * x);
+  }
+  nv_row_to_rgb(y, uv, rgb, x, width);
+}
+
+}  // namespace
+
+namespace {
+
+// swap the bytes of every 16-bit word, uyvy <-> yuyv
+const __m256i UYVY_TO_YUYV = SIMD_MM256_SETR_EPI8(
+    0x1, 0x0, 0x3, 0x2, 0x5, 0x4, 0x7, 0x6, 0x9, 0x8, 0xB, 0xA, 0xD, 0xC, 0xF,
+    0xE, 0x1, 0x0, 0x3, 0x2, 0x5, 0x4, 0x7, 0x6, 0x9, 0x8, 0xB, 0xA, 0xD, 0xC,
+    0xF, 0xE);
+
+// 64 pixels per step, the rest of the row is converted one by one
+template <bool align, bool uyvy>
+void packed_row_to_rgb_avx(const unsigned char* src, unsigned char* dst,
+                           unsigned int width) {
+  alignas(32) uint8_t yuyv[4 * A];
+  unsigned int x = 0;
+  for (; x + DA <= width; x += DA) {
+    const auto* block = reinterpret_cast<const __m256i*>(src + 2 * x);
+    if (uyvy) {
+      for (size_t i = 0; i < 4; ++i) {
+        Store<true>(reinterpret_cast<__m256i*>(yuyv) + i,
+                    _mm256_shuffle_epi8(Load<align>(block + i), UYVY_TO_YUYV));
+      }
+      yuv2rgb_avx2<align>(yuyv, dst + 3 * x);
+    } else {
+      yuv2rgb_avx2<align>(const_cast<uint8_t*>(src + 2 * x), dst + 3 * x);
+    }
+  }
+  if (uyvy) {
+    packed_row_to_rgb<1, 0, 3, 2>(src, dst, x, width);
+  } else {
+    packed_row_to_rgb<0, 1, 2, 3>(src, dst, x, width);
+  }
+}
+
+template <bool uyvy>
+void packed_to_rgb_avx(const unsigned char* src, unsigned int src_stride,
+                       unsigned char* dst, unsigned int dst_stride,
+                       unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    const unsigned char* s = src + row * src_stride;
+    unsigned char* d = dst + row * dst_stride;
+    // padded rows usually keep the alignment of the first one
+    if (Aligned(s) && Aligned(d)) {
+      packed_row_to_rgb_avx<true, uyvy>(s, d, width);
+    } else {
+      packed_row_to_rgb_avx<false, uyvy>(s, d, width);
+    }
+  }
+}
+
+}  // namespace
+
+void yuyv_to_rgb_avx(const unsigned char* src, unsigned int src_stride,
+                     unsigned char* dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height) {
+  packed_to_rgb_avx<false>(src, src_stride, dst, dst_stride, width, height);
+}
+
+void uyvy_to_rgb_avx(const unsigned char* src, unsigned int src_stride,
+                     unsigned char* dst, unsigned int dst_stride,
+                     unsigned int width, unsigned int height) {
+  packed_to_rgb_avx<true>(src, src_stride, dst, dst_stride, width, height);
+}
+
+void uyvy_to_yuyv_avx(const unsigned char* src, unsigned int src_stride,
+                      unsigned char* dst, unsigned int dst_stride,
+                      unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    const unsigned char* s = src + row * src_stride;
+    unsigned char* d = dst + row * dst_stride;
+    // 16 pixels per step
+    unsigned int x = 0;
+    for (; x + HA <= width; x += HA) {
+      Store<false>(reinterpret_cast<__m256i*>(d + 2 * x),
+                   _mm256_shuffle_epi8(
+                       Load<false>(reinterpret_cast<const __m256i*>(s + 2 * x)),
+                       UYVY_TO_YUYV));
+    }
+    uyvy_row_to_yuyv(s, d, x, width);
+  }
+}
+
+void nv12_to_rgb_avx(const unsigned char* y, unsigned int y_stride,
+                     const unsigned char* uv, unsigned int uv_stride,
+                     unsigned char* rgb, unsigned int rgb_stride,
+                     unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    nv_row_to_rgb_avx(y + row * y_stride, uv + (row >> 1) * uv_stride,
+                      rgb + row * rgb_stride, width);
+  }
+}
+
+void nv16_to_rgb_avx(const unsigned char* y, unsigned int y_stride,
+                     const unsigned char* uv, unsigned int uv_stride,
+                     unsigned char* rgb, unsigned int rgb_stride,
+                     unsigned int width, unsigned int height) {
+  for (unsigned int row = 0; row < height; ++row) {
+    nv_row_to_rgb_avx(y + row * y_stride, uv + row * uv_stride,
+                      rgb + row * rgb_stride, width);
+  }
+}
 #endif
 
 }  // namespace stream
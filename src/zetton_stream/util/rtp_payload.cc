@@ -0,0 +1,802 @@
+#include "zetton_stream/util/rtp_payload.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/util/clock.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// JPEG main header, restart marker header and quantization table header
+constexpr size_t kJpegHeaderSize = 8;
+constexpr size_t kJpegRestartHeaderSize = 4;
+constexpr size_t kJpegTableHeaderSize = 4;
+// largest header a depacketized JPEG gets
+constexpr size_t kJpegMaxFileHeaderSize = 1024;
+// extended sequence number and a line header of RFC 4175
+constexpr size_t kRawHeaderSize = 2;
+constexpr size_t kRawLineHeaderSize = 6;
+
+// standard Huffman tables of the JPEG specification (K.3), which RFC 2435
+// receivers assume
+const uint8_t kLumDcCodeLens[16] = {0, 1, 5, 1, 1, 1, 1, 1,
+                                    1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t kLumDcSymbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t kLumAcCodeLens[16] = {0, 2, 1, 3, 3, 2, 4, 3,
+                                    5, 5, 4, 4, 0, 0, 1, 0x7d};
+const uint8_t kLumAcSymbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+const uint8_t kChmDcCodeLens[16] = {0, 3, 1, 1, 1, 1, 1, 1,
+                                    1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t kChmDcSymbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t kChmAcCodeLens[16] = {0, 2, 1, 2, 4, 4, 3, 4,
+                                    7, 5, 4, 4, 0, 1, 2, 0x77};
+const uint8_t kChmAcSymbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+struct HuffmanTable {
+  uint8_t id;
+  const uint8_t* code_lens;
+  const uint8_t* symbols;
+  size_t num_symbols;
+};
+
+// class and destination, as in the DHT segment
+const HuffmanTable kHuffmanTables[4] = {
+    {0x00, kLumDcCodeLens, kLumDcSymbols, sizeof(kLumDcSymbols)},
+    {0x10, kLumAcCodeLens, kLumAcSymbols, sizeof(kLumAcSymbols)},
+    {0x01, kChmDcCodeLens, kChmDcSymbols, sizeof(kChmDcSymbols)},
+    {0x11, kChmAcCodeLens, kChmAcSymbols, sizeof(kChmAcSymbols)},
+};
+
+inline uint16_t ReadU16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+inline uint8_t* WriteU16(uint8_t* p, uint32_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+  return p + 2;
+}
+
+inline uint8_t* WriteU24(uint8_t* p, uint32_t value) {
+  p[0] = static_cast<uint8_t>(value >> 16);
+  return WriteU16(p + 1, value);
+}
+
+inline uint8_t* WriteU32(uint8_t* p, uint32_t value) {
+  p[0] = static_cast<uint8_t>(value >> 24);
+  return WriteU24(p + 1, value);
+}
+
+// what RFC 2435 needs of a JPEG
+struct JpegLayout {
+  // 0 for 4:2:2, 1 for 4:2:0, +64 with restart markers
+  uint8_t type = 0;
+  int width = 0;
+  int height = 0;
+  uint16_t restart_interval = 0;
+  // quantization tables of luma and chroma, in zigzag order
+  const uint8_t* tables[2] = {nullptr, nullptr};
+  bool precise[2] = {false, false};
+  const uint8_t* scan = nullptr;
+  size_t scan_size = 0;
+};
+
+bool IsStandardHuffmanTable(uint8_t id, const uint8_t* code_lens,
+                            const uint8_t* symbols, size_t num_symbols) {
+  for (const auto& table : kHuffmanTables) {
+    if (table.id == id) {
+      return num_symbols == table.num_symbols &&
+             memcmp(code_lens, table.code_lens, 16) == 0 &&
+             memcmp(symbols, table.symbols, num_symbols) == 0;
+    }
+  }
+  return false;
+}
+
+bool ParseJpeg(const uint8_t* data, size_t size, JpegLayout* layout) {
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    AERROR_F("not a JPEG");
+    return false;
+  }
+  const uint8_t* tables[4] = {nullptr, nullptr, nullptr, nullptr};
+  bool precise[4] = {false, false, false, false};
+  uint8_t table_ids[2] = {0, 0};
+  bool has_frame = false;
+  size_t pos = 2;
+  while (pos + 4 <= size) {
+    if (data[pos] != 0xFF) {
+      AERROR_F("broken JPEG marker at {}", pos);
+      return false;
+    }
+    const uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {
+      ++pos;
+      continue;
+    }
+    const size_t length = ReadU16(data + pos + 2);
+    const uint8_t* segment = data + pos + 4;
+    if (length < 2 || pos + 2 + length > size) {
+      AERROR_F("truncated JPEG segment {:#x}", marker);
+      return false;
+    }
+    const size_t segment_size = length - 2;
+    switch (marker) {
+      case 0xDB:  // DQT, one or more tables
+        for (size_t n = 0; n < segment_size;) {
+          const bool is_precise = (segment[n] >> 4) != 0;
+          const uint8_t id = segment[n] & 0x03;
+          const size_t table_size = is_precise ? 128 : 64;
+          if (n + 1 + table_size > segment_size) {
+            AERROR_F("truncated JPEG quantization table");
+            return false;
+          }
+          tables[id] = segment + n + 1;
+          precise[id] = is_precise;
+          n += 1 + table_size;
+        }
+        break;
+      case 0xC4:  // DHT
+        for (size_t n = 0; n + 17 <= segment_size;) {
+          size_t num_symbols = 0;
+          for (int i = 0; i < 16; ++i) {
+            num_symbols += segment[n + 1 + i];
+          }
+          if (n + 17 + num_symbols > segment_size ||
+              !IsStandardHuffmanTable(segment[n], segment + n + 1,
+                                      segment + n + 17, num_symbols)) {
+            AERROR_F("JPEG with custom Huffman tables cannot be sent");
+            return false;
+          }
+          n += 17 + num_symbols;
+        }
+        break;
+      case 0xC0:  // SOF0 and SOF1, baseline
+      case 0xC1: {
+        if (segment_size < 15 || segment[5] != 3) {
+          AERROR_F("only YCbCr JPEG can be sent");
+          return false;
+        }
+        layout->height = ReadU16(segment + 1);
+        layout->width = ReadU16(segment + 3);
+        const uint8_t luma = segment[7];
+        if (segment[10] != 0x11 || segment[13] != 0x11 ||
+            (luma != 0x21 && luma != 0x22)) {
+          AERROR_F("only 4:2:2 and 4:2:0 JPEG can be sent");
+          return false;
+        }
+        layout->type = luma == 0x21 ? 0 : 1;
+        table_ids[0] = segment[8] & 0x03;
+        table_ids[1] = segment[11] & 0x03;
+        has_frame = true;
+        break;
+      }
+      case 0xC2:
+      case 0xC3:
+      case 0xC5:
+      case 0xC6:
+      case 0xC7:
+      case 0xC9:
+      case 0xCA:
+      case 0xCB:
+      case 0xCD:
+      case 0xCE:
+      case 0xCF:
+        AERROR_F("only baseline JPEG can be sent");
+        return false;
+      case 0xDD:  // DRI
+        if (segment_size >= 2) {
+          layout->restart_interval = ReadU16(segment);
+        }
+        break;
+      case 0xDA: {  // SOS, the entropy coded data follows up to EOI
+        const size_t scan_start = pos + 2 + length;
+        size_t end = size;
+        if (end >= scan_start + 2 && data[end - 2] == 0xFF &&
+            data[end - 1] == 0xD9) {
+          end -= 2;
+        }
+        layout->scan = segment + segment_size;
+        layout->scan_size = end - scan_start;
+        pos = size;
+        continue;
+      }
+      default:
+        break;
+    }
+    pos += 2 + length;
+  }
+
+  if (!has_frame || layout->scan == nullptr ||
+      tables[table_ids[0]] == nullptr || tables[table_ids[1]] == nullptr) {
+    AERROR_F("incomplete JPEG");
+    return false;
+  }
+  if (layout->width > 2040 || layout->height > 2040) {
+    AERROR_F("{}x{} JPEG is too large for RTP", layout->width,
+             layout->height);
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    layout->tables[i] = tables[table_ids[i]];
+    layout->precise[i] = precise[table_ids[i]];
+  }
+  if (layout->restart_interval > 0) {
+    layout->type += 64;
+  }
+  return true;
+}
+
+// JPEG headers of RFC 2435 (appendix A) into a buffer of capacity bytes,
+// returns their size. 0 if the buffer is too small or the tables do not
+// have the size their precision asks for
+size_t WriteJpegHeaders(uint8_t* start, size_t capacity, uint8_t type,
+                        int width, int height, const uint8_t* tables,
+                        uint8_t precision, size_t tables_size,
+                        uint16_t restart_interval) {
+  const size_t luma_size = (precision & 1) ? 128 : 64;
+  const size_t chroma_size = (precision & 2) ? 128 : 64;
+  if (capacity < kJpegMaxFileHeaderSize || tables_size < luma_size) {
+    return 0;
+  }
+  uint8_t* p = start;
+  *p++ = 0xFF;
+  *p++ = 0xD8;
+
+  // 1. quantization tables, one for every component if only one was sent
+  const bool has_chroma = tables_size >= luma_size + chroma_size;
+  for (int i = 0; i < (has_chroma ? 2 : 1); ++i) {
+    const size_t table_size = i == 0 ? luma_size : chroma_size;
+    *p++ = 0xFF;
+    *p++ = 0xDB;
+    p = WriteU16(p, 3 + table_size);
+    *p++ = static_cast<uint8_t>((table_size == 128 ? 0x10 : 0x00) | i);
+    memcpy(p, tables + (i == 0 ? 0 : luma_size), table_size);
+    p += table_size;
+  }
+  const uint8_t chroma_table = has_chroma ? 1 : 0;
+
+  // 2. frame
+  *p++ = 0xFF;
+  *p++ = 0xC0;
+  p = WriteU16(p, 17);
+  *p++ = 8;
+  p = WriteU16(p, height);
+  p = WriteU16(p, width);
+  *p++ = 3;
+  const uint8_t components[3][3] = {
+      {1, static_cast<uint8_t>((type & 0x3F) == 0 ? 0x21 : 0x22), 0},
+      {2, 0x11, chroma_table},
+      {3, 0x11, chroma_table}};
+  for (const auto& component : components) {
+    memcpy(p, component, 3);
+    p += 3;
+  }
+
+  // 3. Huffman tables and restart interval
+  for (const auto& table : kHuffmanTables) {
+    *p++ = 0xFF;
+    *p++ = 0xC4;
+    p = WriteU16(p, 3 + 16 + table.num_symbols);
+    *p++ = table.id;
+    memcpy(p, table.code_lens, 16);
+    p += 16;
+    memcpy(p, table.symbols, table.num_symbols);
+    p += table.num_symbols;
+  }
+  if (restart_interval > 0) {
+    *p++ = 0xFF;
+    *p++ = 0xDD;
+    p = WriteU16(p, 4);
+    p = WriteU16(p, restart_interval);
+  }
+
+  // 4. scan
+  const uint8_t scan[14] = {0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2,
+                            0x11, 3,    0x11, 0, 63, 0};
+  memcpy(p, scan, sizeof(scan));
+  p += sizeof(scan);
+  return static_cast<size_t>(p - start);
+}
+
+// pixels and bytes of a pixel group of RFC 4175, 0 if not supported
+void GetPixelGroup(StreamPixelFormat format, size_t* pixels, size_t* bytes) {
+  switch (format) {
+    case StreamPixelFormat::PIXEL_FORMAT_UYVY:
+    case StreamPixelFormat::PIXEL_FORMAT_YUYV:
+      *pixels = 2;
+      *bytes = 4;
+      break;
+    case StreamPixelFormat::PIXEL_FORMAT_RGB:
+    case StreamPixelFormat::PIXEL_FORMAT_BGR:
+      *pixels = 1;
+      *bytes = 3;
+      break;
+    default:
+      *pixels = 0;
+      *bytes = 0;
+      break;
+  }
+}
+
+// UYVY and YUYV differ by the order of the bytes of each pair
+void SwapBytePairs(const uint8_t* src, uint8_t* dst, size_t size) {
+  for (size_t i = 0; i + 1 < size; i += 2) {
+    const uint8_t first = src[i];
+    dst[i] = src[i + 1];
+    dst[i + 1] = first;
+  }
+}
+
+}  // namespace
+
+size_t RtpPacket::GetSize() const {
+  size_t size = header_size;
+  for (int i = 0; i < num_payloads; ++i) {
+    size += payload_size[i];
+  }
+  return size;
+}
+
+bool RtpPacketizer::Init(uint32_t ssrc, size_t max_packet_size) {
+  // room for the headers and a line of a few pixels
+  if (max_packet_size < kRtpMaxHeaderSize + 64 || max_packet_size > 65507) {
+    AERROR_F("invalid RTP packet size {}", max_packet_size);
+    return false;
+  }
+  ssrc_ = ssrc;
+  max_packet_size_ = max_packet_size;
+  sequence_ = ssrc * 2654435761u;
+  return true;
+}
+
+bool RtpPacketizer::IsSupported(StreamPixelFormat format) {
+  size_t pixels = 0;
+  size_t bytes = 0;
+  GetPixelGroup(format, &pixels, &bytes);
+  return format == StreamPixelFormat::PIXEL_FORMAT_MJPEG || pixels > 0;
+}
+
+bool RtpPacketizer::Packetize(const Frame& frame, uint32_t timestamp,
+                              std::vector<RtpPacket>* packets) {
+  if (!frame.IsMapped() || !IsSupported(frame.pixel_format)) {
+    AERROR_F("cannot send {} frames over RTP",
+             StreamPixelFormatToStr(frame.pixel_format));
+    return false;
+  }
+  if (frame.pixel_format == StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    return PacketizeJpeg(frame, timestamp, packets);
+  }
+  return PacketizeRaw(frame, timestamp, packets);
+}
+
+uint8_t* RtpPacketizer::AddPacket(std::vector<RtpPacket>* packets,
+                                  size_t* num_packets, uint8_t payload_type,
+                                  uint32_t timestamp) {
+  // packets are reused from frame to frame
+  if (*num_packets == packets->size()) {
+    packets->emplace_back();
+  }
+  RtpPacket& packet = (*packets)[(*num_packets)++];
+  packet.num_payloads = 0;
+  packet.header[0] = 0x80;
+  packet.header[1] = payload_type;
+  uint8_t* p = WriteU16(packet.header + 2, sequence_++ & 0xFFFF);
+  p = WriteU32(p, timestamp);
+  p = WriteU32(p, ssrc_);
+  packet.header_size = kRtpHeaderSize;
+  return p;
+}
+
+bool RtpPacketizer::PacketizeJpeg(const Frame& frame, uint32_t timestamp,
+                                  std::vector<RtpPacket>* packets) {
+  // 1. layout and tables of the JPEG
+  const size_t size = frame.bytes_used > 0 && frame.bytes_used <
+                                                  frame.planes[0].size
+                          ? frame.bytes_used
+                          : frame.planes[0].size;
+  JpegLayout layout;
+  if (!ParseJpeg(frame.GetData(), size, &layout)) {
+    return false;
+  }
+  const size_t luma_size = layout.precise[0] ? 128 : 64;
+  const size_t chroma_size = layout.precise[1] ? 128 : 64;
+  memcpy(tables_, layout.tables[0], luma_size);
+  memcpy(tables_ + luma_size, layout.tables[1], chroma_size);
+  const size_t tables_size = luma_size + chroma_size;
+  const uint8_t precision =
+      (layout.precise[0] ? 1 : 0) | (layout.precise[1] ? 2 : 0);
+
+  // 2. fragments of the scan, the first one with the tables
+  size_t num_packets = 0;
+  size_t offset = 0;
+  while (offset < layout.scan_size || num_packets == 0) {
+    uint8_t* p = AddPacket(packets, &num_packets, kRtpJpegPayloadType,
+                           timestamp);
+    *p++ = 0;
+    p = WriteU24(p, static_cast<uint32_t>(offset));
+    *p++ = layout.type;
+    // tables are sent with every frame
+    *p++ = 255;
+    *p++ = static_cast<uint8_t>(layout.width / 8);
+    *p++ = static_cast<uint8_t>(layout.height / 8);
+    if (layout.restart_interval > 0) {
+      // fragments do not follow restart intervals
+      p = WriteU16(p, layout.restart_interval);
+      p = WriteU16(p, 0xFFFF);
+    }
+    RtpPacket& packet = (*packets)[num_packets - 1];
+    if (offset == 0) {
+      *p++ = 0;
+      *p++ = precision;
+      p = WriteU16(p, static_cast<uint32_t>(tables_size));
+      packet.payload[packet.num_payloads] = tables_;
+      packet.payload_size[packet.num_payloads++] = tables_size;
+    }
+    packet.header_size = static_cast<size_t>(p - packet.header);
+    const size_t room = max_packet_size_ - packet.GetSize();
+    const size_t n = std::min(room, layout.scan_size - offset);
+    packet.payload[packet.num_payloads] = layout.scan + offset;
+    packet.payload_size[packet.num_payloads++] = n;
+    offset += n;
+  }
+  packets->resize(num_packets);
+  packets->back().header[1] |= 0x80;
+  return true;
+}
+
+bool RtpPacketizer::PacketizeRaw(const Frame& frame, uint32_t timestamp,
+                                 std::vector<RtpPacket>* packets) {
+  size_t group_pixels = 0;
+  size_t group_bytes = 0;
+  GetPixelGroup(frame.pixel_format, &group_pixels, &group_bytes);
+  const size_t width = static_cast<size_t>(frame.width);
+  const size_t height = static_cast<size_t>(frame.height);
+  const size_t row_bytes = width / group_pixels * group_bytes;
+
+  // 1. rows in the byte order of RFC 4175
+  const uint8_t* data = frame.GetData();
+  size_t stride = static_cast<size_t>(frame.GetStride());
+  if (frame.pixel_format == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
+    scratch_.resize(row_bytes * height);
+    for (size_t y = 0; y < height; ++y) {
+      SwapBytePairs(data + y * stride, scratch_.data() + y * row_bytes,
+                    row_bytes);
+    }
+    data = scratch_.data();
+    stride = row_bytes;
+  }
+
+  // 2. packets of as many line segments as fit
+  size_t num_packets = 0;
+  size_t line = 0;
+  size_t pixel = 0;
+  while (line < height) {
+    uint8_t* p = AddPacket(packets, &num_packets, kRtpRawPayloadType,
+                           timestamp);
+    RtpPacket& packet = (*packets)[num_packets - 1];
+    p = WriteU16(p, (sequence_ - 1) >> 16);
+    size_t room = max_packet_size_ - kRtpHeaderSize - kRawHeaderSize;
+    uint8_t* previous = nullptr;
+    while (line < height && packet.num_payloads < kRtpMaxPayloads &&
+           room >= kRawLineHeaderSize + group_bytes) {
+      room -= kRawLineHeaderSize;
+      const size_t groups = std::min((width - pixel) / group_pixels,
+                                     room / group_bytes);
+      const size_t bytes = groups * group_bytes;
+      if (previous != nullptr) {
+        // continuation bit of the previous line header
+        previous[4] |= 0x80;
+      }
+      previous = p;
+      p = WriteU16(p, static_cast<uint32_t>(bytes));
+      p = WriteU16(p, static_cast<uint32_t>(line & 0x7FFF));
+      p = WriteU16(p, static_cast<uint32_t>(pixel & 0x7FFF));
+      packet.payload[packet.num_payloads] =
+          data + line * stride + pixel / group_pixels * group_bytes;
+      packet.payload_size[packet.num_payloads++] = bytes;
+      room -= bytes;
+      pixel += groups * group_pixels;
+      if (pixel + group_pixels > width) {
+        ++line;
+        pixel = 0;
+      }
+    }
+    packet.header_size = static_cast<size_t>(p - packet.header);
+  }
+  packets->resize(num_packets);
+  packets->back().header[1] |= 0x80;
+  return true;
+}
+
+bool RtpDepacketizer::Init(StreamPixelFormat format, int width, int height,
+                           int num_frames) {
+  size_t group_pixels = 0;
+  size_t group_bytes = 0;
+  GetPixelGroup(format, &group_pixels, &group_bytes);
+  if (format != StreamPixelFormat::PIXEL_FORMAT_MJPEG &&
+      (group_pixels == 0 || width <= 0 || height <= 0)) {
+    AERROR_F("cannot receive {}x{} {} frames over RTP", width, height,
+             StreamPixelFormatToStr(format));
+    return false;
+  }
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  num_frames_ = std::max(num_frames, 2);
+  pool_.reset();
+  frame_.reset();
+  expected_sequence_ = -1;
+  return true;
+}
+
+bool RtpDepacketizer::StartFrame(StreamPixelFormat format, int width,
+                                 int height) {
+  if (pool_ == nullptr || pool_->GetPixelFormat() != format ||
+      width != width_ || height != height_) {
+    pool_ = FramePool::Create(format, width, height, num_frames_);
+    if (pool_ == nullptr) {
+      AERROR_F("cannot allocate {}x{} {} frames", width, height,
+               StreamPixelFormatToStr(format));
+      return false;
+    }
+    width_ = width;
+    height_ = height;
+  }
+  frame_ = pool_->AcquireFrame(0);
+  if (frame_ == nullptr) {
+    // every frame is still held by the application
+    return false;
+  }
+  broken_ = false;
+  received_ = 0;
+  header_size_ = 0;
+  return true;
+}
+
+void RtpDepacketizer::DropFrame() {
+  if (frame_ != nullptr || broken_) {
+    ++frames_dropped_;
+  }
+  frame_.reset();
+  broken_ = false;
+}
+
+FramePtr RtpDepacketizer::Push(const uint8_t* packet, size_t size) {
+  // 1. rtp header
+  if (size < kRtpHeaderSize || (packet[0] >> 6) != 2) {
+    return nullptr;
+  }
+  const size_t csrc_size = (packet[0] & 0x0F) * 4;
+  size_t header_size = kRtpHeaderSize + csrc_size;
+  if (packet[0] & 0x10) {
+    // header extension
+    if (size < header_size + 4) {
+      return nullptr;
+    }
+    header_size += 4 + ReadU16(packet + header_size + 2) * 4;
+  }
+  if (packet[0] & 0x20) {
+    // padding
+    size -= std::min<size_t>(packet[size - 1], size);
+  }
+  if (size < header_size) {
+    return nullptr;
+  }
+  const bool marker = (packet[1] & 0x80) != 0;
+  const uint16_t sequence = ReadU16(packet + 2);
+  const uint32_t timestamp = static_cast<uint32_t>(ReadU16(packet + 4)) << 16 |
+                             ReadU16(packet + 6);
+
+  // 2. a new timestamp ends the previous frame, losses break the frame
+  if (timestamp != timestamp_ && (frame_ != nullptr || broken_)) {
+    // the end of the previous frame never came
+    DropFrame();
+  }
+  timestamp_ = timestamp;
+  if (expected_sequence_ >= 0 && sequence != expected_sequence_) {
+    packets_lost_ += static_cast<uint16_t>(sequence - expected_sequence_);
+    broken_ = true;
+  }
+  expected_sequence_ = static_cast<uint16_t>(sequence + 1);
+  const bool first = frame_ == nullptr && !broken_;
+
+  // 3. payload into the frame
+  const bool pushed =
+      format_ == StreamPixelFormat::PIXEL_FORMAT_MJPEG
+          ? PushJpeg(packet + header_size, size - header_size, first)
+          : PushRaw(packet + header_size, size - header_size, first);
+  if (!pushed) {
+    broken_ = true;
+  }
+  if (!marker) {
+    return nullptr;
+  }
+  if (broken_ || frame_ == nullptr ||
+      (format_ != StreamPixelFormat::PIXEL_FORMAT_MJPEG &&
+       received_ != GetRawSize())) {
+    DropFrame();
+    return nullptr;
+  }
+
+  // 4. complete
+  FramePtr frame = std::move(frame_);
+  frame_.reset();
+  if (format_ == StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    uint8_t* end = frame->GetData() + header_size_ + received_;
+    end[0] = 0xFF;
+    end[1] = 0xD9;
+    frame->bytes_used =
+        static_cast<uint32_t>(header_size_ + received_ + 2);
+  } else {
+    frame->bytes_used = static_cast<uint32_t>(frame->GetSize());
+  }
+  frame->timestamp_ns = NowNs();
+  frame->system_timestamp_ns = SystemNowNs();
+  frame->sequence = num_frames_received_++;
+  frame->dropped_frames = 0;
+  frame->flags = 0;
+  return frame;
+}
+
+size_t RtpDepacketizer::GetRawSize() const {
+  size_t group_pixels = 0;
+  size_t group_bytes = 0;
+  GetPixelGroup(format_, &group_pixels, &group_bytes);
+  return static_cast<size_t>(width_) / group_pixels * group_bytes *
+         static_cast<size_t>(height_);
+}
+
+bool RtpDepacketizer::PushJpeg(const uint8_t* payload, size_t size,
+                               bool first) {
+  if (size < kJpegHeaderSize) {
+    return false;
+  }
+  const uint32_t offset = static_cast<uint32_t>(payload[1]) << 16 |
+                          ReadU16(payload + 2);
+  const uint8_t type = payload[4];
+  const uint8_t quality = payload[5];
+  const int width = payload[6] * 8;
+  const int height = payload[7] * 8;
+  const uint8_t* p = payload + kJpegHeaderSize;
+  const uint8_t* end = payload + size;
+  uint16_t restart_interval = 0;
+  if (type >= 64 && type < 128) {
+    if (end - p < static_cast<ptrdiff_t>(kJpegRestartHeaderSize)) {
+      return false;
+    }
+    restart_interval = ReadU16(p);
+    p += kJpegRestartHeaderSize;
+  }
+  if ((type & 0x3F) > 1 || quality < 128) {
+    // tables derived from a quality factor are not supported
+    AWARN_F("unsupported RTP JPEG type {} quality {}", type, quality);
+    return false;
+  }
+
+  // 1. the first fragment has the tables, headers are rebuilt from them
+  if (offset == 0) {
+    if (!first) {
+      return false;
+    }
+    if (end - p < static_cast<ptrdiff_t>(kJpegTableHeaderSize)) {
+      return false;
+    }
+    const uint8_t precision = p[1];
+    const size_t tables_size = ReadU16(p + 2);
+    p += kJpegTableHeaderSize;
+    if (tables_size < 64 || end - p < static_cast<ptrdiff_t>(tables_size)) {
+      return false;
+    }
+    if (!StartFrame(StreamPixelFormat::PIXEL_FORMAT_MJPEG, width, height)) {
+      return false;
+    }
+    header_size_ = WriteJpegHeaders(frame_->GetData(), frame_->planes[0].size,
+                                    type, width, height, p, precision,
+                                    tables_size, restart_interval);
+    if (header_size_ == 0) {
+      AWARN_F("cannot rebuild the headers of a {}x{} RTP JPEG", width,
+              height);
+      return false;
+    }
+    p += tables_size;
+  }
+  if (frame_ == nullptr || offset != received_) {
+    return false;
+  }
+
+  // 2. the scan, leaving room for EOI
+  const size_t n = static_cast<size_t>(end - p);
+  if (header_size_ + received_ + n + 2 > frame_->planes[0].size) {
+    return false;
+  }
+  memcpy(frame_->GetData() + header_size_ + received_, p, n);
+  received_ += n;
+  return true;
+}
+
+bool RtpDepacketizer::PushRaw(const uint8_t* payload, size_t size,
+                              bool first) {
+  if (first && !StartFrame(format_, width_, height_)) {
+    return false;
+  }
+  if (frame_ == nullptr || size < kRawHeaderSize) {
+    return false;
+  }
+  size_t group_pixels = 0;
+  size_t group_bytes = 0;
+  GetPixelGroup(format_, &group_pixels, &group_bytes);
+
+  // 1. line headers, then the segments in the same order
+  const uint8_t* headers = payload + kRawHeaderSize;
+  const uint8_t* end = payload + size;
+  size_t num_segments = 0;
+  while (true) {
+    const uint8_t* header = headers + num_segments * kRawLineHeaderSize;
+    if (end - header < static_cast<ptrdiff_t>(kRawLineHeaderSize)) {
+      return false;
+    }
+    ++num_segments;
+    if (!(header[4] & 0x80)) {
+      break;
+    }
+  }
+  const uint8_t* data = headers + num_segments * kRawLineHeaderSize;
+  const size_t stride = static_cast<size_t>(frame_->GetStride());
+  for (size_t i = 0; i < num_segments; ++i) {
+    const uint8_t* header = headers + i * kRawLineHeaderSize;
+    const size_t length = ReadU16(header);
+    const size_t line = ReadU16(header + 2) & 0x7FFF;
+    const size_t pixel = ReadU16(header + 4) & 0x7FFF;
+    const size_t offset = pixel / group_pixels * group_bytes;
+    if (static_cast<size_t>(end - data) < length ||
+        line >= static_cast<size_t>(height_) ||
+        offset + length > stride) {
+      return false;
+    }
+    uint8_t* dst = frame_->GetData() + line * stride + offset;
+    if (format_ == StreamPixelFormat::PIXEL_FORMAT_YUYV) {
+      SwapBytePairs(data, dst, length);
+    } else {
+      memcpy(dst, data, length);
+    }
+    data += length;
+    received_ += length;
+  }
+  return true;
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,588 @@
+#include "zetton_stream/util/shm_frame_ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+constexpr uint32_t kShmRingMagic = 0x5a534652;  // "ZSFR"
+constexpr uint32_t kShmRingVersion = 1;
+// bit of the slot masks held by the writer
+constexpr uint64_t kWriterBit = 1ULL << 63;
+// reader entry of a dead process being cleaned up
+constexpr uint32_t kReclaimingPid = 0xffffffff;
+constexpr size_t kPageSize = 4096;
+// longest sleep of a waiting reader before it checks the writer is alive
+constexpr int kWriterCheckMs = 100;
+
+static_assert(kShmMaxReaders < 63, "one bit per reader and the writer bit");
+static_assert(kShmMaxSlots <= 256, "slot index is packed in 8 bits");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "atomics in shared memory must be lock free");
+
+size_t RoundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+std::string ShmPath(const std::string& name) {
+  return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+bool IsAlive(uint32_t pid) {
+  if (pid == 0 ||
+      (kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH)) {
+    return false;
+  }
+  // a zombie, e.g. a reader forked by the writer that was not reaped yet,
+  // still answers signals but holds nothing anymore
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return true;
+  }
+  char state = 0;
+  // the state follows the command name, which is in parentheses
+  const bool parsed = fscanf(file, "%*d (%*[^)]) %c", &state) == 1;
+  fclose(file);
+  return !parsed || state != 'Z';
+}
+
+long Futex(std::atomic<uint32_t>* word, int op, uint32_t value,  // NOLINT
+           const struct timespec* timeout) {
+  // the mapping is shared between processes, so no FUTEX_PRIVATE_FLAG
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value,
+                 timeout, nullptr, 0);
+}
+
+uint64_t NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+}  // namespace
+
+struct ShmFrameRing::Header {
+  // written last by the creator, the ring is ready once it is set
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t num_slots;
+  uint32_t reserved;
+  uint64_t slot_size;
+  uint64_t slot_stride;
+  uint64_t slots_offset;
+  uint64_t data_offset;
+  uint64_t total_size;
+
+  std::atomic<uint32_t> writer_pid;
+  std::atomic<uint32_t> closed;
+  // number << 8 | slot of the latest published frame
+  std::atomic<uint64_t> latest;
+
+  // bumped for every frame, readers sleep on it
+  alignas(64) std::atomic<uint32_t> futex;
+  std::atomic<uint32_t> waiters;
+
+  alignas(64) std::atomic<uint32_t> reader_pids[kShmMaxReaders];
+};
+
+struct alignas(64) ShmFrameRing::Slot {
+  // one bit per reader holding the slot, kWriterBit while it is written
+  std::atomic<uint64_t> readers;
+  // number of the frame in the slot, 0 if empty or being written
+  std::atomic<uint64_t> number;
+  ShmFrameInfo info;
+};
+
+void GetShmFrameInfo(const Frame& frame, const uint8_t* slot_data,
+                     ShmFrameInfo* info) {
+  info->pixel_format = static_cast<int32_t>(frame.pixel_format);
+  info->width = frame.width;
+  info->height = frame.height;
+  info->num_planes = frame.num_planes;
+  for (int i = 0; i < kMaxFramePlanes; ++i) {
+    const bool used = i < frame.num_planes;
+    info->plane_offset[i] =
+        used ? static_cast<uint64_t>(frame.planes[i].data - slot_data) : 0;
+    info->plane_size[i] = used ? frame.planes[i].size : 0;
+    info->plane_stride[i] = used ? frame.planes[i].stride : 0;
+  }
+  info->timestamp_ns = frame.timestamp_ns;
+  info->system_timestamp_ns = frame.system_timestamp_ns;
+  info->sequence = frame.sequence;
+  info->dropped_frames = frame.dropped_frames;
+  info->flags = frame.flags;
+  info->bytes_used = frame.bytes_used;
+}
+
+bool SetShmFrameInfo(const ShmFrameInfo& info, uint8_t* slot_data,
+                     size_t slot_size, Frame* frame) {
+  // the writer is trusted with the layout, but not with the bounds
+  if (info.num_planes <= 0 || info.num_planes > kMaxFramePlanes ||
+      info.pixel_format <= 0 ||
+      info.pixel_format >=
+          static_cast<int32_t>(StreamPixelFormat::PIXEL_FORMAT_MAX_NUM)) {
+    return false;
+  }
+  for (int i = 0; i < info.num_planes; ++i) {
+    if (info.plane_offset[i] > slot_size ||
+        info.plane_size[i] > slot_size - info.plane_offset[i]) {
+      return false;
+    }
+  }
+
+  frame->pixel_format = static_cast<StreamPixelFormat>(info.pixel_format);
+  frame->width = info.width;
+  frame->height = info.height;
+  frame->num_planes = info.num_planes;
+  frame->planes.fill(FramePlane());
+  for (int i = 0; i < info.num_planes; ++i) {
+    frame->planes[i].data = slot_data + info.plane_offset[i];
+    frame->planes[i].size = info.plane_size[i];
+    frame->planes[i].stride = info.plane_stride[i];
+  }
+  frame->timestamp_ns = info.timestamp_ns;
+  frame->system_timestamp_ns = info.system_timestamp_ns;
+  frame->sequence = info.sequence;
+  frame->dropped_frames = info.dropped_frames;
+  frame->flags = info.flags;
+  frame->bytes_used = info.bytes_used;
+  return true;
+}
+
+std::shared_ptr<ShmFrameRing> ShmFrameRing::Create(const std::string& name,
+                                                   int num_slots,
+                                                   size_t slot_size) {
+  if (num_slots <= 0 || num_slots > kShmMaxSlots || slot_size == 0) {
+    AERROR_F("invalid shared memory ring {} of {} slots of {} bytes", name,
+             num_slots, slot_size);
+    return nullptr;
+  }
+
+  // 1. layout: header, slot headers, then the page-aligned data of the slots
+  const std::string path = ShmPath(name);
+  const size_t slots_offset = RoundUp(sizeof(Header), 64);
+  const size_t data_offset =
+      RoundUp(slots_offset + sizeof(Slot) * num_slots, kPageSize);
+  const size_t slot_stride = RoundUp(slot_size, kPageSize);
+  const size_t total_size = data_offset + slot_stride * num_slots;
+
+  std::shared_ptr<ShmFrameRing> ring(new ShmFrameRing());
+  ring->name_ = name;
+  ring->writer_ = true;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    // 2. a new ring, zero-filled by ftruncate
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0666);
+    if (fd >= 0) {
+      if (ftruncate(fd, static_cast<off_t>(total_size)) != 0 ||
+          !ring->Map(fd, total_size)) {
+        AERROR_F("cannot allocate shared memory {} of {} bytes: code {}, "
+                 "string [{}]",
+                 path, total_size, errno, strerror(errno));
+        close(fd);
+        shm_unlink(path.c_str());
+        return nullptr;
+      }
+      close(fd);
+      Header* header = ring->header_;
+      header->version = kShmRingVersion;
+      header->num_slots = static_cast<uint32_t>(num_slots);
+      header->slot_size = slot_size;
+      header->slot_stride = slot_stride;
+      header->slots_offset = slots_offset;
+      header->data_offset = data_offset;
+      header->total_size = total_size;
+      header->writer_pid.store(static_cast<uint32_t>(getpid()));
+      header->magic.store(kShmRingMagic, std::memory_order_release);
+      ring->SetLayout();
+      AINFO_F("created shared memory ring {} of {} slots of {} bytes", path,
+              num_slots, slot_size);
+      return ring;
+    }
+    if (errno != EEXIST) {
+      AERROR_F("cannot create shared memory {}: code {}, string [{}]", path,
+               errno, strerror(errno));
+      return nullptr;
+    }
+
+    // 3. the ring of a previous writer
+    fd = shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+      continue;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+        ring->Map(fd, static_cast<size_t>(st.st_size))) {
+      Header* header = ring->header_;
+      const bool same_layout =
+          header->magic.load(std::memory_order_acquire) == kShmRingMagic &&
+          header->version == kShmRingVersion &&
+          header->num_slots == static_cast<uint32_t>(num_slots) &&
+          header->slot_size == slot_size && header->total_size == total_size &&
+          static_cast<size_t>(st.st_size) == total_size;
+      const uint32_t pid = header->writer_pid.load();
+      if (same_layout && !header->closed.load() &&
+          pid != static_cast<uint32_t>(getpid()) && IsAlive(pid)) {
+        AERROR_F("shared memory {} is written by process {}", path, pid);
+        close(fd);
+        // not ours, so not closed nor unlinked on destruction
+        ring->Unmap();
+        return nullptr;
+      }
+      if (same_layout) {
+        // 3.1. take over, frames the dead writer was writing are dropped and
+        // readers keep their slots
+        close(fd);
+        ring->SetLayout();
+        for (int i = 0; i < num_slots; ++i) {
+          Slot& slot = ring->slots_[i];
+          if (slot.readers.load() & kWriterBit) {
+            slot.number.store(0);
+            slot.readers.fetch_and(~kWriterBit);
+          }
+        }
+        header->writer_pid.store(static_cast<uint32_t>(getpid()));
+        header->closed.store(0);
+        AINFO_F("took over shared memory ring {} of process {}", path, pid);
+        return ring;
+      }
+
+      // 3.2. another layout, readers of the old ring have to reattach
+      header->closed.store(1);
+      ring->WakeReaders();
+      ring->Unmap();
+    }
+    close(fd);
+    shm_unlink(path.c_str());
+  }
+
+  AERROR_F("cannot create shared memory {}", path);
+  return nullptr;
+}
+
+std::shared_ptr<ShmFrameRing> ShmFrameRing::Open(const std::string& name) {
+  // 1. map the ring of a writer
+  const std::string path = ShmPath(name);
+  const int fd = shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    ADEBUG_F("cannot open shared memory {}: code {}, string [{}]", path, errno,
+             strerror(errno));
+    return nullptr;
+  }
+  std::shared_ptr<ShmFrameRing> ring(new ShmFrameRing());
+  ring->name_ = name;
+  struct stat st;
+  const bool mapped =
+      fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+      ring->Map(fd, static_cast<size_t>(st.st_size));
+  close(fd);
+  if (!mapped) {
+    return nullptr;
+  }
+
+  // 2. check it is complete and still written
+  Header* header = ring->header_;
+  if (header->magic.load(std::memory_order_acquire) != kShmRingMagic ||
+      header->version != kShmRingVersion ||
+      header->total_size > static_cast<size_t>(st.st_size) ||
+      header->num_slots == 0 ||
+      header->num_slots > static_cast<uint32_t>(kShmMaxSlots)) {
+    ADEBUG_F("shared memory {} is not a frame ring (yet)", path);
+    return nullptr;
+  }
+  ring->SetLayout();
+  if (ring->IsWriterGone()) {
+    ADEBUG_F("writer of shared memory {} is gone", path);
+    return nullptr;
+  }
+
+  // 3. take a reader entry
+  if (!ring->Register()) {
+    AERROR_F("shared memory {} has too many readers", path);
+    return nullptr;
+  }
+  AINFO_F("attached to shared memory ring {} as reader {}", path,
+          ring->reader_index_);
+  return ring;
+}
+
+ShmFrameRing::~ShmFrameRing() {
+  if (header_ != nullptr) {
+    if (writer_) {
+      // readers see the ring closed and reattach to the next one
+      header_->closed.store(1);
+      WakeReaders();
+      shm_unlink(ShmPath(name_).c_str());
+    } else {
+      Unregister();
+    }
+  }
+  Unmap();
+}
+
+bool ShmFrameRing::Map(int fd, size_t size) {
+  void* memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  memory_ = memory;
+  memory_size_ = size;
+  header_ = static_cast<Header*>(memory);
+  return true;
+}
+
+void ShmFrameRing::SetLayout() {
+  auto* base = static_cast<uint8_t*>(memory_);
+  num_slots_ = static_cast<int>(header_->num_slots);
+  slot_size_ = header_->slot_size;
+  slot_stride_ = header_->slot_stride;
+  slots_ = reinterpret_cast<Slot*>(base + header_->slots_offset);
+  data_ = base + header_->data_offset;
+}
+
+void ShmFrameRing::Unmap() {
+  if (memory_ != nullptr) {
+    munmap(memory_, memory_size_);
+  }
+  memory_ = nullptr;
+  memory_size_ = 0;
+  header_ = nullptr;
+  slots_ = nullptr;
+  data_ = nullptr;
+}
+
+bool ShmFrameRing::Register() {
+  const auto pid = static_cast<uint32_t>(getpid());
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    for (int i = 0; i < kShmMaxReaders; ++i) {
+      uint32_t expected = 0;
+      if (header_->reader_pids[i].compare_exchange_strong(expected, pid)) {
+        reader_index_ = i;
+        return true;
+      }
+    }
+    if (ReclaimDeadReaders() == 0) {
+      break;
+    }
+  }
+  return false;
+}
+
+void ShmFrameRing::Unregister() {
+  if (reader_index_ < 0) {
+    return;
+  }
+  const uint64_t bit = 1ULL << reader_index_;
+  for (int i = 0; i < num_slots_; ++i) {
+    slots_[i].readers.fetch_and(~bit, std::memory_order_release);
+  }
+  header_->reader_pids[reader_index_].store(0);
+  reader_index_ = -1;
+}
+
+int ShmFrameRing::ReclaimDeadReaders() {
+  int reclaimed = 0;
+  for (int i = 0; i < kShmMaxReaders; ++i) {
+    uint32_t pid = header_->reader_pids[i].load();
+    if (pid == 0 || pid == kReclaimingPid || IsAlive(pid)) {
+      continue;
+    }
+    // only one process cleans up an entry, and nobody takes it meanwhile
+    if (!header_->reader_pids[i].compare_exchange_strong(pid,
+                                                         kReclaimingPid)) {
+      continue;
+    }
+    const uint64_t bit = 1ULL << i;
+    for (int j = 0; j < num_slots_; ++j) {
+      slots_[j].readers.fetch_and(~bit, std::memory_order_release);
+    }
+    header_->reader_pids[i].store(0);
+    AWARN_F("reclaimed slots of dead reader process {} of {}", pid,
+            ShmPath(name_));
+    ++reclaimed;
+  }
+  return reclaimed;
+}
+
+int ShmFrameRing::ClaimSlot() {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    while (true) {
+      // 1. the free slot with the oldest frame, empty slots first
+      int best = -1;
+      uint64_t best_number = UINT64_MAX;
+      for (int i = 0; i < num_slots_; ++i) {
+        if (slots_[i].readers.load(std::memory_order_acquire) == 0) {
+          const uint64_t number =
+              slots_[i].number.load(std::memory_order_relaxed);
+          if (number < best_number) {
+            best = i;
+            best_number = number;
+          }
+        }
+      }
+      if (best < 0) {
+        break;
+      }
+
+      // 2. claim it unless a reader came first
+      uint64_t expected = 0;
+      if (slots_[best].readers.compare_exchange_strong(
+              expected, kWriterBit, std::memory_order_acq_rel)) {
+        slots_[best].number.store(0, std::memory_order_relaxed);
+        return best;
+      }
+    }
+    // 3. all slots held, maybe by readers that died
+    if (ReclaimDeadReaders() == 0) {
+      break;
+    }
+  }
+  return -1;
+}
+
+void ShmFrameRing::Publish(int slot, const ShmFrameInfo& info) {
+  Slot& s = slots_[slot];
+  s.info = info;
+  const uint64_t number =
+      (header_->latest.load(std::memory_order_relaxed) >> 8) + 1;
+  s.number.store(number, std::memory_order_release);
+  s.readers.fetch_and(~kWriterBit, std::memory_order_release);
+  header_->latest.store(number << 8 | static_cast<uint64_t>(slot));
+  WakeReaders();
+}
+
+void ShmFrameRing::Abort(int slot) {
+  slots_[slot].readers.fetch_and(~kWriterBit, std::memory_order_release);
+}
+
+void ShmFrameRing::WakeReaders() {
+  header_->futex.fetch_add(1);
+  if (header_->waiters.load() > 0) {
+    Futex(&header_->futex, FUTEX_WAKE, INT_MAX, nullptr);
+  }
+}
+
+int ShmFrameRing::Acquire(uint64_t after, bool next, uint64_t* number,
+                          ShmFrameInfo* info) {
+  const uint64_t bit = 1ULL << reader_index_;
+  // hold a slot if it still has the expected frame
+  auto hold = [&](int slot, uint64_t expected) {
+    Slot& s = slots_[slot];
+    const uint64_t previous =
+        s.readers.fetch_or(bit, std::memory_order_acq_rel);
+    if ((previous & kWriterBit) ||
+        s.number.load(std::memory_order_acquire) != expected) {
+      s.readers.fetch_and(~bit, std::memory_order_release);
+      return false;
+    }
+    *info = s.info;
+    *number = expected;
+    return true;
+  };
+
+  // 1. the oldest frame after the given one that is still in the ring
+  if (next) {
+    for (int attempt = 0; attempt < num_slots_; ++attempt) {
+      int oldest = -1;
+      uint64_t oldest_number = UINT64_MAX;
+      for (int i = 0; i < num_slots_; ++i) {
+        const uint64_t n = slots_[i].number.load(std::memory_order_acquire);
+        if (n > after && n < oldest_number) {
+          oldest = i;
+          oldest_number = n;
+        }
+      }
+      if (oldest < 0) {
+        return -1;
+      }
+      if (hold(oldest, oldest_number)) {
+        return oldest;
+      }
+    }
+  }
+
+  // 2. the latest frame, looked up again if it was overwritten meanwhile
+  for (int attempt = 0; attempt < num_slots_ + 1; ++attempt) {
+    const uint64_t latest = header_->latest.load();
+    const uint64_t latest_number = latest >> 8;
+    if (latest_number <= after) {
+      return -1;
+    }
+    const int slot = static_cast<int>(latest & 0xff);
+    if (hold(slot, latest_number)) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void ShmFrameRing::Release(int slot) {
+  slots_[slot].readers.fetch_and(~(1ULL << reader_index_),
+                                 std::memory_order_release);
+}
+
+bool ShmFrameRing::Wait(uint64_t after, int timeout_ms) {
+  // a negative timeout waits forever
+  const uint64_t deadline = timeout_ms < 0
+                                ? UINT64_MAX
+                                : NowMs() + static_cast<uint64_t>(timeout_ms);
+  while (true) {
+    if (GetLatestNumber() > after) {
+      return true;
+    }
+    if (IsWriterGone()) {
+      return false;
+    }
+    const uint64_t now = NowMs();
+    if (now >= deadline) {
+      return false;
+    }
+
+    // the futex is read before the frame number is checked again, so a frame
+    // published in between makes the wait return at once
+    const uint32_t value = header_->futex.load();
+    header_->waiters.fetch_add(1);
+    if (GetLatestNumber() <= after) {
+      const uint64_t sleep_ms =
+          std::min<uint64_t>(deadline - now, kWriterCheckMs);
+      struct timespec timeout;
+      timeout.tv_sec = static_cast<time_t>(sleep_ms / 1000);
+      timeout.tv_nsec = static_cast<long>(sleep_ms % 1000) * 1000000;  // NOLINT
+      Futex(&header_->futex, FUTEX_WAIT, value, &timeout);
+    }
+    header_->waiters.fetch_sub(1);
+  }
+}
+
+uint64_t ShmFrameRing::GetLatestNumber() const {
+  return header_->latest.load() >> 8;
+}
+
+bool ShmFrameRing::IsWriterGone() const {
+  return header_->closed.load() != 0 || !IsAlive(header_->writer_pid.load());
+}
+
+}  // namespace stream
+}  // namespace zetton
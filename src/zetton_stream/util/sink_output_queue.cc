@@ -0,0 +1,134 @@
+#include "zetton_stream/util/sink_output_queue.h"
+
+#include <algorithm>
+
+#include "zetton_common/log/log.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+namespace zetton {
+namespace stream {
+
+SinkOutputQueue::~SinkOutputQueue() { Stop(); }
+
+bool SinkOutputQueue::Start(BaseStreamSink* output,
+                            const SinkOutputOptions& options) {
+  if (output == nullptr || options.queue_size <= 0) {
+    AERROR_F("invalid sink output queue of {} frames", options.queue_size);
+    return false;
+  }
+  if (thread_.joinable()) {
+    AWARN_F("sink output queue is already running");
+    return true;
+  }
+
+  output_ = output;
+  options_ = options;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    running_ = true;
+  }
+  thread_ = std::thread(&SinkOutputQueue::Run, this);
+  return true;
+}
+
+void SinkOutputQueue::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  room_cond_.notify_all();
+  thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = false;
+}
+
+bool SinkOutputQueue::Push(const FramePtr& frame) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (stop_ || !running_) {
+    return false;
+  }
+
+  // 1. make room following the policy
+  const size_t queue_size = static_cast<size_t>(options_.queue_size);
+  if (queue_.size() >= queue_size) {
+    switch (options_.backpressure) {
+      case StreamBackpressure::BACKPRESSURE_DROP_NEWEST:
+        ++statistics_.frames_dropped;
+        return false;
+      case StreamBackpressure::BACKPRESSURE_DROP_OLDEST:
+        while (queue_.size() >= queue_size) {
+          queue_.pop_front();
+          ++statistics_.frames_dropped;
+        }
+        break;
+      case StreamBackpressure::BACKPRESSURE_BLOCK:
+      default:
+        room_cond_.wait(lock,
+                        [&] { return stop_ || queue_.size() < queue_size; });
+        if (stop_) {
+          return false;
+        }
+        break;
+    }
+  }
+
+  // 2. hand the frame to the worker
+  queue_.push_back(frame);
+  ++statistics_.frames_queued;
+  statistics_.max_queue_depth = std::max(
+      statistics_.max_queue_depth, static_cast<int>(queue_.size()));
+  lock.unlock();
+  cond_.notify_one();
+  return true;
+}
+
+void SinkOutputQueue::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  room_cond_.wait(lock, [&] {
+    return (queue_.empty() && !rendering_) || stop_;
+  });
+}
+
+SinkOutputStatistics SinkOutputQueue::GetStatistics() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+void SinkOutputQueue::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    // queued frames are still rendered on stop
+    if (queue_.empty()) {
+      break;
+    }
+    FramePtr frame = std::move(queue_.front());
+    queue_.pop_front();
+    rendering_ = true;
+    lock.unlock();
+    room_cond_.notify_all();
+
+    const bool rendered = output_->Render(frame);
+    // the last reference may give the frame back to its pool
+    frame.reset();
+
+    lock.lock();
+    rendering_ = false;
+    if (rendered) {
+      ++statistics_.frames_rendered;
+    } else {
+      ++statistics_.frames_failed;
+    }
+    if (queue_.empty()) {
+      room_cond_.notify_all();
+    }
+  }
+}
+
+}  // namespace stream
+}  // namespace zetton
@@ -0,0 +1,234 @@
+#include "zetton_stream/util/v4l2_controls.h"
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// same naming scheme as v4l2-ctl: lower case, non-alphanumeric runs
+// replaced by a single underscore
+std::string ToControlName(const char* name) {
+  std::string result;
+  for (const char* p = name; *p != '\0'; ++p) {
+    if (std::isalnum(static_cast<unsigned char>(*p))) {
+      result += static_cast<char>(std::tolower(static_cast<unsigned char>(*p)));
+    } else if (!result.empty() && result.back() != '_') {
+      result += '_';
+    }
+  }
+  while (!result.empty() && result.back() == '_') result.pop_back();
+  return result;
+}
+
+}  // namespace
+
+bool V4l2Controls::Enumerate(cv4l_fd* fd) {
+  controls_.clear();
+
+  v4l2_query_ext_ctrl qec;
+  memset(&qec, 0, sizeof(qec));
+  while (fd->query_ext_ctrl(qec, true) == 0) {
+    if (!(qec.flags & V4L2_CTRL_FLAG_DISABLED) &&
+        qec.type != V4L2_CTRL_TYPE_CTRL_CLASS &&
+        !(qec.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD)) {
+      V4l2ControlInfo info;
+      info.id = qec.id;
+      info.type = qec.type;
+      info.flags = qec.flags;
+      info.name = ToControlName(qec.name);
+      info.minimum = qec.minimum;
+      info.maximum = qec.maximum;
+      info.step = qec.step;
+      info.default_value = qec.default_value;
+      controls_.push_back(info);
+    }
+  }
+
+  std::sort(controls_.begin(), controls_.end(),
+            [](const V4l2ControlInfo& a, const V4l2ControlInfo& b) {
+              return a.id < b.id;
+            });
+  ADEBUG_F("found {} controls", controls_.size());
+  return !controls_.empty();
+}
+
+const V4l2ControlInfo* V4l2Controls::Find(uint32_t id) const {
+  auto it = std::lower_bound(
+      controls_.begin(), controls_.end(), id,
+      [](const V4l2ControlInfo& info, uint32_t id) { return info.id < id; });
+  if (it == controls_.end() || it->id != id) return nullptr;
+  return &(*it);
+}
+
+const V4l2ControlInfo* V4l2Controls::Find(const std::string& name) const {
+  for (const auto& info : controls_) {
+    if (info.name == name) return &info;
+  }
+  return nullptr;
+}
+
+bool V4l2Controls::GetControl(cv4l_fd* fd, uint32_t id, int64_t* value) const {
+  const auto* info = Find(id);
+  if (info == nullptr) {
+    AERROR_F("control 0x{:x} is not supported", id);
+    return false;
+  }
+
+  v4l2_ext_control control;
+  memset(&control, 0, sizeof(control));
+  control.id = id;
+  v4l2_ext_controls controls;
+  memset(&controls, 0, sizeof(controls));
+  controls.which = V4L2_CTRL_WHICH_CUR_VAL;
+  controls.count = 1;
+  controls.controls = &control;
+  if (fd->g_ext_ctrls(controls) != 0) {
+    AERROR_F("cannot get control {}: code {}, string [{}]", info->name, errno,
+             strerror(errno));
+    return false;
+  }
+
+  *value = info->type == V4L2_CTRL_TYPE_INTEGER64 ? control.value64
+                                                  : control.value;
+  return true;
+}
+
+bool V4l2Controls::SetControl(cv4l_fd* fd, uint32_t id, int64_t value) const {
+  return SetControls(fd, {{id, value}});
+}
+
+bool V4l2Controls::SetControls(cv4l_fd* fd,
+                               const V4l2ControlValues& values) const {
+  // 1. build the control list
+  std::vector<v4l2_ext_control> list;
+  list.reserve(values.size());
+  for (const auto& value : values) {
+    const auto* info = Find(value.first);
+    if (info == nullptr) {
+      ADEBUG_F("control 0x{:x} is not supported, skipped", value.first);
+      continue;
+    }
+    if (info->flags & V4L2_CTRL_FLAG_READ_ONLY) {
+      AWARN_F("control {} is read-only, skipped", info->name);
+      continue;
+    }
+
+    v4l2_ext_control control;
+    memset(&control, 0, sizeof(control));
+    control.id = info->id;
+    const int64_t clamped =
+        std::min(std::max(value.second, info->minimum), info->maximum);
+    if (clamped != value.second) {
+      AWARN_F("value {} of control {} clamped to [{}, {}]", value.second,
+              info->name, info->minimum, info->maximum);
+    }
+    if (info->type == V4L2_CTRL_TYPE_INTEGER64) {
+      control.value64 = clamped;
+    } else {
+      control.value = static_cast<int32_t>(clamped);
+    }
+    list.push_back(control);
+  }
+  if (list.empty()) {
+    return true;
+  }
+
+  // 2. set all controls at once
+  v4l2_ext_controls controls;
+  memset(&controls, 0, sizeof(controls));
+  controls.which = V4L2_CTRL_WHICH_CUR_VAL;
+  controls.count = list.size();
+  controls.controls = list.data();
+  if (fd->s_ext_ctrls(controls) == 0) {
+    return true;
+  }
+
+  // 3. fall back to one by one so that a single rejected control does not
+  // discard the others
+  AWARN_F("cannot set {} controls at once (failed at index {}): code {}, "
+          "string [{}]",
+          list.size(), controls.error_idx, errno, strerror(errno));
+  bool result = true;
+  for (auto& control : list) {
+    controls.count = 1;
+    controls.controls = &control;
+    if (fd->s_ext_ctrls(controls) != 0) {
+      const auto* info = Find(control.id);
+      AERROR_F("cannot set control {}: code {}, string [{}]", info->name,
+               errno, strerror(errno));
+      result = false;
+    }
+  }
+  return result;
+}
+
+bool V4l2Controls::Apply(cv4l_fd* fd,
+                         const CameraSourceOptions& options) const {
+  return SetControls(fd, ToControlValues(options));
+}
+
+V4l2ControlValues V4l2Controls::ToControlValues(
+    const CameraSourceOptions& options) {
+  V4l2ControlValues values;
+
+  if (options.brightness >= 0) {
+    values.emplace_back(V4L2_CID_BRIGHTNESS, options.brightness);
+  }
+  if (options.contrast >= 0) {
+    values.emplace_back(V4L2_CID_CONTRAST, options.contrast);
+  }
+  if (options.saturation >= 0) {
+    values.emplace_back(V4L2_CID_SATURATION, options.saturation);
+  }
+  if (options.sharpness >= 0) {
+    values.emplace_back(V4L2_CID_SHARPNESS, options.sharpness);
+  }
+  if (options.gain >= 0) {
+    values.emplace_back(V4L2_CID_GAIN, options.gain);
+  }
+
+  // check auto white balance, the auto control goes first so that the manual
+  // value is accepted in the same batch
+  if (options.auto_white_balance) {
+    values.emplace_back(V4L2_CID_AUTO_WHITE_BALANCE, 1);
+  } else {
+    values.emplace_back(V4L2_CID_AUTO_WHITE_BALANCE, 0);
+    if (options.white_balance >= 0) {
+      values.emplace_back(V4L2_CID_WHITE_BALANCE_TEMPERATURE,
+                          options.white_balance);
+    }
+  }
+
+  // check auto exposure
+  if (!options.auto_exposure) {
+    // turn down exposure control (from max of 3)
+    values.emplace_back(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL);
+    // change the exposure level
+    if (options.exposure >= 0) {
+      values.emplace_back(V4L2_CID_EXPOSURE_ABSOLUTE, options.exposure);
+    }
+  }
+
+  // check auto focus
+  if (options.auto_focus) {
+    values.emplace_back(V4L2_CID_FOCUS_AUTO, 1);
+  } else {
+    values.emplace_back(V4L2_CID_FOCUS_AUTO, 0);
+    if (options.focus >= 0) {
+      values.emplace_back(V4L2_CID_FOCUS_ABSOLUTE, options.focus);
+    }
+  }
+
+  return values;
+}
+
+}  // namespace stream
+}  // namespace zetton
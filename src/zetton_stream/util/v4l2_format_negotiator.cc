@@ -0,0 +1,337 @@
+#include "zetton_stream/util/v4l2_format_negotiator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#include "zetton_common/log/log.h"
+
+namespace zetton {
+namespace stream {
+
+namespace {
+
+// cached results of previous negotiations, keyed by device and request
+std::mutex& CacheMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::map<std::string, V4l2Mode>& Cache() {
+  static std::map<std::string, V4l2Mode> cache;
+  return cache;
+}
+
+std::string FourccToStr(uint32_t fourcc) {
+  std::string result;
+  for (int i = 0; i < 4; ++i) {
+    const char c = static_cast<char>((fourcc >> (8 * i)) & 0xff);
+    result += c == ' ' || c == '\0' ? '_' : c;
+  }
+  return result;
+}
+
+std::string CacheKey(cv4l_fd* fd, const StreamOptions& options,
+                     const std::vector<uint32_t>& pixel_formats) {
+  v4l2_capability cap;
+  fd->querycap(cap);
+  std::string key = options.resource.location;
+  key += '|';
+  key += reinterpret_cast<const char*>(cap.driver);
+  key += '|';
+  key += reinterpret_cast<const char*>(cap.card);
+  key += '|';
+  key += reinterpret_cast<const char*>(cap.bus_info);
+  key += '|' + std::to_string(options.width) + 'x' +
+         std::to_string(options.height) + '@' +
+         std::to_string(options.frame_rate) + '|' +
+         StreamNegotiationGoalToStr(options.negotiation_goal);
+  for (const auto pixel_format : pixel_formats) {
+    key += '|' + FourccToStr(pixel_format);
+  }
+  return key;
+}
+
+// bytes per pixel on the wire, MJPEG is a rough estimate of its compression
+double BytesPerPixel(uint32_t pixel_format) {
+  switch (pixel_format) {
+    case V4L2_PIX_FMT_GREY:
+      return 1.0;
+    case V4L2_PIX_FMT_RGB24:
+      return 3.0;
+    case V4L2_PIX_FMT_MJPEG:
+      return 0.3;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+      return 1.5;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    default:
+      return 2.0;
+  }
+}
+
+// relative cpu cost per pixel of turning a frame into the output format
+double DecodeCostPerPixel(uint32_t pixel_format) {
+  switch (pixel_format) {
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_RGB24:
+      return 1.0;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_NV16M:
+      return 2.0;
+    case V4L2_PIX_FMT_UYVY:
+      return 3.0;
+    case V4L2_PIX_FMT_MJPEG:
+    default:
+      return 10.0;
+  }
+}
+
+double ToSeconds(const v4l2_fract& fract) {
+  return fract.denominator > 0
+             ? static_cast<double>(fract.numerator) / fract.denominator
+             : 0.0;
+}
+
+// closest value to the request within a stepwise range, the maximum if
+// nothing was requested
+uint32_t ClampToStep(uint32_t value, uint32_t min, uint32_t max,
+                     uint32_t step) {
+  if (value == 0) {
+    return max;
+  }
+  value = std::min(std::max(value, min), max);
+  if (step > 1) {
+    value = min + (value - min + step / 2) / step * step;
+    if (value > max) value -= step;
+  }
+  return value;
+}
+
+}  // namespace
+
+std::string V4l2ModeToStr(const V4l2Mode& mode) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%s %ux%u@%.2f",
+           FourccToStr(mode.pixel_format).c_str(), mode.width, mode.height,
+           mode.FrameRate());
+  return buffer;
+}
+
+bool V4l2FormatNegotiator::Enumerate(
+    cv4l_fd* fd, const StreamOptions& options,
+    const std::vector<uint32_t>& pixel_formats) {
+  modes_.clear();
+
+  v4l2_fmtdesc fmtdesc;
+  for (int r = fd->enum_fmt(fmtdesc, true); r == 0; r = fd->enum_fmt(fmtdesc)) {
+    const uint32_t pixel_format = fmtdesc.pixelformat;
+    if (std::find(pixel_formats.begin(), pixel_formats.end(), pixel_format) ==
+        pixel_formats.end()) {
+      ADEBUG_F("pixel format {} is not supported, skipped",
+               FourccToStr(pixel_format));
+      continue;
+    }
+
+    v4l2_frmsizeenum frmsize;
+    if (fd->enum_framesizes(frmsize, pixel_format) != 0) {
+      // frame sizes are not reported, let the driver adjust the request
+      AddFrameSize(fd, options, pixel_format, options.width, options.height);
+      continue;
+    }
+    if (frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+      do {
+        AddFrameSize(fd, options, pixel_format, frmsize.discrete.width,
+                     frmsize.discrete.height);
+      } while (fd->enum_framesizes(frmsize) == 0);
+    } else {
+      const auto& stepwise = frmsize.stepwise;
+      AddFrameSize(fd, options, pixel_format,
+                   ClampToStep(options.width, stepwise.min_width,
+                               stepwise.max_width, stepwise.step_width),
+                   ClampToStep(options.height, stepwise.min_height,
+                               stepwise.max_height, stepwise.step_height));
+    }
+  }
+
+  ADEBUG_F("found {} capture modes on {}", modes_.size(),
+           options.resource.location);
+  return !modes_.empty();
+}
+
+void V4l2FormatNegotiator::AddFrameSize(cv4l_fd* fd,
+                                        const StreamOptions& options,
+                                        uint32_t pixel_format, uint32_t width,
+                                        uint32_t height) {
+  V4l2Mode mode;
+  mode.pixel_format = pixel_format;
+  mode.width = width;
+  mode.height = height;
+
+  v4l2_frmivalenum frmival;
+  if (fd->enum_frameintervals(frmival, pixel_format, width, height) != 0) {
+    // frame intervals are not reported
+    modes_.push_back(mode);
+    return;
+  }
+  if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+    do {
+      mode.interval = frmival.discrete;
+      modes_.push_back(mode);
+    } while (fd->enum_frameintervals(frmival) == 0);
+    return;
+  }
+
+  // stepwise or continuous intervals: the fastest rate and the requested one
+  const auto& stepwise = frmival.stepwise;
+  mode.interval = stepwise.min;
+  modes_.push_back(mode);
+  if (options.frame_rate > 0) {
+    v4l2_fract interval;
+    interval.numerator = 1000;
+    interval.denominator =
+        static_cast<uint32_t>(std::lround(options.frame_rate * 1000));
+    if (ToSeconds(interval) > ToSeconds(stepwise.min) &&
+        ToSeconds(interval) <= ToSeconds(stepwise.max)) {
+      mode.interval = interval;
+      modes_.push_back(mode);
+    }
+  }
+}
+
+bool V4l2FormatNegotiator::SelectMode(
+    const StreamOptions& options, const std::vector<uint32_t>& pixel_formats,
+    V4l2Mode* mode) const {
+  const double requested_fps = options.frame_rate;
+  const double requested_area =
+      static_cast<double>(options.width) * options.height;
+
+  // lexicographic cost of a mode, lower is better
+  using Key = std::array<double, 6>;
+  auto make_key = [&](const V4l2Mode& candidate) {
+    // 1. distance to the requested frame size, larger sizes are preferred
+    // over smaller ones since they can still be cropped or scaled
+    double size_class = 0.0;
+    double size_distance = 0.0;
+    if (options.width > 0 && options.height > 0 &&
+        (candidate.width != options.width ||
+         candidate.height != options.height)) {
+      const bool larger = candidate.width >= options.width &&
+                          candidate.height >= options.height;
+      size_class = larger ? 1.0 : 2.0;
+      size_distance = std::fabs(
+          static_cast<double>(candidate.width) * candidate.height -
+          requested_area);
+    }
+
+    // 2. frame rate, an unknown rate is assumed to match the request
+    const double fps =
+        candidate.FrameRate() > 0 ? candidate.FrameRate() : requested_fps;
+    const double fps_missing =
+        requested_fps > 0 && fps < requested_fps * 0.99 ? requested_fps - fps
+                                                        : 0.0;
+    // frames above the requested rate are decimated before being converted
+    const double delivered_fps =
+        requested_fps > 0 ? std::min(fps, requested_fps) : fps;
+
+    // 3. bandwidth and conversion cost per second
+    const double pixels = static_cast<double>(candidate.width) *
+                          candidate.height;
+    const double bandwidth =
+        pixels * BytesPerPixel(candidate.pixel_format) * fps;
+    const double decode_cost =
+        pixels * DecodeCostPerPixel(candidate.pixel_format) * delivered_fps;
+
+    const double format_rank = static_cast<double>(
+        std::find(pixel_formats.begin(), pixel_formats.end(),
+                  candidate.pixel_format) -
+        pixel_formats.begin());
+
+    switch (options.negotiation_goal) {
+      case StreamNegotiationGoal::GOAL_MAX_FPS:
+        return Key{size_class, size_distance, -fps,
+                   decode_cost, format_rank, bandwidth};
+      case StreamNegotiationGoal::GOAL_MIN_BANDWIDTH:
+        return Key{size_class, size_distance, fps_missing,
+                   bandwidth, decode_cost, format_rank};
+      case StreamNegotiationGoal::GOAL_MIN_DECODE_COST:
+        return Key{size_class, size_distance, fps_missing,
+                   decode_cost, bandwidth, format_rank};
+      case StreamNegotiationGoal::GOAL_REQUESTED:
+      default:
+        return Key{format_rank, size_class, size_distance,
+                   fps_missing, std::fabs(fps - requested_fps), bandwidth};
+    }
+  };
+
+  if (modes_.empty()) {
+    return false;
+  }
+  auto best = modes_.begin();
+  Key best_key = make_key(*best);
+  for (auto it = std::next(modes_.begin()); it != modes_.end(); ++it) {
+    const Key key = make_key(*it);
+    if (key < best_key) {
+      best = it;
+      best_key = key;
+    }
+  }
+  *mode = *best;
+  return true;
+}
+
+bool V4l2FormatNegotiator::Negotiate(
+    cv4l_fd* fd, const StreamOptions& options,
+    const std::vector<uint32_t>& pixel_formats, V4l2Mode* mode) {
+  // 1. reuse the result of a previous negotiation
+  const std::string key = CacheKey(fd, options, pixel_formats);
+  {
+    std::lock_guard<std::mutex> lock(CacheMutex());
+    auto it = Cache().find(key);
+    if (it != Cache().end()) {
+      *mode = it->second;
+      ADEBUG_F("reuse capture mode {} for {}", V4l2ModeToStr(*mode),
+               options.resource.location);
+      return true;
+    }
+  }
+
+  // 2. enumerate and pick the best mode
+  if (!Enumerate(fd, options, pixel_formats)) {
+    AWARN_F("no supported capture mode found on {}",
+            options.resource.location);
+    return false;
+  }
+  if (!SelectMode(options, pixel_formats, mode)) {
+    return false;
+  }
+  AINFO_F("negotiated capture mode {} for {} (goal: {})", V4l2ModeToStr(*mode),
+          options.resource.location,
+          StreamNegotiationGoalToStr(options.negotiation_goal));
+  if (options.frame_rate > 0 && mode->FrameRate() > 0 &&
+      mode->FrameRate() < options.frame_rate * 0.99) {
+    AWARN_F("{} cannot reach the requested frame rate {}, got {}",
+            options.resource.location, options.frame_rate, mode->FrameRate());
+  }
+
+  // 3. remember it for fast restarts
+  std::lock_guard<std::mutex> lock(CacheMutex());
+  Cache()[key] = *mode;
+  return true;
+}
+
+void V4l2FormatNegotiator::ClearCache() {
+  std::lock_guard<std::mutex> lock(CacheMutex());
+  Cache().clear();
+}
+
+}  // namespace stream
+}  // namespace zetton
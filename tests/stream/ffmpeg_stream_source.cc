@@ -0,0 +1,300 @@
+#include <catch2/catch.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/source/ffmpeg_stream_source.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kWidth = 96;
+constexpr int kHeight = 64;
+constexpr int kFps = 10;
+constexpr int kFrames = 30;
+
+std::string TempPath(const char* name) {
+  return "/tmp/zs_test_" + std::to_string(getpid()) + "_" + name;
+}
+
+// every frame of the clip is a flat gray of its own, in limited range
+uint8_t Luma(int n) { return static_cast<uint8_t>(16 + 7 * n); }
+// the same gray in full range rgb
+int Gray(int n) { return static_cast<int>(std::lround(7.0 * n * 255 / 219)); }
+
+bool WritePackets(AVFormatContext* format, AVCodecContext* encoder,
+                  AVStream* stream, AVPacket* packet) {
+  while (avcodec_receive_packet(encoder, packet) == 0) {
+    av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+    packet->stream_index = stream->index;
+    if (av_interleaved_write_frame(format, packet) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// kFrames of mpeg4 video in a matroska file, a keyframe every 4 frames.
+// false if this build of libavcodec has no mpeg4 encoder
+bool WriteClip(const std::string& path) {
+  const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+  if (codec == nullptr) {
+    return false;
+  }
+  AVFormatContext* format = nullptr;
+  REQUIRE(avformat_alloc_output_context2(&format, nullptr, "matroska",
+                                         path.c_str()) >= 0);
+  AVStream* stream = avformat_new_stream(format, nullptr);
+  AVCodecContext* encoder = avcodec_alloc_context3(codec);
+  REQUIRE(stream != nullptr);
+  REQUIRE(encoder != nullptr);
+  encoder->width = kWidth;
+  encoder->height = kHeight;
+  encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+  encoder->time_base = AVRational{1, kFps};
+  encoder->framerate = AVRational{kFps, 1};
+  encoder->gop_size = 4;
+  encoder->max_b_frames = 0;
+  encoder->flags |= AV_CODEC_FLAG_QSCALE;
+  encoder->global_quality = FF_QP2LAMBDA * 2;
+  if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+    encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  REQUIRE(avcodec_open2(encoder, codec, nullptr) >= 0);
+  REQUIRE(avcodec_parameters_from_context(stream->codecpar, encoder) >= 0);
+  stream->time_base = encoder->time_base;
+  REQUIRE(avio_open(&format->pb, path.c_str(), AVIO_FLAG_WRITE) >= 0);
+  REQUIRE(avformat_write_header(format, nullptr) >= 0);
+
+  AVFrame* frame = av_frame_alloc();
+  AVPacket* packet = av_packet_alloc();
+  REQUIRE(frame != nullptr);
+  REQUIRE(packet != nullptr);
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = kWidth;
+  frame->height = kHeight;
+  REQUIRE(av_frame_get_buffer(frame, 0) >= 0);
+  for (int n = 0; n < kFrames; ++n) {
+    REQUIRE(av_frame_make_writable(frame) >= 0);
+    for (int y = 0; y < kHeight; ++y) {
+      memset(frame->data[0] + y * frame->linesize[0], Luma(n), kWidth);
+    }
+    for (int plane = 1; plane < 3; ++plane) {
+      for (int y = 0; y < kHeight / 2; ++y) {
+        memset(frame->data[plane] + y * frame->linesize[plane], 128,
+               kWidth / 2);
+      }
+    }
+    frame->pts = n;
+    REQUIRE(avcodec_send_frame(encoder, frame) >= 0);
+    REQUIRE(WritePackets(format, encoder, stream, packet));
+  }
+  REQUIRE(avcodec_send_frame(encoder, nullptr) >= 0);
+  REQUIRE(WritePackets(format, encoder, stream, packet));
+  REQUIRE(av_write_trailer(format) >= 0);
+
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  avcodec_free_context(&encoder);
+  avio_closep(&format->pb);
+  avformat_free_context(format);
+  return true;
+}
+
+std::unique_ptr<zs::FfmpegStreamSource> OpenSource(const std::string& uri,
+                                                   int loop = 0) {
+  zs::StreamOptions options;
+  options.resource = uri;
+  options.pixel_format = zs::StreamPixelFormat::PIXEL_FORMAT_RGB;
+  options.loop = loop;
+  std::unique_ptr<zs::FfmpegStreamSource> source(new zs::FfmpegStreamSource());
+  REQUIRE(source->Init(options));
+  REQUIRE(source->Open());
+  REQUIRE(source->IsStreaming());
+  return source;
+}
+
+// index of the clip frame, from its gray level
+int FrameIndex(const zs::Frame& frame) {
+  REQUIRE(frame.pixel_format == zs::StreamPixelFormat::PIXEL_FORMAT_RGB);
+  REQUIRE(frame.width == kWidth);
+  REQUIRE(frame.height == kHeight);
+  const uint8_t* pixel =
+      frame.GetData() + kHeight / 2 * frame.GetStride() + kWidth / 2 * 3;
+  const int n = static_cast<int>(std::lround(pixel[0] * 219.0 / 255 / 7));
+  for (int c = 0; c < 3; ++c) {
+    REQUIRE(std::abs(pixel[c] - Gray(n)) <= 3);
+  }
+  return n;
+}
+
+// frames until the end of the stream, numbered one after the other
+int ReadAll(zs::FfmpegStreamSource* source, int first) {
+  int count = 0;
+  uint32_t sequence = 0;
+  while (auto frame = source->Acquire()) {
+    CAPTURE(count);
+    REQUIRE(FrameIndex(*frame) == (first + count) % kFrames);
+    REQUIRE((count == 0 || frame->sequence == sequence + 1));
+    sequence = frame->sequence;
+    ++count;
+  }
+  REQUIRE(source->IsEndOfStream());
+  return count;
+}
+
+// ffmpeg serving a clip over rtp in mpeg-ts, as a camera on the network
+pid_t Serve(const std::string& path, int port) {
+  const char* ffmpeg = getenv("ZS_FFMPEG");
+  const std::string url = "rtp://127.0.0.1:" + std::to_string(port);
+  const pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    execlp(ffmpeg != nullptr ? ffmpeg : "ffmpeg", "ffmpeg", "-loglevel",
+           "error", "-re", "-stream_loop", "-1", "-i", path.c_str(), "-c",
+           "copy", "-f", "rtp_mpegts", url.c_str(),
+           static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  return pid;
+}
+
+void Stop(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
+
+template <typename Predicate>
+bool WaitFor(Predicate predicate, int timeout_ms) {
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("files are decoded, seeked and looped", "[ffmpeg]") {
+  const std::string path = TempPath("clip.mkv");
+  if (!WriteClip(path)) {
+    WARN("no mpeg4 encoder, skipped");
+    return;
+  }
+
+  SECTION("every frame once") {
+    auto source = OpenSource("file://" + path);
+    REQUIRE(ReadAll(source.get(), 0) == kFrames);
+    REQUIRE(source->GetPosition() == Approx((kFrames - 1.0) / kFps));
+    REQUIRE(source->Acquire(10) == nullptr);
+
+    // again from the start after a close
+    source->Close();
+    REQUIRE(!source->IsStreaming());
+    REQUIRE(source->Open());
+    auto frame = source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(FrameIndex(*frame) == 0);
+  }
+
+  SECTION("seeked between keyframes") {
+    auto source = OpenSource("file://" + path);
+    auto frame = source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(FrameIndex(*frame) == 0);
+
+    // decoded from the keyframe before, shown from the position on
+    REQUIRE(source->Seek(1.5));
+    frame = source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(FrameIndex(*frame) == 15);
+    REQUIRE(source->GetPosition() == Approx(1.5));
+    REQUIRE(ReadAll(source.get(), 16) == kFrames - 16);
+
+    // and back, after the end
+    REQUIRE(source->Seek(0.4));
+    frame = source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(FrameIndex(*frame) == 4);
+    REQUIRE(!source->IsEndOfStream());
+  }
+
+  SECTION("looped") {
+    auto source = OpenSource("file://" + path, 2);
+    REQUIRE(ReadAll(source.get(), 0) == 3 * kFrames);
+  }
+
+  SECTION("captured into frames of the caller") {
+    auto source = OpenSource("file://" + path);
+    auto shared = std::make_shared<zs::Frame>();
+    REQUIRE(source->Capture(shared));
+    REQUIRE(shared->memory == zs::FrameMemory::MEMORY_BORROWED);
+    REQUIRE(FrameIndex(*shared) == 0);
+
+    auto copy = std::make_shared<zs::Frame>();
+    REQUIRE(copy->Allocate(zs::StreamPixelFormat::PIXEL_FORMAT_RGB, kWidth,
+                           kHeight));
+    uint8_t* data = copy->GetData();
+    REQUIRE(source->Capture(copy));
+    REQUIRE(copy->GetData() == data);
+    REQUIRE(FrameIndex(*copy) == 1);
+  }
+
+  unlink(path.c_str());
+}
+
+// needs the ffmpeg command line tool, or ZS_FFMPEG set to it. run with
+// [live] or by name
+TEST_CASE("live streams reconnect after the server restarts",
+          "[.][live][ffmpeg]") {
+  const std::string path = TempPath("live.mkv");
+  if (!WriteClip(path)) {
+    WARN("no mpeg4 encoder, skipped");
+    return;
+  }
+  const int port = 20000 + getpid() % 20000 / 2 * 2;
+  pid_t server = Serve(path, port);
+  auto source = OpenSource("rtp://127.0.0.1:" + std::to_string(port));
+
+  // 1. frames while the server runs
+  for (int n = 0; n < 5; ++n) {
+    auto frame = source->Acquire(5000);
+    REQUIRE(frame != nullptr);
+    FrameIndex(*frame);
+  }
+
+  // 2. the stream is lost once reads time out, and comes back with the
+  // server
+  Stop(server);
+  REQUIRE(WaitFor([&] { return !source->IsStreaming(); }, 15000));
+  server = Serve(path, port);
+  REQUIRE(WaitFor([&] { return source->IsStreaming(); }, 15000));
+  auto frame = source->Acquire(5000);
+  REQUIRE(frame != nullptr);
+  FrameIndex(*frame);
+
+  source->Close();
+  Stop(server);
+  unlink(path.c_str());
+}
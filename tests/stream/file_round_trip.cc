@@ -0,0 +1,335 @@
+#include <catch2/catch.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/sink/file_stream_sink.h"
+#include "zetton_stream/source/file_stream_source.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kWidth = 34;
+constexpr int kHeight = 18;
+constexpr int kNumFrames = 5;
+
+std::string FilePath(const char* name) {
+  return "/tmp/zs_test_" + std::to_string(getpid()) + "_" + name;
+}
+
+void RemoveRecording(const std::string& path) {
+  remove(path.c_str());
+  remove((path + ".idx").c_str());
+}
+
+// byte x of row y of a plane of frame n
+uint8_t Pattern(int n, int plane, int x, int y) {
+  return static_cast<uint8_t>(x * 7 + y * 13 + n * 31 + plane * 101);
+}
+
+// frame n with rows padded to an odd stride, like a driver may give
+zs::FramePtr MakeFrame(zs::StreamPixelFormat format, int n) {
+  const int row_bytes = kWidth * zs::GetBytesPerPixel(format);
+  const int stride = row_bytes + 3;
+  auto buffer = std::make_shared<std::vector<uint8_t>>(
+      zs::GetFrameSize(format, kWidth, kHeight, stride), 0);
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Wrap(format, kWidth, kHeight, buffer->data(), stride,
+                      buffer));
+  for (int p = 0; p < frame->num_planes; ++p) {
+    const int rows = static_cast<int>(frame->planes[p].size / stride);
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < row_bytes; ++x) {
+        frame->GetData(p)[y * stride + x] = Pattern(n, p, x, y);
+      }
+    }
+  }
+  frame->timestamp_ns = 1000000000ULL + n * 33000000ULL;
+  frame->system_timestamp_ns = 5000000000ULL + n;
+  frame->sequence = static_cast<uint32_t>(100 + n);
+  frame->flags = static_cast<uint32_t>(n * 2);
+  return frame;
+}
+
+// a JPEG that only has the segments the source looks at
+std::vector<uint8_t> MakeJpeg(int n) {
+  std::vector<uint8_t> jpeg = {0xFF, 0xD8,
+                               // SOF0 with the dimensions
+                               0xFF, 0xC0, 0x00, 0x0B, 0x08,
+                               static_cast<uint8_t>(kHeight >> 8),
+                               static_cast<uint8_t>(kHeight & 0xff),
+                               static_cast<uint8_t>(kWidth >> 8),
+                               static_cast<uint8_t>(kWidth & 0xff), 0x01,
+                               0x01, 0x11, 0x00,
+                               // SOS
+                               0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00,
+                               0x00, 0x3F, 0x00};
+  // entropy coded data of a size that differs per frame, with a stuffed byte
+  for (int i = 0; i < 40 + n * 9; ++i) {
+    jpeg.push_back(static_cast<uint8_t>(i % 0xFF));
+  }
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0x00);
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0xD9);
+  return jpeg;
+}
+
+zs::FramePtr MakeMjpegFrame(int n) {
+  const std::vector<uint8_t> jpeg = MakeJpeg(n);
+  auto buffer = std::make_shared<std::vector<uint8_t>>(
+      zs::GetFrameSize(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, kWidth,
+                       kHeight, 0),
+      0xAA);
+  std::copy(jpeg.begin(), jpeg.end(), buffer->begin());
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Wrap(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, kWidth,
+                      kHeight, buffer->data(), 0, buffer));
+  frame->bytes_used = static_cast<uint32_t>(jpeg.size());
+  frame->sequence = static_cast<uint32_t>(100 + n);
+  frame->flags = static_cast<uint32_t>(n * 2);
+  return frame;
+}
+
+void Record(const std::string& path, const std::vector<zs::FramePtr>& frames) {
+  zs::StreamOptions options;
+  options.resource = "file://" + path;
+  zs::FileStreamSink sink;
+  REQUIRE(sink.Init(options));
+  sink.SetBlocking(true);
+  REQUIRE(sink.Open());
+  for (const auto& frame : frames) {
+    REQUIRE(sink.Render(frame));
+  }
+  sink.Close();
+  REQUIRE(sink.GetNumWritten() == frames.size());
+  REQUIRE(sink.GetNumDropped() == 0);
+}
+
+struct IndexLine {
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  uint64_t timestamp_ns = 0;
+  uint64_t system_timestamp_ns = 0;
+  uint32_t sequence = 0;
+  uint32_t flags = 0;
+};
+
+std::vector<IndexLine> ReadIndex(const std::string& path) {
+  std::vector<IndexLine> lines;
+  FILE* file = fopen((path + ".idx").c_str(), "r");
+  REQUIRE(file != nullptr);
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if (line[0] == '#') {
+      continue;
+    }
+    IndexLine l;
+    REQUIRE(sscanf(line,
+                   "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                   " %" SCNu64 " %" SCNu32 " %" SCNu32,
+                   &l.number, &l.offset, &l.size, &l.timestamp_ns,
+                   &l.system_timestamp_ns, &l.sequence, &l.flags) == 7);
+    lines.push_back(l);
+  }
+  fclose(file);
+  return lines;
+}
+
+// index lines match the rendered frames, records of size each
+void CheckIndex(const std::string& path,
+                const std::vector<zs::FramePtr>& frames,
+                uint64_t header_size, uint64_t frame_header_size) {
+  const auto lines = ReadIndex(path);
+  REQUIRE(lines.size() == frames.size());
+  uint64_t offset = header_size;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    offset += frame_header_size;
+    REQUIRE(lines[i].number == i);
+    REQUIRE(lines[i].offset == offset);
+    REQUIRE(lines[i].timestamp_ns == frames[i]->timestamp_ns);
+    REQUIRE(lines[i].system_timestamp_ns == frames[i]->system_timestamp_ns);
+    REQUIRE(lines[i].sequence == frames[i]->sequence);
+    REQUIRE(lines[i].flags == frames[i]->flags);
+    offset += lines[i].size;
+  }
+}
+
+std::unique_ptr<zs::FileStreamSource> OpenSource(const std::string& path,
+                                                 zs::StreamOptions options) {
+  options.resource = "file://" + path;
+  std::unique_ptr<zs::FileStreamSource> source(new zs::FileStreamSource());
+  REQUIRE(source->Init(options));
+  source->SetPacing(zs::FilePacing::PACING_FASTEST);
+  REQUIRE(source->Open());
+  return source;
+}
+
+}  // namespace
+
+TEST_CASE("raw recordings replay without their row padding", "[file]") {
+  const std::string path = FilePath("rgb.raw");
+  const auto format = zs::StreamPixelFormat::PIXEL_FORMAT_RGB;
+  std::vector<zs::FramePtr> frames;
+  for (int n = 0; n < kNumFrames; ++n) {
+    frames.push_back(MakeFrame(format, n));
+  }
+  Record(path, frames);
+  CheckIndex(path, frames, 0, 0);
+  REQUIRE(ReadIndex(path)[0].size == kWidth * 3 * kHeight);
+
+  zs::StreamOptions options;
+  options.pixel_format = format;
+  options.width = kWidth;
+  options.height = kHeight;
+  options.loop = 1;
+  auto source = OpenSource(path, options);
+  REQUIRE(source->GetNumFrames() == kNumFrames);
+
+  // two passes of every frame, then the end of the recording. the second
+  // pass is stamped one recording, kNumFrames intervals, later
+  for (int pass = 0; pass < 2; ++pass) {
+    const uint64_t pass_ns = pass * kNumFrames * 33000000ULL;
+    for (int n = 0; n < kNumFrames; ++n) {
+      auto frame = source->Acquire();
+      REQUIRE(frame != nullptr);
+      REQUIRE(frame->pixel_format == format);
+      REQUIRE(frame->GetStride() == kWidth * 3);
+      REQUIRE(frame->sequence ==
+              static_cast<uint32_t>(pass * kNumFrames + n));
+      REQUIRE(frame->timestamp_ns == frames[n]->timestamp_ns + pass_ns);
+      REQUIRE(frame->system_timestamp_ns ==
+              frames[n]->system_timestamp_ns + pass_ns);
+      REQUIRE(frame->flags == frames[n]->flags);
+      for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth * 3; ++x) {
+          REQUIRE(frame->GetData()[y * kWidth * 3 + x] == Pattern(n, 0, x, y));
+        }
+      }
+    }
+  }
+  REQUIRE(source->Acquire() == nullptr);
+  REQUIRE(source->IsEndOfStream());
+  source->Close();
+
+  // frames back to back without the index, stamped when they are replayed
+  remove((path + ".idx").c_str());
+  options.loop = 0;
+  source = OpenSource(path, options);
+  REQUIRE(source->GetNumFrames() == kNumFrames);
+  auto frame = source->Acquire();
+  REQUIRE(frame != nullptr);
+  REQUIRE(frame->GetData()[kWidth * 3 + 5] == Pattern(0, 0, 5, 1));
+  REQUIRE(frame->timestamp_ns != frames[0]->timestamp_ns);
+  REQUIRE(frame->system_timestamp_ns > frames[0]->system_timestamp_ns);
+  source->Close();
+  RemoveRecording(path);
+}
+
+TEST_CASE("y4m recordings replay semi-planar and packed frames", "[file]") {
+  const std::string path = FilePath("nv12.y4m");
+  std::vector<zs::FramePtr> frames;
+  for (int n = 0; n < kNumFrames; ++n) {
+    frames.push_back(MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_NV12, n));
+  }
+  Record(path, frames);
+  const size_t frame_size = kWidth * kHeight * 3 / 2;
+  const auto lines = ReadIndex(path);
+  REQUIRE(lines[0].size == frame_size);
+  CheckIndex(path, frames, lines[0].offset - 6, 6);
+
+  SECTION("nv12") {
+    auto source = OpenSource(path, zs::StreamOptions());
+    REQUIRE(source->GetNumFrames() == kNumFrames);
+    for (int n = 0; n < kNumFrames; ++n) {
+      auto frame = source->Acquire();
+      REQUIRE(frame != nullptr);
+      REQUIRE(frame->pixel_format == zs::StreamPixelFormat::PIXEL_FORMAT_NV12);
+      REQUIRE(frame->width == kWidth);
+      for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth; ++x) {
+          REQUIRE(frame->GetData(0)[y * frame->GetStride(0) + x] ==
+                  Pattern(n, 0, x, y));
+        }
+      }
+      for (int y = 0; y < kHeight / 2; ++y) {
+        for (int x = 0; x < kWidth; ++x) {
+          REQUIRE(frame->GetData(1)[y * frame->GetStride(1) + x] ==
+                  Pattern(n, 1, x, y));
+        }
+      }
+    }
+    REQUIRE(source->Acquire() == nullptr);
+  }
+  SECTION("yuyv") {
+    // 4:2:2 from packed frames, replayed packed again
+    const std::string yuyv_path = FilePath("yuyv.y4m");
+    std::vector<zs::FramePtr> yuyv_frames;
+    for (int n = 0; n < kNumFrames; ++n) {
+      yuyv_frames.push_back(
+          MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_YUYV, n));
+    }
+    Record(yuyv_path, yuyv_frames);
+    REQUIRE(ReadIndex(yuyv_path)[0].size == kWidth * kHeight * 2);
+
+    zs::StreamOptions options;
+    options.pixel_format = zs::StreamPixelFormat::PIXEL_FORMAT_YUYV;
+    auto source = OpenSource(yuyv_path, options);
+    for (int n = 0; n < kNumFrames; ++n) {
+      auto frame = source->Acquire();
+      REQUIRE(frame != nullptr);
+      REQUIRE(frame->pixel_format == zs::StreamPixelFormat::PIXEL_FORMAT_YUYV);
+      for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth * 2; ++x) {
+          REQUIRE(frame->GetData()[y * frame->GetStride() + x] ==
+                  Pattern(n, 0, x, y));
+        }
+      }
+    }
+    source->Close();
+    RemoveRecording(yuyv_path);
+  }
+  RemoveRecording(path);
+}
+
+TEST_CASE("mjpeg recordings replay the payload of every frame", "[file]") {
+  const std::string path = FilePath("camera.mjpeg");
+  std::vector<zs::FramePtr> frames;
+  for (int n = 0; n < kNumFrames; ++n) {
+    frames.push_back(MakeMjpegFrame(n));
+  }
+  Record(path, frames);
+  CheckIndex(path, frames, 0, 0);
+
+  // with the index, and scanned for JPEGs without it
+  for (const bool indexed : {true, false}) {
+    if (!indexed) {
+      remove((path + ".idx").c_str());
+    }
+    auto source = OpenSource(path, zs::StreamOptions());
+    REQUIRE(source->GetNumFrames() == kNumFrames);
+    for (int n = 0; n < kNumFrames; ++n) {
+      const std::vector<uint8_t> jpeg = MakeJpeg(n);
+      auto frame = source->Acquire();
+      REQUIRE(frame != nullptr);
+      REQUIRE(frame->pixel_format ==
+              zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG);
+      REQUIRE(frame->width == kWidth);
+      REQUIRE(frame->height == kHeight);
+      REQUIRE(frame->bytes_used == jpeg.size());
+      REQUIRE(std::equal(jpeg.begin(), jpeg.end(), frame->GetData()));
+    }
+    REQUIRE(source->Acquire() == nullptr);
+    source->Close();
+  }
+  RemoveRecording(path);
+}
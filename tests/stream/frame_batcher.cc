@@ -0,0 +1,155 @@
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstring>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/util/frame_batcher.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kTensorWidth = 8;
+constexpr int kTensorHeight = 8;
+
+// flat gray frame whose tensor holds the value of the frame everywhere
+zs::Frame MakeFrame(uint32_t sequence, int source) {
+  zs::Frame frame;
+  REQUIRE(frame.Allocate(zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8, 16, 16));
+  memset(frame.GetData(), static_cast<int>(10 * source + sequence),
+         frame.planes[0].size);
+  frame.sequence = sequence;
+  frame.timestamp_ns = 1000 + sequence;
+  return frame;
+}
+
+zs::FrameBatcherPtr CreateBatcher(int batch_size, bool per_source,
+                                  int max_latency_ms = 0) {
+  zs::BatchOptions options;
+  options.batch_size = batch_size;
+  options.per_source = per_source;
+  options.max_latency_ms = max_latency_ms;
+  zs::PreprocessOptions preprocess;
+  preprocess.width = kTensorWidth;
+  preprocess.height = kTensorHeight;
+  preprocess.std = {{1.0f, 1.0f, 1.0f}};
+  preprocess.num_threads = 1;
+  auto batcher = zs::FrameBatcher::Create(options, preprocess);
+  REQUIRE(batcher != nullptr);
+  return batcher;
+}
+
+// the entry of a slot and the first value of its tensor
+void CheckSlot(const zs::FrameBatch& batch, int slot, uint32_t sequence,
+               int source) {
+  CAPTURE(slot);
+  const zs::BatchEntry& entry = batch.entries[slot];
+  REQUIRE(entry.valid);
+  REQUIRE(entry.source == source);
+  REQUIRE(entry.sequence == sequence);
+  REQUIRE(entry.timestamp_ns == 1000 + sequence);
+  float value;
+  memcpy(&value, batch.GetTensor(slot), sizeof(value));
+  REQUIRE(value == Approx(10 * source + sequence));
+}
+
+}  // namespace
+
+TEST_CASE("full batches are handed out in arrival order", "[batch]") {
+  auto batcher = CreateBatcher(4, false);
+
+  // frames of two sources interleaved, each in the next slot
+  for (uint32_t n = 0; n < 8; ++n) {
+    REQUIRE(batcher->Add(MakeFrame(n, n % 2), n % 2));
+  }
+  for (uint32_t first = 0; first < 8; first += 4) {
+    auto batch = batcher->Wait(1000);
+    REQUIRE(batch != nullptr);
+    REQUIRE(batch->num_frames == 4);
+    REQUIRE(!batch->expired);
+    REQUIRE(batch->GetSize() == 4 * batcher->GetTensorSize());
+    for (int slot = 0; slot < 4; ++slot) {
+      CheckSlot(*batch, slot, first + slot, (first + slot) % 2);
+    }
+  }
+  REQUIRE(batcher->Wait(20) == nullptr);
+
+  const zs::BatchStatistics statistics = batcher->GetStatistics();
+  REQUIRE(statistics.frames_added == 8);
+  REQUIRE(statistics.batches_full == 2);
+  REQUIRE(statistics.batches_expired == 0);
+  REQUIRE(statistics.batches_dropped == 0);
+}
+
+TEST_CASE("open batches are handed out by the deadline or a flush",
+          "[batch]") {
+  SECTION("deadline") {
+    auto batcher = CreateBatcher(4, false, 50);
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE(batcher->Add(MakeFrame(0, 0)));
+    REQUIRE(batcher->Add(MakeFrame(1, 0)));
+    auto batch = batcher->Wait(2000);
+    REQUIRE(batch != nullptr);
+    REQUIRE(std::chrono::steady_clock::now() - start >=
+            std::chrono::milliseconds(50));
+    REQUIRE(batch->expired);
+    REQUIRE(batch->num_frames == 2);
+    CheckSlot(*batch, 0, 0, 0);
+    CheckSlot(*batch, 1, 1, 0);
+    REQUIRE(!batch->entries[2].valid);
+    REQUIRE(!batch->entries[3].valid);
+    REQUIRE(batcher->GetStatistics().batches_expired == 1);
+  }
+
+  SECTION("flush") {
+    // without a deadline only a flush hands out the batch
+    auto batcher = CreateBatcher(4, false);
+    REQUIRE(batcher->Add(MakeFrame(0, 0)));
+    REQUIRE(batcher->Wait(20) == nullptr);
+    batcher->Flush();
+    auto batch = batcher->Wait(0);
+    REQUIRE(batch != nullptr);
+    REQUIRE(batch->expired);
+    REQUIRE(batch->num_frames == 1);
+    CheckSlot(*batch, 0, 0, 0);
+  }
+}
+
+TEST_CASE("per source batches keep a slot for every source", "[batch]") {
+  auto batcher = CreateBatcher(2, true);
+
+  // 1. one frame of each source, in any order. there is no slot for a third
+  REQUIRE(batcher->Add(MakeFrame(0, 1), 1));
+  REQUIRE(batcher->Add(MakeFrame(1, 0), 0));
+  REQUIRE(!batcher->Add(MakeFrame(2, 2), 2));
+  auto batch = batcher->Wait(1000);
+  REQUIRE(batch != nullptr);
+  REQUIRE(!batch->expired);
+  CheckSlot(*batch, 0, 1, 0);
+  CheckSlot(*batch, 1, 0, 1);
+  batch.reset();
+
+  // 2. a source a frame ahead of the other starts the next batch
+  REQUIRE(batcher->Add(MakeFrame(2, 0), 0));
+  REQUIRE(batcher->Add(MakeFrame(3, 0), 0));
+  batch = batcher->Wait(1000);
+  REQUIRE(batch != nullptr);
+  REQUIRE(batch->expired);
+  REQUIRE(batch->num_frames == 1);
+  CheckSlot(*batch, 0, 2, 0);
+  REQUIRE(!batch->entries[1].valid);
+}
+
+TEST_CASE("a consumer that falls behind loses the oldest batch", "[batch]") {
+  auto batcher = CreateBatcher(1, false);
+  for (uint32_t n = 0; n < 3; ++n) {
+    REQUIRE(batcher->Add(MakeFrame(n, 0)));
+  }
+  REQUIRE(batcher->GetStatistics().batches_dropped == 1);
+  for (uint32_t n = 1; n < 3; ++n) {
+    auto batch = batcher->Wait(0);
+    REQUIRE(batch != nullptr);
+    CheckSlot(*batch, 0, n, 0);
+  }
+}
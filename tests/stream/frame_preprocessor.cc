@@ -0,0 +1,250 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/util/frame_preprocessor.h"
+#include "zetton_stream/util/pixel_format.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+// even, so that every packed 4:2:2 row has whole pixel pairs
+constexpr int kSourceWidth = 334;
+constexpr int kSourceHeight = 201;
+
+zs::Frame MakeFrame(zs::StreamPixelFormat format) {
+  zs::Frame frame;
+  REQUIRE(frame.Allocate(format, kSourceWidth, kSourceHeight));
+  uint32_t state = 12345;
+  for (int plane = 0; plane < frame.num_planes; ++plane) {
+    for (size_t i = 0; i < frame.planes[plane].size; ++i) {
+      state = state * 1103515245u + 12345u;
+      frame.planes[plane].data[i] = static_cast<uint8_t>(state >> 16);
+    }
+  }
+  return frame;
+}
+
+// rgb rows of the frame through the scalar conversions
+std::vector<uint8_t> ToRgb(const zs::Frame& frame) {
+  const unsigned int width = frame.width;
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * 3 * frame.height);
+  for (int y = 0; y < frame.height; ++y) {
+    const uint8_t* src = frame.GetData() + y * frame.GetStride();
+    uint8_t* dst = rgb.data() + static_cast<size_t>(y) * width * 3;
+    switch (frame.pixel_format) {
+      case zs::StreamPixelFormat::PIXEL_FORMAT_RGB:
+        memcpy(dst, src, width * 3);
+        break;
+      case zs::StreamPixelFormat::PIXEL_FORMAT_BGR:
+        for (unsigned int x = 0; x < width; ++x) {
+          dst[3 * x] = src[3 * x + 2];
+          dst[3 * x + 1] = src[3 * x + 1];
+          dst[3 * x + 2] = src[3 * x];
+        }
+        break;
+      case zs::StreamPixelFormat::PIXEL_FORMAT_YUYV:
+        zs::yuyv_to_rgb(src, 0, dst, 0, width, 1);
+        break;
+      case zs::StreamPixelFormat::PIXEL_FORMAT_UYVY:
+        zs::uyvy_to_rgb(src, 0, dst, 0, width, 1);
+        break;
+      case zs::StreamPixelFormat::PIXEL_FORMAT_NV12:
+      case zs::StreamPixelFormat::PIXEL_FORMAT_NV16: {
+        const int uv_row =
+            frame.pixel_format == zs::StreamPixelFormat::PIXEL_FORMAT_NV12
+                ? y / 2
+                : y;
+        zs::nv16_to_rgb(src, 0, frame.GetData(1) + uv_row * frame.GetStride(1),
+                        0, dst, 0, width, 1);
+        break;
+      }
+      default:
+        for (unsigned int x = 0; x < width; ++x) {
+          dst[3 * x] = dst[3 * x + 1] = dst[3 * x + 2] = src[x];
+        }
+        break;
+    }
+  }
+  return rgb;
+}
+
+// bilinear sampling with pixel centers aligned, as cv::INTER_LINEAR
+void Sample(int dst, int dst_size, int src_size, int* src0, int* src1,
+            double* weight) {
+  const double pos =
+      std::max((dst + 0.5) * src_size / dst_size - 0.5, 0.0);
+  *src0 = std::min(static_cast<int>(pos), src_size - 1);
+  *src1 = std::min(*src0 + 1, src_size - 1);
+  *weight = *src0 == src_size - 1 ? 0.0 : pos - *src0;
+}
+
+// normalized value of every tensor element, in double
+std::vector<double> Reference(const zs::Frame& frame,
+                              const zs::PreprocessOptions& options,
+                              const zs::PreprocessTransform& transform) {
+  const std::vector<uint8_t> rgb = ToRgb(frame);
+  const size_t plane_size = static_cast<size_t>(options.width) * options.height;
+  std::vector<double> tensor(plane_size * 3);
+  for (int y = 0; y < options.height; ++y) {
+    for (int x = 0; x < options.width; ++x) {
+      const int rx = x - transform.offset_x;
+      const int ry = y - transform.offset_y;
+      const bool inside = rx >= 0 && rx < transform.width && ry >= 0 &&
+                          ry < transform.height;
+      int x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+      double wx = 0.0, wy = 0.0;
+      if (inside) {
+        Sample(rx, transform.width, frame.width, &x0, &x1, &wx);
+        Sample(ry, transform.height, frame.height, &y0, &y1, &wy);
+      }
+      for (int c = 0; c < 3; ++c) {
+        const int plane = options.bgr ? 2 - c : c;
+        double value = options.pad_value[plane];
+        if (inside) {
+          auto at = [&](int px, int py) {
+            return static_cast<double>(
+                rgb[(static_cast<size_t>(py) * frame.width + px) * 3 + c]);
+          };
+          const double top = at(x0, y0) + wx * (at(x1, y0) - at(x0, y0));
+          const double bottom = at(x0, y1) + wx * (at(x1, y1) - at(x0, y1));
+          value = top + wy * (bottom - top);
+        }
+        tensor[plane * plane_size + static_cast<size_t>(y) * options.width +
+               x] = (value - options.mean[plane]) / options.std[plane];
+      }
+    }
+  }
+  return tensor;
+}
+
+double HalfToFloat(uint16_t half) {
+  const int exponent = (half >> 10) & 0x1f;
+  const int mantissa = half & 0x3ff;
+  const double sign = half & 0x8000 ? -1.0 : 1.0;
+  if (exponent == 0) {
+    return sign * std::ldexp(mantissa, -24);
+  }
+  return sign * std::ldexp(mantissa + 1024, exponent - 25);
+}
+
+// compare every element with the reference. yuv conversions may round a
+// channel differently, so they get one level of slack
+void Compare(const std::vector<uint8_t>& tensor,
+             const std::vector<double>& reference,
+             const zs::PreprocessOptions& options, double levels) {
+  const size_t plane_size = static_cast<size_t>(options.width) * options.height;
+  for (size_t i = 0; i < reference.size(); ++i) {
+    const int plane = static_cast<int>(i / plane_size);
+    const double slack = levels / options.std[plane];
+    const double expected = reference[i];
+    CAPTURE(i, plane, expected);
+    switch (options.data_type) {
+      case zs::TensorDataType::DATA_TYPE_FLOAT16: {
+        uint16_t half;
+        memcpy(&half, tensor.data() + i * 2, sizeof(half));
+        REQUIRE(std::fabs(HalfToFloat(half) - expected) <=
+                slack + 1e-3 * std::max(1.0, std::fabs(expected)));
+        break;
+      }
+      case zs::TensorDataType::DATA_TYPE_INT8: {
+        const double q = std::max(
+            -128.0, std::min(127.0, expected / options.quant_scale +
+                                        options.quant_zero_point));
+        REQUIRE(std::fabs(static_cast<int8_t>(tensor[i]) - q) <=
+                0.5 + 1e-3 + slack / options.quant_scale);
+        break;
+      }
+      case zs::TensorDataType::DATA_TYPE_FLOAT32:
+      default: {
+        float value;
+        memcpy(&value, tensor.data() + i * 4, sizeof(value));
+        REQUIRE(std::fabs(value - expected) <= slack + 1e-4);
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+TEST_CASE("tensors match a scalar reference", "[preprocess]") {
+  const auto format = GENERATE(zs::StreamPixelFormat::PIXEL_FORMAT_YUYV,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_UYVY,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_NV12,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_NV16,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_RGB,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_BGR,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8);
+  const auto data_type = GENERATE(zs::TensorDataType::DATA_TYPE_FLOAT32,
+                                  zs::TensorDataType::DATA_TYPE_FLOAT16,
+                                  zs::TensorDataType::DATA_TYPE_INT8);
+  // odd sizes leave tails after every vector loop
+  const int width = GENERATE(157, 13);
+  const bool letterbox = GENERATE(true, false);
+  const bool bgr = GENERATE(false, true);
+  CAPTURE(zs::StreamPixelFormatToStr(format),
+          zs::TensorDataTypeToStr(data_type), width, letterbox, bgr);
+
+  zs::PreprocessOptions options;
+  options.width = width;
+  options.height = width == 13 ? 11 : 96;
+  options.letterbox = letterbox;
+  options.bgr = bgr;
+  options.mean = {{123.7f, 116.3f, 103.5f}};
+  options.std = {{58.4f, 57.1f, 57.4f}};
+  options.data_type = data_type;
+  options.quant_scale = 3.0f / 127.0f;
+  options.quant_zero_point = 3;
+  options.num_threads = 3;
+  zs::FramePreprocessor preprocessor;
+  REQUIRE(preprocessor.Init(options));
+
+  const zs::Frame frame = MakeFrame(format);
+  std::vector<uint8_t> tensor(preprocessor.GetTensorSize());
+  zs::PreprocessTransform transform;
+  REQUIRE(preprocessor.Process(frame, tensor.data(), &transform));
+  if (letterbox) {
+    REQUIRE((transform.width == width || transform.height == options.height));
+  } else {
+    REQUIRE(transform.width == width);
+    REQUIRE(transform.height == options.height);
+  }
+
+  const bool yuv = format != zs::StreamPixelFormat::PIXEL_FORMAT_RGB &&
+                   format != zs::StreamPixelFormat::PIXEL_FORMAT_BGR &&
+                   format != zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8;
+  Compare(tensor, Reference(frame, options, transform), options,
+          yuv ? 1.0 : 0.01);
+}
+
+TEST_CASE("a preprocessor can be initialized again", "[preprocess]") {
+  zs::PreprocessOptions options;
+  options.width = 64;
+  options.height = 48;
+  options.num_threads = 4;
+  zs::FramePreprocessor preprocessor;
+  REQUIRE(preprocessor.Init(options));
+  REQUIRE(preprocessor.GetNumThreads() == 4);
+
+  const zs::Frame frame = MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_RGB);
+  std::vector<uint8_t> first(preprocessor.GetTensorSize());
+  REQUIRE(preprocessor.Process(frame, first.data()));
+
+  // the new workers wait for the next frame instead of the last one, given
+  // the time to run before it
+  for (int n = 0; n < 3; ++n) {
+    REQUIRE(preprocessor.Init(options));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::vector<uint8_t> again(preprocessor.GetTensorSize(), 0);
+    REQUIRE(preprocessor.Process(frame, again.data()));
+    REQUIRE(again == first);
+  }
+}
@@ -0,0 +1,230 @@
+#include <catch2/catch.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/sink/mjpeg_http_sink.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kTimeoutMs = 2000;
+
+// a JPEG of size bytes in a larger buffer, owned by the frame or borrowed
+zs::FramePtr MakeJpegFrame(size_t size, uint8_t value, bool owned) {
+  auto buffer = std::make_shared<std::vector<uint8_t>>(size + 100, 0xEE);
+  std::fill(buffer->begin(), buffer->begin() + size, value);
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Wrap(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, 64, 48,
+                      buffer->data(), 0, buffer,
+                      owned ? zs::FrameMemory::MEMORY_OWNED
+                            : zs::FrameMemory::MEMORY_BORROWED));
+  frame->planes[0].size = buffer->size();
+  frame->bytes_used = static_cast<uint32_t>(size);
+  frame->timestamp_ns = 1500000000ULL;
+  return frame;
+}
+
+std::unique_ptr<zs::MjpegHttpSink> OpenSink(const char* uri,
+                                            int send_buffer_size = 0) {
+  zs::StreamOptions options;
+  options.resource = uri;
+  std::unique_ptr<zs::MjpegHttpSink> sink(new zs::MjpegHttpSink());
+  REQUIRE(sink->Init(options));
+  if (send_buffer_size > 0) {
+    sink->SetSendBufferSize(send_buffer_size);
+  }
+  REQUIRE(sink->Open());
+  REQUIRE(sink->GetPort() > 0);
+  return sink;
+}
+
+// client that sent the request, with a small receive buffer if asked
+int Connect(int port, const std::string& request, int receive_buffer = 0) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  REQUIRE(fd >= 0);
+  if (receive_buffer > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer,
+               sizeof(receive_buffer));
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  REQUIRE(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+  REQUIRE(send(fd, request.data(), request.size(), 0) ==
+          static_cast<ssize_t>(request.size()));
+  return fd;
+}
+
+// size bytes, or less if the server closes the connection
+std::string ReadBytes(int fd, size_t size) {
+  std::string data;
+  while (data.size() < size) {
+    pollfd p = {fd, POLLIN, 0};
+    REQUIRE(poll(&p, 1, kTimeoutMs) == 1);
+    char buffer[4096];
+    const ssize_t n =
+        recv(fd, buffer, std::min(sizeof(buffer), size - data.size()), 0);
+    REQUIRE(n >= 0);
+    if (n == 0) {
+      break;
+    }
+    data.append(buffer, static_cast<size_t>(n));
+  }
+  return data;
+}
+
+// a header up to and including the empty line
+std::string ReadHeader(int fd) {
+  std::string header;
+  while (header.size() < 4 ||
+         header.compare(header.size() - 4, 4, "\r\n\r\n") != 0) {
+    const std::string byte = ReadBytes(fd, 1);
+    REQUIRE(byte.size() == 1);
+    header += byte;
+  }
+  return header;
+}
+
+// the JPEG of the next part, after checking its header and trailer
+std::string ReadPart(int fd) {
+  const std::string header = ReadHeader(fd);
+  REQUIRE(header.compare(0, 15, "--zettonframe\r\n") == 0);
+  REQUIRE(header.find("Content-Type: image/jpeg\r\n") != std::string::npos);
+  REQUIRE(header.find("X-Timestamp: 1.500000\r\n") != std::string::npos);
+  const size_t length_pos = header.find("Content-Length: ");
+  REQUIRE(length_pos != std::string::npos);
+  const size_t length = strtoul(header.c_str() + length_pos + 16, nullptr, 10);
+  const std::string jpeg = ReadBytes(fd, length);
+  REQUIRE(jpeg.size() == length);
+  REQUIRE(ReadBytes(fd, 2) == "\r\n");
+  return jpeg;
+}
+
+// the whole response of a request the server refuses
+std::string ReadRefusal(int port, const std::string& request) {
+  const int fd = Connect(port, request);
+  const std::string response = ReadBytes(fd, 4096);
+  close(fd);
+  return response;
+}
+
+template <typename Predicate>
+bool WaitFor(Predicate predicate) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(kTimeoutMs);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("clients get every frame as a multipart stream", "[http]") {
+  auto sink = OpenSink("http://127.0.0.1:0/stream");
+
+  // 1. frames without clients are dropped, a client gets the response and
+  // the latest frame since it connected
+  REQUIRE(sink->Render(MakeJpegFrame(500, 9, true)));
+  const int fd = Connect(sink->GetPort(), "GET /stream HTTP/1.1\r\n"
+                                          "Host: localhost\r\n\r\n");
+  REQUIRE(WaitFor([&] { return sink->GetNumClients() == 1; }));
+  REQUIRE(sink->Render(MakeJpegFrame(1000, 1, true)));
+  const std::string response = ReadHeader(fd);
+  REQUIRE(response.compare(0, 17, "HTTP/1.0 200 OK\r\n") == 0);
+  REQUIRE(response.find("Content-Type: multipart/x-mixed-replace; "
+                        "boundary=zettonframe\r\n") != std::string::npos);
+  REQUIRE(ReadPart(fd) == std::string(1000, 1));
+  REQUIRE(sink->GetNumClients() == 1);
+
+  // 2. then every new one, shared or copied, without the unused bytes of
+  // their buffers
+  for (int i = 2; i < 6; ++i) {
+    const size_t size = 3000 + i * 517;
+    REQUIRE(sink->Render(MakeJpegFrame(size, static_cast<uint8_t>(i),
+                                       i % 2 == 0)));
+    REQUIRE(ReadPart(fd) == std::string(size, static_cast<char>(i)));
+  }
+  REQUIRE(WaitFor([&] { return sink->GetNumSent() == 5; }));
+  REQUIRE(sink->GetNumSkipped() == 0);
+
+  // 3. frames of other formats are refused
+  auto raw = std::make_shared<zs::Frame>();
+  REQUIRE(raw->Allocate(zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8, 8, 8));
+  REQUIRE(!sink->Render(raw));
+
+  close(fd);
+  REQUIRE(WaitFor([&] { return sink->GetNumClients() == 0; }));
+  sink->Close();
+}
+
+TEST_CASE("requests other than a get of the path are refused", "[http]") {
+  auto sink = OpenSink("http://127.0.0.1:0/stream");
+  const int port = sink->GetPort();
+
+  std::string response = ReadRefusal(port, "GET /other HTTP/1.1\r\n\r\n");
+  REQUIRE(response.compare(0, 22, "HTTP/1.0 404 Not Found") == 0);
+  REQUIRE(response.find("Content-Length: 0\r\n") != std::string::npos);
+
+  response = ReadRefusal(port, "POST /stream HTTP/1.1\r\n\r\n");
+  REQUIRE(response.compare(0, 31, "HTTP/1.0 405 Method Not Allowed") == 0);
+
+  response = ReadRefusal(port, "GET\r\n\r\n");
+  REQUIRE(response.compare(0, 24, "HTTP/1.0 400 Bad Request") == 0);
+
+  // a query does not change the path
+  const int fd = Connect(port, "GET /stream?fps=5 HTTP/1.1\r\n\r\n");
+  REQUIRE(ReadHeader(fd).compare(0, 17, "HTTP/1.0 200 OK\r\n") == 0);
+  close(fd);
+  sink->Close();
+}
+
+TEST_CASE("a client that falls behind skips to the latest frame", "[http]") {
+  // small socket buffers, so that the client falls behind within a frame
+  auto sink = OpenSink("http://127.0.0.1:0", 16384);
+  const int fd = Connect(sink->GetPort(), "GET / HTTP/1.1\r\n\r\n", 16384);
+  REQUIRE(ReadHeader(fd).compare(0, 17, "HTTP/1.0 200 OK\r\n") == 0);
+
+  // 1. frames keep coming while the client does not read, it is stuck in
+  // the first one
+  constexpr size_t kSize = 200000;
+  constexpr int kFrames = 20;
+  for (int i = 0; i < kFrames; ++i) {
+    REQUIRE(sink->Render(
+        MakeJpegFrame(kSize, static_cast<uint8_t>(i), i % 2 == 0)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  REQUIRE(sink->GetNumSent() == 0);
+  REQUIRE(sink->GetNumSkipped() == 0);
+  REQUIRE(sink->GetNumClients() == 1);
+
+  // 2. the client still gets whole frames: the one it was sent, then the
+  // latest, skipping the others
+  REQUIRE(ReadPart(fd) == std::string(kSize, 0));
+  REQUIRE(ReadPart(fd) == std::string(kSize, kFrames - 1));
+  REQUIRE(WaitFor([&] { return sink->GetNumSent() == 2; }));
+  REQUIRE(sink->GetNumSkipped() == kFrames - 2);
+
+  close(fd);
+  sink->Close();
+}
@@ -0,0 +1,145 @@
+#include <catch2/catch.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/util/ocv.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+// frame over a buffer whose owner counts how often it is released
+zs::FramePtr MakeFrame(zs::StreamPixelFormat format, int width, int height,
+                       int stride, int* releases) {
+  auto* buffer = new std::vector<uint8_t>(
+      zs::GetFrameSize(format, width, height, stride), 0);
+  std::shared_ptr<std::vector<uint8_t>> owner(
+      buffer, [releases](std::vector<uint8_t>* b) {
+        ++*releases;
+        delete b;
+      });
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Wrap(format, width, height, buffer->data(), stride, owner));
+  return frame;
+}
+
+}  // namespace
+
+TEST_CASE("mat views hold the frame until the last one is released",
+          "[ocv]") {
+  int releases = 0;
+  auto frame =
+      MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_RGB, 64, 48, 256,
+                &releases);
+  uint8_t* data = frame->GetData();
+
+  cv::Mat view = zs::ToMat(frame);
+  frame.reset();
+  REQUIRE(releases == 0);
+  REQUIRE(view.data == data);
+  REQUIRE(view.step[0] == 256);
+  REQUIRE(view.type() == CV_8UC3);
+
+  {
+    // copies and rois share the view
+    cv::Mat copy = view;
+    cv::Mat roi = view(cv::Rect(8, 4, 16, 8));
+    cv::Mat roi_copy;
+    roi_copy = roi;
+    roi.setTo(cv::Scalar(1, 2, 3));
+    REQUIRE(data[4 * 256 + 8 * 3] == 1);
+    REQUIRE(data[4 * 256 + 8 * 3 + 2] == 3);
+    view.release();
+    copy.release();
+    REQUIRE(releases == 0);
+    roi.release();
+    REQUIRE(releases == 0);
+  }
+  REQUIRE(releases == 1);
+}
+
+TEST_CASE("new memory of a view does not hold the frame", "[ocv]") {
+  int releases = 0;
+  auto frame =
+      MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8, 32, 16, 32,
+                &releases);
+  cv::Mat view = zs::ToMat(frame);
+  cv::Mat clone = view.clone();
+  cv::Mat result;
+  cv::add(view, cv::Scalar(1), result);
+
+  // reallocating the view drops its reference to the frame
+  view.create(20, 20, CV_8UC3);
+  frame.reset();
+  REQUIRE(releases == 1);
+  view.setTo(cv::Scalar(5, 6, 7));
+  REQUIRE(clone.rows == 16);
+  REQUIRE(result.at<uint8_t>(0, 0) == 1);
+}
+
+TEST_CASE("semi-planar frames are viewed whole and by plane", "[ocv]") {
+  int releases = 0;
+  {
+    auto frame =
+        MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_NV12, 64, 32, 80,
+                  &releases);
+    cv::Mat whole = zs::ToMat(frame);
+    cv::Mat chroma = zs::ToMat(frame, 1);
+    REQUIRE(whole.rows == 48);
+    REQUIRE(whole.cols == 64);
+    REQUIRE(chroma.type() == CV_8UC2);
+    REQUIRE(chroma.rows == 16);
+    REQUIRE(chroma.cols == 32);
+    REQUIRE(chroma.data == frame->GetData(1));
+    frame.reset();
+
+    cv::Mat rgb;
+    cv::cvtColor(whole, rgb, cv::COLOR_YUV2RGB_NV12);
+    REQUIRE(rgb.rows == 32);
+    whole.release();
+    REQUIRE(releases == 0);
+  }
+  REQUIRE(releases == 1);
+}
+
+TEST_CASE("umat views hold the frame until the last one is released",
+          "[ocv]") {
+  int releases = 0;
+  cv::UMat umat;
+  {
+    auto frame =
+        MakeFrame(zs::StreamPixelFormat::PIXEL_FORMAT_RGB, 32, 32, 96,
+                  &releases);
+    umat = zs::ToUMat(frame);
+    REQUIRE(!umat.empty());
+  }
+  REQUIRE(releases == 0);
+  {
+    cv::UMat roi = umat(cv::Rect(0, 0, 8, 8));
+    cv::UMat gray;
+    cv::cvtColor(roi, gray, cv::COLOR_RGB2GRAY);
+    umat.release();
+    REQUIRE(releases == 0);
+  }
+  REQUIRE(releases == 1);
+}
+
+TEST_CASE("camera image views hold the image", "[ocv]") {
+  std::weak_ptr<zs::CameraImage> weak;
+  cv::Mat view;
+  {
+    auto image = std::make_shared<zs::CameraImage>();
+    REQUIRE(image->Allocate(16, 8, 3));
+    weak = image;
+    view = zs::ToMat(image);
+    REQUIRE(view.data == reinterpret_cast<uint8_t*>(image->image));
+  }
+  REQUIRE(!weak.expired());
+  cv::Mat copy = view(cv::Rect(0, 0, 4, 4));
+  view.release();
+  REQUIRE(!weak.expired());
+  copy.release();
+  REQUIRE(weak.expired());
+}
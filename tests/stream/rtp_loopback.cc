@@ -0,0 +1,312 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/sink/rtp_stream_sink.h"
+#include "zetton_stream/source/rtp_stream_source.h"
+#include "zetton_stream/util/rtp_payload.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kWidth = 320;
+constexpr int kHeight = 240;
+
+uint8_t Pattern(int n, int x, int y) {
+  return static_cast<uint8_t>(x * 3 + y * 11 + n * 29);
+}
+
+zs::FramePtr MakeRawFrame(zs::StreamPixelFormat format, int n) {
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Allocate(format, kWidth, kHeight));
+  const int row_bytes = kWidth * zs::GetBytesPerPixel(format);
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < row_bytes; ++x) {
+      frame->GetData()[y * frame->GetStride() + x] = Pattern(n, x, y);
+    }
+  }
+  return frame;
+}
+
+void Append(std::vector<uint8_t>* data, std::initializer_list<int> bytes) {
+  for (int byte : bytes) {
+    data->push_back(static_cast<uint8_t>(byte));
+  }
+}
+
+// the headers of a baseline 4:2:0 JPEG up to its scan, in the order an RTP
+// receiver rebuilds them. a precise luma table takes 16 bits per entry
+std::vector<uint8_t> MakeJpegHeaders(int width, int height, bool precise) {
+  std::vector<uint8_t> jpeg;
+  Append(&jpeg, {0xFF, 0xD8});
+  for (int i = 0; i < 2; ++i) {
+    const size_t size = i == 0 && precise ? 128 : 64;
+    Append(&jpeg, {0xFF, 0xDB, 0, static_cast<int>(3 + size),
+                   (size == 128 ? 0x10 : 0x00) | i});
+    for (size_t k = 0; k < size; ++k) {
+      jpeg.push_back(static_cast<uint8_t>(1 + (k * 7 + i) % 200));
+    }
+  }
+  Append(&jpeg, {0xFF, 0xC0, 0, 17, 8, height >> 8, height & 0xFF,
+                 width >> 8, width & 0xFF, 3, 1, 0x22, 0, 2, 0x11, 1, 3,
+                 0x11, 1});
+  return jpeg;
+}
+
+// entropy coded data of frame n, without markers
+std::vector<uint8_t> MakeScan(int n, size_t size) {
+  std::vector<uint8_t> scan(size);
+  for (size_t i = 0; i < size; ++i) {
+    scan[i] = static_cast<uint8_t>((i * 13 + n) % 0xFF);
+  }
+  return scan;
+}
+
+zs::FramePtr MakeJpegFrame(const std::vector<uint8_t>& headers,
+                           const std::vector<uint8_t>& scan) {
+  auto data = std::make_shared<std::vector<uint8_t>>(headers);
+  Append(data.get(), {0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0,
+                      63, 0});
+  data->insert(data->end(), scan.begin(), scan.end());
+  Append(data.get(), {0xFF, 0xD9});
+  auto frame = std::make_shared<zs::Frame>();
+  REQUIRE(frame->Wrap(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, kWidth,
+                      kHeight, data->data(), 0, data));
+  frame->planes[0].size = data->size();
+  frame->bytes_used = static_cast<uint32_t>(data->size());
+  return frame;
+}
+
+std::vector<uint8_t> Serialize(const zs::RtpPacket& packet) {
+  std::vector<uint8_t> data(packet.header, packet.header + packet.header_size);
+  for (int i = 0; i < packet.num_payloads; ++i) {
+    data.insert(data.end(), packet.payload[i],
+                packet.payload[i] + packet.payload_size[i]);
+  }
+  return data;
+}
+
+std::vector<std::vector<uint8_t>> Packetize(const zs::Frame& frame,
+                                            size_t max_packet_size = 1400) {
+  zs::RtpPacketizer packetizer;
+  REQUIRE(packetizer.Init(1234, max_packet_size));
+  std::vector<zs::RtpPacket> packets;
+  REQUIRE(packetizer.Packetize(frame, 9000, &packets));
+  std::vector<std::vector<uint8_t>> data;
+  for (const auto& packet : packets) {
+    data.push_back(Serialize(packet));
+  }
+  return data;
+}
+
+// pushes every packet, the frame completed by the last one
+zs::FramePtr Depacketize(zs::RtpDepacketizer* depacketizer,
+                         const std::vector<std::vector<uint8_t>>& packets) {
+  zs::FramePtr frame;
+  for (const auto& packet : packets) {
+    // exactly the bytes of the packet, so that overreads are caught
+    std::unique_ptr<uint8_t[]> copy(new uint8_t[packet.size()]);
+    std::copy(packet.begin(), packet.end(), copy.get());
+    frame = depacketizer->Push(copy.get(), packet.size());
+  }
+  return frame;
+}
+
+struct Loopback {
+  std::unique_ptr<zs::RtpStreamSource> source;
+  std::unique_ptr<zs::RtpStreamSink> sink;
+};
+
+Loopback OpenLoopback(zs::StreamPixelFormat format, bool gso) {
+  Loopback loopback;
+  zs::StreamOptions options;
+  options.resource = "rtp://127.0.0.1:0";
+  if (format == zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG) {
+    options.codec = zs::StreamCodec::CODEC_MJPEG;
+  } else {
+    options.pixel_format = format;
+    options.width = kWidth;
+    options.height = kHeight;
+  }
+  loopback.source.reset(new zs::RtpStreamSource());
+  REQUIRE(loopback.source->Init(options));
+  REQUIRE(loopback.source->Open());
+
+  options.resource =
+      "rtp://127.0.0.1:" + std::to_string(loopback.source->GetPort());
+  loopback.sink.reset(new zs::RtpStreamSink());
+  REQUIRE(loopback.sink->Init(options));
+  loopback.sink->SetGso(gso);
+  REQUIRE(loopback.sink->Open());
+  REQUIRE((gso || !loopback.sink->IsGsoEnabled()));
+  return loopback;
+}
+
+}  // namespace
+
+TEST_CASE("raw frames survive an rtp loopback", "[rtp]") {
+  const bool gso = GENERATE(true, false);
+  const auto format = GENERATE(zs::StreamPixelFormat::PIXEL_FORMAT_UYVY,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_YUYV,
+                               zs::StreamPixelFormat::PIXEL_FORMAT_RGB);
+  CAPTURE(gso, zs::StreamPixelFormatToStr(format));
+  Loopback loopback = OpenLoopback(format, gso);
+
+  const int row_bytes = kWidth * zs::GetBytesPerPixel(format);
+  for (int n = 0; n < 3; ++n) {
+    REQUIRE(loopback.sink->Render(MakeRawFrame(format, n)));
+    auto frame = loopback.source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(frame->pixel_format == format);
+    REQUIRE(frame->width == kWidth);
+    REQUIRE(frame->height == kHeight);
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < row_bytes; ++x) {
+        REQUIRE(frame->GetData()[y * frame->GetStride() + x] ==
+                Pattern(n, x, y));
+      }
+    }
+  }
+  REQUIRE(loopback.source->GetNumLost() == 0);
+  REQUIRE(loopback.source->GetNumDropped() == 0);
+}
+
+TEST_CASE("jpeg frames survive an rtp loopback", "[rtp]") {
+  const bool gso = GENERATE(true, false);
+  const bool precise = GENERATE(false, true);
+  CAPTURE(gso, precise);
+  Loopback loopback =
+      OpenLoopback(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, gso);
+
+  const std::vector<uint8_t> headers =
+      MakeJpegHeaders(kWidth, kHeight, precise);
+  for (int n = 0; n < 3; ++n) {
+    const std::vector<uint8_t> scan = MakeScan(n, 20000 + n * 1111);
+    REQUIRE(loopback.sink->Render(MakeJpegFrame(headers, scan)));
+    auto frame = loopback.source->Acquire();
+    REQUIRE(frame != nullptr);
+    REQUIRE(frame->pixel_format == zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG);
+    REQUIRE(frame->width == kWidth);
+    REQUIRE(frame->height == kHeight);
+
+    // the same tables and frame header, then the scan
+    const uint8_t* data = frame->GetData();
+    const size_t size = frame->bytes_used;
+    REQUIRE(size > headers.size() + scan.size() + 2);
+    REQUIRE(std::equal(headers.begin(), headers.end(), data));
+    REQUIRE(std::equal(scan.begin(), scan.end(),
+                       data + size - 2 - scan.size()));
+    REQUIRE(data[size - 2] == 0xFF);
+    REQUIRE(data[size - 1] == 0xD9);
+  }
+  REQUIRE(loopback.source->GetNumLost() == 0);
+  REQUIRE(loopback.source->GetNumDropped() == 0);
+}
+
+TEST_CASE("broken jpeg frames are not sent", "[rtp]") {
+  std::vector<uint8_t> headers = MakeJpegHeaders(kWidth, kHeight, false);
+  zs::RtpPacketizer packetizer;
+  REQUIRE(packetizer.Init(1, 1400));
+  std::vector<zs::RtpPacket> packets;
+
+  SECTION("quantization table past its segment") {
+    // a precise table in a segment sized for a normal one
+    headers[6] = 0x10;
+    REQUIRE(!packetizer.Packetize(*MakeJpegFrame(headers, MakeScan(0, 100)),
+                                  0, &packets));
+  }
+  SECTION("scan header over the end of image") {
+    // the scan header takes the EOI, there is no scan left
+    auto frame = MakeJpegFrame(headers, {});
+    uint8_t* sos = frame->GetData() + headers.size();
+    sos[3] = 14;
+    REQUIRE(packetizer.Packetize(*frame, 0, &packets));
+    REQUIRE(packets.size() == 1);
+    REQUIRE(packets[0].GetSize() < 200);
+  }
+}
+
+TEST_CASE("truncated and undersized rtp packets are dropped", "[rtp]") {
+  const std::vector<uint8_t> headers = MakeJpegHeaders(64, 48, true);
+  auto jpeg = MakeJpegFrame(headers, MakeScan(0, 3000));
+  const auto jpeg_packets = Packetize(*jpeg);
+  REQUIRE(jpeg_packets.size() > 2);
+  zs::RtpDepacketizer depacketizer;
+  REQUIRE(depacketizer.Init(zs::StreamPixelFormat::PIXEL_FORMAT_MJPEG, 0, 0,
+                            2));
+
+  SECTION("whole") {
+    auto frame = Depacketize(&depacketizer, jpeg_packets);
+    REQUIRE(frame != nullptr);
+    REQUIRE(frame->width == 64);
+    REQUIRE(depacketizer.GetNumDropped() == 0);
+  }
+  SECTION("tables cut short") {
+    // 1. the first packet ends within the tables it announces
+    auto packets = jpeg_packets;
+    packets[0].resize(zs::kRtpHeaderSize + 8 + 4 + 100);
+    REQUIRE(Depacketize(&depacketizer, packets) == nullptr);
+    REQUIRE(depacketizer.GetNumDropped() == 1);
+  }
+  SECTION("tables smaller than their precision") {
+    // 2. a precise luma table needs 128 bytes, only 64 are announced and
+    // the packet ends after them
+    auto packets = jpeg_packets;
+    uint8_t* tables_header = packets[0].data() + zs::kRtpHeaderSize + 8;
+    REQUIRE(tables_header[1] == 1);
+    tables_header[2] = 0;
+    tables_header[3] = 64;
+    packets[0].resize(zs::kRtpHeaderSize + 8 + 4 + 64);
+    REQUIRE(Depacketize(&depacketizer, packets) == nullptr);
+    REQUIRE(depacketizer.GetNumDropped() == 1);
+  }
+  SECTION("frame too small for the headers") {
+    // 3. an 8x8 frame has no room for the headers of a JPEG
+    auto packets = jpeg_packets;
+    uint8_t* jpeg_header = packets[0].data() + zs::kRtpHeaderSize;
+    jpeg_header[6] = 1;
+    jpeg_header[7] = 1;
+    REQUIRE(Depacketize(&depacketizer, packets) == nullptr);
+    REQUIRE(depacketizer.GetNumDropped() == 1);
+  }
+  SECTION("fragment past the end of the frame") {
+    // 4. an offset the frame never reaches
+    auto packets = jpeg_packets;
+    packets[1][zs::kRtpHeaderSize + 1] = 0x7F;
+    REQUIRE(Depacketize(&depacketizer, packets) == nullptr);
+    REQUIRE(depacketizer.GetNumDropped() == 1);
+  }
+  SECTION("rtp header longer than the packet") {
+    // 5. an extension, csrcs and padding that do not fit
+    const std::vector<uint8_t>& first = jpeg_packets[0];
+    std::vector<uint8_t> packet(first.begin(), first.begin() + 16);
+    packet[0] = 0x90;
+    packet[14] = 0xFF;
+    packet[15] = 0xFF;
+    REQUIRE(Depacketize(&depacketizer, {packet}) == nullptr);
+    packet[0] = 0x8F;
+    REQUIRE(Depacketize(&depacketizer, {packet}) == nullptr);
+    packet[0] = 0xA0;
+    REQUIRE(Depacketize(&depacketizer, {packet}) == nullptr);
+  }
+  SECTION("raw line past the packet") {
+    // 6. a line header announcing more bytes than the packet has
+    const auto format = zs::StreamPixelFormat::PIXEL_FORMAT_UYVY;
+    auto packets = Packetize(*MakeRawFrame(format, 0));
+    zs::RtpDepacketizer raw;
+    REQUIRE(raw.Init(format, kWidth, kHeight, 2));
+    auto frame = Depacketize(&raw, packets);
+    REQUIRE(frame != nullptr);
+    frame.reset();
+    uint8_t* line_header = packets[0].data() + zs::kRtpHeaderSize + 2;
+    line_header[0] = 0x7F;
+    REQUIRE(Depacketize(&raw, packets) == nullptr);
+    REQUIRE(raw.GetNumDropped() == 1);
+  }
+}
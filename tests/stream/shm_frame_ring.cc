@@ -0,0 +1,336 @@
+#include <catch2/catch.hpp>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "zetton_stream/util/shm_frame_ring.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+std::string RingName(const char* test) {
+  return "/zs_test_" + std::string(test) + "_" + std::to_string(getpid());
+}
+
+// writer side of one frame: sequence stamped into the slot and its info
+bool PublishFrame(zs::ShmFrameRing* ring, uint32_t sequence) {
+  const int slot = ring->ClaimSlot();
+  if (slot < 0) {
+    return false;
+  }
+  uint8_t* data = ring->GetSlotData(slot);
+  memset(data, static_cast<int>(sequence & 0xff), ring->GetSlotSize());
+  zs::ShmFrameInfo info;
+  info.pixel_format =
+      static_cast<int32_t>(zs::StreamPixelFormat::PIXEL_FORMAT_GRAY8);
+  info.width = 16;
+  info.height = 16;
+  info.num_planes = 1;
+  info.plane_size[0] = 256;
+  info.plane_stride[0] = 16;
+  info.sequence = sequence;
+  ring->Publish(slot, info);
+  return true;
+}
+
+// run body in a child process, which reports back through a pipe once it is
+// ready and then waits to be killed
+pid_t Fork(const std::function<bool()>& body) {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  const pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    const char ready = body() ? 1 : 0;
+    if (write(fds[1], &ready, 1) != 1) {
+      _exit(1);
+    }
+    while (true) {
+      pause();
+    }
+  }
+  close(fds[1]);
+  char ready = 0;
+  const bool read_ready = read(fds[0], &ready, 1) == 1;
+  close(fds[0]);
+  REQUIRE(read_ready);
+  REQUIRE(ready == 1);
+  return pid;
+}
+
+void Kill(pid_t pid) {
+  kill(pid, SIGKILL);
+  int status = 0;
+  waitpid(pid, &status, 0);
+}
+
+}  // namespace
+
+TEST_CASE("frames are acquired in publish order", "[shm]") {
+  const std::string name = RingName("order");
+  auto writer = zs::ShmFrameRing::Create(name, 4, 4096);
+  REQUIRE(writer != nullptr);
+  auto reader = zs::ShmFrameRing::Open(name);
+  REQUIRE(reader != nullptr);
+
+  uint64_t number = 0;
+  zs::ShmFrameInfo info;
+  REQUIRE(reader->GetLatestNumber() == 0);
+  REQUIRE(reader->Acquire(0, false, &number, &info) == -1);
+
+  // 1. the latest frame
+  REQUIRE(PublishFrame(writer.get(), 10));
+  int slot = reader->Acquire(0, false, &number, &info);
+  REQUIRE(slot >= 0);
+  REQUIRE(number == 1);
+  REQUIRE(info.sequence == 10);
+  REQUIRE(reader->GetSlotData(slot)[100] == 10);
+  zs::Frame frame;
+  REQUIRE(zs::SetShmFrameInfo(info, reader->GetSlotData(slot),
+                              reader->GetSlotSize(), &frame));
+  REQUIRE(frame.width == 16);
+  REQUIRE(frame.GetData() == reader->GetSlotData(slot));
+  reader->Release(slot);
+  REQUIRE(reader->Acquire(1, false, &number, &info) == -1);
+
+  // 2. every frame in turn, as long as it is in the ring
+  for (uint32_t i = 11; i < 14; ++i) {
+    REQUIRE(PublishFrame(writer.get(), i));
+  }
+  uint64_t last = 1;
+  for (uint32_t i = 11; i < 14; ++i) {
+    slot = reader->Acquire(last, true, &number, &info);
+    REQUIRE(slot >= 0);
+    REQUIRE(number == last + 1);
+    REQUIRE(info.sequence == i);
+    reader->Release(slot);
+    last = number;
+  }
+
+  // 3. overwritten frames are skipped up to the oldest one left
+  for (uint32_t i = 14; i < 20; ++i) {
+    REQUIRE(PublishFrame(writer.get(), i));
+  }
+  slot = reader->Acquire(last, true, &number, &info);
+  REQUIRE(slot >= 0);
+  REQUIRE(number == 7);
+  REQUIRE(info.sequence == 16);
+  reader->Release(slot);
+  slot = reader->Acquire(last, false, &number, &info);
+  REQUIRE(number == 10);
+  reader->Release(slot);
+}
+
+TEST_CASE("slots held by readers are never claimed", "[shm]") {
+  const std::string name = RingName("hold");
+  auto writer = zs::ShmFrameRing::Create(name, 2, 4096);
+  auto reader = zs::ShmFrameRing::Open(name);
+  REQUIRE(reader != nullptr);
+
+  REQUIRE(PublishFrame(writer.get(), 1));
+  uint64_t number = 0;
+  zs::ShmFrameInfo info;
+  const int held = reader->Acquire(0, false, &number, &info);
+  REQUIRE(held >= 0);
+
+  // the writer cycles through the other slot only
+  for (uint32_t i = 2; i < 10; ++i) {
+    const int slot = writer->ClaimSlot();
+    REQUIRE(slot >= 0);
+    REQUIRE(slot != held);
+    writer->Abort(slot);
+    REQUIRE(PublishFrame(writer.get(), i));
+  }
+  REQUIRE(reader->GetSlotData(held)[0] == 1);
+
+  // both slots held, then the held one is the oldest and reused first
+  const int other = reader->Acquire(1, false, &number, &info);
+  REQUIRE(other >= 0);
+  REQUIRE(writer->ClaimSlot() == -1);
+  reader->Release(held);
+  REQUIRE(writer->ClaimSlot() == held);
+  writer->Abort(held);
+  reader->Release(other);
+}
+
+TEST_CASE("readers never see a slot being written", "[shm]") {
+  const std::string name = RingName("stress");
+  auto writer = zs::ShmFrameRing::Create(name, 3, 4096);
+  auto reader = zs::ShmFrameRing::Open(name);
+  REQUIRE(reader != nullptr);
+
+  constexpr uint32_t kFrames = 20000;
+  std::atomic<bool> torn{false};
+  std::atomic<uint64_t> received{0};
+  std::thread reading([&] {
+    uint64_t last = 0;
+    while (last < kFrames) {
+      if (!reader->Wait(last, 1000)) {
+        break;
+      }
+      uint64_t number = 0;
+      zs::ShmFrameInfo info;
+      const int slot = reader->Acquire(last, false, &number, &info);
+      if (slot < 0) {
+        continue;
+      }
+      // the whole slot carries the sequence of its frame
+      const uint8_t* data = reader->GetSlotData(slot);
+      const auto expected = static_cast<uint8_t>(info.sequence & 0xff);
+      for (size_t i = 0; i < reader->GetSlotSize(); i += 64) {
+        if (data[i] != expected) {
+          torn = true;
+        }
+      }
+      if (number <= last || info.sequence != number) {
+        torn = true;
+      }
+      reader->Release(slot);
+      last = number;
+      ++received;
+    }
+  });
+  for (uint32_t i = 1; i <= kFrames; ++i) {
+    int slot = -1;
+    while ((slot = writer->ClaimSlot()) < 0) {
+      std::this_thread::yield();
+    }
+    writer->Abort(slot);
+    REQUIRE(PublishFrame(writer.get(), i));
+  }
+  reading.join();
+  REQUIRE(!torn);
+  REQUIRE(received > 0);
+  REQUIRE(reader->GetLatestNumber() == kFrames);
+}
+
+TEST_CASE("waiting readers wake up on frames and a closed writer", "[shm]") {
+  const std::string name = RingName("wait");
+  auto writer = zs::ShmFrameRing::Create(name, 2, 4096);
+  auto reader = zs::ShmFrameRing::Open(name);
+  REQUIRE(reader != nullptr);
+
+  // 1. timeout
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(!reader->Wait(0, 50));
+  REQUIRE(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(50));
+
+  // 2. a frame published meanwhile
+  std::thread publishing([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    PublishFrame(writer.get(), 1);
+  });
+  start = std::chrono::steady_clock::now();
+  REQUIRE(reader->Wait(0, 2000));
+  REQUIRE(std::chrono::steady_clock::now() - start <
+          std::chrono::milliseconds(1000));
+  publishing.join();
+
+  // 3. without a timeout, longer than the writer checks
+  publishing = std::thread([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    PublishFrame(writer.get(), 2);
+  });
+  REQUIRE(reader->Wait(1, -1));
+  publishing.join();
+
+  // 4. the writer closing the ring
+  std::thread closing([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    writer.reset();
+  });
+  REQUIRE(!reader->Wait(2, -1));
+  closing.join();
+  REQUIRE(reader->IsWriterGone());
+  REQUIRE(zs::ShmFrameRing::Open(name) == nullptr);
+}
+
+TEST_CASE("slots of a killed reader are reclaimed", "[shm]") {
+  const std::string name = RingName("reclaim");
+  auto writer = zs::ShmFrameRing::Create(name, 2, 4096);
+  REQUIRE(writer != nullptr);
+  REQUIRE(PublishFrame(writer.get(), 1));
+  REQUIRE(PublishFrame(writer.get(), 2));
+
+  // a reader process holding both slots
+  const pid_t pid = Fork([&name] {
+    // kept until the process is killed
+    static zs::ShmFrameRingPtr reader;
+    reader = zs::ShmFrameRing::Open(name);
+    uint64_t number = 0;
+    zs::ShmFrameInfo info;
+    return reader != nullptr && reader->Acquire(0, true, &number, &info) >= 0 &&
+           reader->Acquire(number, true, &number, &info) >= 0;
+  });
+  REQUIRE(writer->ClaimSlot() == -1);
+
+  Kill(pid);
+  const int slot = writer->ClaimSlot();
+  REQUIRE(slot >= 0);
+  writer->Abort(slot);
+  REQUIRE(writer->ClaimSlot() >= 0);
+}
+
+TEST_CASE("a restarted writer takes over the ring of a dead one", "[shm]") {
+  const std::string name = RingName("takeover");
+  // a writer process that published two frames and died while writing
+  const pid_t pid = Fork([&name] {
+    // never closed, like the ring of a crashed process
+    static zs::ShmFrameRingPtr writer;
+    writer = zs::ShmFrameRing::Create(name, 3, 4096);
+    if (writer == nullptr) {
+      return false;
+    }
+    return PublishFrame(writer.get(), 1) && PublishFrame(writer.get(), 2) &&
+           writer->ClaimSlot() >= 0;
+  });
+
+  // 1. a reader holding a frame of the dead writer
+  auto reader = zs::ShmFrameRing::Open(name);
+  REQUIRE(reader != nullptr);
+  uint64_t number = 0;
+  zs::ShmFrameInfo info;
+  const int held = reader->Acquire(0, false, &number, &info);
+  REQUIRE(held >= 0);
+  REQUIRE(number == 2);
+
+  // 2. a live writer keeps its ring
+  REQUIRE(zs::ShmFrameRing::Create(name, 3, 4096) == nullptr);
+  Kill(pid);
+  REQUIRE(reader->IsWriterGone());
+
+  // 3. another layout is not taken over
+  SECTION("same layout") {
+    auto writer = zs::ShmFrameRing::Create(name, 3, 4096);
+    REQUIRE(writer != nullptr);
+    REQUIRE(!reader->IsWriterGone());
+    REQUIRE(reader->GetSlotData(held)[0] == 2);
+    for (int i = 0; i < 2; ++i) {
+      const int slot = writer->ClaimSlot();
+      REQUIRE(slot >= 0);
+      REQUIRE(slot != held);
+      writer->Abort(slot);
+      REQUIRE(PublishFrame(writer.get(), 3 + i));
+    }
+    REQUIRE(reader->GetLatestNumber() == 4);
+    REQUIRE(reader->Wait(2, 100));
+    reader->Release(held);
+  }
+  SECTION("other layout") {
+    auto writer = zs::ShmFrameRing::Create(name, 4, 4096);
+    REQUIRE(writer != nullptr);
+    REQUIRE(reader->IsWriterGone());
+    REQUIRE(writer->GetLatestNumber() == 0);
+  }
+}
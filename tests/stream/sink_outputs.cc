@@ -0,0 +1,123 @@
+#include <catch2/catch.hpp>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zetton_stream/base/frame.h"
+#include "zetton_stream/base/frame_pool.h"
+#include "zetton_stream/interface/base_stream_sink.h"
+
+namespace zs = zetton::stream;
+
+namespace {
+
+constexpr int kWidth = 64;
+constexpr int kHeight = 48;
+
+// output that keeps every frame it is given
+class RecordingSink : public zs::BaseStreamSink {
+ public:
+  bool Open() override { return true; }
+  void Close() override {}
+
+  bool Render(const zs::FramePtr& frame) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.push_back(frame);
+    return true;
+  }
+
+  std::vector<zs::FramePtr> GetFrames() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<zs::FramePtr> frames_;
+};
+
+class ForwardingSink : public zs::BaseStreamSink {
+ public:
+  bool Open() override { return true; }
+  void Close() override {}
+};
+
+void AddOutputs(ForwardingSink* sink, RecordingSink* sync_output,
+                RecordingSink* async_output) {
+  zs::StreamOptions options;
+  options.output_format = zs::StreamPixelFormat::PIXEL_FORMAT_RGB;
+  REQUIRE(sink->Init(options));
+  sink->AddOutput(sync_output);
+  zs::SinkOutputOptions async;
+  async.async = true;
+  sink->AddOutput(async_output, async);
+}
+
+}  // namespace
+
+TEST_CASE("pooled frames reach async outputs by reference", "[sink]") {
+  ForwardingSink sink;
+  RecordingSink sync_output;
+  RecordingSink async_output;
+  AddOutputs(&sink, &sync_output, &async_output);
+
+  auto pool = zs::FramePool::Create(zs::StreamPixelFormat::PIXEL_FORMAT_RGB,
+                                    kWidth, kHeight, 2);
+  REQUIRE(pool != nullptr);
+  for (int n = 0; n < 2; ++n) {
+    auto frame = pool->AcquireFrame();
+    REQUIRE(frame != nullptr);
+    REQUIRE(frame->memory == zs::FrameMemory::MEMORY_POOLED);
+    REQUIRE(!frame->IsTransient());
+    frame->sequence = n;
+    REQUIRE(sink.Render(frame));
+  }
+  sink.FlushOutputs();
+
+  // the same frames, not copies, and their slots stay taken
+  const auto sync_frames = sync_output.GetFrames();
+  const auto async_frames = async_output.GetFrames();
+  REQUIRE(async_frames.size() == 2);
+  for (int n = 0; n < 2; ++n) {
+    REQUIRE(async_frames[n] == sync_frames[n]);
+    REQUIRE(async_frames[n]->GetData() == sync_frames[n]->GetData());
+    REQUIRE(async_frames[n]->sequence == static_cast<uint32_t>(n));
+  }
+  REQUIRE(pool->GetAvailable() == 0);
+  sink.StopOutputs();
+}
+
+TEST_CASE("transient images are copied for async outputs", "[sink]") {
+  ForwardingSink sink;
+  RecordingSink sync_output;
+  RecordingSink async_output;
+  AddOutputs(&sink, &sync_output, &async_output);
+
+  std::vector<uint8_t> image(kWidth * kHeight * 3);
+  for (size_t i = 0; i < image.size(); ++i) {
+    image[i] = static_cast<uint8_t>(i * 7);
+  }
+  REQUIRE(sink.Render(image.data(), kWidth, kHeight));
+  // the caller reuses its image right away
+  std::fill(image.begin(), image.end(), 0);
+  sink.FlushOutputs();
+
+  // the caller thread output saw the image itself, the queued one a copy of
+  // it as it was
+  const auto sync_frames = sync_output.GetFrames();
+  const auto async_frames = async_output.GetFrames();
+  REQUIRE(sync_frames.size() == 1);
+  REQUIRE(async_frames.size() == 1);
+  REQUIRE(sync_frames[0]->GetData() == image.data());
+  const zs::Frame& copy = *async_frames[0];
+  REQUIRE(copy.GetData() != image.data());
+  REQUIRE(copy.memory == zs::FrameMemory::MEMORY_OWNED);
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth * 3; ++x) {
+      REQUIRE(copy.GetData()[y * copy.GetStride() + x] ==
+              static_cast<uint8_t>((y * kWidth * 3 + x) * 7));
+    }
+  }
+  sink.StopOutputs();
+}